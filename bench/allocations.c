@@ -0,0 +1,129 @@
+/*
+Check that a synchronization without changes does not reserve heap memory.
+  Synchronizes a source directory (e.g. created by generate) to a target
+  directory in-process a number of times so that the engine sees the whole
+  tree and its caches and arena blocks are reserved, then once more
+  with the hook of allocation.h counting the heap allocations made
+  by all threads. Must be linked with objects compiled
+  with COUNTALLOCATIONS defined (make check-allocations).
+
+Options:
+- -R - recursive directory synchronization
+- -t <big_file_threshold> - minimal file size to consider it big
+- -H - pair the files of a directory with a hash table
+- -w <warmups> - number of synchronizations before the checked one
+  (default 2)
+
+Usage:
+allocations [-R] [-t <big_file_threshold>] [-H] [-w <warmups>]
+  source_path target_path
+
+Exit status:
+0 if the checked synchronization made no heap allocations
+1 if it made heap allocations
+a negative number if an error occured
+*/
+
+#include "allocation.h"
+#include "arena.h"
+#include "dirsync.h"
+#include "logger.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <syslog.h>
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  dirsyncSettings settings;
+  unsigned int warmups;
+  const char *source, *destination;
+};
+
+/*
+Parses the options.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  int option;
+  dirsyncDefaults(&o->settings);
+  o->warmups = 2;
+  while ((option = getopt(argc, argv, ":Rt:Hw:")) != -1)
+  {
+    switch (option)
+    {
+    case 'R':
+      o->settings.recursive = 1;
+      break;
+    case 't':
+      if (sscanf(optarg, "%llu", &o->settings.threshold) < 1)
+        return -1;
+      break;
+    case 'H':
+      o->settings.hashDiff = 1;
+      break;
+    case 'w':
+      if (sscanf(optarg, "%u", &o->warmups) < 1)
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // Exactly two directory paths have to follow the options.
+  if (optind != argc - 2)
+    return -1;
+  o->source = argv[optind];
+  o->destination = argv[optind + 1];
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  options o;
+  unsigned int i;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: allocations [-R] [-t <big_file_threshold>] [-H] "
+      "[-w <warmups>] source_path target_path\n");
+    return -1;
+  }
+  dirsync *context = dirsyncCreate(o.source, o.destination, &o.settings);
+  if (context == NULL)
+  {
+    perror(o.source);
+    return -2;
+  }
+  // Only failures are logged.
+  loggerSetLevel(LOG_WARNING);
+  int result = 0;
+  for (i = 0; i < o.warmups && result == 0; ++i)
+    if (dirsyncRun(context, NULL) < 0)
+      result = -3;
+  if (result == 0)
+  {
+    unsigned long long before = allocationCount();
+    int status = dirsyncRun(context, NULL);
+    unsigned long long allocations = allocationCount() - before;
+    printf("status %i, %llu heap allocations, %lu arena blocks\n", status,
+      allocations, arenaBlocks());
+    if (status < 0)
+      result = -3;
+    else if (allocations != 0)
+      result = 1;
+  }
+  dirsyncDestroy(context);
+  return result;
+}
@@ -0,0 +1,404 @@
+/*
+Benchmark driver of the synchronization engine (libdirsync). Synchronizes
+  a source directory (e.g. created by generate) to an empty target directory
+  in-process and measures four phases:
+- full - the first synchronization copying every file
+- noop - a synchronization without changes, i.e. the cost of scanning
+- modify - a synchronization after rewriting percent % of the source files
+- delete - a synchronization after removing percent % of the source files
+  The files are chosen by a hash of their paths, so every run changes
+  the same files. Changing the source directory is not measured.
+For every phase, the driver writes a record with the wall time, files whose
+  metadata was read per second, copied MB per second, copied and removed
+  entries, read and write system calls (from /proc/self/io, which does not
+  count e.g. stat or getdents), user and system CPU time and the peak
+  resident set size of the process during the phase (its high-water mark
+  is reset through /proc/self/clear_refs before every phase).
+
+Options:
+- -R - recursive directory synchronization
+- -t <big_file_threshold> - minimal file size to consider it big
+- -H - pair the files of a directory with a hash table
+- -M <memory_budget> - maximal size in bytes of the listings of a pair
+  of directories kept in memory
+- -p <percent> - percentage of the files changed before phases modify
+  and delete (default 10)
+- -o <format> - csv (default) or json (one object per line)
+- -O <results_file> - append the records to a file instead of writing them
+  to the standard output; a CSV header is only written to an empty file
+- -L <label> - label written in every record, e.g. a commit identifier
+
+Usage:
+bench [-R] [-t <big_file_threshold>] [-H] [-M <memory_budget>]
+  [-p <percent>] [-o csv|json] [-O <results_file>] [-L <label>]
+  source_path target_path
+*/
+
+// nftw
+#define _XOPEN_SOURCE 700
+
+#include "dirsync.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Maximal number of file descriptors used by nftw.
+#define WALKDESCRIPTORS 32
+
+// Changes made to the source directory before a phase.
+enum change
+{
+  CHANGE_NONE,
+  CHANGE_MODIFY,
+  CHANGE_DELETE
+};
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  dirsyncSettings settings;
+  double percent;
+  // If not 0, records are written as JSON instead of CSV.
+  char json;
+  const char *resultsFile, *label, *source, *destination;
+};
+
+typedef struct sample sample;
+/*
+Counters of the process read before and after a phase.
+*/
+struct sample
+{
+  // Time in nanoseconds (metricsNow).
+  unsigned long long time;
+  // Numbers of read and write system calls.
+  unsigned long long reads, writes;
+  // User and system CPU time in microseconds.
+  unsigned long long user, system;
+  // Peak resident set size in KiB since the last resetPeak.
+  long peak;
+};
+
+// Change made by changeFile and the number of changed files.
+static enum change change;
+static double changePercent;
+static unsigned long long changedFiles;
+
+/*
+Resets the peak resident set size of the process to its current resident
+  set size so that the next sample reports the peak of one phase.
+*/
+static void resetPeak(void)
+{
+  FILE *file = fopen("/proc/self/clear_refs", "w");
+  // Without clear_refs, the peak of the whole process is reported.
+  if (file != NULL)
+  {
+    fputs("5", file);
+    fclose(file);
+  }
+}
+
+/*
+Reads the counters of the process.
+writes:
+s - sample
+*/
+static void takeSample(sample *s)
+{
+  char line[128];
+  struct rusage usage;
+  s->reads = s->writes = 0;
+  s->peak = -1;
+  FILE *file = fopen("/proc/self/status", "r");
+  if (file != NULL)
+  {
+    while (fgets(line, sizeof(line), file) != NULL)
+      sscanf(line, "VmHWM: %ld", &s->peak);
+    fclose(file);
+  }
+  file = fopen("/proc/self/io", "r");
+  // Without task I/O accounting, the system calls are reported as 0.
+  if (file != NULL)
+  {
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+      sscanf(line, "syscr: %llu", &s->reads);
+      sscanf(line, "syscw: %llu", &s->writes);
+    }
+    fclose(file);
+  }
+  getrusage(RUSAGE_SELF, &usage);
+  s->user = usage.ru_utime.tv_sec * 1000000ULL + usage.ru_utime.tv_usec;
+  s->system = usage.ru_stime.tv_sec * 1000000ULL + usage.ru_stime.tv_usec;
+  // Without /proc/self/status, the peak of the whole process is reported.
+  if (s->peak == -1)
+    s->peak = usage.ru_maxrss;
+  s->time = metricsNow();
+}
+
+/*
+Checks if a file is chosen to be changed, using the FNV-1a hash of its path
+  salted with the kind of the change so that different files are modified
+  and removed.
+reads:
+path - file path
+returns:
+1 if the file is chosen
+0 otherwise
+*/
+static int chosen(const char *path)
+{
+  unsigned long long hash = 14695981039346656037ULL ^ change;
+  for (; *path != '\0'; ++path)
+    hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+  return hash % 10000 < changePercent * 100;
+}
+
+/*
+Function called by nftw for every entry of the source directory. Rewrites
+  the first byte of a chosen file, which updates its modification time,
+  or removes the file.
+reads:
+path - entry path
+metadata - entry metadata
+type - type of the entry reported by nftw
+walk - unused
+returns:
+-1 if an error occured (errno is set, the path is printed)
+0 if no error occured
+*/
+static int changeFile(const char *path, const struct stat *metadata,
+  int type, struct FTW *walk)
+{
+  (void)walk;
+  if (type != FTW_F || !S_ISREG(metadata->st_mode) || !chosen(path))
+    return 0;
+  if (change == CHANGE_DELETE)
+  {
+    if (unlink(path) == -1)
+    {
+      perror(path);
+      return -1;
+    }
+  }
+  else
+  {
+    int descriptor = open(path, O_RDWR);
+    if (descriptor == -1)
+    {
+      perror(path);
+      return -1;
+    }
+    // Invert the first byte; an empty file gets one byte.
+    unsigned char byte = 0;
+    int failed = pread(descriptor, &byte, 1, 0) == -1;
+    byte = ~byte;
+    if (failed || pwrite(descriptor, &byte, 1, 0) != 1)
+    {
+      perror(path);
+      close(descriptor);
+      return -1;
+    }
+    close(descriptor);
+  }
+  ++changedFiles;
+  return 0;
+}
+
+/*
+Writes the record of a phase.
+reads:
+o - options
+name - name of the phase
+status - status code of the synchronization
+before - sample taken before the synchronization
+after - sample taken after it
+writes:
+file - file to which the record is appended
+*/
+static void writeRecord(FILE *file, const options *o, const char *name,
+  int status, const sample *before, const sample *after)
+{
+  double seconds = (after->time - before->time) / 1e9;
+  unsigned long long stated = metricsGet(METRIC_FILES_STATED),
+    copied = metricsGet(METRIC_FILES_COPIED),
+    bytes = metricsGet(METRIC_BYTES_COPIED),
+    deleted = metricsGet(METRIC_DELETES),
+    errors = metricsGet(METRIC_ERRORS);
+  double filesRate = seconds > 0 ? stated / seconds : 0;
+  double bytesRate = seconds > 0 ? bytes / seconds / 1e6 : 0;
+  unsigned long long reads = after->reads - before->reads,
+    writes = after->writes - before->writes;
+  double user = (after->user - before->user) / 1e6,
+    system = (after->system - before->system) / 1e6;
+  if (o->json)
+  {
+    fprintf(file, "{\"label\":\"");
+    // Labels are commit identifiers; only quotes and backslashes are escaped.
+    const char *c;
+    for (c = o->label; *c != '\0'; ++c)
+      fprintf(file, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    fprintf(file, "\",\"phase\":\"%s\",\"status\":%i,\"changed\":%llu,"
+      "\"seconds\":%.6f,\"files_stated\":%llu,\"files_per_second\":%.1f,"
+      "\"files_copied\":%llu,\"bytes_copied\":%llu,"
+      "\"mb_per_second\":%.2f,\"deleted\":%llu,\"errors\":%llu,"
+      "\"read_syscalls\":%llu,\"write_syscalls\":%llu,"
+      "\"user_seconds\":%.3f,\"system_seconds\":%.3f,"
+      "\"peak_rss_kib\":%ld}\n", name, status, changedFiles, seconds, stated,
+      filesRate, copied, bytes, bytesRate, deleted, errors, reads, writes,
+      user, system, after->peak);
+  }
+  else
+    // Commas in the label would break the columns.
+    fprintf(file, "%s,%s,%i,%llu,%.6f,%llu,%.1f,%llu,%llu,%.2f,%llu,%llu,"
+      "%llu,%llu,%.3f,%.3f,%ld\n", strchr(o->label, ',') == NULL ?
+      o->label : "", name, status, changedFiles, seconds, stated, filesRate,
+      copied, bytes, bytesRate, deleted, errors, reads, writes, user, system,
+      after->peak);
+}
+
+/*
+Parses the options and the directory paths.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  int option;
+  dirsyncDefaults(&o->settings);
+  o->percent = 10;
+  o->json = 0;
+  o->resultsFile = NULL;
+  o->label = "";
+  while ((option = getopt(argc, argv, ":Rt:HM:p:o:O:L:")) != -1)
+  {
+    switch (option)
+    {
+    case 'R':
+      o->settings.recursive = 1;
+      break;
+    case 't':
+      if (sscanf(optarg, "%llu", &o->settings.threshold) < 1)
+        return -1;
+      break;
+    case 'H':
+      o->settings.hashDiff = 1;
+      break;
+    case 'M':
+      if (sscanf(optarg, "%llu", &o->settings.memoryBudget) < 1)
+        return -1;
+      break;
+    case 'p':
+      if (sscanf(optarg, "%lf", &o->percent) < 1 || o->percent < 0 ||
+        o->percent > 100)
+        return -1;
+      break;
+    case 'o':
+      if (strcmp(optarg, "csv") == 0)
+        o->json = 0;
+      else if (strcmp(optarg, "json") == 0)
+        o->json = 1;
+      else
+        return -1;
+      break;
+    case 'O':
+      o->resultsFile = optarg;
+      break;
+    case 'L':
+      o->label = optarg;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // Exactly two directory paths have to follow the options.
+  if (optind != argc - 2)
+    return -1;
+  o->source = argv[optind];
+  o->destination = argv[optind + 1];
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  // Phases in the order of execution with the changes made before them.
+  static const char *const names[] = {"full", "noop", "modify", "delete"};
+  static const enum change changes[] = {CHANGE_NONE, CHANGE_NONE,
+    CHANGE_MODIFY, CHANGE_DELETE};
+  options o;
+  sample before, after;
+  unsigned int i;
+  int result = 0;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: bench [-R] [-t <big_file_threshold>] [-H] "
+      "[-M <memory_budget>] [-p <percent>] [-o csv|json] "
+      "[-O <results_file>] [-L <label>] source_path target_path\n");
+    return -1;
+  }
+  FILE *file = stdout;
+  if (o.resultsFile != NULL && (file = fopen(o.resultsFile, "a")) == NULL)
+  {
+    perror(o.resultsFile);
+    return -2;
+  }
+  dirsync *context = dirsyncCreate(o.source, o.destination, &o.settings);
+  if (context == NULL)
+  {
+    perror(o.source);
+    return -3;
+  }
+  // Only failures are logged so that logging does not skew the results.
+  loggerSetLevel(LOG_WARNING);
+  // The header is written only at the beginning of the file.
+  if (!o.json && (fseek(file, 0, SEEK_END) == -1 || ftell(file) == 0))
+    fprintf(file, "label,phase,status,changed,seconds,files_stated,"
+      "files_per_second,files_copied,bytes_copied,mb_per_second,deleted,"
+      "errors,read_syscalls,write_syscalls,user_seconds,system_seconds,"
+      "peak_rss_kib\n");
+  changePercent = o.percent;
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+  {
+    change = changes[i];
+    changedFiles = 0;
+    if (change != CHANGE_NONE && nftw(dirsyncSource(context), changeFile,
+      WALKDESCRIPTORS, FTW_PHYS) != 0)
+    {
+      result = -4;
+      break;
+    }
+    resetPeak();
+    takeSample(&before);
+    int status = dirsyncRun(context, NULL);
+    takeSample(&after);
+    writeRecord(file, &o, names[i], status, &before, &after);
+    fflush(file);
+    if (status < 0)
+      result = -5;
+  }
+  dirsyncDestroy(context);
+  if (file != stdout)
+    fclose(file);
+  return result;
+}
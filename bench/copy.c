@@ -0,0 +1,541 @@
+/*
+Microbenchmark of the copy functions (file.h). For every file size, it
+  creates a scratch file of pseudo-random contents and copies it repeatedly
+  with copySmallFile (read and write) and copyBigFile (mmap and write)
+  into every target directory, so that the big file threshold (option -t
+  of the daemon) can be chosen from measurements on the actual hardware.
+  A target directory on the same file system as the scratch directory
+  and one on another file system show whether the file system matters.
+The page cache is hot when the scratch file was just read. For a cold
+  cache, the pages of the scratch file are dropped with
+  posix_fadvise(POSIX_FADV_DONTNEED) before every copy, and with -D also
+  all caches are dropped through /proc/sys/vm/drop_caches (requires root).
+  Every copy is removed before the next one and its removal is not measured.
+For every method, size, cache state and target, a record is written
+  with the latency percentiles and the throughput at the median latency.
+  copyBigFile cannot map an empty file, so it is skipped for size 0.
+
+Options:
+- -s <sizes> - comma-separated file sizes in bytes with optional suffix
+  K, M or G (powers of 1024); default 0,4K,64K,1M,16M,256M
+- -n <runs> - number of copies measured per record (default 10)
+- -c <cache> - hot, cold or both (default)
+- -D - drop all caches before every cold copy
+- -b <buffer_size> - size in bytes of the copy buffer (default BUFFERSIZE,
+  at most BUFFERMAXIMUM)
+- -o <format> - csv (default) or json (one object per line)
+- -O <results_file> - append the records to a file instead of writing them
+  to the standard output; a CSV header is only written to an empty file
+- -L <label> - label written in every record, e.g. a commit identifier
+
+Usage:
+copy [-s <sizes>] [-n <runs>] [-c hot|cold|both] [-D] [-b <buffer_size>]
+  [-o csv|json] [-O <results_file>] [-L <label>] scratch_path target_path...
+*/
+
+#include "file.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Maximal number of measured sizes.
+#define MAXSIZES 32
+// Size in bytes of the buffer of pseudo-random contents of scratch files.
+#define CONTENTSIZE (1024 * 1024)
+
+// Copy functions compared by the benchmark.
+enum method
+{
+  METHOD_SMALL,
+  METHOD_BIG,
+  METHODS
+};
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  unsigned long long sizes[MAXSIZES];
+  unsigned int sizeCount, runs;
+  // If not 0, the copies are measured with a hot and a cold cache.
+  char hot, cold;
+  char dropCaches;
+  size_t bufferSize;
+  // If not 0, records are written as JSON instead of CSV.
+  char json;
+  const char *resultsFile, *label, *scratch;
+  // Target directory paths; the last elements of argv.
+  char **targets;
+  int targetCount;
+};
+
+// Names of the methods in the records.
+static const char *const methodNames[METHODS] = {"small", "big"};
+// Pseudo-random contents written to the scratch files.
+static char content[CONTENTSIZE];
+
+/*
+Parses a size with an optional suffix K, M or G.
+reads:
+text - size
+writes:
+size - size in bytes
+returns:
+-1 if the size is invalid
+0 otherwise
+*/
+static int parseSize(const char *text, unsigned long long *size)
+{
+  char suffix = '\0';
+  int count = sscanf(text, "%llu%c", size, &suffix);
+  if (count < 1)
+    return -1;
+  if (count == 1)
+    return 0;
+  switch (suffix)
+  {
+  case 'G':
+    *size *= 1024;
+    // fall through
+  case 'M':
+    *size *= 1024;
+    // fall through
+  case 'K':
+    *size *= 1024;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/*
+Parses a comma-separated list of sizes.
+reads:
+text - list
+writes:
+o - sizes and their number
+returns:
+-1 if a size is invalid or there are more than MAXSIZES sizes
+0 otherwise
+*/
+static int parseSizes(char *text, options *o)
+{
+  char *size;
+  o->sizeCount = 0;
+  for (size = strtok(text, ","); size != NULL; size = strtok(NULL, ","))
+  {
+    if (o->sizeCount == MAXSIZES ||
+      parseSize(size, &o->sizes[o->sizeCount]) == -1)
+      return -1;
+    ++o->sizeCount;
+  }
+  return o->sizeCount > 0 ? 0 : -1;
+}
+
+/*
+Creates a scratch file of pseudo-random contents and writes it back
+  to the disk, so that its pages can be dropped from the page cache.
+reads:
+path - file path
+size - size in bytes of the file
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int createScratch(const char *path, unsigned long long size)
+{
+  int descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (descriptor == -1)
+    return -1;
+  unsigned long long left = size;
+  while (left > 0)
+  {
+    size_t chunk = left < CONTENTSIZE ? left : CONTENTSIZE;
+    ssize_t written = write(descriptor, content, chunk);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1)
+    {
+      close(descriptor);
+      return -1;
+    }
+    left -= written;
+  }
+  // Dirty pages cannot be dropped.
+  if (fsync(descriptor) == -1)
+  {
+    close(descriptor);
+    return -1;
+  }
+  return close(descriptor);
+}
+
+/*
+Drops the pages of a file from the page cache and optionally all caches
+  of the system.
+reads:
+path - file path
+all - if not 0, all caches are dropped
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int dropCache(const char *path, char all)
+{
+  int descriptor = open(path, O_RDONLY);
+  if (descriptor == -1)
+    return -1;
+  int status = posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+  close(descriptor);
+  if (status != 0)
+  {
+    errno = status;
+    return -1;
+  }
+  if (!all)
+    return 0;
+  // Write back dirty pages, e.g. of the previous copies, before dropping.
+  sync();
+  descriptor = open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if (descriptor == -1)
+    return -1;
+  // 3 drops the page cache, dentries and inodes.
+  status = write(descriptor, "3", 1) == 1 ? 0 : -1;
+  close(descriptor);
+  return status;
+}
+
+/*
+Warms up the page cache with the contents of a file.
+reads:
+path - file path
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int readFile(const char *path)
+{
+  int descriptor = open(path, O_RDONLY);
+  if (descriptor == -1)
+    return -1;
+  ssize_t count;
+  while ((count = read(descriptor, content, CONTENTSIZE)) != 0)
+    if (count == -1 && errno != EINTR)
+    {
+      close(descriptor);
+      return -1;
+    }
+  return close(descriptor);
+}
+
+/*
+Compares latencies for qsort.
+*/
+static int compareLatencies(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a,
+    y = *(const unsigned long long *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+Returns a percentile of sorted latencies using the nearest rank.
+reads:
+latencies - latencies sorted in ascending order
+count - number of latencies, at least 1
+percent - percentile from 0 to 100
+*/
+static unsigned long long percentile(const unsigned long long *latencies,
+  unsigned int count, unsigned int percent)
+{
+  unsigned int rank = (count * percent + 99) / 100;
+  return latencies[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+Writes a record.
+reads:
+o - options
+method - copy function
+size - size in bytes of the copied file
+cold - if not 0, the cache was cold
+target - target directory path
+crossDevice - if not 0, the target is on another file system
+latencies - latencies in nanoseconds sorted in ascending order
+count - number of successful copies
+failures - number of failed copies
+writes:
+file - file to which the record is appended
+*/
+static void writeRecord(FILE *file, const options *o, enum method method,
+  unsigned long long size, char cold, const char *target, char crossDevice,
+  const unsigned long long *latencies, unsigned int count,
+  unsigned int failures)
+{
+  double p50 = 0, p90 = 0, p99 = 0, maximum = 0, rate = 0;
+  if (count > 0)
+  {
+    p50 = percentile(latencies, count, 50) / 1e6;
+    p90 = percentile(latencies, count, 90) / 1e6;
+    p99 = percentile(latencies, count, 99) / 1e6;
+    maximum = latencies[count - 1] / 1e6;
+    // MB per second at the median latency.
+    rate = p50 > 0 ? size / p50 / 1e3 : 0;
+  }
+  const char *cache = cold ? "cold" : "hot",
+    *filesystem = crossDevice ? "cross" : "same";
+  if (o->json)
+  {
+    fprintf(file, "{\"label\":\"");
+    // Labels are commit identifiers; only quotes and backslashes are escaped.
+    const char *c;
+    for (c = o->label; *c != '\0'; ++c)
+      fprintf(file, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    fprintf(file, "\",\"method\":\"%s\",\"size\":%llu,\"cache\":\"%s\","
+      "\"filesystem\":\"%s\",\"target\":\"", methodNames[method], size, cache,
+      filesystem);
+    for (c = target; *c != '\0'; ++c)
+      fprintf(file, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    fprintf(file, "\",\"runs\":%u,\"failures\":%u,\"p50_ms\":%.3f,"
+      "\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+      "\"mb_per_second\":%.2f}\n", count, failures, p50, p90, p99, maximum,
+      rate);
+  }
+  else
+    // Commas in the label or the target would break the columns.
+    fprintf(file, "%s,%s,%llu,%s,%s,%s,%u,%u,%.3f,%.3f,%.3f,%.3f,%.2f\n",
+      strchr(o->label, ',') == NULL ? o->label : "", methodNames[method], size,
+      cache, filesystem, strchr(target, ',') == NULL ? target : "", count,
+      failures, p50, p90, p99, maximum, rate);
+}
+
+/*
+Measures copies of a scratch file with a method, a cache state
+  and a target directory and writes their record.
+reads:
+o - options
+method - copy function
+scratchPath - scratch file path
+size - size in bytes of the scratch file
+cold - if not 0, the pages of the scratch file are dropped before every copy
+target - target directory path
+crossDevice - if not 0, the target is on another file system
+writes:
+latencies - buffer for o->runs latencies
+file - file to which the record is appended
+returns:
+-1 if the cache could not be dropped or the copy could not be removed
+  (errno is set, the path is printed)
+0 otherwise
+*/
+static int measure(FILE *file, const options *o, enum method method,
+  const char *scratchPath, unsigned long long size, char cold,
+  const char *target, char crossDevice, unsigned long long *latencies)
+{
+  char copyPath[PATH_MAX];
+  const struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+  unsigned int run, count = 0, failures = 0;
+  if (snprintf(copyPath, PATH_MAX, "%s/copy-%llu", target, size) >= PATH_MAX)
+  {
+    errno = ENAMETOOLONG;
+    perror(target);
+    return -1;
+  }
+  // The first copy of a hot series reads the file into the cache.
+  if (!cold && readFile(scratchPath) == -1)
+  {
+    perror(scratchPath);
+    return -1;
+  }
+  for (run = 0; run < o->runs; ++run)
+  {
+    if (cold && dropCache(scratchPath, o->dropCaches) == -1)
+    {
+      perror(o->dropCaches ? "/proc/sys/vm/drop_caches" : scratchPath);
+      return -1;
+    }
+    unsigned long long start = metricsNow();
+    int status = method == METHOD_SMALL ?
+      copySmallFile(scratchPath, copyPath, 0644, &times[0], &times[1]) :
+      copyBigFile(scratchPath, copyPath, size, 0644, &times[0], &times[1]);
+    unsigned long long end = metricsNow();
+    // Non-critical errors, e.g. a rejected advice, do not spoil the copy.
+    if (status < 0)
+      ++failures;
+    else
+      latencies[count++] = end - start;
+    if (unlink(copyPath) == -1 && errno != ENOENT)
+    {
+      perror(copyPath);
+      return -1;
+    }
+  }
+  qsort(latencies, count, sizeof(latencies[0]), compareLatencies);
+  writeRecord(file, o, method, size, cold, target, crossDevice, latencies,
+    count, failures);
+  fflush(file);
+  return 0;
+}
+
+/*
+Parses the options and the paths.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  static char defaultSizes[] = "0,4K,64K,1M,16M,256M";
+  int option;
+  parseSizes(defaultSizes, o);
+  o->runs = 10;
+  o->hot = o->cold = 1;
+  o->dropCaches = 0;
+  o->bufferSize = BUFFERSIZE;
+  o->json = 0;
+  o->resultsFile = NULL;
+  o->label = "";
+  while ((option = getopt(argc, argv, ":s:n:c:Db:o:O:L:")) != -1)
+  {
+    switch (option)
+    {
+    case 's':
+      if (parseSizes(optarg, o) == -1)
+        return -1;
+      break;
+    case 'n':
+      if (sscanf(optarg, "%u", &o->runs) < 1 || o->runs == 0)
+        return -1;
+      break;
+    case 'c':
+      o->hot = strcmp(optarg, "cold") != 0;
+      o->cold = strcmp(optarg, "hot") != 0;
+      if (!o->hot && !o->cold)
+        return -1;
+      // Reject names other than hot, cold and both.
+      if (o->hot && o->cold && strcmp(optarg, "both") != 0)
+        return -1;
+      break;
+    case 'D':
+      o->dropCaches = 1;
+      break;
+    case 'b':
+      if (sscanf(optarg, "%zu", &o->bufferSize) < 1 || o->bufferSize == 0 ||
+        o->bufferSize > BUFFERMAXIMUM)
+        return -1;
+      break;
+    case 'o':
+      if (strcmp(optarg, "csv") == 0)
+        o->json = 0;
+      else if (strcmp(optarg, "json") == 0)
+        o->json = 1;
+      else
+        return -1;
+      break;
+    case 'O':
+      o->resultsFile = optarg;
+      break;
+    case 'L':
+      o->label = optarg;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // The scratch directory and at least one target directory have to follow.
+  if (optind > argc - 2)
+    return -1;
+  o->scratch = argv[optind];
+  o->targets = argv + optind + 1;
+  o->targetCount = argc - optind - 1;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  options o;
+  char scratchPath[PATH_MAX];
+  struct stat scratchDirectory, targetDirectory;
+  unsigned int s;
+  int t, result = 0;
+  size_t i;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: copy [-s <sizes>] [-n <runs>] [-c hot|cold|both] [-D] "
+      "[-b <buffer_size>] [-o csv|json] [-O <results_file>] [-L <label>] "
+      "scratch_path target_path...\n");
+    return -1;
+  }
+  if (stat(o.scratch, &scratchDirectory) == -1)
+  {
+    perror(o.scratch);
+    return -2;
+  }
+  unsigned long long *latencies = malloc(o.runs * sizeof(latencies[0]));
+  if (latencies == NULL)
+  {
+    perror("malloc");
+    return -3;
+  }
+  FILE *file = stdout;
+  if (o.resultsFile != NULL && (file = fopen(o.resultsFile, "a")) == NULL)
+  {
+    perror(o.resultsFile);
+    return -4;
+  }
+  // The header is written only at the beginning of the file.
+  if (!o.json && (fseek(file, 0, SEEK_END) == -1 || ftell(file) == 0))
+    fprintf(file, "label,method,size,cache,filesystem,target,runs,failures,"
+      "p50_ms,p90_ms,p99_ms,max_ms,mb_per_second\n");
+  fileSetBufferSize(o.bufferSize);
+  // The contents do not matter as long as they are not sparse.
+  for (i = 0; i < CONTENTSIZE; ++i)
+    content[i] = (char)(i * 2654435761U >> 24);
+  for (s = 0; s < o.sizeCount && result == 0; ++s)
+  {
+    unsigned long long size = o.sizes[s];
+    snprintf(scratchPath, PATH_MAX, "%s/scratch-%llu", o.scratch, size);
+    if (createScratch(scratchPath, size) == -1)
+    {
+      perror(scratchPath);
+      result = -5;
+      break;
+    }
+    for (t = 0; t < o.targetCount && result == 0; ++t)
+    {
+      char crossDevice = stat(o.targets[t], &targetDirectory) == 0 &&
+        targetDirectory.st_dev != scratchDirectory.st_dev;
+      enum method method;
+      for (method = 0; method < METHODS && result == 0; ++method)
+      {
+        // An empty file cannot be mapped.
+        if (method == METHOD_BIG && size == 0)
+          continue;
+        if ((o.hot && measure(file, &o, method, scratchPath, size, 0,
+          o.targets[t], crossDevice, latencies) == -1) ||
+          (o.cold && measure(file, &o, method, scratchPath, size, 1,
+          o.targets[t], crossDevice, latencies) == -1))
+          result = -6;
+      }
+    }
+    unlink(scratchPath);
+  }
+  free(latencies);
+  if (file != stdout)
+    fclose(file);
+  return result;
+}
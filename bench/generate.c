@@ -0,0 +1,344 @@
+/*
+Generator of synthetic directory trees for benchmarking DirSyncD.
+  The same options and seed always produce the same tree, so results
+  of different commits can be compared.
+
+Options:
+- -n <files> - number of files distributed round-robin among the directories
+  of the tree (default 10000)
+- -b <mean_size> - mean size in bytes of a file (default 16384)
+- -z <distribution> - distribution of file sizes: fixed (every file has
+  the mean size), uniform (from 0 to twice the mean) or exponential
+  (many small files and a few big ones; default)
+- -d <depth> - number of levels of subdirectories below the root (default 3)
+- -w <fan_out> - number of subdirectories of every directory above the lowest
+  level (default 4)
+- -F <flat_files> - number of additional files placed in a single directory
+  'flat' of the root, e.g. to measure huge directories (default 0)
+- -r <seed> - seed of the pseudo-random sizes and contents (default 1)
+
+Usage:
+generate [-n <files>] [-b <mean_size>] [-z <distribution>] [-d <depth>]
+  [-w <fan_out>] [-F <flat_files>] [-r <seed>] directory
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Size in bytes of the buffer of pseudo-random file contents.
+#define CONTENTSIZE (1024 * 1024)
+
+// Distributions of file sizes.
+enum distribution
+{
+  DISTRIBUTION_FIXED,
+  DISTRIBUTION_UNIFORM,
+  DISTRIBUTION_EXPONENTIAL
+};
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  unsigned long long files, meanSize, flatFiles;
+  enum distribution distribution;
+  unsigned int depth, fanOut;
+  unsigned long long seed;
+  const char *root;
+};
+
+// State of the pseudo-random number generator.
+static unsigned long long state;
+// Pseudo-random contents written to the files.
+static char content[CONTENTSIZE];
+// Number of files and bytes written so far.
+static unsigned long long writtenFiles, writtenBytes;
+
+/*
+Returns the next pseudo-random number of the xorshift64* generator.
+*/
+static unsigned long long nextRandom(void)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+Draws the size of a file.
+reads:
+o - options
+returns:
+size in bytes
+*/
+static unsigned long long drawSize(const options *o)
+{
+  // Number from the interval (0, 1).
+  double u = ((nextRandom() >> 11) + 0.5) / 9007199254740992.0;
+  switch (o->distribution)
+  {
+  case DISTRIBUTION_FIXED:
+    return o->meanSize;
+  case DISTRIBUTION_UNIFORM:
+    return (unsigned long long)(u * 2 * o->meanSize);
+  default:
+    // Inverse of the cumulative distribution function.
+    return (unsigned long long)(-log(u) * o->meanSize);
+  }
+}
+
+/*
+Creates a file filled with pseudo-random contents.
+reads:
+path - file path
+size - size in bytes of the file
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int writeFile(const char *path, unsigned long long size)
+{
+  int descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (descriptor == -1)
+    return -1;
+  // Start at a pseudo-random offset so that files differ.
+  size_t offset = nextRandom() % CONTENTSIZE;
+  unsigned long long left = size;
+  while (left > 0)
+  {
+    size_t chunk = CONTENTSIZE - offset;
+    if (chunk > left)
+      chunk = left;
+    ssize_t written = write(descriptor, content + offset, chunk);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1)
+    {
+      close(descriptor);
+      return -1;
+    }
+    left -= written;
+    offset = (offset + written) % CONTENTSIZE;
+  }
+  if (close(descriptor) == -1)
+    return -1;
+  ++writtenFiles;
+  writtenBytes += size;
+  return 0;
+}
+
+/*
+Counts the directories of a tree, including its root.
+reads:
+depth - number of levels below the root
+fanOut - number of subdirectories of every directory above the lowest level
+returns:
+number of directories
+*/
+static unsigned long long countDirectories(unsigned int depth,
+  unsigned int fanOut)
+{
+  unsigned long long count = 1, level = 1;
+  unsigned int i;
+  for (i = 0; i < depth; ++i)
+  {
+    level *= fanOut;
+    count += level;
+  }
+  return count;
+}
+
+/*
+Creates a directory of the tree with its files and subdirectories.
+  Directory number index gets the files index, index + directories,
+  index + 2 * directories and so on.
+reads:
+o - options
+path - directory path
+depth - number of levels below the directory
+directories - number of directories of the whole tree
+writes:
+index - number of the directory, increased for every created directory
+returns:
+-1 if an error occured (errno is set, the path is printed)
+0 if no error occured
+*/
+static int createDirectory(const options *o, const char *path,
+  unsigned int depth, unsigned long long directories,
+  unsigned long long *index)
+{
+  char child[PATH_MAX];
+  unsigned long long file;
+  unsigned int i;
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+  {
+    perror(path);
+    return -1;
+  }
+  for (file = (*index)++; file < o->files; file += directories)
+  {
+    snprintf(child, PATH_MAX, "%s/file%llu", path, file);
+    if (writeFile(child, drawSize(o)) == -1)
+    {
+      perror(child);
+      return -1;
+    }
+  }
+  if (depth == 0)
+    return 0;
+  for (i = 0; i < o->fanOut; ++i)
+  {
+    if (snprintf(child, PATH_MAX, "%s/dir%u", path, i) >= PATH_MAX)
+    {
+      errno = ENAMETOOLONG;
+      perror(path);
+      return -1;
+    }
+    if (createDirectory(o, child, depth - 1, directories, index) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+Creates the directory 'flat' of the root with o->flatFiles files.
+reads:
+o - options
+returns:
+-1 if an error occured (errno is set, the path is printed)
+0 if no error occured
+*/
+static int createFlat(const options *o)
+{
+  char path[PATH_MAX];
+  unsigned long long file;
+  snprintf(path, PATH_MAX, "%s/flat", o->root);
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+  {
+    perror(path);
+    return -1;
+  }
+  for (file = 0; file < o->flatFiles; ++file)
+  {
+    snprintf(path, PATH_MAX, "%s/flat/file%llu", o->root, file);
+    if (writeFile(path, drawSize(o)) == -1)
+    {
+      perror(path);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+Parses the options and the directory path.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  int option;
+  o->files = 10000;
+  o->meanSize = 16384;
+  o->distribution = DISTRIBUTION_EXPONENTIAL;
+  o->depth = 3;
+  o->fanOut = 4;
+  o->flatFiles = 0;
+  o->seed = 1;
+  while ((option = getopt(argc, argv, ":n:b:z:d:w:F:r:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      if (sscanf(optarg, "%llu", &o->files) < 1)
+        return -1;
+      break;
+    case 'b':
+      if (sscanf(optarg, "%llu", &o->meanSize) < 1)
+        return -1;
+      break;
+    case 'z':
+      if (strcmp(optarg, "fixed") == 0)
+        o->distribution = DISTRIBUTION_FIXED;
+      else if (strcmp(optarg, "uniform") == 0)
+        o->distribution = DISTRIBUTION_UNIFORM;
+      else if (strcmp(optarg, "exponential") == 0)
+        o->distribution = DISTRIBUTION_EXPONENTIAL;
+      else
+        return -1;
+      break;
+    case 'd':
+      if (sscanf(optarg, "%u", &o->depth) < 1)
+        return -1;
+      break;
+    case 'w':
+      if (sscanf(optarg, "%u", &o->fanOut) < 1)
+        return -1;
+      break;
+    case 'F':
+      if (sscanf(optarg, "%llu", &o->flatFiles) < 1)
+        return -1;
+      break;
+    case 'r':
+      if (sscanf(optarg, "%llu", &o->seed) < 1)
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // Exactly one directory path has to follow the options.
+  if (optind != argc - 1)
+    return -1;
+  o->root = argv[optind];
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  options o;
+  unsigned long long index = 0;
+  size_t i;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: generate [-n <files>] [-b <mean_size>] "
+      "[-z fixed|uniform|exponential] [-d <depth>] [-w <fan_out>] "
+      "[-F <flat_files>] [-r <seed>] directory\n");
+    return -1;
+  }
+  // Without subdirectories the depth does not matter.
+  if (o.fanOut == 0)
+    o.depth = 0;
+  // xorshift never leaves state 0.
+  state = o.seed != 0 ? o.seed : 1;
+  for (i = 0; i < CONTENTSIZE; i += sizeof(unsigned long long))
+  {
+    unsigned long long word = nextRandom();
+    memcpy(content + i, &word, sizeof(word));
+  }
+  if (createDirectory(&o, o.root, o.depth, countDirectories(o.depth,
+    o.fanOut), &index) == -1)
+    return -2;
+  if (o.flatFiles > 0 && createFlat(&o) == -1)
+    return -2;
+  printf("%llu files, %llu bytes, %llu directories\n", writtenFiles,
+    writtenBytes, countDirectories(o.depth, o.fanOut) +
+    (o.flatFiles > 0 ? 1 : 0));
+  return 0;
+}
@@ -0,0 +1,384 @@
+/*
+Microbenchmark of pairing the file lists of a directory pair (option -H
+  of the daemon). For every number of entries, it builds a source and
+  a target list of names in pseudo-random order, like readdir returns them,
+  and pairs them repeatedly with both methods of the engine:
+- sort - listMergeSort of both lists (linked_list.h)
+- hash - hashJoin of the lists (hash_join.h)
+  followed by the walk comparing the lists with strcmp, like
+  updateDestinationFiles, which counts the paired names. Building the lists
+  is not measured. The names are allocated from the arena like the entries
+  of a listed directory.
+For every method and number of entries, a record is written with the median
+  and minimal time and the number of pairs, which is the same for both
+  methods.
+
+Options:
+- -n <entries> - comma-separated numbers of entries of each list (default
+  1000,10000,100000,1000000)
+- -m <percent> - percentage of the source names which are also in the target
+  list (default 90)
+- -r <runs> - number of measured pairings per record (default 5)
+- -o <format> - csv (default) or json (one object per line)
+- -O <results_file> - append the records to a file instead of writing them
+  to the standard output; a CSV header is only written to an empty file
+- -L <label> - label written in every record, e.g. a commit identifier
+
+Usage:
+lists [-n <entries>] [-m <percent>] [-r <runs>] [-o csv|json]
+  [-O <results_file>] [-L <label>]
+*/
+
+#include "arena.h"
+#include "hash_join.h"
+#include "linked_list.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <dirent.h>
+
+// Maximal number of measured list sizes.
+#define MAXSIZES 32
+// Maximal number of measured pairings per record.
+#define MAXRUNS 1000
+
+// Pairing methods compared by the benchmark.
+enum method
+{
+  METHOD_SORT,
+  METHOD_HASH,
+  METHODS
+};
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  unsigned long long sizes[MAXSIZES];
+  unsigned int sizeCount;
+  double percent;
+  unsigned int runs;
+  // If not 0, records are written as JSON instead of CSV.
+  char json;
+  const char *resultsFile, *label;
+};
+
+// Names of the methods in the records.
+static const char *const methodNames[METHODS] = {"sort", "hash"};
+
+/*
+Scrambles a number with the finalizer of MurmurHash3 so that consecutive
+  numbers give names in pseudo-random order.
+reads:
+x - number
+returns:
+scrambled number
+*/
+static unsigned long long scramble(unsigned long long x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb3fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/*
+Adds an entry with a name built from a number to a list. The entry
+  is allocated from the arena with only the bytes of its name.
+reads:
+number - number of the name
+writes:
+l - list
+returns:
+-1 if memory could not be allocated
+0 if no error occured
+*/
+static int addName(list *l, unsigned long long number)
+{
+  char name[32];
+  int length = snprintf(name, sizeof(name), "file%016llx", number);
+  struct dirent *entry = arenaAllocate(offsetof(struct dirent, d_name) +
+    length + 1);
+  if (entry == NULL)
+    return -1;
+  entry->d_type = DT_REG;
+  memcpy(entry->d_name, name, length + 1);
+  return pushBack(l, entry) == 0 ? 0 : -1;
+}
+
+/*
+Builds the lists of a directory pair. The first percent % of the source
+  names are also target names; the other target names are not in the source
+  list. The target list is in the reverse order of the source list so that
+  the lists are in different pseudo-random orders.
+reads:
+count - number of entries of each list
+percent - percentage of the source names in the target list
+writes:
+source - source list
+target - target list
+returns:
+-1 if memory could not be allocated
+0 if no error occured
+*/
+static int buildLists(unsigned long long count, double percent, list *source,
+  list *target)
+{
+  unsigned long long common = count * percent / 100, i;
+  initialize(source);
+  initialize(target);
+  for (i = 0; i < count; ++i)
+    if (addName(source, scramble(i)) == -1)
+      return -1;
+  for (i = count; i > 0; --i)
+    // Inverted numbers give names missing in the source list.
+    if (addName(target, i - 1 < common ? scramble(i - 1) : ~scramble(i - 1))
+      == -1)
+      return -1;
+  return 0;
+}
+
+/*
+Walks the paired lists like updateDestinationFiles and counts the names
+  present in both.
+reads:
+source - source list
+target - target list
+returns:
+number of pairs
+*/
+static unsigned long long countPairs(const list *source, const list *target)
+{
+  element *s = source->first, *t = target->first;
+  unsigned long long pairs = 0;
+  while (s != NULL && t != NULL)
+  {
+    int comparison = strcmp(s->entry->d_name, t->entry->d_name);
+    if (comparison == 0)
+      ++pairs;
+    if (comparison <= 0)
+      s = s->next;
+    if (comparison >= 0)
+      t = t->next;
+  }
+  return pairs;
+}
+
+/*
+Compares times for qsort.
+*/
+static int compareTimes(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a,
+    y = *(const unsigned long long *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+Writes a record.
+reads:
+o - options
+method - pairing method
+count - number of entries of each list
+times - times in nanoseconds sorted in ascending order
+pairs - number of pairs found
+writes:
+file - file to which the record is appended
+*/
+static void writeRecord(FILE *file, const options *o, enum method method,
+  unsigned long long count, const unsigned long long *times,
+  unsigned long long pairs)
+{
+  double median = times[o->runs / 2] / 1e6, minimum = times[0] / 1e6;
+  if (o->json)
+  {
+    fprintf(file, "{\"label\":\"");
+    // Labels are commit identifiers; only quotes and backslashes are escaped.
+    const char *c;
+    for (c = o->label; *c != '\0'; ++c)
+      fprintf(file, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+    fprintf(file, "\",\"method\":\"%s\",\"entries\":%llu,"
+      "\"common_percent\":%.1f,\"runs\":%u,\"p50_ms\":%.3f,\"min_ms\":%.3f,"
+      "\"pairs\":%llu}\n", methodNames[method], count, o->percent, o->runs,
+      median, minimum, pairs);
+  }
+  else
+    // Commas in the label would break the columns.
+    fprintf(file, "%s,%s,%llu,%.1f,%u,%.3f,%.3f,%llu\n",
+      strchr(o->label, ',') == NULL ? o->label : "", methodNames[method],
+      count, o->percent, o->runs, median, minimum, pairs);
+}
+
+/*
+Measures the pairings of lists of a size with a method and writes their
+  record.
+reads:
+o - options
+method - pairing method
+count - number of entries of each list
+writes:
+file - file to which the record is appended
+returns:
+-1 if memory could not be allocated (the error is printed)
+0 otherwise
+*/
+static int measure(FILE *file, const options *o, enum method method,
+  unsigned long long count)
+{
+  static unsigned long long times[MAXRUNS];
+  unsigned long long pairs = 0;
+  unsigned int run;
+  list source, target;
+  for (run = 0; run < o->runs; ++run)
+  {
+    // Reuse the memory of the previous run.
+    arenaReset();
+    if (buildLists(count, o->percent, &source, &target) == -1)
+    {
+      fprintf(stderr, "lists: cannot allocate %llu entries\n", count);
+      return -1;
+    }
+    unsigned long long start = metricsNow();
+    // If the table cannot be allocated, the engine sorts the lists too.
+    if (method == METHOD_SORT || hashJoin(&source, &target) == -1)
+    {
+      listMergeSort(&source);
+      listMergeSort(&target);
+    }
+    pairs = countPairs(&source, &target);
+    times[run] = metricsNow() - start;
+  }
+  qsort(times, o->runs, sizeof(times[0]), compareTimes);
+  writeRecord(file, o, method, count, times, pairs);
+  fflush(file);
+  return 0;
+}
+
+/*
+Parses comma-separated numbers of entries.
+reads:
+text - numbers, e.g. '1000,100000'
+writes:
+o - numbers of entries
+returns:
+-1 if the text is invalid
+0 if no error occured
+*/
+static int parseSizes(const char *text, options *o)
+{
+  unsigned int count = 0;
+  int length;
+  while (count < MAXSIZES &&
+    sscanf(text, "%llu%n", &o->sizes[count], &length) == 1)
+  {
+    ++count;
+    text += length;
+    if (*text == '\0')
+    {
+      o->sizeCount = count;
+      return 0;
+    }
+    if (*text++ != ',')
+      return -1;
+  }
+  return -1;
+}
+
+/*
+Parses the options.
+reads:
+argc - number of elements of argv
+argv - program name followed by options
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  int option;
+  parseSizes("1000,10000,100000,1000000", o);
+  o->percent = 90;
+  o->runs = 5;
+  o->json = 0;
+  o->resultsFile = NULL;
+  o->label = "";
+  while ((option = getopt(argc, argv, ":n:m:r:o:O:L:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      if (parseSizes(optarg, o) == -1)
+        return -1;
+      break;
+    case 'm':
+      if (sscanf(optarg, "%lf", &o->percent) < 1 || o->percent < 0 ||
+        o->percent > 100)
+        return -1;
+      break;
+    case 'r':
+      if (sscanf(optarg, "%u", &o->runs) < 1 || o->runs == 0 ||
+        o->runs > MAXRUNS)
+        return -1;
+      break;
+    case 'o':
+      if (strcmp(optarg, "csv") == 0)
+        o->json = 0;
+      else if (strcmp(optarg, "json") == 0)
+        o->json = 1;
+      else
+        return -1;
+      break;
+    case 'O':
+      o->resultsFile = optarg;
+      break;
+    case 'L':
+      o->label = optarg;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // No arguments follow the options.
+  return optind == argc ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  options o;
+  unsigned int s;
+  enum method method;
+  int result = 0;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: lists [-n <entries>] [-m <percent>] [-r <runs>] "
+      "[-o csv|json] [-O <results_file>] [-L <label>]\n");
+    return -1;
+  }
+  FILE *file = stdout;
+  if (o.resultsFile != NULL && (file = fopen(o.resultsFile, "a")) == NULL)
+  {
+    perror(o.resultsFile);
+    return -2;
+  }
+  // The header is written only at the beginning of the file.
+  if (!o.json && (fseek(file, 0, SEEK_END) == -1 || ftell(file) == 0))
+    fprintf(file, "label,method,entries,common_percent,runs,p50_ms,min_ms,"
+      "pairs\n");
+  for (s = 0; s < o.sizeCount && result == 0; ++s)
+    for (method = 0; method < METHODS && result == 0; ++method)
+      if (measure(file, &o, method, o.sizes[s]) == -1)
+        result = -3;
+  if (file != stdout)
+    fclose(file);
+  return result;
+}
@@ -0,0 +1,109 @@
+/*
+Synchronizes a source directory to a target directory once in-process
+  with the engine (libdirsync), e.g. for checks comparing the directories
+  afterwards (make check-pairing).
+
+Options:
+- -R - recursive directory synchronization
+- -t <big_file_threshold> - minimal file size to consider it big
+- -H - pair the files of a directory with a hash table
+- -M <memory_budget> - maximal size in bytes of the listings of a pair
+  of directories kept in memory
+
+Usage:
+sync [-R] [-t <big_file_threshold>] [-H] [-M <memory_budget>]
+  source_path target_path
+
+Exit status:
+0 if the synchronization succeeded
+a negative number otherwise
+*/
+
+#include "dirsync.h"
+#include "logger.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <syslog.h>
+
+typedef struct options options;
+/*
+Values of the options.
+*/
+struct options
+{
+  dirsyncSettings settings;
+  const char *source, *destination;
+};
+
+/*
+Parses the options.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+o - values of the options
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, options *o)
+{
+  int option;
+  dirsyncDefaults(&o->settings);
+  while ((option = getopt(argc, argv, ":Rt:HM:")) != -1)
+  {
+    switch (option)
+    {
+    case 'R':
+      o->settings.recursive = 1;
+      break;
+    case 't':
+      if (sscanf(optarg, "%llu", &o->settings.threshold) < 1)
+        return -1;
+      break;
+    case 'H':
+      o->settings.hashDiff = 1;
+      break;
+    case 'M':
+      if (sscanf(optarg, "%llu", &o->settings.memoryBudget) < 1)
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+  }
+  // Exactly two directory paths have to follow the options.
+  if (optind != argc - 2)
+    return -1;
+  o->source = argv[optind];
+  o->destination = argv[optind + 1];
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  options o;
+  if (parseOptions(argc, argv, &o) < 0)
+  {
+    printf("Usage: sync [-R] [-t <big_file_threshold>] [-H] "
+      "[-M <memory_budget>] source_path target_path\n");
+    return -1;
+  }
+  dirsync *context = dirsyncCreate(o.source, o.destination, &o.settings);
+  if (context == NULL)
+  {
+    perror(o.source);
+    return -2;
+  }
+  // Only failures are logged.
+  loggerSetLevel(LOG_WARNING);
+  int status = dirsyncRun(context, NULL);
+  dirsyncDestroy(context);
+  if (status < 0)
+  {
+    fprintf(stderr, "sync: synchronization failed; %i\n", status);
+    return -3;
+  }
+  return 0;
+}
@@ -11,7 +11,11 @@ check_error ()
 
 BUILD=./build
 TARGET=DirSyncD
+# Engine (dirsync.h) linked into the daemon and embeddable in other programs.
+LIBRARY=libdirsync
 INCLUDE=-Iinclude
+# Threads are used by the control socket.
+FLAGS=-pthread
 SOURCE=$(find source/ -type f -iregex ".*\.c")
 check_error
 
@@ -24,7 +28,7 @@ mkdir -p $BUILD
 OBJECTS=""
 for path in $SOURCE
 do
-  path_wo_ext=$(echo $path | sed 's|.c\>||')
+  path_wo_ext=$(echo $path | sed 's|\.c$||')
   # Equivalent to 'dirname' command.
   dir_name=$(echo $path_wo_ext | sed 's|/[^/]*$||')
 
@@ -33,10 +37,18 @@ do
 
   source=$path_wo_ext.c
   object=$BUILD/$path_wo_ext.o
-  gcc $source $INCLUDE -c -o $object
+  gcc $FLAGS -fPIC $source $INCLUDE -c -o $object
   check_error
 
-  OBJECTS="$OBJECTS $object"
+  # The daemon's main function is not part of the library.
+  if [ $source != source/$TARGET.c ]
+  then
+    OBJECTS="$OBJECTS $object"
+  fi
 done
 
-gcc $OBJECTS -o $BUILD/$TARGET
+ar rcs $BUILD/$LIBRARY.a $OBJECTS
+check_error
+gcc $FLAGS -shared $OBJECTS -o $BUILD/$LIBRARY.so
+check_error
+gcc $FLAGS $BUILD/source/$TARGET.o $BUILD/$LIBRARY.a -o $BUILD/$TARGET
@@ -1,9 +1,71 @@
 #ifndef DIRSYNCD_H
 #define DIRSYNCD_H
 
+#include "dirsync.h"
+#include "synchronization.h"
+
 #include <dirent.h>
 #include <sys/stat.h>
 
+typedef struct parameters parameters;
+/*
+Values of the options and arguments passed to the program.
+*/
+struct parameters
+{
+  // Source directory path.
+  char *source;
+  // Target directory path.
+  char *destination;
+  // Sleep time in seconds.
+  unsigned int interval;
+  // Control socket path or NULL if the socket is not to be created.
+  char *controlSocket;
+  // Metrics file path or NULL if metrics are not to be written.
+  char *metricsFile;
+  // Status file path or NULL if progress is not to be written (progress.h).
+  char *statusFile;
+  // Trace file path or NULL if cycles are not traced (trace.h).
+  char *traceFile;
+  /* Directory of the files with tuned settings or NULL if the settings
+  are not tuned. */
+  char *tuningDirectory;
+  /* Directory of the files with calibrated big file thresholds or NULL
+  if the threshold is not calibrated (calibration.h). */
+  char *calibrationDirectory;
+  // Least important level of logged messages, e.g. LOG_INFO.
+  int logLevel;
+  // Log file path or NULL if messages are to be written to syslog.
+  char *logFile;
+  // Size in bytes after which the log file is rotated.
+  unsigned long long logFileSize;
+  /* Settings of the synchronization: recursion, big file threshold
+  and the other options of the engine. */
+  dirsyncSettings settings;
+  /* Number of comparator threads of the pipeline or 0 if files
+  are compared and copied by the thread synchronizing directories. */
+  unsigned int comparators;
+  // Number of copy lanes of the pipeline, 1 or PIPELINELANES.
+  unsigned int lanes;
+  // Numbers of copier threads of the lanes.
+  unsigned int copiers[PIPELINELANES];
+  // Number of threads prefetching file metadata or 0 if it is not prefetched.
+  unsigned int prefetchers;
+  /* Number of threads synchronizing ranges of huge directories or 0
+  if directories are not split. */
+  unsigned int partitioners;
+  /* Configuration file path or NULL if options are only given
+  on the command line. */
+  char *configFile;
+  /* Buffers of the text of the configuration file and of its options
+  or NULL; released with free. */
+  char *configText;
+  char **configArguments;
+  // Options and arguments of the command line parsed again when reloading.
+  int argc;
+  char **argv;
+};
+
 /*
 Analyzes options and arguments passed to the program and in its parameters
   writes values ready for use.
@@ -11,18 +73,12 @@ reads:
 argc - number of program parameters (options and arguments together)
 argv - programu parameters
 writes:
-source - source directory path
-destination - target directory path
-interval - sleep time in seconds
-recursive - recursive directory synchronization (boolean)
-threshold - minimal file size to consider it big (this function stores threshold
-  in a global variable)
+params - values of the options and arguments
 returns:
 < 0 if an error occured
 0 if no error occured
 */
-int parseParameters(int argc, char **argv, char **source, char **destination,
-  unsigned int *interval, char *recursive);
+int parseParameters(int argc, char **argv, parameters *params);
 
 /*
 Handles signal SIGUSR1.
@@ -31,23 +87,43 @@ signo - number of the handled signal - always SIGUSR1
 */
 void sigusr1Handler(int signo);
 /*
+Handles signal SIGUSR2.
+reads:
+signo - number of the handled signal - always SIGUSR2
+*/
+void sigusr2Handler(int signo);
+/*
 Handles signal SIGTERM.
 reads:
 signo - number of the handled signal - always SIGTERM
 */
 void sigtermHandler(int signo);
+/*
+Handles signal SIGHUP.
+reads:
+signo - number of the handled signal - always SIGHUP
+*/
+void sighupHandler(int signo);
+
+/*
+Synchronizes the subdirectories queued with command trigger-path
+  of the control socket.
+writes:
+context - context of the synchronized directories
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int synchronizeTargets(dirsync *context);
 
 /*
 Starts a child process from the parent process. Stops the parent process.
   Transforms the child process into a daemon.
   Sleeps and synchronizes directories. Handles signals.
-reads:
-source - source directory path
-destination - target directory path
-interval - sleep time in seconds
-recursive - recursive directory synchronization (boolean)
+writes:
+params - values of the options and arguments passed to the program,
+  updated when the configuration is reloaded with signal SIGHUP
 */
-void runDaemon(char *source, char *destination, unsigned int interval,
-  char recursive);
+void runDaemon(parameters *params);
 
 #endif // DIRSYNCD_H
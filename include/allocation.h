@@ -0,0 +1,17 @@
+#ifndef ALLOCATION_H
+#define ALLOCATION_H
+
+/*
+Hook counting heap allocations, used to verify that steady-state
+  synchronization cycles do not reserve memory. It is compiled only
+  if COUNTALLOCATIONS is defined, e.g.
+  make FLAGS="-pthread -DCOUNTALLOCATIONS"
+  In that case malloc, calloc and realloc of the C library are replaced
+  with functions counting the calls of all threads.
+returns:
+number of heap allocations made by the process so far or 0 if the hook
+  is not compiled
+*/
+unsigned long long allocationCount(void);
+
+#endif // ALLOCATION_H
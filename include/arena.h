@@ -0,0 +1,65 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+Region of memory from which a synchronization cycle allocates directory
+  entries, list nodes and arrays. Memory is released in the reverse order
+  of allocation by restoring a saved position, like a stack, and is kept
+  for the next cycles instead of being returned to the heap. Therefore,
+  after the first cycles, synchronizing a tree whose shape does not grow
+  makes no heap allocations. Only the thread synchronizing directories
+  may use the arena.
+*/
+
+typedef struct arenaBlock arenaBlock;
+
+typedef struct arenaMark arenaMark;
+/*
+Position in the arena saved with arenaSave.
+*/
+struct arenaMark
+{
+  // Block containing the position.
+  arenaBlock *block;
+  // Number of bytes of the block allocated before the position.
+  size_t used;
+};
+
+/*
+Allocates memory from the arena. The memory is aligned like memory
+  returned by malloc.
+reads:
+size - number of bytes
+returns:
+NULL if an error occured
+pointer to the allocated memory otherwise
+*/
+void *arenaAllocate(size_t size);
+
+/*
+Saves the current position in the arena.
+returns:
+position to be passed to arenaRestore
+*/
+arenaMark arenaSave(void);
+
+/*
+Releases all memory allocated since a position was saved.
+reads:
+mark - position returned by arenaSave
+*/
+void arenaRestore(arenaMark mark);
+
+/*
+Releases all memory allocated from the arena but keeps it for reuse.
+*/
+void arenaReset(void);
+
+/*
+Returns the number of blocks reserved on the heap by the arena.
+*/
+unsigned long arenaBlocks(void);
+
+#endif // ARENA_H
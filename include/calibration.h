@@ -0,0 +1,74 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+/*
+Calibration of the big file threshold. Both copy functions (file.h) copy
+  scratch files of CALIBRATIONSIZES sizes, from 64 KiB growing 4 times,
+  CALIBRATIONRUNS times each in a new directory in the target directory,
+  so that the writes go to the target file system. Every copy reads
+  the scratch file from the disk and is written back to the disk.
+  The threshold is the smallest size at which copyBigFile is faster
+  and from which it is not slower by more than CALIBRATIONMARGIN percent
+  at any measured size, or no big files if there is no such size.
+  The measurements are logged and the threshold is saved to a file
+  per target device so that the daemon calibrates a device only once.
+*/
+
+// Number of measured file sizes: 64 KiB << (2 * i), up to 64 MiB.
+#define CALIBRATIONSIZES 6
+// Number of copies of every size with every function; the median is used.
+#define CALIBRATIONRUNS 5
+// Percentage by which copyBigFile may be slower at a size above the threshold.
+#define CALIBRATIONMARGIN 5
+
+/*
+Enables calibration and names the file of the device of the target
+  directory.
+reads:
+directory - directory of the files with calibrated thresholds
+targetPath - absolute target directory path
+returns:
+-1 if the calibration file path is too long
+-2 if the metadata of the target directory could not be read (errno is set)
+0 if no error occured
+*/
+int calibrationStart(const char *directory, const char *targetPath);
+
+/*
+Checks if calibration is enabled.
+returns:
+1 if calibrationStart was called successfully
+0 otherwise
+*/
+int calibrationEnabled(void);
+
+/*
+Requests calibration before the next synchronization, e.g. with the control
+  socket (control.h). May be called from any thread.
+*/
+void calibrationRequest(void);
+
+/*
+Checks if calibration was requested and clears the request.
+returns:
+1 if calibration was requested
+0 otherwise
+*/
+int calibrationRequested(void);
+
+/*
+Reads the threshold saved for the target device or, if there is none
+  or force is set, measures and saves it. Must not be called while files
+  are copied.
+reads:
+force - if not 0, the saved threshold is ignored
+writes:
+threshold - calibrated big file threshold; unchanged if -1 is returned
+returns:
+-1 if the scratch files could not be written or copied (errno is set)
+-2 if the threshold was measured but could not be saved (errno is set)
+0 if no error occured
+*/
+int calibrationThreshold(char force, unsigned long long *threshold);
+
+#endif // CALIBRATION_H
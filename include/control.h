@@ -0,0 +1,121 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <pthread.h>
+
+/*
+Creates a Unix domain control socket and starts a thread serving the commands
+  sent to it. The protocol is line-based: a client sends one command per line
+  and for every command receives a line "ok" or "error <message>", optionally
+  preceded by lines "<key>: <value>". Supported commands:
+- trigger-full - synchronize the whole source directory immediately
+- trigger-path <subdir> - synchronize only subdirectory subdir (relative
+  to the source directory) immediately
+- status - report the daemon's state and progress of the current synchronization
+- progress - report the bytes done, the rate and the estimated time left
+  of the current synchronization and of the big files being copied
+  (progress.h)
+- pause - stop starting synchronizations and suspend the current one
+- resume - undo pause
+- cancel-current-cycle - abort the current synchronization
+- calibrate - measure the big file threshold again before the next
+  synchronization, which starts immediately (calibration.h)
+reads:
+socketPath - path at which the socket is created
+mainThread - thread woken with SIGUSR1 (trigger-full) or SIGUSR2
+  (trigger-path) when a synchronization is requested
+recursive - recursive directory synchronization (boolean); trigger-path
+  is only accepted if it is set
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int controlStart(const char *socketPath, pthread_t mainThread, char recursive);
+
+/*
+Stops the control thread started with controlStart and removes the socket.
+  Does nothing if controlStart was not called successfully.
+*/
+void controlStop(void);
+
+/*
+Replaces the recursion setting given to controlStart, e.g. after
+  the configuration was reloaded.
+reads:
+recursive - recursive directory synchronization (boolean)
+*/
+void controlSetRecursive(char recursive);
+
+/*
+Checks if synchronizations are paused.
+returns:
+1 if synchronizations are paused
+0 otherwise
+*/
+int controlPaused(void);
+
+/*
+Marks the beginning of a synchronization cycle. Clears the cancellation flag
+  and the progress of the previous cycle.
+*/
+void controlBeginCycle(void);
+
+/*
+Marks the end of a synchronization cycle.
+reads:
+status - status code of the finished synchronization
+*/
+void controlEndCycle(int status);
+
+/*
+Reports the directory being currently synchronized to the status command.
+reads:
+path - directory path
+*/
+void controlEnterDirectory(const char *path);
+
+/*
+Called by the synchronization before processing every directory entry.
+  Counts processed entries and blocks while synchronizations are paused.
+returns:
+-1 if the current cycle was cancelled and the synchronization must stop
+0 if the synchronization may continue
+*/
+int controlCheckpoint(void);
+
+/*
+Cancels the current cycle like command cancel-current-cycle. May be called
+  from any thread.
+returns:
+1 if a cycle was in progress
+0 otherwise
+*/
+int controlCancel(void);
+
+/*
+Checks if the current cycle was cancelled without counting an entry
+  and without blocking.
+returns:
+1 if the current cycle was cancelled
+0 otherwise
+*/
+int controlCancelled(void);
+
+/*
+Removes the first subdirectory path queued with command trigger-path.
+writes:
+subPath - path relative to the source directory; must have room
+  for PATH_MAX bytes
+returns:
+1 if a path was written to subPath
+0 if the queue was empty
+*/
+int controlNextPath(char *subPath);
+
+/*
+Removes all subdirectory paths queued with command trigger-path because
+  a full synchronization will cover them.
+*/
+void controlDiscardPaths(void);
+
+#endif // CONTROL_H
@@ -0,0 +1,46 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <sys/types.h>
+
+/*
+Limits of concurrent copies per block device. A rotational disk seeks
+  between parallel streams and slows down, while an NVMe drive needs many
+  requests in flight to reach its throughput. The limit of a device
+  is derived from /sys/dev/block/<major>:<minor>/queue (or the queue
+  of the whole disk for a partition) when the device is first seen:
+- DEVICEROTATIONAL copies on a rotational disk,
+- a half of the request queue size, from DEVICEMINIMUM to DEVICEMAXIMUM,
+  on other disks,
+- no limit on devices without a queue (e.g. tmpfs, network file systems).
+The last slot of a device is reserved for small files so that copies
+  of big files never make the tiny copy lane (pipeline.h) wait for them.
+*/
+
+// Concurrent copies allowed on a rotational disk.
+#define DEVICEROTATIONAL 2
+// Minimal and maximal number of concurrent copies on other disks.
+#define DEVICEMINIMUM 4
+#define DEVICEMAXIMUM 64
+
+/*
+Waits until a copy may read from one device and write to another, then
+  reserves a slot on both. Slots of both devices are reserved at once
+  so copies waiting for each other's devices never deadlock.
+reads:
+source - device of the source file
+target - device of the target file
+small - if not 0, the file is smaller than LANETINYSIZE (pipeline.h) and
+  may take the last slot of a device
+*/
+void deviceAcquire(dev_t source, dev_t target, char small);
+
+/*
+Releases the slots reserved with deviceAcquire.
+reads:
+source - device of the source file
+target - device of the target file
+*/
+void deviceRelease(dev_t source, dev_t target);
+
+#endif // DEVICE_H
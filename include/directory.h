@@ -1,7 +1,9 @@
 #ifndef DIRECTORY_H
 #define DIRECTORY_H
 
+#include "filter.h"
 #include "linked_list.h"
+#include "spill.h"
 
 #include <dirent.h>
 #include <sys/stat.h>
@@ -29,42 +31,67 @@ returns:
 */
 int createEmptyDirectory(const char *path, mode_t mode);
 
+/*
+Opens a directory for reading its entries.
+reads:
+path - directory path
+returns:
+-1 if an error occured
+directory descriptor otherwise
+*/
+int openDirectory(const char *path);
+
 /*
 Recursively removes a directory.
 reads:
-path - directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+path - buffer of PATH_MAX bytes containing the directory path, absolute
+  or relative to the process' current working directory (cwd); must end
+  with '/'; bytes after the path are used to build the paths of its entries
 pathLength - path length in bytes
 returns:
 < 0 if a critical error occured
 > 0 if a non-critical error occured
 0 if no error occured
 */
-int removeDirectoryRecursively(const char *path, const size_t pathLength);
+int removeDirectoryRecursively(char *path, const size_t pathLength);
 
 /*
-Fills the list of files of directory dir.
+Fills the list of files of directory dir. The entries and list nodes
+  are allocated from the arena (arena.h). If overflow is not NULL
+  and the list exceeds its limit, all entries are written to overflow
+  as sorted runs and the list is left empty. Files excluded by the rules
+  of scope are skipped.
 reads:
-dir - directory stream opened with opendir
+dir - directory descriptor opened with openDirectory
+scope - filter rules of the directory (filter.h) or NULL
 writes:
 files - list of regular files located in dir
+overflow - spill for the entries or NULL if the list is unbounded
 returns:
 < 0 if an error occured
 0 if no error occured
 */
-int listFiles(DIR *dir, list *files);
+int listFiles(int dir, list *files, spill *overflow,
+  const filterScope *scope);
 
 /*
-Fills the lists of files and subdirectories of directory dir.
-writes:
-dir - directory stream opened with opendir
+Fills the lists of files and subdirectories of directory dir. The entries
+  and list nodes are allocated from the arena (arena.h). If overflow is not
+  NULL and the lists exceed its limit, all entries are written to overflow
+  as sorted runs and the lists are left empty. Entries excluded by the rules
+  of scope are skipped.
+reads:
+dir - directory descriptor opened with openDirectory
+scope - filter rules of the directory (filter.h) or NULL
 writes:
 files - list of regular files located in dir
 subdirs - list of subdirectories located in dir
+overflow - spill for the entries or NULL if the lists are unbounded
 returns:
 < 0 if an error occured
 0 if no error occured
 */
-int listFilesAndDirectories(DIR *dir, list *files, list *subdirs);
+int listFilesAndDirectories(int dir, list *files, list *subdirs,
+  spill *overflow, const filterScope *scope);
 
 #endif // DIRECTORY_H
@@ -0,0 +1,220 @@
+#ifndef DIRSYNC_H
+#define DIRSYNC_H
+
+/*
+Embeddable synchronization engine (libdirsync). A context holds a pair
+  of directories and the settings of their synchronization, so a program
+  can synchronize in-process, e.g. right after writing a batch of files,
+  without starting the daemon. The daemon is a client of the same functions.
+
+The settings of a context are passed down to every synchronized directory
+  and copied file, so contexts with different settings can be created,
+  reconfigured and tuned independently. Only the modules shared
+  by the process (arena, metrics, pipeline, control socket, filters) are
+  configured for the synchronizing context, when it begins after a different
+  context or after it was reconfigured, and because they count and hold one
+  cycle at a time, dirsyncBegin waits until the previous context calls
+  dirsyncEnd. Every context remembers the tree of its own source directory
+  for adaptive scanning.
+  Link with -pthread and build/libdirsync.a or build/libdirsync.so.
+*/
+
+// Events reported to the callback of a context.
+enum dirsyncEvent
+{
+  // A file was copied; bytes is its size.
+  DIRSYNC_COPIED,
+  // A target file or directory was removed.
+  DIRSYNC_DELETED,
+  // Copying or removing failed; status is the status code of the operation.
+  DIRSYNC_ERROR
+};
+
+/*
+Function called after every copy and removal. It may be called from several
+  threads at once (pipeline.h, partition.h) and must not call the engine.
+reads:
+user - pointer given to dirsyncSetCallback
+event - kind of the event
+path - target file or directory path
+bytes - number of copied bytes or 0
+status - 0 or the status code of a failed operation
+*/
+typedef void (*dirsyncCallback)(void *user, enum dirsyncEvent event,
+  const char *path, unsigned long long bytes, int status);
+
+typedef struct dirsyncSettings dirsyncSettings;
+/*
+Settings of the synchronization of a pair of directories.
+*/
+struct dirsyncSettings
+{
+  // Recursive directory synchronization (boolean).
+  char recursive;
+  /* Big file threshold. If the file size is lesser than threshold,
+  then during copying the file is considered small, otherwise big. */
+  unsigned long long threshold;
+  /* If not 0, files are copied in order from the most recently modified
+  instead of the lexicographic order. */
+  char newestFirst;
+  /* Maximal number of bytes occupied by the listings of a pair of directories
+  or 0 if unlimited. */
+  unsigned long long memoryBudget;
+  /* If not 0, files of a directory are paired with a hash table instead
+  of sorting both lists. */
+  char hashDiff;
+  // Minimal age in seconds of copied files or 0 (see option -a).
+  unsigned int minimumAge;
+  /* Minimal and maximal time in seconds between scans of a directory
+  with adaptive scanning (schedule.h) or 0 if it is disabled; only used
+  with recursive synchronization. */
+  unsigned int adaptiveInterval, maximalInterval;
+};
+
+typedef struct dirsync dirsync;
+
+/*
+Writes the default settings: non-recursive synchronization without big files,
+  in lexicographic order, with unlimited memory and sorted lists.
+writes:
+settings - settings
+*/
+void dirsyncDefaults(dirsyncSettings *settings);
+
+/*
+Creates a context for a pair of directories.
+reads:
+source - source directory path
+destination - target directory path
+settings - settings copied into the context
+returns:
+NULL if a path could not be resolved or memory could not be allocated
+  (errno is set)
+context otherwise
+*/
+dirsync *dirsyncCreate(const char *source, const char *destination,
+  const dirsyncSettings *settings);
+
+/*
+Replaces the settings of a context, e.g. after the configuration of a program
+  was reloaded. Must not be called while the context synchronizes. Threads,
+  listings and the schedule of adaptive scanning are kept.
+reads:
+settings - settings copied into the context
+writes:
+context - context
+*/
+void dirsyncReconfigure(dirsync *context, const dirsyncSettings *settings);
+
+/*
+Returns the settings of a context.
+*/
+const dirsyncSettings *dirsyncGetSettings(const dirsync *context);
+
+/*
+Replaces the big file threshold of a context, e.g. by the tuner (tuner.h).
+  Must not be called while the context synchronizes.
+reads:
+threshold - big file threshold
+writes:
+context - context
+*/
+void dirsyncSetThreshold(dirsync *context, unsigned long long threshold);
+
+/*
+Sets the function called after every copy and removal of a context.
+reads:
+callback - function or NULL to report nothing
+user - pointer passed to the function
+writes:
+context - context
+*/
+void dirsyncSetCallback(dirsync *context, dirsyncCallback callback,
+  void *user);
+
+/*
+Returns the absolute source directory path ending with '/'.
+*/
+const char *dirsyncSource(const dirsync *context);
+
+/*
+Returns the absolute target directory path ending with '/'.
+*/
+const char *dirsyncDestination(const dirsync *context);
+
+/*
+Begins a synchronization cycle of a context, waiting until no other context
+  synchronizes. Clears the cancellation of the previous cycle.
+reads:
+full - with adaptive scanning, if not 0, every directory is treated as due
+writes:
+context - context
+*/
+void dirsyncBegin(dirsync *context, char full);
+
+/*
+Synchronizes the directories of a context or one of their subdirectories.
+  The whole directories are synchronized after the entries matching
+  the priority patterns (priority.h) and, if set, with adaptive scanning.
+  Must be called between dirsyncBegin and dirsyncEnd.
+reads:
+subPath - subdirectory path relative to the source directory or NULL
+  to synchronize the whole directories
+writes:
+context - context
+returns:
+-20 if the subdirectory path is too long
+< 0 if another error occured
+0 if no error occured
+*/
+int dirsyncSynchronize(dirsync *context, const char *subPath);
+
+/*
+Ends the synchronization cycle of a context and lets other contexts begin.
+reads:
+status - status code of the cycle
+writes:
+context - context
+*/
+void dirsyncEnd(dirsync *context, int status);
+
+/*
+Synchronizes the directories of a context or one of their subdirectories
+  in a cycle of its own.
+reads:
+subPath - like in dirsyncSynchronize
+writes:
+context - context
+returns:
+the status code of dirsyncSynchronize
+*/
+int dirsyncRun(dirsync *context, const char *subPath);
+
+/*
+Cancels the cycle of a context if it is running. May be called from any
+  thread except from a signal handler.
+reads:
+context - context
+returns:
+1 if the context was synchronizing
+0 otherwise
+*/
+int dirsyncCancel(dirsync *context);
+
+/*
+Destroys a context which is not synchronizing.
+writes:
+context - context; NULL is ignored
+*/
+void dirsyncDestroy(dirsync *context);
+
+/*
+Reports an event to the callback of the synchronizing context. Called
+  by the engine.
+reads:
+event, path, bytes, status - like in dirsyncCallback
+*/
+void dirsyncNotify(enum dirsyncEvent event, const char *path,
+  unsigned long long bytes, int status);
+
+#endif // DIRSYNC_H
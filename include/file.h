@@ -1,8 +1,22 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <stddef.h>
 #include <sys/stat.h>
 
+// Default size in bytes of the buffer used to copy files.
+#define BUFFERSIZE 4096
+// Maximal size in bytes of the buffer used to copy files.
+#define BUFFERMAXIMUM (256 * 1024)
+
+/*
+Sets the size of the buffer used by the following copies. Must not be called
+  while files are copied.
+reads:
+size - size in bytes, from 1 to BUFFERMAXIMUM
+*/
+void fileSetBufferSize(size_t size);
+
 /*
 Copies a file. Reads the source file using read function and writes
   the target file using write function.
@@ -0,0 +1,128 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+
+/*
+Include/exclude rules similar to rsync's. A rule is a pattern which
+  is matched against the name of an entry or, if the pattern contains '/'
+  other than at its end, against the entry path relative to the directory
+  in which the rule applies (the source directory for global rules).
+  A pattern ending with '/' only matches directories. The first matching
+  rule decides: an entry matching an exclude rule is neither listed
+  in the source nor in the target directory, so excluded subdirectories
+  are never opened and excluded target entries are never deleted.
+  Rules of per-directory ignore files are checked before the rules
+  of ignore files of parent directories, which are checked before global
+  rules given with filterAdd and filterLoad.
+*/
+
+typedef struct filterRule filterRule;
+
+typedef struct filterScope filterScope;
+/*
+Rules applying in a directory during its listing.
+*/
+struct filterScope
+{
+  // Scope of the parent directory or NULL for the source directory.
+  const filterScope *parent;
+  // Rules of the ignore file of the directory.
+  const filterRule *rules;
+  // Number of rules.
+  unsigned int count;
+  /* Directory path relative to the source directory, ending with '/'
+  unless empty; only valid while the directory is listed. */
+  const char *path;
+  // Length in bytes of path.
+  size_t length;
+};
+
+/*
+Adds a global rule.
+reads:
+pattern - rule pattern; must not be empty
+include - if not 0, matching entries are included, otherwise excluded
+returns:
+-1 if memory could not be reserved
+-2 if the pattern is invalid
+0 if no error occured
+*/
+int filterAdd(const char *pattern, char include);
+
+/*
+Adds global rules read from a file. Every line is a rule: '+ <pattern>'
+  includes, '- <pattern>' or '<pattern>' excludes; empty lines and lines
+  starting with '#' are ignored.
+reads:
+path - path of the file
+returns:
+-1 if the file could not be read
+-2 if a rule could not be added
+0 if no error occured
+*/
+int filterLoad(const char *path);
+
+/*
+Sets the name of per-directory ignore files, e.g. '.dirsyncignore'. Rules
+  of such a file in a source directory apply to the directory
+  and its subdirectories.
+reads:
+name - file name
+*/
+void filterSetIgnoreFile(const char *name);
+
+/*
+Sets the length of the source directory path so that paths of entries
+  relative to it can be found.
+reads:
+rootLength - length in bytes of the absolute source directory path
+  ending with '/'
+*/
+void filterConfigure(size_t rootLength);
+
+/*
+Prepares the rules applying in a source directory. Reads the ignore file
+  of the directory and, if parent is NULL and the directory is not
+  the source directory itself, of all its parent directories. The rules are
+  allocated from the arena (arena.h).
+reads:
+sourcePath - absolute directory path ending with '/'
+sourcePathLength - length in bytes of sourcePath
+parent - scope of the parent directory or NULL
+writes:
+scope - scope of the directory
+returns:
+< 0 if an ignore file could not be read
+0 if no error occured
+*/
+int filterEnter(const char *sourcePath, size_t sourcePathLength,
+  const filterScope *parent, filterScope *scope);
+
+/*
+Checks if an entry of a directory is excluded.
+reads:
+scope - scope of the directory
+name - entry name
+directory - if not 0, the entry is a directory
+returns:
+1 if the entry is excluded
+0 otherwise
+*/
+int filterExcluded(const filterScope *scope, const char *name,
+  char directory);
+
+/*
+Checks with global rules if an entry or any of its parent directories
+  is excluded.
+reads:
+relativePath - entry path relative to the source directory; a directory
+  path may end with '/'
+directory - if not 0, the entry is a directory
+returns:
+1 if the entry is excluded
+0 otherwise
+*/
+int filterPathExcluded(const char *relativePath, char directory);
+
+#endif // FILTER_H
@@ -0,0 +1,26 @@
+#ifndef HASH_JOIN_H
+#define HASH_JOIN_H
+
+#include "linked_list.h"
+
+/*
+Pairs the entries of two lists by name in O(n) time using an open-addressing
+  hash table of the names of the second list, as an alternative to sorting
+  both lists with listMergeSort. The nodes are relinked so that the lists
+  can be compared like sorted lists (e.g. by updateDestinationFiles):
+- first, entries present in both lists, in the same order in both
+  (the order of the first list),
+- then the other entries; no name of the rest of the first list equals
+  any name of the rest of the second list, so comparing them never finds
+  a pair.
+The table is allocated from the arena (arena.h).
+writes:
+first - list of source entries
+second - list of target entries
+returns:
+-1 if memory could not be allocated (the lists are unchanged)
+0 if no error occured
+*/
+int hashJoin(list *first, list *second);
+
+#endif // HASH_JOIN_H
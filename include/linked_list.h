@@ -48,7 +48,8 @@ l - empty singly linked list intended for the first use
 void initialize(list *l);
 
 /*
-Adds a directory entry at the end of the list.
+Adds a directory entry at the end of the list. The node is allocated
+  from the arena (arena.h).
 reads:
 newEntry - directory entry to be added at the end of the list
 writes:
@@ -57,7 +58,9 @@ l - singly linked list with added node containing directory entry newEntry
 int pushBack(list *l, struct dirent *newEntry);
 
 /*
-Clears the singly linked list.
+Clears the singly linked list. The nodes are not released; they are
+  released by restoring the arena to a position saved before
+  the list was filled.
 writes:
 l - empty singly linked list intended for reuse
 */
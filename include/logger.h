@@ -0,0 +1,58 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/*
+Log levels are the ones of syslog: LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG.
+  Details of operations on single files are logged at LOG_DEBUG, summaries
+  of synchronizations at LOG_INFO and failed operations at LOG_WARNING.
+*/
+#include <syslog.h>
+
+/*
+Starts a thread which writes the logged messages in batches. Until it is
+  started, messages are written synchronously to syslog.
+reads:
+logFile - path of the file to which messages are written or NULL
+  if they are to be written to syslog
+maxFileSize - size in bytes after which the file is rotated: renamed
+  to '<logFile>.1' (the previous '.1' to '.2', etc.) and created anew
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int loggerStart(const char *logFile, unsigned long long maxFileSize);
+
+/*
+Writes all queued messages and stops the thread started with loggerStart.
+*/
+void loggerStop(void);
+
+/*
+Sets the least important level of the messages which are logged.
+reads:
+level - log level, e.g. LOG_INFO
+*/
+void loggerSetLevel(int level);
+
+/*
+Parses a log level name.
+reads:
+name - 'error', 'warning', 'info' or 'debug'
+returns:
+-1 if the name is invalid
+log level otherwise
+*/
+int loggerParseLevel(const char *name);
+
+/*
+Queues a message for writing without waiting for the write. Can be called
+  from any thread. If the queue is full, the message is dropped and counted.
+reads:
+level - message level; the message is ignored if it is less important than
+  the level set with loggerSetLevel
+format - printf format of the message
+*/
+void logMessage(int level, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+#endif // LOGGER_H
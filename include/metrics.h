@@ -0,0 +1,191 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+Counters collected for every synchronization cycle and accumulated over
+  all cycles.
+*/
+enum metricsCounter
+{
+  // Number of directories whose entries were listed.
+  METRIC_DIRS_SCANNED,
+  // Number of files whose metadata was read.
+  METRIC_FILES_STATED,
+  // Number of files copied successfully.
+  METRIC_FILES_COPIED,
+  // Number of bytes of files copied successfully.
+  METRIC_BYTES_COPIED,
+  // Number of files and directories removed successfully.
+  METRIC_DELETES,
+  // Number of operations which failed.
+  METRIC_ERRORS,
+  /* Number of files not copied or copied again later because they were
+  modified recently or while they were copied. */
+  METRIC_FILES_DEFERRED,
+  // Number of counters, not a counter.
+  METRIC_COUNTERS
+};
+
+/*
+Latency histograms accumulated over all cycles.
+*/
+enum metricsHistogram
+{
+  // Reading metadata of a single file.
+  HISTOGRAM_STAT,
+  // Copying a single file.
+  HISTOGRAM_COPY,
+  // Listing the entries of a source directory and its target equivalent.
+  HISTOGRAM_SCAN,
+  /* Replication lag: time from the modification of a source file
+  to the end of its copy. */
+  HISTOGRAM_LAG,
+  // Number of histograms, not a histogram.
+  METRIC_HISTOGRAMS
+};
+
+/*
+Phases of a synchronization cycle whose wall time is measured.
+*/
+enum metricsPhase
+{
+  // Listing directory entries.
+  PHASE_SCAN,
+  // Sorting the lists of entries.
+  PHASE_SORT,
+  // Comparing and updating files.
+  PHASE_FILES,
+  // Comparing and updating subdirectories.
+  PHASE_DIRECTORIES,
+  // Number of phases, not a phase.
+  METRIC_PHASES
+};
+
+/*
+Stages of the pipelined engine (pipeline.h) whose utilisation is measured.
+*/
+enum metricsStage
+{
+  // Listing and merging directories.
+  STAGE_SCANNER,
+  // Reading and comparing file metadata.
+  STAGE_COMPARATOR,
+  // Copying file contents.
+  STAGE_COPIER,
+  // Number of stages, not a stage.
+  METRIC_STAGES
+};
+
+/*
+Reads the monotonic clock.
+returns:
+current time in nanoseconds counted from an unspecified point
+*/
+unsigned long long metricsNow(void);
+
+/*
+Increases a counter of the current cycle. May be called from any thread.
+reads:
+counter - increased counter
+value - number added to the counter
+*/
+void metricsAdd(enum metricsCounter counter, unsigned long long value);
+
+/*
+Reads a counter of the current cycle. May be called from any thread.
+reads:
+counter - read counter
+returns:
+value of the counter
+*/
+unsigned long long metricsGet(enum metricsCounter counter);
+
+/*
+Records a latency in a histogram. May be called from any thread.
+reads:
+histogram - histogram in which the latency is recorded
+nanoseconds - latency in nanoseconds
+*/
+void metricsObserve(enum metricsHistogram histogram,
+  unsigned long long nanoseconds);
+
+/*
+Records the staleness of a target file, i.e. how long ago its source file
+  was modified, when it is copied or left outdated (deferred or failed).
+  Keeps the maximum of the current cycle. May be called from any thread.
+reads:
+nanoseconds - staleness in nanoseconds
+*/
+void metricsStaleness(unsigned long long nanoseconds);
+
+/*
+Returns the maximal staleness recorded in the current cycle.
+returns:
+staleness in nanoseconds
+*/
+unsigned long long metricsMaxStaleness(void);
+
+/*
+Adds wall time spent in a phase of the current cycle. May be called
+  from any thread.
+reads:
+phase - phase in which the time was spent
+nanoseconds - time in nanoseconds
+*/
+void metricsPhase(enum metricsPhase phase, unsigned long long nanoseconds);
+
+/*
+Sets the number of threads of a stage. Stage utilisation is only written
+  if the comparator stage has threads.
+reads:
+stage - stage of the pipelined engine
+threads - number of threads of the stage
+*/
+void metricsStageThreads(enum metricsStage stage, unsigned int threads);
+
+/*
+Adds time during which a thread of a stage was busy. May be called from
+  any thread.
+reads:
+stage - stage of the pipelined engine
+nanoseconds - time in nanoseconds
+*/
+void metricsStageBusy(enum metricsStage stage, unsigned long long nanoseconds);
+
+/*
+Returns the utilisation of a stage during the last finished cycle.
+reads:
+stage - stage of the pipelined engine
+returns:
+busy time of all threads of the stage divided by the number of threads
+  and the duration of the cycle, from 0 to 1
+*/
+double metricsStageUtilisation(enum metricsStage stage);
+
+/*
+Marks the beginning of a synchronization cycle. Zeroes the counters
+  and phase times of the current cycle.
+*/
+void metricsBeginCycle(void);
+
+/*
+Marks the end of a synchronization cycle. Adds the counters and phase times
+  of the current cycle to the cumulative ones.
+reads:
+status - status code of the finished synchronization
+*/
+void metricsEndCycle(int status);
+
+/*
+Writes all metrics in Prometheus text exposition format. The file is replaced
+  atomically so a collector never reads a partially written one.
+reads:
+path - path of the file, e.g. in the textfile collector directory
+  of node_exporter
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int metricsWrite(const char *path);
+
+#endif // METRICS_H
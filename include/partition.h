@@ -0,0 +1,61 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+/*
+Pool of threads executing the parts of a task in parallel. It is used
+  to compare and copy the files of a single huge directory: its sorted
+  source and target lists are split into ranges of names and every range
+  is synchronized by a different thread. The thread which runs a task also
+  executes its parts so that it does not wait idle.
+*/
+
+// Maximal number of partitioning threads.
+#define PARTITIONTHREADS 32
+/* Minimal number of source and target files of a directory pair split
+into ranges; smaller directories are not worth waking the threads. */
+#define PARTITIONFILES 4096
+
+/*
+Function executing a part of a task.
+reads:
+argument - argument given to partitionRun
+part - index of the part, from 0 to the number of parts - 1
+*/
+typedef void (*partitionTask)(void *argument, unsigned int part);
+
+/*
+Starts the partitioning threads. The threads block all signals.
+reads:
+count - number of threads, from 1 to PARTITIONTHREADS
+returns:
+-1 if the number of threads is invalid
+-2 if a thread could not be started
+0 if no error occured
+*/
+int partitionStart(unsigned int count);
+
+/*
+Stops the partitioning threads. Does nothing if they were not started.
+*/
+void partitionStop(void);
+
+/*
+Returns the number of running partitioning threads.
+returns:
+0 if the threads were not started
+number of threads otherwise
+*/
+unsigned int partitionThreads(void);
+
+/*
+Executes all parts of a task in the partitioning threads and the calling
+  thread and returns after all of them finished. Only the thread
+  synchronizing directories may call it.
+reads:
+task - function executing a part
+argument - argument of the function
+parts - number of parts
+*/
+void partitionRun(partitionTask task, void *argument, unsigned int parts);
+
+#endif // PARTITION_H
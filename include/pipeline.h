@@ -0,0 +1,160 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "dirsync.h"
+#include "schedule.h"
+
+#include <limits.h>
+#include <sys/stat.h>
+
+/*
+Three-stage engine synchronizing files. The scanner (the thread walking
+  the directory tree) lists and merges directories and produces actions,
+  comparator threads read metadata and decide whether a file has to be
+  copied, and copier threads copy file contents. The stages are connected
+  by bounded lock-free queues. Actions are taken from a fixed pool so
+  the scanner waits when the later stages fall behind (back-pressure)
+  and no memory is reserved during a cycle.
+The copier stage can be split into lanes of size classes, each with its own
+  threads and byte budget, so that small files are not queued behind huge
+  ones. When the actions of a lane exceed its budget, the comparator
+  submitting a further action of the lane waits until the copiers
+  of the lane free enough bytes.
+*/
+
+// Maximal number of threads of a stage.
+#define PIPELINETHREADS 32
+// Number of copy lanes when size classes are used.
+#define PIPELINELANES 3
+// Files smaller than this size in bytes are copied in the tiny lane.
+#define LANETINYSIZE (64 * 1024)
+// Files at least this big in bytes are copied in the huge lane.
+#define LANEHUGESIZE (64 * 1024 * 1024)
+
+typedef struct action action;
+/*
+File handled by the comparator and copier stages.
+*/
+struct action
+{
+  // If not 0, the file exists in the target directory.
+  char existing;
+  // Source file metadata, read by the comparator stage.
+  struct stat metadata;
+  /* Device of the target file, found by the scanner for a new file
+  and by the comparator stage otherwise. */
+  dev_t targetDevice;
+  // Source file path.
+  char source[PATH_MAX];
+  // Target file path.
+  char destination[PATH_MAX];
+  // Next action in the queue of a copy lane.
+  action *next;
+  /* Node of the directory of the file with adaptive scanning (schedule.h)
+  or NULL. */
+  scanNode *node;
+  // Set by the handlers if the file was copied or deferred.
+  char changed;
+  // Settings of the context which submitted the action.
+  const dirsyncSettings *settings;
+};
+
+/*
+Function executing an action in the comparator or copier stage.
+reads:
+a - action
+returns:
+< 0 if an error occured
+0 if the action is finished
+> 0 if the action is passed to the copier stage (only from the comparator
+  stage)
+*/
+typedef int (*actionHandler)(action *a);
+
+/*
+Starts the comparator and copier threads. The threads block all signals
+  so that signals are handled by the thread synchronizing directories.
+reads:
+comparators - number of comparator threads, from 1 to PIPELINETHREADS
+lanes - 1 to copy all files in one lane or PIPELINELANES to copy files
+  smaller than LANETINYSIZE, smaller than LANEHUGESIZE and the other ones
+  in separate lanes
+copiers - numbers of copier threads of the lanes, each from 1
+  to PIPELINETHREADS
+compare - handler of the comparator stage
+copy - handler of the copier stage
+returns:
+-1 if the numbers of threads are invalid
+-2 if memory could not be reserved
+-3 if a thread could not be started
+0 if no error occured
+*/
+int pipelineStart(unsigned int comparators, unsigned int lanes,
+  const unsigned int *copiers, actionHandler compare, actionHandler copy);
+
+/*
+Finishes the queued actions and stops the threads. Does nothing if
+  the pipeline was not started.
+*/
+void pipelineStop(void);
+
+/*
+Limits the number of threads of every copy lane which copy files at the same
+  time. The other threads wait.
+reads:
+copiers - maximal number of copying threads of a lane, at least 1
+*/
+void pipelineSetCopiers(unsigned int copiers);
+
+/*
+Returns the number of copier threads of the biggest copy lane.
+returns:
+0 if the pipeline is not running
+number of threads otherwise
+*/
+unsigned int pipelineCopiers(void);
+
+/*
+Checks if the pipeline was started.
+returns:
+1 if the pipeline is running
+0 otherwise
+*/
+int pipelineEnabled(void);
+
+/*
+Takes a free action from the pool, waiting until the later stages finish
+  one if all are in flight. Only the scanner thread may call it.
+returns:
+action to be filled and passed to pipelineSubmit
+*/
+action *pipelineAcquire(void);
+
+/*
+Passes an action to the comparator stage.
+reads:
+a - action taken with pipelineAcquire
+*/
+void pipelineSubmit(action *a);
+
+/*
+Waits until all submitted actions are finished. Only the scanner thread
+  may call it.
+returns:
+number of actions which failed since the previous call
+*/
+unsigned int pipelineDrain(void);
+
+/*
+Marks the beginning of a synchronization cycle so that the time during
+  which the scanner waits for the later stages is not counted as busy.
+*/
+void pipelineBeginCycle(void);
+
+/*
+Marks the end of a synchronization cycle. Records the busy time
+  of the scanner in the metrics.
+*/
+void pipelineEndCycle(void);
+
+#endif // PIPELINE_H
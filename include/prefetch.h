@@ -0,0 +1,88 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "linked_list.h"
+
+#include <sys/stat.h>
+
+/*
+Prefetcher of file metadata. While the thread synchronizing directories
+  compares the files of a directory one by one, a pool of threads reads
+  the metadata of the following files of both directories with statx,
+  requesting only the fields used for the comparison and copying. On network
+  file systems and cold caches, the round trips of the files overlap instead
+  of being waited for one after another. If the comparison reaches a file
+  whose metadata was not read yet, it reads it itself instead of waiting.
+*/
+
+// Maximal number of prefetching threads.
+#define PREFETCHTHREADS 32
+
+// Sides of a prefetch: the source and the target directory.
+enum prefetchSide
+{
+  PREFETCH_SOURCE,
+  PREFETCH_TARGET,
+  PREFETCH_SIDES
+};
+
+typedef struct prefetch prefetch;
+
+/*
+Starts the prefetching threads. The threads block all signals.
+reads:
+count - number of threads, from 1 to PREFETCHTHREADS
+returns:
+-1 if the number of threads is invalid
+-2 if a thread could not be started
+0 if no error occured
+*/
+int prefetchStart(unsigned int count);
+
+/*
+Stops the prefetching threads. Does nothing if they were not started.
+*/
+void prefetchStop(void);
+
+/*
+Starts prefetching the metadata of the files of a source and a target
+  directory in the order of their lists. The prefetch is allocated from
+  the arena (arena.h) and must be finished with prefetchEnd before
+  the lists are modified. Only the thread synchronizing directories
+  may call it.
+reads:
+sourcePath - source directory path
+source - list of source files
+targetPath - target directory path
+target - list of target files
+returns:
+NULL if the threads are not running or an error occured
+prefetch otherwise
+*/
+prefetch *prefetchBegin(const char *sourcePath, const list *source,
+  const char *targetPath, const list *target);
+
+/*
+Returns the metadata of a file, reading it if it was not prefetched yet.
+reads:
+p - prefetch
+which - PREFETCH_SOURCE or PREFETCH_TARGET
+index - position of the file in its list
+writes:
+buf - file metadata; only the type, permissions, size, device, i-node
+  and access and modification times are filled
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+int prefetchGet(prefetch *p, enum prefetchSide which, unsigned int index,
+  struct stat *buf);
+
+/*
+Waits until no thread reads metadata for a prefetch anymore.
+writes:
+p - prefetch
+*/
+void prefetchEnd(prefetch *p);
+
+#endif // PREFETCH_H
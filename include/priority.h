@@ -0,0 +1,51 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include "dirsync.h"
+
+#include <stddef.h>
+
+/*
+Adds a priority pattern. Files and subdirectories matching any priority
+  pattern are synchronized before all other entries in every cycle.
+reads:
+pattern - glob(7) pattern relative to the source directory,
+  e.g. 'zz-config' or 'data/?*.db'; must not be absolute nor contain '..'
+returns:
+-1 if too many patterns were added
+-2 if the pattern is invalid
+0 if no error occured
+*/
+int priorityAdd(const char *pattern);
+
+/*
+Returns the number of added priority patterns.
+*/
+unsigned int priorityCount(void);
+
+/*
+Synchronizes the regular files and, if setting recursive is not 0,
+  the subdirectories matching the priority patterns. Matching files are
+  synchronized first, in order from the most recently modified if setting
+  newestFirst is not 0, then matching subdirectories are synchronized
+  recursively.
+  Entries whose target parent directory does not exist yet are skipped
+  because they are created by the synchronization of the whole directory.
+reads:
+settings - settings of the synchronizing context (dirsync.h); without
+  recursive synchronization, only files located directly in the source
+  directory are synchronized
+sourcePath - source directory path; must end with '/'
+sourcePathLength - length in bytes of sourcePath
+destinationPath - target directory path; must end with '/'
+destinationPathLength - length in bytes of destinationPath
+returns:
+< 0 if an error occured which prevents from synchronizing all entries
+> 0 if an error occured which prevents from synchronizing an entry
+0 if no error occured
+*/
+int synchronizePriority(const dirsyncSettings *settings,
+  const char *sourcePath, const size_t sourcePathLength,
+  const char *destinationPath, const size_t destinationPathLength);
+
+#endif // PRIORITY_H
@@ -0,0 +1,41 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+USDT static tracepoints of provider dirsyncd, e.g. for bpftrace:
+  bpftrace -e 'usdt:./build/DirSyncD:dirsyncd:copy_end
+    { @ns = hist(arg3); }'
+  A probe is a single NOP instruction with its arguments described
+  in an ELF note (readelf -n build/DirSyncD), so it costs nothing until
+  a tracer attaches to it. Probes:
+- cycle_start(full) - a cycle begins; full is 1 if all directories are due
+- cycle_end(status, files, bytes) - a cycle ends with its status code,
+  copied files and bytes
+- scan_start(source, target) - listing a pair of directories begins
+- scan_end(source, status, ns) - listing ends with its status code
+  and latency in nanoseconds
+- stat(path, status, ns) - metadata of a file was read; the prefetching
+  threads (prefetch.h) pass only the file name
+- copy_start(source, target, size, method) - a copy begins; method
+  is "small" (read and write) or "big" (mmap and write)
+- copy_end(source, size, status, ns) - a copy ends
+- delete(path, status, ns) - a file or a directory was removed
+The probes are compiled only if sys/sdt.h (systemtap-sdt-dev
+  or systemtap-sdt-devel) is installed and NOPROBES is not defined,
+  e.g. make FLAGS="-pthread -DNOPROBES"; otherwise the arguments are not
+  even evaluated.
+*/
+
+#if !defined(NOPROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+// Fires probe name of provider dirsyncd with up to 12 arguments.
+#define PROBE(...) STAP_PROBEV(dirsyncd, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef PROBE
+#define PROBE(...) do { } while (0)
+#endif
+
+#endif // PROBES_H
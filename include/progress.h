@@ -0,0 +1,101 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stddef.h>
+#include <limits.h>
+
+/*
+Progress of the current synchronization cycle and of the files being copied:
+  bytes done and known, the current rate and the estimated time left.
+  The copy loops (file.h) advance the counters of the copying thread
+  so that a slow copy of a huge file can be told from a hung one.
+  The bytes known to the cycle are the bytes of the copied files
+  and of the files queued in the pipeline (pipeline.h), so the estimate grows
+  while directories are still being scanned.
+The summary is written to a status file by a thread of its own every
+  PROGRESSINTERVAL seconds and returned by command progress of the control
+  socket (control.h).
+*/
+
+// Maximal number of files whose progress is reported at the same time.
+#define PROGRESSFILES 32
+// Minimal size in bytes of a file whose progress is reported separately.
+#define PROGRESSSIZE (1024 * 1024)
+// Time in seconds between rewrites of the status file.
+#define PROGRESSINTERVAL 1
+// Size in bytes of a buffer fitting the summary of all reported files.
+#define PROGRESSLENGTH (PROGRESSFILES * (PATH_MAX + 128) + 512)
+
+/*
+Starts the thread rewriting the status file. The file is written next
+  to its path with suffix '.tmp' and renamed so that readers never see
+  a partial file.
+reads:
+path - status file path, e.g. /run/dirsyncd/status
+returns:
+-1 if the path is too long
+-2 if the thread could not be started
+0 if no error occured
+*/
+int progressStart(const char *path);
+
+/*
+Stops the thread started with progressStart and removes the status file.
+  Does nothing if progressStart was not called successfully.
+*/
+void progressStop(void);
+
+/*
+Marks the beginning of a synchronization cycle. Clears the progress
+  of the previous cycle.
+*/
+void progressBeginCycle(void);
+
+/*
+Marks the end of a synchronization cycle. The summary keeps reporting
+  the finished cycle until the next one begins.
+*/
+void progressEndCycle(void);
+
+/*
+Changes the number of bytes of the files waiting for a copier thread.
+reads:
+bytes - number of bytes added (> 0) or removed (< 0)
+*/
+void progressQueue(long long bytes);
+
+/*
+Marks the beginning of a copy in the calling thread.
+reads:
+path - source file path
+size - size in bytes of the file
+*/
+void progressBeginFile(const char *path, unsigned long long size);
+
+/*
+Counts bytes written by the copy of the calling thread. Does nothing
+  outside progressBeginFile and progressEndFile.
+reads:
+bytes - number of written bytes
+*/
+void progressAdvance(unsigned long long bytes);
+
+/*
+Marks the end of the copy of the calling thread. The bytes which were not
+  written, e.g. because the copy failed, are no longer expected.
+*/
+void progressEndFile(void);
+
+/*
+Writes the summary of the progress as lines "<key>: <value>". Lines which
+  do not fit into the buffer are left out.
+writes:
+buffer - text of the summary ending with '\0'
+reads:
+size - size in bytes of the buffer, at least PROGRESSLENGTH to fit all lines
+returns:
+length in bytes of the summary
+*/
+size_t progressFormat(char *buffer, size_t size);
+
+#endif // PROGRESS_H
@@ -0,0 +1,150 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "linked_list.h"
+
+#include <time.h>
+
+typedef struct scanNode scanNode;
+/*
+Node of the tree mirroring the source directory tree, remembered between
+  synchronization cycles. Stores when the directory has to be scanned next.
+*/
+struct scanNode
+{
+  // Subdirectory name or NULL for the source directory.
+  char *name;
+  // First subdirectory node in lexicographic order by name.
+  scanNode *children;
+  // Next node with the same parent in lexicographic order by name.
+  scanNode *next;
+  // Time in seconds between scans of the directory.
+  unsigned int interval;
+  // Time at which the directory has to be scanned next.
+  time_t due;
+  // Minimum of due of the directory and all its descendants.
+  time_t subtreeDue;
+  /* Number of holders of the directory (scheduleOpen) and changes counted
+  by them; changed atomically. */
+  unsigned int holders;
+  unsigned long long changes;
+};
+
+/*
+Enables adaptive scanning. A directory in which changes were found is scanned
+  again after minInterval seconds. Each scan without changes doubles
+  the interval up to maxInterval.
+reads:
+minInterval - minimal time in seconds between scans of a directory
+maxInterval - maximal time in seconds between scans of a directory
+*/
+void scheduleConfigure(unsigned int minInterval, unsigned int maxInterval);
+
+/*
+Starts a synchronization cycle.
+reads:
+full - if not 0, every directory is treated as due
+*/
+void scheduleBeginCycle(char full);
+
+/*
+Creates the node of a source directory, which is due immediately.
+returns:
+NULL if an error occured
+node of the source directory otherwise
+*/
+scanNode *scheduleCreateRoot(void);
+
+/*
+Releases the tree of a source directory created with scheduleCreateRoot.
+writes:
+root - node of the source directory; NULL is ignored
+*/
+void scheduleDestroy(scanNode *root);
+
+/*
+Checks if a directory has to be scanned in the current cycle.
+reads:
+node - node of the directory
+returns:
+1 if the directory is due
+0 otherwise
+*/
+int scheduleDue(const scanNode *node);
+
+/*
+Checks if any directory in a subtree has to be scanned in the current cycle.
+reads:
+node - node of the subtree's root directory
+returns:
+1 if any directory of the subtree is due
+0 otherwise
+*/
+int scheduleSubtreeDue(const scanNode *node);
+
+/*
+Records the result of scanning a directory and computes when it is due next.
+reads:
+changes - number of changes made in the directory during the scan
+writes:
+node - node of the scanned directory
+*/
+void scheduleRecord(scanNode *node, unsigned long long changes);
+
+/*
+Starts counting the changes of a directory whose files are compared
+  and copied by the pipeline (pipeline.h) after the scanner leaves
+  the directory. The scanner holds the directory until it releases it.
+writes:
+node - node of the directory
+*/
+void scheduleOpen(scanNode *node);
+
+/*
+Holds a directory for an action of the pipeline handling one of its files.
+writes:
+node - node of the directory
+*/
+void scheduleHold(scanNode *node);
+
+/*
+Releases a directory held by the scanner or by an action and counts
+  the changes made by the holder. The last release records the result
+  of the scan (scheduleRecord). May be called from any thread.
+reads:
+changes - number of changes made by the holder
+writes:
+node - node of the directory
+*/
+void scheduleRelease(scanNode *node, unsigned long long changes);
+
+/*
+Makes a directory due in the next cycle, e.g. because a cached subdirectory
+  could not be opened.
+writes:
+node - node of the directory
+*/
+void scheduleInvalidate(scanNode *node);
+
+/*
+Replaces the children of a node with nodes of the given subdirectories,
+  reusing the nodes of subdirectories which existed before and removing
+  the nodes of subdirectories which do not exist anymore.
+reads:
+subdirs - sorted list of subdirectories of the directory
+writes:
+node - node of the directory
+returns:
+< 0 if an error occured (the node has fewer children than subdirs)
+0 if no error occured
+*/
+int scheduleSetChildren(scanNode *node, list *subdirs);
+
+/*
+Recomputes subtreeDue of a node from its own due and its children.
+writes:
+node - node of the directory
+*/
+void scheduleUpdate(scanNode *node);
+
+#endif // SCHEDULE_H
@@ -0,0 +1,148 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "linked_list.h"
+
+#include <sys/types.h>
+
+/*
+External sorting of directory listings which do not fit into the memory
+  budget (setting memoryBudget, dirsync.h). When the lists of a directory
+  grow over the half of the budget (the other half is for the other
+  directory of the pair), they are sorted and written as a run
+  to a temporary file and the memory is reused. The runs are then read
+  through a k-way merge so that peak memory does not depend
+  on the number of entries.
+*/
+
+typedef struct spill spill;
+/*
+Sorted runs of the entries of one directory.
+*/
+struct spill
+{
+  // Descriptor of the temporary file or -1 if nothing was spilled.
+  int file;
+  // Size of the temporary file in bytes.
+  off_t size;
+  /* Offsets of the runs in the file; run i consists of bytes
+  from offsets[i] to offsets[i + 1]. */
+  off_t *offsets;
+  // Number of runs and number of offsets fitting in the array.
+  unsigned int runs, capacity;
+  /* Number of bytes which the lists of the directory may occupy before
+  they are spilled or 0 if they are never spilled. */
+  size_t limit;
+};
+
+/*
+Initializes a spill with no runs and the limit derived from the memory
+  budget.
+reads:
+memoryBudget - maximal number of bytes occupied by the listings of a pair
+  of directories or 0 if unlimited
+writes:
+s - spill intended for the first use
+*/
+void spillInitialize(spill *s, unsigned long long memoryBudget);
+
+/*
+Sorts the lists and writes their entries as one run, creating
+  the temporary file on first use. The lists are not cleared.
+reads:
+files - list of files
+subdirs - list of subdirectories or NULL
+writes:
+s - spill with an added run
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int spillWrite(spill *s, list *files, list *subdirs);
+
+/*
+Adds to the list the spilled entries of the given type, in lexicographic
+  order. The entries and list nodes are allocated from the arena (arena.h).
+reads:
+type - d_type of the entries, e.g. DT_DIR
+writes:
+s - spill whose runs may be merged into fewer runs
+l - list to which the entries are added
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int spillCollect(spill *s, unsigned char type, list *l);
+
+/*
+Closes the temporary file and releases the memory of the spill.
+writes:
+s - spill with no runs
+*/
+void spillClose(spill *s);
+
+typedef struct merge merge;
+
+typedef struct cursor cursor;
+/*
+Position in a sorted sequence of entries which is either a list
+  or the merged runs of a spill.
+*/
+struct cursor
+{
+  // Current list node if the entries are in a list.
+  element *element;
+  // Merge of the runs if the entries were spilled.
+  merge *merge;
+  // Type of the entries read from the runs.
+  unsigned char type;
+  /* Name of the current entry or NULL after the last one. If the entries
+  were spilled, the name is only valid until the cursor is moved. */
+  const char *name;
+  // Position of the current entry.
+  unsigned int index;
+};
+
+/*
+Opens a cursor at the first entry.
+reads:
+l - sorted list of entries used if nothing was spilled
+type - d_type of the entries read from the runs, e.g. DT_REG
+writes:
+s - spill whose runs may be merged into fewer runs
+c - cursor
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int cursorOpen(cursor *c, list *l, spill *s, unsigned char type);
+
+/*
+Moves a cursor to the next entry.
+writes:
+c - cursor
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int cursorNext(cursor *c);
+
+/*
+Checks if the name of the current entry stays valid after the cursor
+  is moved.
+reads:
+c - cursor
+returns:
+1 if the name is stable
+0 otherwise
+*/
+int cursorStable(const cursor *c);
+
+/*
+Closes a cursor.
+writes:
+c - cursor
+*/
+void cursorClose(cursor *c);
+
+#endif // SPILL_H
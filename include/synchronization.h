@@ -1,42 +1,102 @@
 #ifndef SYNCHRONIZATION_H
 #define SYNCHRONIZATION_H
 
+#include "dirsync.h"
 #include "linked_list.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "schedule.h"
+#include "spill.h"
 
 #include <stddef.h>
 
+/*
+Synchronizes a single regular file: copies it if it does not exist
+  in the target directory or has other modification time, otherwise copies
+  its permissions if they differ.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+srcFilePath - source file path
+dstFilePath - target file path; its parent directory must exist
+returns:
+< 0 if an error occured which prevents from comparing the files
+> 0 if an error occured which prevents from editing the target file
+0 if no error occured
+*/
+int synchronizeFile(const dirsyncSettings *settings,
+  const char *srcFilePath, const char *dstFilePath);
+
+/*
+Handler of the comparator stage of the pipeline (pipeline.h). Reads
+  the metadata of the source file and, if it exists, of the target file.
+  Copies permissions if only they differ.
+reads:
+a - action with the file paths
+writes:
+a - action with the source file metadata
+returns:
+< 0 if an error occured
+0 if the target file is up to date
+1 if the file has to be copied
+*/
+int compareAction(action *a);
+
+/*
+Handler of the copier stage of the pipeline (pipeline.h). Copies the source
+  file to the target file.
+reads:
+a - action filled by compareAction
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int copyAction(action *a);
+
 /*
 Detects differences and updates files in the target directory. If an inode
   (index node, a physical file in mass storage) has more than 1 name (hard link)
   in the source directory, then we copy every hard link as a separate file.
 reads:
-srcDirPath - source directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+settings - settings of the synchronizing context (dirsync.h)
+srcDirPath - buffer of PATH_MAX bytes containing the source directory path,
+  absolute or relative to the process' current working directory (cwd);
+  must end with '/'; bytes after the path are used to build the paths
+  of its entries and the path is restored before returning
 srcDirPathLength - length in bytes of srcDirPath
-filesSrc - ordered (sorted) list of files located in source directory
-dstDirPath - target directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+filesSrc - cursor at the first of the ordered (sorted) files located
+  in source directory
+dstDirPath - buffer of PATH_MAX bytes containing the target directory path,
+  used like srcDirPath
 dstDirPathLength - length in bytes of dstDirPath
-filesDst - in the same order as filesSrc list of files located
-  in target directory
+filesDst - cursor at the first of the files located in target directory,
+  in the same order as filesSrc
+metadata - metadata of the files of both lists prefetched with prefetchBegin
+  (prefetch.h) or NULL if it is read when needed
+If setting newestFirst is not 0, the files are copied after
+  comparing all of them, in order from the most recently modified, unless
+  they are read from spilled runs. If the pipeline (pipeline.h) is running,
+  the files are only submitted to it and errors of their comparison
+  and copying are reported by pipelineDrain.
 returns:
 < 0 if an error occured which prevents from checking all files
 > 0 if an error occured which prevents from editing a file
 0 if no error occured
 */
-int updateDestinationFiles(const char *srcDirPath,
-  const size_t srcDirPathLength, list *filesSrc, const char *dstDirPath,
-  const size_t dstDirPathLength, list *filesDst);
+int updateDestinationFiles(const dirsyncSettings *settings, char *srcDirPath,
+  const size_t srcDirPathLength, cursor *filesSrc, char *dstDirPath,
+  const size_t dstDirPathLength, cursor *filesDst, prefetch *metadata);
 
 /*
 Detects differences and updates subdirectories in the target directory.
 reads:
-srcDirPath - source directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+srcDirPath - buffer of PATH_MAX bytes containing the source directory path,
+  absolute or relative to the process' current working directory (cwd);
+  must end with '/'; bytes after the path are used to build the paths
+  of its entries and the path is restored before returning
 srcDirPathLength - length in bytes of srcDirPath
 subdirsSrc - ordered (sorted) list of subdirectories located in source directory
-dstDirPath - target directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+dstDirPath - buffer of PATH_MAX bytes containing the target directory path,
+  used like srcDirPath
 dstDirPathLength - length in bytes of dstDirPath
 subdirsDst - in the same order as subdirsSrc list of subdirectories located
   in target directory
@@ -51,49 +111,86 @@ returns:
 > 0 if at least 1 error occured which prevents from creating a subdirectory
 0 if no error occured
 */
-int updateDestinationDirectories(const char *srcDirPath,
-  const size_t srcDirPathLength, list *subdirsSrc, const char *dstDirPath,
+int updateDestinationDirectories(char *srcDirPath,
+  const size_t srcDirPathLength, list *subdirsSrc, char *dstDirPath,
   const size_t dstDirPathLength, list *subdirsDst, char *isReady);
 
 /*
 Non-recursively synchronizes the source and target directories.
 reads:
-sourcePath - source directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath - buffer of PATH_MAX bytes containing the source directory path,
+  absolute or relative to the process' current working directory (cwd);
+  must end with '/'; bytes after the path are used to build the paths
+  of its entries and the path is restored before returning
 sourcePathLength - length in bytes of sourcePath
-destinationPath - target directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+destinationPath - buffer of PATH_MAX bytes containing the target directory
+  path, used like sourcePath
 destinationPathLength - length in bytes of destinationPath
 returns:
 < 0 if an error occured
 0 if no error occured
 */
-int synchronizeNonRecursively(const char *sourcePath,
-  const size_t sourcePathLength, const char *destinationPath,
+int synchronizeNonRecursively(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
   const size_t destinationPathLength);
 
 /*
 Recursively synchronizes the source and target directories.
 reads:
-sourcePath - source directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath - buffer of PATH_MAX bytes containing the source directory path,
+  absolute or relative to the process' current working directory (cwd);
+  must end with '/'; bytes after the path are used to build the paths
+  of its entries and the path is restored before returning
 sourcePathLength - length in bytes of sourcePath
-destinationPath - target directory path, absolute or relative to the process'
-  current working directory (cwd); must end with '/'
+destinationPath - buffer of PATH_MAX bytes containing the target directory
+  path, used like sourcePath
 destinationPathLength - length in bytes of destinationPath
 returns:
 < 0 if an error occured
 0 if no error occured
 */
-int synchronizeRecursively(const char *sourcePath,
-  const size_t sourcePathLength, const char *destinationPath,
+int synchronizeRecursively(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
   const size_t destinationPathLength);
 
+/*
+Recursively synchronizes the source and target directories, scanning only
+  the directories which are due according to the schedule (schedule.h).
+  The schedule is remembered in the tree of the source directory between
+  calls so the source and target directories must be the same in every call
+  with the same tree.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath - buffer of PATH_MAX bytes containing the source directory path,
+  absolute or relative to the process' current working directory (cwd);
+  must end with '/'; bytes after the path are used to build the paths
+  of its entries and the path is restored before returning
+sourcePathLength - length in bytes of sourcePath
+destinationPath - buffer of PATH_MAX bytes containing the target directory
+  path, used like sourcePath
+destinationPathLength - length in bytes of destinationPath
+writes:
+root - node of the source directory (scheduleCreateRoot) or NULL
+  to synchronize the whole tree
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+int synchronizeAdaptively(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
+  const size_t destinationPathLength, scanNode *root);
+
 /*
 Pointer to a function synchronizing the source and target directories.
 */
-typedef int (*synchronizer)(const char *sourcePath,
-  const size_t sourcePathLength, const char *destinationPath,
+typedef int (*synchronizer)(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
   const size_t destinationPathLength);
 
 #endif // SYNCHRONIZATION_H
@@ -0,0 +1,95 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+Profiling of synchronization cycles. Every thread records timestamped spans
+  of its work (listing, sorting, comparing, reading metadata, copying,
+  removing, writing the log) into a buffer of its own without locks.
+  At the end of every cycle the spans are written as Chrome trace JSON
+  which can be opened in Perfetto or chrome://tracing. When tracing
+  is disabled, recording a span only checks a flag.
+*/
+
+// Kinds of spans.
+enum traceKind
+{
+  // Whole synchronization cycle.
+  TRACE_CYCLE,
+  // Listing a source directory and its target equivalent.
+  TRACE_SCAN,
+  // Sorting or pairing the lists of entries.
+  TRACE_SORT,
+  // Comparing and updating the files of a directory.
+  TRACE_DIFF,
+  // Comparing and updating the subdirectories of a directory.
+  TRACE_DIRECTORIES,
+  // Reading the metadata of a file.
+  TRACE_STAT,
+  // Copying a file.
+  TRACE_COPY,
+  // Removing a file or a directory.
+  TRACE_DELETE,
+  // Writing a batch of log messages.
+  TRACE_LOG,
+  // Number of kinds, not a kind.
+  TRACE_KINDS
+};
+
+/* Number of spans a thread can record in a cycle; further ones are counted
+as dropped. */
+#define TRACEEVENTS 16384
+// Maximal number of bytes of the end of a path kept in a span, with '\0'.
+#define TRACENAME 96
+
+/*
+Enables tracing. The spans of every cycle replace the trace file.
+reads:
+path - trace file path
+returns:
+-1 if the path is too long
+0 if no error occured
+*/
+int traceStart(const char *path);
+
+/*
+Disables tracing. Buffers of the threads are kept until the process exits
+  because the threads may still record spans.
+*/
+void traceStop(void);
+
+/*
+Checks if tracing is enabled, e.g. to skip reading the clock.
+returns:
+1 if tracing is enabled
+0 otherwise
+*/
+int traceEnabled(void);
+
+/*
+Records a span of the calling thread. Does nothing if tracing is disabled.
+reads:
+kind - kind of the span
+start - time at which the span began (metricsNow)
+end - time at which the span ended (metricsNow)
+path - path of the entry or directory or NULL
+*/
+void traceSpan(enum traceKind kind, unsigned long long start,
+  unsigned long long end, const char *path);
+
+/*
+Marks the beginning of a synchronization cycle.
+*/
+void traceBeginCycle(void);
+
+/*
+Marks the end of a synchronization cycle and writes the spans recorded
+  since its beginning to the trace file.
+reads:
+status - status code of the cycle
+returns:
+-1 if the file could not be written (errno is set)
+0 if no error occured or tracing is disabled
+*/
+int traceEndCycle(int status);
+
+#endif // TRACE_H
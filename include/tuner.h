@@ -0,0 +1,67 @@
+#ifndef TUNER_H
+#define TUNER_H
+
+#include "dirsync.h"
+
+/*
+Online tuner of the copier thread count, the copy buffer size and the big
+  file threshold. After every cycle which copied enough data, it computes
+  the throughput of the cycle (bytes and files copied per second, every file
+  counted as TUNERFILECOST more bytes) and hill-climbs over one knob
+  at a time: a cycle measures the current settings, the next cycle tries
+  a knob moved by one step, which is kept if the throughput grew by more
+  than TUNERGAIN percent and reverted otherwise. After both directions
+  of a knob are rejected, the next knob is tuned. Every decision is logged
+  and kept settings are saved to a file per pair of directories so that
+  a restarted daemon continues from them.
+*/
+
+// Minimal numbers of files and bytes copied in a cycle to measure it.
+#define TUNERFILES 64
+#define TUNERBYTES (16ULL * 1024 * 1024)
+// Bytes added per copied file to account for its opening and metadata.
+#define TUNERFILECOST 16384
+// Minimal improvement in percent for which a tried setting is kept.
+#define TUNERGAIN 5
+
+/*
+Enables the tuner and loads the settings saved for the pair of directories
+  of a context, whose big file threshold is then tuned. The copier thread
+  count is only tuned if the pipeline is running.
+reads:
+directory - directory of the files with saved settings
+writes:
+context - context of the synchronized directories; must not be destroyed
+  while the tuner is enabled
+returns:
+-1 if the settings file path is too long
+0 if no error occured (also if no settings were saved)
+*/
+int tunerStart(const char *directory, dirsync *context);
+
+/*
+Moves the threshold knob to the level of a big file threshold set outside
+  the tuner, e.g. by reloading the configuration, and applies it. A tried
+  setting is reverted and the next cycle measures the new settings. Does
+  nothing if the tuner is disabled.
+reads:
+value - big file threshold
+*/
+void tunerSetThreshold(unsigned long long value);
+
+/*
+Marks the beginning of a synchronization cycle. Does nothing if the tuner
+  is disabled.
+*/
+void tunerBeginCycle(void);
+
+/*
+Measures a finished synchronization cycle and selects the settings
+  of the next one. Does nothing if the tuner is disabled.
+reads:
+files - number of files copied in the cycle
+bytes - number of bytes copied in the cycle
+*/
+void tunerEndCycle(unsigned long long files, unsigned long long bytes);
+
+#endif // TUNER_H
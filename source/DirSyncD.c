@@ -1,7 +1,23 @@
+#include "allocation.h"
+#include "arena.h"
+#include "calibration.h"
+#include "control.h"
 #include "directory.h"
+#include "dirsync.h"
+#include "filter.h"
 #include "DirSyncD.h"
+#include "logger.h"
+#include "metrics.h"
 #include "path.h"
+#include "pipeline.h"
+#include "partition.h"
+#include "prefetch.h"
+#include "priority.h"
+#include "progress.h"
+#include "schedule.h"
 #include "synchronization.h"
+#include "trace.h"
+#include "tuner.h"
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -15,7 +31,12 @@
 #include <linux/fs.h>
 #include <signal.h>
 #include <errno.h>
-#include <syslog.h>
+#include <pthread.h>
+#include <time.h>
+#include <ctype.h>
+
+// Maximal size in bytes of the configuration file.
+#define CONFIGSIZE 65536
 
 /*
 Essential arguments:
@@ -26,94 +47,252 @@ Additional options:
 - -i <sleep_time> - sleep time
 - -R - recursive directory synchronization
 - -t <big_file_threshold> - minimal file size to consider it big
+- -c <control_socket> - path of a Unix domain socket accepting commands
+- -m <metrics_file> - path of a file to which metrics are written
+  in Prometheus text format after every synchronization
+- -s <status_file> - path of a file rewritten every second with the bytes
+  done, the rate and the estimated time left of the current synchronization
+  and of the big files being copied
+- -j <trace_file> - path of a file to which the spans of every
+  synchronization (listing, sorting, comparing, reading metadata, copying,
+  removing, logging) of all threads are written in Chrome trace JSON format
+- -l <log_level> - least important level of logged messages: error, warning,
+  info (default) or debug (details of operations on single files)
+- -f <log_file> - path of a file to which messages are written instead
+  of syslog
+- -r <log_file_size> - size in bytes (greater than 0) after which the log
+  file is rotated
+- -A <min_interval> - adaptive scanning (with -R): the daemon wakes up every
+  min_interval seconds and scans only directories which are due; a directory
+  with changes is due after min_interval seconds, a directory without changes
+  backs off exponentially up to sleep_time; every sleep_time seconds
+  all directories are scanned
+- -p <pattern> - glob pattern relative to source_path; matching files
+  and subdirectories are synchronized before all other entries in every
+  cycle; can be given up to 16 times
+- -n - copy the files of a directory and the priority files in order
+  from the most recently modified
+- -M <memory_budget> - maximal size in bytes (at least 1 MiB) of the listings
+  of a pair of directories kept in memory; bigger listings are sorted
+  in runs in temporary files (in TMPDIR or /tmp) and merged while comparing
+- -H - pair the files of a directory with a hash table in O(n) time instead
+  of sorting the source and target lists
+- -P <comparators>:<copiers> - compare and copy files in a pipeline
+  of comparator and copier threads (each from 1 to 32) while directories
+  are still being scanned; with -P <comparators>:<tiny>:<medium>:<huge>,
+  files smaller than 64 KiB, smaller than 64 MiB and the other ones
+  are copied by separate pools of copier threads
+- -T <tuning_directory> - tune the number of copying threads, the copy buffer
+  size and the big file threshold from the throughput of every cycle and save
+  the settings to a file in the directory
+- -k <calibration_directory> - at startup, measure both copying methods
+  on scratch files in the target directory and use the size from which
+  mmap is faster as the big file threshold instead of big_file_threshold;
+  the threshold is saved to a file per target device in the directory
+  and measured again only with command calibrate of the control socket
+- -S <prefetchers> - read the metadata of the files of a directory with statx
+  in a pool of threads (from 1 to 32) ahead of their comparison
+- -W <partitioners> - split the files of a directory with at least 4096
+  source and target files into ranges of names synchronized in parallel
+  by a pool of threads (from 1 to 32) and the synchronizing thread
+- -a <min_age> - defer copying files modified less than min_age seconds ago
+  until they stop changing; a file which changes while it is copied
+  is copied again in a later cycle
+- -x <pattern> - exclude entries matching the pattern (see filter.h);
+  excluded directories are not scanned and excluded target entries
+  are not deleted
+- -I <pattern> - include entries matching the pattern even if a later rule
+  excludes them
+- -X <rules_file> - read include ('+ <pattern>') and exclude
+  ('- <pattern>') rules from a file
+- -D <ignore_file> - read exclude rules of every source directory
+  and its subdirectories from a file with this name located in it
+- -C <config_file> - read options from a file after the command line;
+  options are separated with whitespace and '#' starts a comment
 
 Usage:
 DirSyncD [-i <sleep_time>] [-R] [-t <big_file_threshold>]
-  source_path target_path
+  [-c <control_socket>] [-m <metrics_file>] [-s <status_file>]
+  [-j <trace_file>] [-l <log_level>] [-f <log_file>] [-r <log_file_size>]
+  [-A <min_interval>] [-p <pattern>]... [-n] [-M <memory_budget>]
+  [-P <comparators>:<copiers>] [-H] [-x <pattern>]... [-I <pattern>]...
+  [-X <rules_file>]... [-D <ignore_file>] [-T <tuning_directory>]
+  [-k <calibration_directory>] [-S <prefetchers>] [-W <partitioners>]
+  [-a <min_age>] [-C <config_file>] source_path target_path
 
 Send signal SIGUSR1 to the daemon:
 - during sleep - to prematurely wake it up.
 - during synchronization - to force it to repeat the synchronization
   immediately after finishing the current one.
 
+Send signal SIGHUP to the daemon to parse the command line and the configuration
+  file again and apply the sleep time, the log level and the settings
+  of the synchronization (-R, -t, -A, -n, -M, -H, -a) after the current
+  synchronization. The other options require a restart.
+
 Send signal SIGTERM to the daemon:
 - during sleep - to stop it.
 - during synchronization - to force it to stop after finishing
   the current synchronization unless the daemon receives SIGUSR1 during it.
+
+Commands accepted by the control socket are described in control.h.
 */
 int main(int argc, char **argv)
 {
-  char *source, *destination;
-  unsigned int interval;
-  char recursive;
+  parameters params;
   // Analyze (parse) parameters passed on program start. If an error occured
-  if (parseParameters(argc, argv, &source, &destination, &interval, &recursive)
-    < 0)
+  if (parseParameters(argc, argv, &params) < 0)
   {
     // Print the correct way of using the program.
     printf("Usage: DirSyncD [-i <sleep_time>] [-R] [-t <big_file_threshold>] "
-      "source_path target_path\n");
+      "[-c <control_socket>] [-m <metrics_file>] [-s <status_file>] "
+      "[-j <trace_file>] [-l <log_level>] [-f <log_file>] "
+      "[-r <log_file_size>] [-A <min_interval>] [-p <pattern>]... [-n] "
+      "[-M <memory_budget>] "
+      "[-P <comparators>:<copiers>] [-H] [-x <pattern>]... "
+      "[-I <pattern>]... [-X <rules_file>]... [-D <ignore_file>] "
+      "[-T <tuning_directory>] [-k <calibration_directory>] "
+      "[-S <prefetchers>] [-W <partitioners>] [-a <min_age>] "
+      "[-C <config_file>] source_path target_path\n");
     // Stop the parent process.
     return -1;
   }
   // Check if the source directory is valid. If it is invalid
-  if (directoryValid(source) < 0)
+  if (directoryValid(params.source) < 0)
   {
     // Print the error message for error code stored in errno variable. 
-    perror(source);
+    perror(params.source);
     // Stop the parent process.
     return -2;
   }
   // Check if the target directory is valid. If it is invalid
-  if (directoryValid(destination) < 0)
+  if (directoryValid(params.destination) < 0)
   {
     // Print the error message for error code stored in errno variable. 
-    perror(destination);
+    perror(params.destination);
     // Stop the parent process.
     return -3;
   }
 
   // Start the daemon.
-  runDaemon(source, destination, interval, recursive);
+  runDaemon(&params);
 
   return 0;
 }
 
-// Without 'static' because this global variable is used in other .c files.
-/* Big file threshold. If the file size is lesser than threshold,
-then during copying the file is considered small, otherwise big. */
-unsigned long long threshold;
+static int parseOptions(int argc, char **argv, parameters *params);
+static int parseConfiguration(parameters *params);
 
-int parseParameters(int argc, char **argv, char **source, char **destination,
-  unsigned int *interval, char *recursive)
+/* If not 0, the options are parsed again to reload the configuration
+and the options with side effects are skipped. */
+static char reloading;
+
+int parseParameters(int argc, char **argv, parameters *params)
 {
   // If no parameters were passed
   if (argc <= 1)
     // Return error code.
     return -1;
   // Save default sleep time equal to 5*60 s = 5 min.
-  *interval = 5 * 60;
-  // Save default non-recursive directory synchronization.
-  *recursive = 0;
-  /* Save default big file threshold equal to maximal possible value
-  of unsigned long long int variable. */
-  threshold = ULLONG_MAX;
+  params->interval = 5 * 60;
+  /* Save default non-recursive directory synchronization, big file threshold
+  equal to maximal possible value of unsigned long long int variable,
+  copying in lexicographic order, unlimited memory for listings, sorting
+  of file lists, copying of files regardless of their age and no adaptive
+  scanning. */
+  dirsyncDefaults(&params->settings);
+  // Save default no control socket.
+  params->controlSocket = NULL;
+  // Save default no metrics file.
+  params->metricsFile = NULL;
+  // Save default no status file.
+  params->statusFile = NULL;
+  // Save default no tracing.
+  params->traceFile = NULL;
+  // Save default fixed settings.
+  params->tuningDirectory = NULL;
+  // Save default big file threshold without calibration.
+  params->calibrationDirectory = NULL;
+  // Save default log level skipping details of operations on single files.
+  params->logLevel = LOG_INFO;
+  // Save default logging to syslog.
+  params->logFile = NULL;
+  // Save default log file rotation size equal to 10 MiB.
+  params->logFileSize = 10ULL * 1024 * 1024;
+  // Save default no pipeline.
+  params->comparators = 0;
+  // Save default metadata reading when needed.
+  params->prefetchers = 0;
+  params->partitioners = 0;
+  // Save default no configuration file.
+  params->configFile = NULL;
+  params->configText = NULL;
+  params->configArguments = NULL;
+  // Save the parameters to parse them again when reloading.
+  params->argc = argc;
+  params->argv = argv;
+  // Parse the options. If an error occured
+  int ret = parseOptions(argc, argv, params);
+  if (ret < 0)
+    // Return error code.
+    return ret;
+  /* Count the arguments not being options
+  (there should be exactly 2: source and target paths). */
+  int remainingArguments = argc - optind;
+  if (remainingArguments != 2) // If there are not exactly 2 arguments
+    // Return error code.
+    return -7;
+  /* Optind is index of the first argument not being an option parsed by getopt.
+  Therefore, optind should be index of source path argument.
+  Save the source path. */
+  params->source = argv[optind];
+  // Save the target path.
+  params->destination = argv[optind + 1];
+  /* If a configuration file was given, parse its options after the options
+  of the command line. If an error occured */
+  if (params->configFile != NULL && (ret = parseConfiguration(params)) < 0)
+    // Return error code.
+    return ret;
+  /* With adaptive scanning, every directory is scanned at least every
+  sleep time. */
+  params->settings.maximalInterval = params->interval;
+  // Return the correct ending code.
+  return 0;
+}
+
+/*
+Parses the options of the program and writes their values to its parameters.
+  Arguments not being options are left for the caller at index optind.
+reads:
+argc - number of elements of argv
+argv - program name followed by options and arguments
+writes:
+params - values of the options
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+static int parseOptions(int argc, char **argv, parameters *params)
+{
   int option;
+  // Start scanning from the beginning of argv even if it was scanned before.
+  optind = 0;
   /* Place ':' at the beginning of __shortopts to distinguish between
   '?' (unknown option) and ':' (no value given for an option). */
-  while ((option = getopt(argc, argv, ":Ri:t:")) != -1)
+  while ((option = getopt(argc, argv,
+    ":Ri:t:c:m:s:j:l:f:r:A:p:nM:P:Hx:I:X:D:T:k:S:W:a:C:")) != -1)
   {
     switch (option)
     {
     case 'R':
       // Enable recursive directory synchronization.
-      *recursive = (char)1;
+      params->settings.recursive = (char)1;
       break;
     case 'i':
       /* String optarg is sleep time in seconds. Transform it into
       unsigned int. If sscanf did not correctly fill interval,
       the passed time value has invalid format and */
-      if (sscanf(optarg, "%u", interval) < 1)
+      if (sscanf(optarg, "%u", &params->interval) < 1)
         // Return error code.
         return -2;
       break;
@@ -121,18 +300,175 @@ int parseParameters(int argc, char **argv, char **source, char **destination,
       /* String optarg is big file threshold. Transform it into
       unsigned long long int. If sscanf did not correctly fill THRESHOLD,
       the passed file size value has invalid format and */
-      if (sscanf(optarg, "%llu", &threshold) < 1)
+      if (sscanf(optarg, "%llu", &params->settings.threshold) < 1)
         // Return error code.
         return -3;
       break;
+    case 'c':
+      // Save the control socket path.
+      params->controlSocket = optarg;
+      break;
+    case 'm':
+      // Save the metrics file path.
+      params->metricsFile = optarg;
+      break;
+    case 's':
+      // Save the status file path.
+      params->statusFile = optarg;
+      break;
+    case 'j':
+      // Save the trace file path.
+      params->traceFile = optarg;
+      break;
+    case 'l':
+      // Transform the level name into a syslog level. If it is invalid
+      if ((params->logLevel = loggerParseLevel(optarg)) < 0)
+        // Return error code.
+        return -8;
+      break;
+    case 'f':
+      // Save the log file path.
+      params->logFile = optarg;
+      break;
+    case 'r':
+      /* String optarg is log file rotation size. If sscanf did not correctly
+      fill logFileSize, the passed size has invalid format. If it is 0,
+      the file would be rotated on every write and */
+      if (sscanf(optarg, "%llu", &params->logFileSize) < 1 ||
+        params->logFileSize == 0)
+        // Return error code.
+        return -9;
+      break;
+    case 'A':
+      /* String optarg is minimal time between scans of a directory.
+      If it is invalid or 0 */
+      if (sscanf(optarg, "%u", &params->settings.adaptiveInterval) < 1 ||
+        params->settings.adaptiveInterval == 0)
+        // Return error code.
+        return -10;
+      break;
+    case 'p':
+      // Priority patterns are not reloaded.
+      if (reloading)
+        break;
+      /* Save the priority pattern. If there are too many patterns
+      or the pattern is invalid */
+      if (priorityAdd(optarg) < 0)
+        // Return error code.
+        return -11;
+      break;
+    case 'n':
+      // Enable copying from the most recently modified file.
+      params->settings.newestFirst = 1;
+      break;
+    case 'a':
+      /* String optarg is the minimal age of copied files in seconds.
+      If it is invalid or 0 */
+      if (sscanf(optarg, "%u", &params->settings.minimumAge) < 1 ||
+        params->settings.minimumAge == 0)
+        // Return error code.
+        return -19;
+      break;
+    case 'M':
+      /* String optarg is the memory budget in bytes. If it is invalid
+      or too small to hold the buffers of the merged runs */
+      if (sscanf(optarg, "%llu", &params->settings.memoryBudget) < 1 ||
+        params->settings.memoryBudget < 1024 * 1024)
+        // Return error code.
+        return -12;
+      break;
+    case 'H':
+      // Enable pairing files with a hash table.
+      params->settings.hashDiff = 1;
+      break;
+    case 'P':
+      /* String optarg is the number of comparator threads and the number
+      of copier threads or the numbers of copier threads of the tiny, medium
+      and huge lanes. */
+      params->lanes = sscanf(optarg, "%u:%u:%u:%u", &params->comparators,
+        &params->copiers[0], &params->copiers[1], &params->copiers[2]) - 1;
+      // If it is invalid or any number is out of range
+      if ((params->lanes != 1 && params->lanes != PIPELINELANES) ||
+        params->comparators == 0 || params->comparators > PIPELINETHREADS)
+        // Return error code.
+        return -13;
+      unsigned int i;
+      for (i = 0; i < params->lanes; ++i)
+        if (params->copiers[i] == 0 || params->copiers[i] > PIPELINETHREADS)
+          // Return error code.
+          return -13;
+      break;
+    case 'x':
+    case 'I':
+      // Filter rules are not reloaded.
+      if (reloading)
+        break;
+      /* Add an exclude or include rule in the order of the options.
+      If it is invalid or memory could not be reserved */
+      if (filterAdd(optarg, option == 'I') < 0)
+        // Return error code.
+        return -14;
+      break;
+    case 'X':
+      if (reloading)
+        break;
+      // Add the rules of the file. If it could not be read
+      if (filterLoad(optarg) < 0)
+      {
+        perror(optarg);
+        // Return error code.
+        return -15;
+      }
+      break;
+    case 'D':
+      if (reloading)
+        break;
+      // The ignore file is looked up in every directory so it is only a name.
+      if (optarg[0] == '\0' || strchr(optarg, '/') != NULL)
+        // Return error code.
+        return -16;
+      filterSetIgnoreFile(optarg);
+      break;
+    case 'T':
+      // Save the directory of the tuned settings.
+      params->tuningDirectory = optarg;
+      break;
+    case 'k':
+      // Save the directory of the calibrated thresholds.
+      params->calibrationDirectory = optarg;
+      break;
+    case 'S':
+      /* String optarg is the number of prefetching threads. If it is invalid
+      or out of range */
+      if (sscanf(optarg, "%u", &params->prefetchers) < 1 ||
+        params->prefetchers == 0 || params->prefetchers > PREFETCHTHREADS)
+        // Return error code.
+        return -17;
+      break;
+    case 'W':
+      /* String optarg is the number of partitioning threads. If it is
+      invalid or out of range */
+      if (sscanf(optarg, "%u", &params->partitioners) < 1 ||
+        params->partitioners == 0 || params->partitioners > PARTITIONTHREADS)
+        // Return error code.
+        return -18;
+      break;
+    case 'C':
+      // The configuration file cannot name another one.
+      if (argv != params->argv)
+        // Return error code.
+        return -20;
+      // Save the configuration file path.
+      params->configFile = optarg;
+      break;
     case ':':
-      // If option -i or -t was passed without its value, print message
+      // If an option other than -R was passed without its value, print message
       printf("Option demands a value\n");
       // Return error code.
       return -4;
       break;
     case '?':
-      // If option other than -R, -i, -t was specified
+      // If an unsupported option was specified
       printf("Unknown option: %c\n", optopt);
       // Return error code.
       return -5;
@@ -146,42 +482,313 @@ int parseParameters(int argc, char **argv, char **source, char **destination,
       break;
     }
   }
-  /* Count the arguments not being options
-  (there should be exactly 2: source and target paths). */
-  int remainingArguments = argc - optind;
-  if (remainingArguments != 2) // If there are not exactly 2 arguments
-    // Return error code.
-    return -7;
-  /* Optind is index of the first argument not being an option parsed by getopt.
-  Therefore, optind should be index of source path argument.
-  Save the source path. */
-  *source = argv[optind];
-  // Save the target path.
-  *destination = argv[optind + 1];
   // Return the correct ending code.
   return 0;
 }
 
+/*
+Reads the configuration file and parses its options like the options
+  of the command line. Options are separated with whitespace and '#' starts
+  a comment lasting until the end of the line.
+writes:
+params - values of the options; configText and configArguments are set
+  to the buffers of the options which must be released with free
+returns:
+-20 if the file could not be read or contains arguments not being options
+< 0 if an option is invalid
+0 if no error occured
+*/
+static int parseConfiguration(parameters *params)
+{
+  FILE *file = fopen(params->configFile, "r");
+  if (file == NULL)
+    return -20;
+  // Read the whole file.
+  char *text = malloc(CONFIGSIZE + 1);
+  size_t length = text != NULL ? fread(text, 1, CONFIGSIZE + 1, file) : 0;
+  int error = ferror(file);
+  fclose(file);
+  // If it could not be read or is too big
+  if (text == NULL || error || length > CONFIGSIZE)
+  {
+    free(text);
+    return -20;
+  }
+  text[length] = '\0';
+  // Cut out the comments.
+  char *c, *comment = text;
+  while ((comment = strchr(comment, '#')) != NULL)
+    for (; *comment != '\0' && *comment != '\n'; ++comment)
+      *comment = ' ';
+  // Count the options and values; the first element is the program name.
+  int count = 1;
+  for (c = text; *c != '\0'; ++c)
+    if (!isspace((unsigned char)*c) && (c == text ||
+      isspace((unsigned char)c[-1])))
+      ++count;
+  char **arguments = malloc(sizeof(char *) * (count + 1));
+  if (arguments == NULL)
+  {
+    free(text);
+    return -20;
+  }
+  params->configText = text;
+  params->configArguments = arguments;
+  // Split the text into null-terminated words.
+  arguments[0] = params->argv[0];
+  count = 1;
+  for (c = strtok(text, " \t\r\n\v\f"); c != NULL;
+    c = strtok(NULL, " \t\r\n\v\f"))
+    arguments[count++] = c;
+  arguments[count] = NULL;
+  int ret = parseOptions(count, arguments, params);
+  // If an option is invalid
+  if (ret < 0)
+    return ret;
+  // If the file contains an argument not being an option
+  if (optind != count)
+    return -20;
+  return 0;
+}
+
 // Flag of forced synchronization set in SIGUSR1 signal handler function.
 char forcedSynchronization;
 // SIGUSR1 signal handler function.
 void sigusr1Handler(int signo)
 {
+  (void)signo;
   // Set the flag of forced synchronization.
   forcedSynchronization = 1;
 }
 
+/* Flag of targeted synchronization set in SIGUSR2 signal handler function.
+SIGUSR2 is sent by the control thread after queueing a subdirectory path. */
+char targetedSynchronization;
+// SIGUSR2 signal handler function.
+void sigusr2Handler(int signo)
+{
+  (void)signo;
+  // Set the flag of targeted synchronization.
+  targetedSynchronization = 1;
+}
+
 // Flag of stopping set in SIGTERM signal handler function.
 char stop;
 // SIGTERM signal handler function.
 void sigtermHandler(int signo)
 {
+  (void)signo;
   // Set the flag of stopping.
   stop = 1;
 }
 
-void runDaemon(char *source, char *destination, unsigned int interval,
-  char recursive)
+// Flag of reloading set in SIGHUP signal handler function.
+char reloadRequested;
+// SIGHUP signal handler function.
+void sighupHandler(int signo)
+{
+  (void)signo;
+  // Set the flag of reloading.
+  reloadRequested = 1;
+}
+
+/*
+Parses the command line and the configuration file again and applies
+  the reloadable options. Thread pools, the control socket, the tuner,
+  the filters and the schedule of adaptive scanning are kept.
+writes:
+params - values of the options and arguments passed to the program
+context - context of the synchronized directories
+returns:
+< 0 if the options are invalid; the previous ones are kept
+0 if no error occured
+*/
+static int reloadConfiguration(parameters *params, dirsync *context)
+{
+  parameters next;
+  reloading = 1;
+  int ret = parseParameters(params->argc, params->argv, &next);
+  reloading = 0;
+  // The reloaded values do not point into the configuration file.
+  free(next.configText);
+  free(next.configArguments);
+  if (ret < 0)
+  {
+    // In the log, write a message about keeping the previous configuration.
+    logMessage(LOG_WARNING, "reloading configuration; %i", ret);
+    return ret;
+  }
+  // The calibrated threshold replaces the one given with -t.
+  if (calibrationEnabled())
+    next.settings.threshold = params->settings.threshold;
+  params->interval = next.interval;
+  params->logLevel = next.logLevel;
+  params->settings = next.settings;
+  loggerSetLevel(params->logLevel);
+  dirsyncReconfigure(context, &params->settings);
+  // Let the tuner continue from the configured threshold.
+  tunerSetThreshold(params->settings.threshold);
+  // trigger-path depends on the recursion.
+  controlSetRecursive(params->settings.recursive);
+  logMessage(LOG_INFO, "reloading configuration; sleep time %u s, %s, "
+    "big file threshold %llu; 0", params->interval,
+    params->settings.recursive ? "recursive" : "non-recursive",
+    params->settings.threshold);
+  return 0;
+}
+
+/*
+Calibrates the big file threshold on the target device (calibration.h)
+  and applies it; the tuner continues from it. If calibration fails,
+  the previous threshold is kept.
+reads:
+force - if not 0, the threshold saved for the device is measured again
+writes:
+params - values of the options and arguments passed to the program
+context - context of the synchronized directories
+*/
+static void calibrate(parameters *params, dirsync *context, char force)
+{
+  unsigned long long threshold;
+  int status = calibrationThreshold(force, &threshold);
+  // If the threshold could not be measured
+  if (status == -1)
+  {
+    // In the log, write a message about keeping the previous threshold.
+    logMessage(LOG_WARNING, "calibrating big file threshold; %i", errno);
+    return;
+  }
+  // If the measured threshold could not be saved
+  if (status == -2)
+    // In the log, write a message about the error.
+    logMessage(LOG_WARNING, "saving calibrated threshold; %i", errno);
+  params->settings.threshold = threshold;
+  dirsyncReconfigure(context, &params->settings);
+  tunerSetThreshold(threshold);
+}
+
+/*
+Calibrates the big file threshold if calibration is enabled and starts
+  the tuner if tuning was requested, so that the tuner starts from
+  the calibrated threshold and then loads the settings saved for
+  the directories.
+reads:
+params - values of the options and arguments passed to the program
+writes:
+context - context of the synchronized directories
+returns:
+-1 if the tuner could not be started
+0 if no error occured
+*/
+static int startThreshold(parameters *params, dirsync *context)
+{
+  // Use the threshold saved for the target device or measure it.
+  if (calibrationEnabled())
+    calibrate(params, context, 0);
+  if (params->tuningDirectory != NULL &&
+    tunerStart(params->tuningDirectory, context) < 0)
+    return -1;
+  return 0;
+}
+
+int synchronizeTargets(dirsync *context)
+{
+  // Initially, set status code indicating no error.
+  int ret = 0;
+  char *subPath = NULL;
+  // Reserve memory for a queued path. If an error occured
+  if ((subPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
+    // Set status code indicating an error.
+    ret = -1;
+  else
+  {
+    // Synchronize every queued path.
+    while (controlNextPath(subPath) == 1)
+    {
+      // Synchronize the subdirectories.
+      int status = dirsyncSynchronize(context, subPath);
+      // In the log, write a message about finishing the synchronization.
+      logMessage(LOG_INFO, "finishing synchronization of %s%s/; %i",
+        dirsyncSource(context), subPath, status);
+      // If the subdirectory path was too long
+      if (status == -20)
+        // Set status code indicating an error.
+        ret = -4;
+      // If another error occured
+      else if (status != 0)
+        // Set status code indicating an error.
+        ret = -5;
+    }
+  }
+  // Release memory which was reserved.
+  free(subPath);
+  // Return the status code.
+  return ret;
+}
+
+// Number of heap allocations made before the current cycle.
+static unsigned long long allocationsBeforeCycle;
+
+/*
+Marks the beginning of a synchronization cycle for the engine (dirsync.h)
+  and the tuner.
+reads:
+full - with adaptive scanning, if not 0, every directory is treated as due
+writes:
+context - context of the synchronized directories
+*/
+static void beginCycle(dirsync *context, char full)
+{
+  /* Reset the progress reported by the control socket and the counters
+  of the current cycle. */
+  dirsyncBegin(context, full);
+  // Start measuring the throughput of the cycle.
+  tunerBeginCycle();
+  // Save the number of heap allocations if they are counted.
+  allocationsBeforeCycle = allocationCount();
+}
+
+/*
+Marks the end of a synchronization cycle for the engine (dirsync.h)
+  and the tuner and writes the metrics file.
+reads:
+status - status code of the finished synchronization
+metricsFile - metrics file path or NULL if metrics are not to be written
+writes:
+context - context of the synchronized directories
+*/
+static void endCycle(dirsync *context, int status, const char *metricsFile)
+{
+  /* Report the finished synchronization to the control socket
+  and accumulate the counters of the finished cycle. */
+  dirsyncEnd(context, status);
+  // If the pipeline is running, write the utilisation of its stages.
+  if (pipelineEnabled())
+    logMessage(LOG_INFO, "stage utilisation: scanner %.0f%%, comparators "
+      "%.0f%%, copiers %.0f%%", 100 * metricsStageUtilisation(STAGE_SCANNER),
+      100 * metricsStageUtilisation(STAGE_COMPARATOR),
+      100 * metricsStageUtilisation(STAGE_COPIER));
+  // In the log, write a summary of the cycle.
+  logMessage(LOG_INFO, "copied %llu files (%llu bytes), deferred %llu files, "
+    "deleted %llu entries, %llu errors", metricsGet(METRIC_FILES_COPIED),
+    metricsGet(METRIC_BYTES_COPIED), metricsGet(METRIC_FILES_DEFERRED),
+    metricsGet(METRIC_DELETES), metricsGet(METRIC_ERRORS));
+  // Select the settings of the next cycle from the throughput of this one.
+  tunerEndCycle(metricsGet(METRIC_FILES_COPIED),
+    metricsGet(METRIC_BYTES_COPIED));
+#ifdef COUNTALLOCATIONS
+  /* In the log, write the number of heap allocations made during the cycle
+  by all threads. */
+  logMessage(LOG_INFO, "made %llu heap allocations (%lu arena blocks)",
+    allocationCount() - allocationsBeforeCycle, arenaBlocks());
+#endif
+  // If a metrics file path was given, write the file. If an error occured
+  if (metricsFile != NULL && metricsWrite(metricsFile) < 0)
+    // In the log, write a message about the error.
+    logMessage(LOG_WARNING, "writing metrics to %s; %i", metricsFile, errno);
+}
+
+void runDaemon(parameters *params)
 {
   // Create a child process.
   pid_t pid = fork();
@@ -208,36 +815,23 @@ void runDaemon(char *source, char *destination, unsigned int interval,
   Programming", page 177, at least in Polish version of the book).
   Initially, set status code indicating no error. */
   int ret = 0;
-  char *sourcePath = NULL, *destinationPath = NULL;
-  /* In ext4 file system, an absolute path can be at most PATH_MAX (4096)
-  bytes long. Reserve PATH_MAX bytes for the source directory path.
-  If an error occured */
-  if ((sourcePath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-    /* Set status code indicating an error. After that,
-    the program immediately goes to the end of the current function. */
-    ret = -1;
-  // Reserve PATH_MAX bytes for the target directory path. If an error occured
-  else if ((destinationPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-    // Set status code indicating an error.
-    ret = -2;
-  // Create the absolute source directory path. If an error occured
-  else if (realpath(source, sourcePath) == NULL)
+  // Set the least important level of logged messages.
+  loggerSetLevel(params->logLevel);
+  /* Create the context of the synchronization with absolute directory paths
+  ending with '/' before the working directory is changed. If an error
+  occured */
+  dirsync *context = dirsyncCreate(params->source, params->destination,
+    &params->settings);
+  if (context == NULL)
   {
     /* Print the error message for error code stored in errno variable.
     It is still possible because we have not readdressed child process'
     descriptors and we can access stdout. */
-    perror("realpath; source");
-    // Set status code indicating an error.
+    perror("realpath");
+    /* Set status code indicating an error. After that,
+    the program immediately goes to the end of the current function. */
     ret = -3;
   }
-  // Create the absolute target directory path. If an error occured
-  else if (realpath(destination, destinationPath) == NULL)
-  {
-    // Print the error message for error code stored in errno variable.
-    perror("realpath; destination");
-    // Set status code indicating an error.
-    ret = -4;
-  }
   // Create a new session and process group. If an error occured
   else if (setsid() == -1)
     // Set status code indicating an error.
@@ -287,15 +881,28 @@ void runDaemon(char *source, char *destination, unsigned int interval,
     else if (dup(0) == -1)
       // Set status code indicating an error.
       ret = -10;
-    /* Here, the child process is already a daemon.
-    Register SIGUSR1 signal handler function. If an error occured */
+    /* Here, the child process is already a daemon. Start the thread writing
+    the log. If an error occured, messages are still written to syslog,
+    only synchronously. */
+    else if (loggerStart(params->logFile, params->logFileSize) < 0)
+      // Set status code indicating an error.
+      ret = -21;
+    // Register SIGUSR1 signal handler function. If an error occured
     else if (signal(SIGUSR1, sigusr1Handler) == SIG_ERR)
       // Set status code indicating an error.
       ret = -11;
+    // Register SIGUSR2 signal handler function. If an error occured
+    else if (signal(SIGUSR2, sigusr2Handler) == SIG_ERR)
+      // Set status code indicating an error.
+      ret = -18;
     // Register SIGTERM signal handler function. If an error occured
     else if (signal(SIGTERM, sigtermHandler) == SIG_ERR)
       // Set status code indicating an error.
       ret = -12;
+    // Register SIGHUP signal handler function. If an error occured
+    else if (signal(SIGHUP, sighupHandler) == SIG_ERR)
+      // Set status code indicating an error.
+      ret = -26;
     // Initialize an empty signal set. If an error occured
     else if (sigemptyset(&set) == -1)
       // Set status code indicating an error.
@@ -304,66 +911,132 @@ void runDaemon(char *source, char *destination, unsigned int interval,
     else if (sigaddset(&set, SIGUSR1) == -1)
       // Set status code indicating an error.
       ret = -14;
+    // Add SIGUSR2 to the signal set. If an error occured
+    else if (sigaddset(&set, SIGUSR2) == -1)
+      // Set status code indicating an error.
+      ret = -19;
     // Add SIGTERM to the signal set. If an error occured
     else if (sigaddset(&set, SIGTERM) == -1)
       // Set status code indicating an error.
       ret = -15;
+    // Add SIGHUP to the signal set. If an error occured
+    else if (sigaddset(&set, SIGHUP) == -1)
+      // Set status code indicating an error.
+      ret = -27;
+    /* If a control socket path was given, create the socket and start
+    the thread serving it. If an error occured */
+    else if (params->controlSocket != NULL &&
+      controlStart(params->controlSocket, pthread_self(),
+      params->settings.recursive) < 0)
+      // Set status code indicating an error.
+      ret = -20;
+    /* If the pipeline was requested, start its threads. If an error
+    occured */
+    else if (params->comparators != 0 && pipelineStart(params->comparators,
+      params->lanes, params->copiers, compareAction, copyAction) < 0)
+      // Set status code indicating an error.
+      ret = -22;
+    /* If calibration was requested, name the file of the target device.
+    If an error occured */
+    else if (params->calibrationDirectory != NULL && calibrationStart(
+      params->calibrationDirectory, dirsyncDestination(context)) < 0)
+      // Set status code indicating an error.
+      ret = -30;
+    /* Calibrate the threshold and start the tuner before the first
+    synchronization. If an error occured */
+    else if (startThreshold(params, context) < 0)
+      // Set status code indicating an error.
+      ret = -23;
+    /* If prefetching was requested, start its threads. If an error
+    occured */
+    else if (params->prefetchers != 0 &&
+      prefetchStart(params->prefetchers) < 0)
+      // Set status code indicating an error.
+      ret = -24;
+    /* If partitioning was requested, start its threads. If an error
+    occured */
+    else if (params->partitioners != 0 &&
+      partitionStart(params->partitioners) < 0)
+      // Set status code indicating an error.
+      ret = -25;
+    /* If a status file path was given, start the thread rewriting the file.
+    If an error occured */
+    else if (params->statusFile != NULL &&
+      progressStart(params->statusFile) < 0)
+      // Set status code indicating an error.
+      ret = -28;
+    // If a trace file path was given, enable tracing. If an error occured
+    else if (params->traceFile != NULL && traceStart(params->traceFile) < 0)
+      // Set status code indicating an error.
+      ret = -29;
     else
     {
-      // Calculate source directory absolute path length.
-      size_t sourcePathLength = strlen(sourcePath);
-      // If there is no '/' immediately before '\0' (null terminator)
-      if (sourcePath[sourcePathLength - 1] != '/')
-        /* Insert '/' in place of '\0'. Increment path length by 1.
-        Insert'\0' after '/'. */
-        stringAppend(sourcePath, sourcePathLength++, "/");
-      // Calculate target directory absolute path length.
-      size_t destinationPathLength = strlen(destinationPath);
-      // If there is no '/' immediately before'\0'
-      if (destinationPath[destinationPathLength - 1] != '/')
-        /* Insert '/' in place of '\0'. Increment path length by 1.
-        Insert '\0' after '/'. */
-        stringAppend(destinationPath, destinationPathLength++, "/");
-      synchronizer synchronize;
-      // If non-recursive synchronization is set
-      if (recursive == 0)
-        // Save a pointer to function synchronizing non-recursively.
-        synchronize = synchronizeNonRecursively;
-      // If recursive synchronization is set
-      else
-        // Save a pointer to function synchronizing recursively.
-        synchronize = synchronizeRecursively;
+      // Time in seconds for which the daemon sleeps.
+      unsigned int sleepTime = params->interval;
+      // Adaptive scanning is only possible with recursive synchronization.
+      char adaptive = params->settings.recursive != 0 &&
+        params->settings.adaptiveInterval != 0;
+      // Time at which all directories were last scanned.
+      time_t lastFullSynchronization = 0;
+      /* If adaptive scanning is set, the engine scans directories at most
+      every adaptiveInterval and at least every interval seconds. */
+      if (adaptive)
+        // Wake up often to scan the directories which are due.
+        sleepTime = params->settings.adaptiveInterval;
       /* Initially, set to 0 because the variable is used to stop
       the daemon (break the loop) with signal SIGTERM. */
       stop = 0;
       /* Initially, set to 0 because the variable is used to skip
       the sleep start with signal SIGUSR1. */
       forcedSynchronization = 0;
+      /* Initially, set to 0 because the variable is used to skip
+      the sleep start with signal SIGUSR2. */
+      targetedSynchronization = 0;
+      /* Initially, set to 0 because the variable is used to reload
+      the configuration with signal SIGHUP. */
+      reloadRequested = 0;
       while (1)
       {
-        // If any synchronization was not forced with signal SIGUSR1
-        if (forcedSynchronization == 0)
+        /* If reloading the configuration was requested with signal SIGHUP
+        during the previous synchronization or sleep */
+        if (reloadRequested != 0)
+        {
+          reloadRequested = 0;
+          // Apply the new options. If they are valid
+          if (reloadConfiguration(params, context) == 0)
+          {
+            adaptive = params->settings.recursive != 0 &&
+              params->settings.adaptiveInterval != 0;
+            sleepTime = adaptive ? params->settings.adaptiveInterval :
+              params->interval;
+          }
+        }
+        /* If any synchronization was not forced with signal SIGUSR1
+        nor requested with signal SIGUSR2 */
+        if (forcedSynchronization == 0 && targetedSynchronization == 0)
         {
-          // Open connection to log ('/var/log/syslog').
-          openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
           // In the log, write a message about sleep start.
-          syslog(LOG_INFO, "falling asleep");
-          // Close the connection to the log.
-          closelog();
+          logMessage(LOG_INFO, "falling asleep");
           // Put the daemon to sleep.
-          unsigned int timeLeft = sleep(interval);
-          // Open the connection to the log.
-          openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
+          unsigned int timeLeft = sleep(sleepTime);
           /* In the log, write a message about waking up with elapsed sleep time
           in seconds. */
-          syslog(LOG_INFO, "waking up; slept for %u s", interval - timeLeft);
-          // Close the connection to the log.
-          closelog();
+          logMessage(LOG_INFO, "waking up; slept for %u s",
+            sleepTime - timeLeft);
           // If sleep was interrupted by receiving SIGTERM
           if (stop == 1)
             // Break the loop.
             break;
+          /* If sleep was only interrupted by receiving SIGHUP, reload
+          the configuration and sleep again for the new sleep time. */
+          if (reloadRequested != 0 && forcedSynchronization == 0 &&
+            targetedSynchronization == 0)
+            continue;
         }
+        /* If calibration was requested using the control socket, measure
+        the threshold again while no files are copied. */
+        if (calibrationRequested())
+          calibrate(params, context, 1);
         /* Start blocking signals from the set (SIGUSR1 and SIGTERM).
         If an error occured */
         if (sigprocmask(SIG_BLOCK, &set, NULL) == -1)
@@ -373,22 +1046,63 @@ void runDaemon(char *source, char *destination, unsigned int interval,
           // Break the loop.
           break;
         }
-        /* Start synchronizing with the selected function. Ignore errors
-        but write the status code to the log. 0 means that
-        the entire synchronization went without errors. Value different
-        from 0 means that directories may be not fully synchronized. */
-        int status = synchronize(sourcePath, sourcePathLength, destinationPath,
-          destinationPathLength);
-        // Open the connection to the log.
-        openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
-        /* In the log, write a message about finishing the synchronization
-        with status code. */
-        syslog(LOG_INFO, "finishing synchronization; %i", status);
-        // Close the connection to the log.
-        closelog();
-        /* Regardless of whether the synchronization was forced or automatic
-        (after sleeping for the entire sleep time), set 0 after its finish. */
+        // If synchronizations were paused using the control socket
+        if (controlPaused())
+        {
+          // In the log, write a message about skipping the synchronization.
+          logMessage(LOG_INFO, "skipping synchronization; paused");
+        }
+        /* If the synchronization is automatic (after sleeping for the entire
+        sleep time) or was forced with signal SIGUSR1 */
+        else if (forcedSynchronization != 0 || targetedSynchronization == 0)
+        {
+          /* Without adaptive scanning, every synchronization is full.
+          With it, only forced synchronizations and ones after interval
+          seconds since the last full one. */
+          char full = 1;
+          if (adaptive)
+          {
+            time_t now = time(NULL);
+            full = forcedSynchronization != 0 ||
+              now - lastFullSynchronization >= (time_t)params->interval;
+            if (full)
+              lastFullSynchronization = now;
+          }
+          /* If the whole directory will be synchronized, forget subdirectories
+          queued using the control socket. */
+          if (full)
+            controlDiscardPaths();
+          /* Mark the beginning of the cycle. Treat all directories as due
+          if the synchronization is full. */
+          beginCycle(context, full);
+          /* Synchronize the entries matching the priority patterns and then
+          the whole directories. Ignore errors but write the status code
+          to the log. 0 means that the entire synchronization went without
+          errors. Value different from 0 means that directories may be
+          not fully synchronized. */
+          int status = dirsyncSynchronize(context, NULL);
+          // Mark the end of the cycle.
+          endCycle(context, status, params->metricsFile);
+          /* In the log, write a message about finishing the synchronization
+          with status code. */
+          logMessage(LOG_INFO, full ? "finishing synchronization; %i" :
+            "finishing adaptive synchronization; %i", status);
+        }
+        // If only subdirectories were requested with signal SIGUSR2
+        else
+        {
+          // Mark the beginning of the cycle.
+          beginCycle(context, 0);
+          // Synchronize the subdirectories queued using the control socket.
+          /* Synchronize them regardless of adaptive scanning (only possible
+          with recursive synchronization). */
+          endCycle(context, synchronizeTargets(context), params->metricsFile);
+        }
+        /* Regardless of whether the synchronization was forced, requested
+        or automatic (after sleeping for the entire sleep time),
+        set 0 after its finish. */
         forcedSynchronization = 0;
+        targetedSynchronization = 0;
         /* Stop blocking signals from the set (SIGUSR1 and SIGTERM).
         If an error occured */
         if (sigprocmask(SIG_UNBLOCK, &set, NULL) == -1)
@@ -413,28 +1127,34 @@ void runDaemon(char *source, char *destination, unsigned int interval,
         the daemon stops. Otherwise a third synchronization is performed, etc.
         After finishing the first synchronization in the series
         during which SIGUSR1 is not received, the daemon stops. */
-        // If no next synchronization was forced but stopping was
-        if (forcedSynchronization == 0 && stop == 1)
+        /* If no next synchronization was forced nor requested
+        but stopping was */
+        if (forcedSynchronization == 0 && targetedSynchronization == 0 &&
+          stop == 1)
           // Break the loop.
           break;
       }
     }
   }
   // If an error occured somewhere, go here.
-  // If memory for source directory path was reserved
-  if (sourcePath != NULL)
-    // Release memory.
-    free(sourcePath);
-  // If memory for target directory path was reserved
-  if (destinationPath != NULL)
-    // Release memory.
-    free(destinationPath);
-  // Open connection to the log.
-  openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
+  // Stop the control thread if it was started and remove the socket.
+  controlStop();
+  // Finish the queued files and stop the pipeline if it was started.
+  pipelineStop();
+  // Stop the prefetching threads if they were started.
+  prefetchStop();
+  // Stop the partitioning threads if they were started.
+  partitionStop();
+  // Stop rewriting the status file and remove it if it was written.
+  progressStop();
+  // Stop recording spans.
+  traceStop();
+  // Release the context if it was created.
+  dirsyncDestroy(context);
   // In the log, write a message about daemon stop with status code.
-  syslog(LOG_INFO, "stopping; %i", ret);
-  // Close the connection to the log.
-  closelog();
+  logMessage(LOG_INFO, "stopping; %i", ret);
+  // Write the queued messages and stop the thread writing the log.
+  loggerStop();
   // Stop the daemon process.
   exit(ret);
 }
@@ -0,0 +1,48 @@
+#include "allocation.h"
+
+#include <stddef.h>
+
+#ifdef COUNTALLOCATIONS
+// Implementations of the C library (glibc) called by the replacements.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+// Number of heap allocations.
+static unsigned long long allocations;
+
+void *malloc(size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(pointer, size);
+}
+
+// Replaced together with malloc as required by the C library.
+void free(void *pointer)
+{
+  __libc_free(pointer);
+}
+
+unsigned long long allocationCount(void)
+{
+  return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+#else
+unsigned long long allocationCount(void)
+{
+  return 0;
+}
+#endif
@@ -0,0 +1,114 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+
+// Minimal size in bytes of a block reserved on the heap.
+#define BLOCKSIZE (1024 * 1024)
+// Alignment of every allocation.
+#define ALIGNMENT alignof(max_align_t)
+
+/*
+Block of memory reserved on the heap. Blocks form a list; the blocks
+  after the current one are free.
+*/
+struct arenaBlock
+{
+  // Next block.
+  arenaBlock *next;
+  // Size of the data in bytes.
+  size_t size;
+  // Number of bytes of the data allocated.
+  size_t used;
+  // Data.
+  alignas(ALIGNMENT) char data[];
+};
+
+// First block and block from which memory is currently allocated.
+static arenaBlock *first, *current;
+// Number of blocks reserved on the heap.
+static unsigned long blocks;
+
+/*
+Reserves a new block on the heap.
+reads:
+size - minimal size of the data in bytes
+returns:
+NULL if an error occured
+created block otherwise
+*/
+static arenaBlock *createBlock(size_t size)
+{
+  if (size < BLOCKSIZE)
+    size = BLOCKSIZE;
+  arenaBlock *block = malloc(sizeof(arenaBlock) + size);
+  if (block == NULL)
+    return NULL;
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  ++blocks;
+  return block;
+}
+
+void *arenaAllocate(size_t size)
+{
+  // Round the size up so that the next allocation is aligned too.
+  size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  // On first use, reserve the first block.
+  if (current == NULL)
+  {
+    if ((first = createBlock(size)) == NULL)
+      return NULL;
+    current = first;
+  }
+  // If the memory does not fit in the current block, go to a free one.
+  while (current->size - current->used < size)
+  {
+    // If there is no free block big enough, insert a new one.
+    if (current->next == NULL || current->next->size < size)
+    {
+      arenaBlock *block = createBlock(size);
+      if (block == NULL)
+        return NULL;
+      block->next = current->next;
+      current->next = block;
+    }
+    current = current->next;
+    // Blocks after the current one are free.
+    current->used = 0;
+  }
+  void *memory = current->data + current->used;
+  current->used += size;
+  return memory;
+}
+
+arenaMark arenaSave(void)
+{
+  arenaMark mark = {current, current != NULL ? current->used : 0};
+  return mark;
+}
+
+void arenaRestore(arenaMark mark)
+{
+  // If nothing was allocated when the position was saved
+  if (mark.block == NULL)
+    arenaReset();
+  else
+  {
+    current = mark.block;
+    current->used = mark.used;
+  }
+}
+
+void arenaReset(void)
+{
+  current = first;
+  if (current != NULL)
+    current->used = 0;
+}
+
+unsigned long arenaBlocks(void)
+{
+  return blocks;
+}
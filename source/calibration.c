@@ -0,0 +1,305 @@
+#include "calibration.h"
+#include "file.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// Size in bytes of the chunk written to scratch files.
+#define CHUNKSIZE (64 * 1024)
+
+// Path of the calibration file or an empty string if calibration is disabled.
+static char calibrationPath[PATH_MAX];
+/* Template of the path of the scratch directory in the target directory
+and the paths of the scratch file and of its copy in it. */
+static char directoryPath[PATH_MAX], scratchPath[PATH_MAX],
+  copyPath[PATH_MAX];
+// Device of the target directory.
+static dev_t device;
+// Set by calibrationRequest; changed atomically.
+static char requested;
+
+int calibrationStart(const char *directory, const char *targetPath)
+{
+  struct stat target;
+  if (stat(targetPath, &target) == -1)
+    return -2;
+  device = target.st_dev;
+  // targetPath ends with '/'.
+  if (snprintf(calibrationPath, sizeof(calibrationPath),
+    "%s/dirsyncd-%u-%u.calibration", directory, major(device), minor(device))
+    >= (int)sizeof(calibrationPath) ||
+    // Leave room for the longest scratch file name, '/scratch'.
+    snprintf(directoryPath, sizeof(directoryPath),
+    "%s.dirsyncd-calibration-XXXXXX", targetPath) + 9 >=
+    (int)sizeof(directoryPath))
+  {
+    calibrationPath[0] = '\0';
+    return -1;
+  }
+  return 0;
+}
+
+int calibrationEnabled(void)
+{
+  return calibrationPath[0] != '\0';
+}
+
+void calibrationRequest(void)
+{
+  __atomic_store_n(&requested, 1, __ATOMIC_RELAXED);
+}
+
+int calibrationRequested(void)
+{
+  return __atomic_exchange_n(&requested, 0, __ATOMIC_RELAXED);
+}
+
+/*
+Reads the threshold from the calibration file.
+writes:
+threshold - saved threshold
+returns:
+1 if a threshold was saved
+0 otherwise
+*/
+static int loadThreshold(unsigned long long *threshold)
+{
+  char name[32];
+  unsigned long long value;
+  int found = 0;
+  FILE *file = fopen(calibrationPath, "r");
+  if (file == NULL)
+    return 0;
+  // The measurements saved with the threshold are ignored.
+  while (fscanf(file, "%31s %llu", name, &value) == 2)
+    if (strcmp(name, "threshold") == 0)
+    {
+      *threshold = value;
+      found = 1;
+    }
+  fclose(file);
+  return found;
+}
+
+/*
+Writes the threshold and the measurements to the calibration file.
+  The file is replaced atomically so a crash never leaves it half-written.
+reads:
+threshold - calibrated threshold
+small, big - median latencies in nanoseconds of copySmallFile
+  and copyBigFile for every size
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int saveThreshold(unsigned long long threshold,
+  const unsigned long long *small, const unsigned long long *big)
+{
+  char temporary[PATH_MAX + 4];
+  unsigned int i;
+  snprintf(temporary, sizeof(temporary), "%s.new", calibrationPath);
+  FILE *file = fopen(temporary, "w");
+  if (file == NULL)
+    return -1;
+  fprintf(file, "threshold %llu\n", threshold);
+  for (i = 0; i < CALIBRATIONSIZES; ++i)
+    fprintf(file, "small-%llu %llu\nbig-%llu %llu\n", 65536ULL << (2 * i),
+      small[i], 65536ULL << (2 * i), big[i]);
+  if (fclose(file) == EOF || rename(temporary, calibrationPath) == -1)
+    return -1;
+  return 0;
+}
+
+/*
+Creates the scratch file and writes it back to the disk so that the copies
+  do not wait for its writeback.
+reads:
+size - size in bytes of the file
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int createScratch(unsigned long long size)
+{
+  static char chunk[CHUNKSIZE];
+  unsigned int i;
+  // The contents do not matter as long as the file is not sparse.
+  for (i = 0; i < CHUNKSIZE; ++i)
+    chunk[i] = (char)i;
+  int descriptor = open(scratchPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (descriptor == -1)
+    return -1;
+  unsigned long long left = size;
+  while (left > 0)
+  {
+    ssize_t written = write(descriptor, chunk,
+      left < CHUNKSIZE ? left : CHUNKSIZE);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1)
+    {
+      close(descriptor);
+      return -1;
+    }
+    left -= written;
+  }
+  if (fsync(descriptor) == -1)
+  {
+    close(descriptor);
+    return -1;
+  }
+  return close(descriptor);
+}
+
+/*
+Copies the scratch file with a copy function, writes the copy back
+  to the disk and removes it. The pages of the scratch file are dropped
+  from the page cache first so that the copy reads the disk like
+  a synchronization of a file which was not read recently.
+reads:
+big - if not 0, copyBigFile is used, otherwise copySmallFile
+size - size in bytes of the scratch file
+writes:
+latency - latency in nanoseconds of the copy
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int measureCopy(char big, unsigned long long size,
+  unsigned long long *latency)
+{
+  const struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+  int descriptor = open(scratchPath, O_RDONLY);
+  if (descriptor == -1)
+    return -1;
+  // The scratch file was written back so its pages are clean and dropped.
+  posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+  close(descriptor);
+  unsigned long long start = metricsNow();
+  int status = big ?
+    copyBigFile(scratchPath, copyPath, size, 0600, &times[0], &times[1]) :
+    copySmallFile(scratchPath, copyPath, 0600, &times[0], &times[1]);
+  /* The copy functions leave the writeback to the kernel, which would
+  delay the next copies instead of this one. */
+  if (status >= 0 && ((descriptor = open(copyPath, O_WRONLY)) == -1 ||
+    fsync(descriptor) == -1))
+    status = -1;
+  *latency = metricsNow() - start;
+  int error = errno;
+  if (descriptor != -1)
+    close(descriptor);
+  unlink(copyPath);
+  errno = error;
+  // Non-critical errors, e.g. a rejected advice, do not spoil the copy.
+  return status < 0 ? -1 : 0;
+}
+
+/*
+Sorts latencies in ascending order.
+reads:
+count - number of latencies
+writes:
+latencies - latencies
+*/
+static void sortLatencies(unsigned long long *latencies, unsigned int count)
+{
+  unsigned int i, j;
+  // Insertion sort of a few elements.
+  for (i = 1; i < count; ++i)
+  {
+    unsigned long long latency = latencies[i];
+    for (j = i; j > 0 && latencies[j - 1] > latency; --j)
+      latencies[j] = latencies[j - 1];
+    latencies[j] = latency;
+  }
+}
+
+/*
+Measures the median latencies of both copy functions for every size.
+  The scratch files are created in a new directory with a unique name
+  so that no file of the target directory is overwritten.
+writes:
+small, big - median latencies in nanoseconds of copySmallFile
+  and copyBigFile for every size
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int measureSizes(unsigned long long *small, unsigned long long *big)
+{
+  unsigned long long runs[2][CALIBRATIONRUNS];
+  unsigned int i, run;
+  char directory[PATH_MAX];
+  strcpy(directory, directoryPath);
+  if (mkdtemp(directory) == NULL)
+    return -1;
+  // calibrationStart checked that the template fits the file names.
+  if (snprintf(scratchPath, sizeof(scratchPath), "%s/scratch", directory)
+    >= (int)sizeof(scratchPath) || snprintf(copyPath, sizeof(copyPath),
+    "%s/copy", directory) >= (int)sizeof(copyPath))
+  {
+    rmdir(directory);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  int status = 0;
+  for (i = 0; status == 0 && i < CALIBRATIONSIZES; ++i)
+  {
+    unsigned long long size = 65536ULL << (2 * i);
+    status = createScratch(size);
+    // Alternate the functions so that both suffer the same disturbances.
+    for (run = 0; status == 0 && run < CALIBRATIONRUNS; ++run)
+      if (measureCopy(0, size, &runs[0][run]) == -1 ||
+        measureCopy(1, size, &runs[1][run]) == -1)
+        status = -1;
+    if (status == -1)
+      break;
+    sortLatencies(runs[0], CALIBRATIONRUNS);
+    sortLatencies(runs[1], CALIBRATIONRUNS);
+    small[i] = runs[0][CALIBRATIONRUNS / 2];
+    big[i] = runs[1][CALIBRATIONRUNS / 2];
+    logMessage(LOG_INFO, "calibration: %llu bytes copied in %.3f ms "
+      "(small) and %.3f ms (big)", size, small[i] / 1e6, big[i] / 1e6);
+  }
+  int error = errno;
+  unlink(scratchPath);
+  rmdir(directory);
+  errno = error;
+  return status;
+}
+
+int calibrationThreshold(char force, unsigned long long *threshold)
+{
+  unsigned long long small[CALIBRATIONSIZES], big[CALIBRATIONSIZES];
+  unsigned int i;
+  if (!force && loadThreshold(threshold))
+  {
+    logMessage(LOG_INFO, "calibration: using big file threshold %llu "
+      "of device %u:%u from %s", *threshold, major(device), minor(device),
+      calibrationPath);
+    return 0;
+  }
+  if (measureSizes(small, big) == -1)
+    return -1;
+  /* Find the smallest size at which copyBigFile wins and from which it does
+  not clearly lose; similar latencies differ by noise. */
+  *threshold = ULLONG_MAX;
+  for (i = CALIBRATIONSIZES; i > 0 && big[i - 1] < small[i - 1] *
+    (1 + CALIBRATIONMARGIN / 100.0); --i)
+    if (big[i - 1] < small[i - 1])
+      *threshold = 65536ULL << (2 * (i - 1));
+  logMessage(LOG_INFO, "calibration: big file threshold %llu for device "
+    "%u:%u", *threshold, major(device), minor(device));
+  if (saveThreshold(*threshold, small, big) == -1)
+    return -2;
+  return 0;
+}
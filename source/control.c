@@ -0,0 +1,475 @@
+#include "control.h"
+#include "calibration.h"
+#include "metrics.h"
+#include "progress.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// Maximal number of subdirectory paths queued with command trigger-path.
+#define MAXPENDINGPATHS 16
+// Maximal length of a command line together with its '\n'.
+#define MAXCOMMANDLENGTH (PATH_MAX + 32)
+/* Time in milliseconds after which the control thread checks if it should
+stop even if no client connects. */
+#define POLLTIMEOUT 500
+// Time in seconds after which a silent client is disconnected.
+#define CLIENTTIMEOUT 5
+
+/* Protects all variables below which are shared between the control thread
+and the synchronizing thread. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a paused synchronization is resumed or cancelled.
+static pthread_cond_t unpaused = PTHREAD_COND_INITIALIZER;
+// Thread woken with signals when a synchronization is requested.
+static pthread_t synchronizingThread;
+// Thread serving the control socket.
+static pthread_t controlThread;
+// Descriptor of the listening socket or -1 if the socket does not exist.
+static int listener = -1;
+// Set to 0 to stop the control thread.
+static char running;
+// Recursive directory synchronization (boolean); changed atomically.
+static char recursiveSynchronization;
+// Path of the listening socket, removed on stop.
+static char socketFilePath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+// Flags read without locking the mutex by controlCheckpoint.
+static char synchronizing, paused, cancelled;
+// Number of finished synchronization cycles.
+static unsigned long long cycles;
+// Status code of the last finished synchronization.
+static int lastStatus;
+// Number of directory entries processed in the current cycle.
+static unsigned long long processed;
+// Directory being currently synchronized.
+static char currentDirectory[PATH_MAX];
+// Queue of subdirectory paths requested with command trigger-path.
+static char pendingPaths[MAXPENDINGPATHS][PATH_MAX];
+// Number of paths in the queue.
+static unsigned int pendingCount;
+
+/*
+Checks if a path given in command trigger-path is relative and does not
+  leave the source directory.
+reads:
+path - path relative to the source directory
+returns:
+1 if the path is valid
+0 otherwise
+*/
+static int subPathValid(const char *path)
+{
+  // An empty or absolute path is invalid.
+  if (path[0] == '\0' || path[0] == '/')
+    return 0;
+  const char *component = path;
+  while (*component != '\0')
+  {
+    // Find the end of the current path component.
+    size_t length = strcspn(component, "/");
+    // Component '..' would leave the source directory.
+    if (length == 2 && component[0] == '.' && component[1] == '.')
+      return 0;
+    // Move to the next component skipping '/'.
+    component += length;
+    if (*component == '/')
+      ++component;
+  }
+  return 1;
+}
+
+/*
+Sends a string to a client. Errors are ignored because the client may have
+  already disconnected and it does not affect the daemon.
+reads:
+client - descriptor of the client's socket
+text - string to be sent
+*/
+static void sendText(int client, const char *text)
+{
+  size_t remainingBytes = strlen(text);
+  while (remainingBytes != 0)
+  {
+    // MSG_NOSIGNAL prevents SIGPIPE if the client has disconnected.
+    ssize_t bytesSent = send(client, text, remainingBytes, MSG_NOSIGNAL);
+    if (bytesSent == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    remainingBytes -= bytesSent;
+    text += bytesSent;
+  }
+}
+
+/*
+Executes a single command and sends the response to the client.
+reads:
+client - descriptor of the client's socket
+command - command line without '\n'
+*/
+static void executeCommand(int client, char *command)
+{
+  // Buffer for the response of command status.
+  char response[PATH_MAX + 256];
+  if (strcmp(command, "trigger-full") == 0)
+  {
+    pthread_mutex_lock(&mutex);
+    int isPaused = paused;
+    pthread_mutex_unlock(&mutex);
+    if (isPaused)
+      sendText(client, "error synchronization paused\n");
+    /* Wake the synchronizing thread exactly like signal SIGUSR1 sent
+    by the user. */
+    else if (pthread_kill(synchronizingThread, SIGUSR1) != 0)
+      sendText(client, "error cannot wake the daemon\n");
+    else
+      sendText(client, "ok\n");
+  }
+  else if (strncmp(command, "trigger-path ", 13) == 0)
+  {
+    char *subPath = command + 13;
+    // Remove trailing '/' characters because they are appended later.
+    size_t length = strlen(subPath);
+    while (length > 1 && subPath[length - 1] == '/')
+      subPath[--length] = '\0';
+    if (__atomic_load_n(&recursiveSynchronization, __ATOMIC_RELAXED) == 0)
+      sendText(client, "error requires recursive synchronization\n");
+    // Commands are longer than the slots of the queue.
+    else if (length >= PATH_MAX)
+      sendText(client, "error path too long\n");
+    else if (!subPathValid(subPath))
+      sendText(client, "error invalid path\n");
+    else
+    {
+      pthread_mutex_lock(&mutex);
+      int isPaused = paused, queued = 0;
+      if (!isPaused && pendingCount < MAXPENDINGPATHS)
+      {
+        // Append the path to the queue.
+        memcpy(pendingPaths[pendingCount++], subPath, length + 1);
+        queued = 1;
+      }
+      pthread_mutex_unlock(&mutex);
+      if (isPaused)
+        sendText(client, "error synchronization paused\n");
+      else if (!queued)
+        sendText(client, "error too many pending paths\n");
+      // Wake the synchronizing thread to synchronize the queued path.
+      else if (pthread_kill(synchronizingThread, SIGUSR2) != 0)
+        sendText(client, "error cannot wake the daemon\n");
+      else
+        sendText(client, "ok\n");
+    }
+  }
+  else if (strcmp(command, "status") == 0)
+  {
+    pthread_mutex_lock(&mutex);
+    snprintf(response, sizeof(response),
+      "state: %s\npaused: %i\ncycles: %llu\nlast status: %i\n"
+      "entries processed: %llu\nfiles copied: %llu\nbytes copied: %llu\n"
+      "errors: %llu\nmax staleness: %.3f s\ncurrent directory: %s\n"
+      "pending paths: %u\nok\n",
+      synchronizing ? "synchronizing" : "sleeping", paused, cycles, lastStatus,
+      __atomic_load_n(&processed, __ATOMIC_RELAXED),
+      metricsGet(METRIC_FILES_COPIED), metricsGet(METRIC_BYTES_COPIED),
+      metricsGet(METRIC_ERRORS), metricsMaxStaleness() / 1e9,
+      synchronizing ? currentDirectory : "",
+      pendingCount);
+    pthread_mutex_unlock(&mutex);
+    sendText(client, response);
+  }
+  else if (strcmp(command, "progress") == 0)
+  {
+    // Only the control thread executes commands.
+    static char summary[PROGRESSLENGTH + 4];
+    size_t length = progressFormat(summary, PROGRESSLENGTH);
+    strcpy(summary + length, "ok\n");
+    sendText(client, summary);
+  }
+  else if (strcmp(command, "pause") == 0)
+  {
+    pthread_mutex_lock(&mutex);
+    __atomic_store_n(&paused, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex);
+    sendText(client, "ok\n");
+  }
+  else if (strcmp(command, "resume") == 0)
+  {
+    pthread_mutex_lock(&mutex);
+    __atomic_store_n(&paused, 0, __ATOMIC_RELAXED);
+    // Wake the synchronization blocked in controlCheckpoint.
+    pthread_cond_broadcast(&unpaused);
+    pthread_mutex_unlock(&mutex);
+    sendText(client, "ok\n");
+  }
+  else if (strcmp(command, "calibrate") == 0)
+  {
+    if (!calibrationEnabled())
+      sendText(client, "error calibration disabled\n");
+    else
+    {
+      calibrationRequest();
+      /* Wake the synchronizing thread like signal SIGUSR1 so that it
+      calibrates before the next synchronization. */
+      if (pthread_kill(synchronizingThread, SIGUSR1) != 0)
+        sendText(client, "error cannot wake the daemon\n");
+      else
+        sendText(client, "ok\n");
+    }
+  }
+  else if (strcmp(command, "cancel-current-cycle") == 0)
+  {
+    if (controlCancel())
+      sendText(client, "ok\n");
+    else
+      sendText(client, "error no synchronization in progress\n");
+  }
+  else
+    sendText(client, "error unknown command\n");
+}
+
+/*
+Reads commands from a client until it disconnects, sends an overlong line
+  or is silent for CLIENTTIMEOUT seconds.
+reads:
+client - descriptor of the client's socket
+*/
+static void serveClient(int client)
+{
+  char buffer[MAXCOMMANDLENGTH];
+  // Number of bytes stored in the buffer.
+  size_t length = 0;
+  while (1)
+  {
+    ssize_t bytesRead = recv(client, buffer + length,
+      sizeof(buffer) - 1 - length, 0);
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    // End of stream, timeout or another error.
+    if (bytesRead <= 0)
+      return;
+    length += bytesRead;
+    buffer[length] = '\0';
+    char *line = buffer, *newLine;
+    // Execute every complete line.
+    while ((newLine = strchr(line, '\n')) != NULL)
+    {
+      *newLine = '\0';
+      // Accept lines ended with "\r\n" sent by tools like telnet.
+      if (newLine > line && newLine[-1] == '\r')
+        newLine[-1] = '\0';
+      if (line[0] != '\0')
+        executeCommand(client, line);
+      line = newLine + 1;
+    }
+    // Move the incomplete line to the beginning of the buffer.
+    length -= line - buffer;
+    memmove(buffer, line, length);
+    // The line does not fit into the buffer.
+    if (length == sizeof(buffer) - 1)
+    {
+      sendText(client, "error command too long\n");
+      return;
+    }
+  }
+}
+
+/*
+Function of the control thread. Accepts clients one after another.
+reads:
+argument - unused
+*/
+static void *controlMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  struct pollfd pfd = {listener, POLLIN, 0};
+  const struct timeval timeout = {CLIENTTIMEOUT, 0};
+  while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    // Wait for a client, periodically checking if the thread should stop.
+    if (poll(&pfd, 1, POLLTIMEOUT) <= 0)
+      continue;
+    int client = accept(listener, NULL, NULL);
+    if (client == -1)
+      continue;
+    // Do not let a silent client block other clients forever.
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    serveClient(client);
+    close(client);
+  }
+  return NULL;
+}
+
+int controlStart(const char *socketPath, pthread_t mainThread, char recursive)
+{
+  struct sockaddr_un address;
+  // The socket path must fit into sun_path together with '\0'.
+  if (strlen(socketPath) >= sizeof(address.sun_path))
+    return -1;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath);
+  if ((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    return -2;
+  // Remove a socket left by a previous daemon which was killed.
+  unlink(socketPath);
+  /* Create the socket accessible only to the daemon's user because
+  the commands control the synchronization. */
+  mode_t previousMask = umask(0077);
+  int status = bind(listener, (struct sockaddr *)&address, sizeof(address));
+  umask(previousMask);
+  if (status == -1 || listen(listener, 8) == -1)
+  {
+    close(listener);
+    listener = -1;
+    return -3;
+  }
+  strcpy(socketFilePath, socketPath);
+  synchronizingThread = mainThread;
+  recursiveSynchronization = recursive;
+  running = 1;
+  sigset_t set, previousSet;
+  /* Block the daemon's signals in the control thread (it inherits the mask)
+  so that the signals sent to the process are handled
+  by the synchronizing thread. */
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  sigaddset(&set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &set, &previousSet);
+  status = pthread_create(&controlThread, NULL, controlMain, NULL);
+  pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+  if (status != 0)
+  {
+    close(listener);
+    listener = -1;
+    unlink(socketFilePath);
+    return -4;
+  }
+  return 0;
+}
+
+void controlStop(void)
+{
+  // If the control thread was not started
+  if (listener == -1)
+    return;
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  pthread_join(controlThread, NULL);
+  close(listener);
+  listener = -1;
+  unlink(socketFilePath);
+}
+
+void controlSetRecursive(char recursive)
+{
+  __atomic_store_n(&recursiveSynchronization, recursive, __ATOMIC_RELAXED);
+}
+
+int controlPaused(void)
+{
+  pthread_mutex_lock(&mutex);
+  int isPaused = paused;
+  pthread_mutex_unlock(&mutex);
+  return isPaused;
+}
+
+void controlBeginCycle(void)
+{
+  pthread_mutex_lock(&mutex);
+  synchronizing = 1;
+  __atomic_store_n(&cancelled, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&processed, 0, __ATOMIC_RELAXED);
+  currentDirectory[0] = '\0';
+  pthread_mutex_unlock(&mutex);
+}
+
+void controlEndCycle(int status)
+{
+  pthread_mutex_lock(&mutex);
+  synchronizing = 0;
+  ++cycles;
+  lastStatus = status;
+  pthread_mutex_unlock(&mutex);
+}
+
+void controlEnterDirectory(const char *path)
+{
+  pthread_mutex_lock(&mutex);
+  strncpy(currentDirectory, path, PATH_MAX - 1);
+  currentDirectory[PATH_MAX - 1] = '\0';
+  pthread_mutex_unlock(&mutex);
+}
+
+int controlCheckpoint(void)
+{
+  /* The scanner and the partition threads (partition.h) count entries,
+  so processed is incremented atomically without the mutex. */
+  __atomic_add_fetch(&processed, 1, __ATOMIC_RELAXED);
+  // Fast path taken almost always: neither paused nor cancelled.
+  if (!__atomic_load_n(&paused, __ATOMIC_RELAXED) &&
+    !__atomic_load_n(&cancelled, __ATOMIC_RELAXED))
+    return 0;
+  pthread_mutex_lock(&mutex);
+  // Wait until the synchronization is resumed or cancelled.
+  while (paused && !cancelled)
+    pthread_cond_wait(&unpaused, &mutex);
+  int ret = cancelled ? -1 : 0;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+int controlCancel(void)
+{
+  pthread_mutex_lock(&mutex);
+  int wasSynchronizing = synchronizing;
+  if (wasSynchronizing)
+  {
+    __atomic_store_n(&cancelled, 1, __ATOMIC_RELAXED);
+    // Wake the synchronization if it is paused so that it can stop.
+    pthread_cond_broadcast(&unpaused);
+  }
+  pthread_mutex_unlock(&mutex);
+  return wasSynchronizing;
+}
+
+int controlCancelled(void)
+{
+  return __atomic_load_n(&cancelled, __ATOMIC_RELAXED) ? 1 : 0;
+}
+
+int controlNextPath(char *subPath)
+{
+  pthread_mutex_lock(&mutex);
+  int ret = 0;
+  if (pendingCount != 0)
+  {
+    strcpy(subPath, pendingPaths[0]);
+    // Shift the remaining paths to keep the requests' order.
+    memmove(pendingPaths[0], pendingPaths[1],
+      sizeof(pendingPaths[0]) * --pendingCount);
+    ret = 1;
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void controlDiscardPaths(void)
+{
+  pthread_mutex_lock(&mutex);
+  pendingCount = 0;
+  pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,180 @@
+#include "device.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+
+// Maximal number of tracked devices; copies on further devices are unlimited.
+#define DEVICES 32
+
+typedef struct device device;
+/*
+Block device with its limit and number of running copies.
+*/
+struct device
+{
+  dev_t id;
+  // Maximal number of concurrent copies or 0 if unlimited.
+  unsigned int limit;
+  // Number of running copies.
+  unsigned int running;
+};
+
+// Known devices and their number.
+static device devices[DEVICES];
+static unsigned int deviceCount;
+// Guards the devices; signalled when a copy releases its slots.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t released = PTHREAD_COND_INITIALIZER;
+
+/*
+Reads a number from a file of the queue directory of a device.
+reads:
+id - device
+name - file name, e.g. 'rotational'
+writes:
+value - read number
+returns:
+-1 if the file could not be read
+0 if no error occured
+*/
+static int readQueue(dev_t id, const char *name, unsigned int *value)
+{
+  char path[128];
+  // A partition has no queue so the queue of its disk is read.
+  const char *formats[] = { "/sys/dev/block/%u:%u/queue/%s",
+    "/sys/dev/block/%u:%u/../queue/%s" };
+  unsigned int i;
+  for (i = 0; i < 2; ++i)
+  {
+    snprintf(path, sizeof(path), formats[i], major(id), minor(id), name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+      continue;
+    int count = fscanf(file, "%u", value);
+    fclose(file);
+    if (count == 1)
+      return 0;
+  }
+  return -1;
+}
+
+/*
+Derives the limit of a device from its queue.
+reads:
+id - device
+returns:
+maximal number of concurrent copies or 0 if unlimited
+*/
+static unsigned int queueLimit(dev_t id)
+{
+  unsigned int rotational, requests, limit;
+  if (readQueue(id, "rotational", &rotational) < 0)
+    return 0;
+  if (rotational)
+    return DEVICEROTATIONAL;
+  limit = readQueue(id, "nr_requests", &requests) < 0 ?
+    DEVICEMINIMUM : requests / 2;
+  if (limit < DEVICEMINIMUM)
+    return DEVICEMINIMUM;
+  if (limit > DEVICEMAXIMUM)
+    return DEVICEMAXIMUM;
+  return limit;
+}
+
+/*
+Finds a known device. Must be called with the lock held.
+reads:
+id - device
+returns:
+NULL if the device is not tracked
+device otherwise
+*/
+static device *findDevice(dev_t id)
+{
+  unsigned int i;
+  for (i = 0; i < deviceCount; ++i)
+    if (devices[i].id == id)
+      return &devices[i];
+  return NULL;
+}
+
+/*
+Adds a device with the limit derived from its queue unless it is known
+  or the table is full. The queue is read without the lock held so that
+  copies on known devices do not wait for it. Must be called without
+  the lock held.
+reads:
+id - device
+*/
+static void addDevice(dev_t id)
+{
+  pthread_mutex_lock(&lock);
+  int known = findDevice(id) != NULL || deviceCount == DEVICES;
+  pthread_mutex_unlock(&lock);
+  if (known)
+    return;
+  unsigned int limit = queueLimit(id);
+  pthread_mutex_lock(&lock);
+  // Another copy may have added the device in the meantime.
+  int added = findDevice(id) == NULL && deviceCount < DEVICES;
+  if (added)
+  {
+    device *d = &devices[deviceCount++];
+    d->id = id;
+    d->limit = limit;
+    d->running = 0;
+  }
+  pthread_mutex_unlock(&lock);
+  if (added)
+    logMessage(LOG_INFO, "device %u:%u allows %u concurrent copies "
+      "(0 - unlimited)", major(id), minor(id), limit);
+}
+
+/*
+Checks if a device has a free slot.
+reads:
+d - device or NULL if untracked
+small - if not 0, the last slot may be taken
+returns:
+1 if a copy may start
+0 otherwise
+*/
+static int available(const device *d, char small)
+{
+  return d == NULL || d->limit == 0 ||
+    d->running + (small ? 0 : 1) < d->limit;
+}
+
+void deviceAcquire(dev_t source, dev_t target, char small)
+{
+  addDevice(source);
+  if (target != source)
+    addDevice(target);
+  pthread_mutex_lock(&lock);
+  device *s = findDevice(source);
+  // A copy within one device takes one slot.
+  device *t = target != source ? findDevice(target) : NULL;
+  while (!available(s, small) || !available(t, small))
+    pthread_cond_wait(&released, &lock);
+  if (s != NULL)
+    ++s->running;
+  if (t != NULL)
+    ++t->running;
+  pthread_mutex_unlock(&lock);
+}
+
+void deviceRelease(dev_t source, dev_t target)
+{
+  pthread_mutex_lock(&lock);
+  device *s = findDevice(source);
+  device *t = target != source ? findDevice(target) : NULL;
+  if (s != NULL)
+    --s->running;
+  if (t != NULL)
+    --t->running;
+  // Waiting copies may need slots of different devices so wake all.
+  pthread_cond_broadcast(&released);
+  pthread_mutex_unlock(&lock);
+}
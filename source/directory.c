@@ -1,12 +1,27 @@
 #include "directory.h"
+#include "arena.h"
 #include "file.h"
+#include "filter.h"
 #include "path.h"
+#include "spill.h"
 
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stddef.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+// Size of the buffer into which directory entries are read.
+#define ENTRIESSIZE 32768
+
+/* Entries returned by system call getdents64 are used as dirent objects
+so their layouts must be the same, which holds for glibc on Linux. */
+_Static_assert(offsetof(struct dirent, d_reclen) == 16 &&
+  offsetof(struct dirent, d_type) == 18 &&
+  offsetof(struct dirent, d_name) == 19,
+  "struct dirent differs from struct linux_dirent64");
 
 int directoryValid(const char *path)
 {
@@ -31,13 +46,20 @@ int createEmptyDirectory(const char *path, mode_t mode)
   return mkdir(path, mode);
 }
 
-int removeDirectoryRecursively(const char *path, const size_t pathLength)
+int openDirectory(const char *path)
+{
+  // Open the directory only for reading its entries.
+  return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int removeDirectoryRecursively(char *path, const size_t pathLength)
 {
   // Initially, set status code indicating no error.
-  int ret = 0;
-  DIR *dir = NULL;
+  int ret = 0, dir = -1;
+  // Save the arena position to release the lists at the end.
+  arenaMark mark = arenaSave();
   // Open the source directory. If an error occured
-  if ((dir = opendir(path)) == NULL)
+  if ((dir = openDirectory(path)) == -1)
     /* Set an error code. After that, the program goes
     to the end of the current function. */
     ret = -1;
@@ -50,66 +72,59 @@ int removeDirectoryRecursively(const char *path, const size_t pathLength)
     // Initialize the subdirectory list.
     initialize(&subdirs);
     // Fill the list. If an error occured
-    if (listFilesAndDirectories(dir, &files, &subdirs) < 0)
+    if (listFilesAndDirectories(dir, &files, &subdirs, NULL, NULL) < 0)
       // Set an error code.
       ret = -2;
     else
     {
-      char *subPath = NULL;
-      // Reserve memory for subdirectory and file paths. If an error occured
-      if ((subPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-        // Set an error code.
-        ret = -3;
-      else
+      /* Build file and subdirectory paths in the buffer of the directory
+      path, after the directory path. */
+      // Save a pointer to the first subdirectory.
+      element *cur = subdirs.first;
+      // Recursively remove subdirectories.
+      while (cur != NULL)
+      {
+        /* Append the subdirectory name to its parent directory path.
+        Function removeDirectoryRecursively demands that
+        the directory path end with '/'. */
+        size_t subPathLength = appendSubdirectoryName(path, pathLength,
+          cur->entry->d_name);
+        // Recursively remove subdirectories. If an error occured
+        if (removeDirectoryRecursively(path, subPathLength) < 0)
+          // Set an error code intended for the calling function.
+          ret = -4;
+        // Move the pointer to the next subdirectory.
+        cur = cur->next;
+      }
+      // Save a pointer to the first file.
+      cur = files.first;
+      // Remove files.
+      while (cur != NULL)
       {
-        /* Copy the directory path as the beginning of its file
-        and subdirectory paths. */
-        strcpy(subPath, path);
-        // Save a pointer to the first subdirectory.
-        element *cur = subdirs.first;
-        // Recursively remove subdirectories.
-        while (cur != NULL)
-        {
-          /* Append the subdirectory name to its parent directory path.
-          Function removeDirectoryRecursively demands that
-          the directory path end with '/'. */
-          size_t subPathLength = appendSubdirectoryName(subPath, pathLength,
-            cur->entry->d_name);
-          // Recursively remove subdirectories. If an error occured
-          if (removeDirectoryRecursively(subPath, subPathLength) < 0)
-            // Set an error code intended for the calling function.
-            ret = -4;
-          // Move the pointer to the next subdirectory.
-          cur = cur->next;
-        }
-        // Save a pointer to the first file.
-        cur = files.first;
-        // Remove files.
-        while (cur != NULL)
-        {
-          // Append the file name to its parent directory path.
-          stringAppend(subPath, pathLength, cur->entry->d_name);
-          // Remove the file. If an error occured
-          if (removeFile(subPath) == -1)
-            // Set an error code.
-            ret = -5;
-          // Move the pointer to the next file.
-          cur = cur->next;
-        }
-        // Release memory intended for file and subdirectory paths.
-        free(subPath);
+        // Append the file name to its parent directory path.
+        stringAppend(path, pathLength, cur->entry->d_name);
+        // Remove the file. If an error occured
+        if (removeFile(path) == -1)
+          // Set an error code.
+          ret = -5;
+        // Move the pointer to the next file.
+        cur = cur->next;
       }
+      // Restore the directory path.
+      path[pathLength] = '\0';
     }
     // Clear file list.
     clear(&files);
     // Clear subdirectory list.
     clear(&subdirs);
   }
+  // Release the directory entries and list nodes.
+  arenaRestore(mark);
   // A critical error occurs if removing any directory entry is unsuccessful.
   /* If the directory was opened, close it. If an error occured
   and the error code is not negative yet,
   thus any critical error has not occured yet */
-  if (dir != NULL && closedir(dir) == -1 && ret >= 0)
+  if (dir != -1 && close(dir) == -1 && ret >= 0)
     // Set a positive error code indicating a non-critical error.
     ret = 1;
   /* If any critical error did not occur, delete the directory.
@@ -121,65 +136,131 @@ int removeDirectoryRecursively(const char *path, const size_t pathLength)
   return ret;
 }
 
-int listFiles(DIR *dir, list *files)
-{
-  struct dirent *entry;
-  // Initially, set errno to 0.
-  errno = 0;
-  // Read a directory entry. If no error occured
-  while ((entry = readdir(dir)) != NULL)
-  {
-    /* If the entry is a regular file, add it to the file list.
-    If an error occured */
-    if (entry->d_type == DT_REG && pushBack(files, entry) < 0)
-      /* Interrupt returning an error code because directory entry lists
-      must be complete for directory comparison during a synchronization. */
-      return -1;
-  }
-  /* If an error occured while reading a directory entry,
-  then readdir returned NULL and set errno to a value not equal to 0. */
-  if (errno != 0)
-    // Return an error code.
-    return -2;
-  // Return the correct ending code.
-  return 0;
-}
-
-int listFilesAndDirectories(DIR *dir, list *files, list *subdirs)
+/*
+Reads all entries of a directory into memory allocated from the arena
+  and adds regular files and, if subdirs is not NULL, subdirectories
+  to the lists. If overflow is not NULL and the lists grow over its limit,
+  they are written to it as sorted runs and their memory is reused.
+  Entries excluded by the rules of scope are skipped.
+reads:
+dir - directory descriptor opened with openDirectory
+writes:
+files - list of regular files located in dir
+subdirs - list of subdirectories located in dir or NULL
+overflow - spill receiving the entries which do not fit in the limit or NULL
+scope - filter rules of the directory (filter.h) or NULL
+returns:
+-1 if an error occured while adding a file
+-2 if an error occured while adding a subdirectory
+-3 if an error occured while reading the entries
+-4 if an error occured while spilling the entries
+0 if no error occured
+*/
+static int listEntries(int dir, list *files, list *subdirs, spill *overflow,
+  const filterScope *scope)
 {
-  struct dirent *entry;
-  // Initially, set errno to 0.
-  errno = 0;
-  // Read a directory entry. If no error occured
-  while ((entry = readdir(dir)) != NULL)
+  /* Buffer into which the entries are read before they are copied
+  to the arena. Only the thread synchronizing directories uses it. */
+  static char buffer[ENTRIESSIZE] __attribute__((aligned(8)));
+  // Save the arena position to reuse the memory of spilled entries.
+  arenaMark mark = arenaSave();
+  // Number of bytes occupied by the entries and list nodes.
+  size_t used = 0;
+  while (1)
   {
-    // If the entry is a regular file
-    if (entry->d_type == DT_REG)
+    // If the lists grew over the limit, spill them and reuse their memory.
+    if (overflow != NULL && overflow->limit != 0 && used > overflow->limit)
     {
-      // Add it to the file list. If an error occured
-      if (pushBack(files, entry) < 0)
-        /* Interrupt returning an error code because directory entry lists
-        must be complete for directory comparison during a synchronization. */
-        return -1;
+      if (spillWrite(overflow, files, subdirs) < 0)
+        return -4;
+      arenaRestore(mark);
+      initialize(files);
+      if (subdirs != NULL)
+        initialize(subdirs);
+      used = 0;
     }
-    // If the entry is a directory
-    else if (entry->d_type == DT_DIR)
+    // Read as many entries as fit in the buffer.
+    long bytesRead = syscall(SYS_getdents64, dir, buffer, ENTRIESSIZE);
+    // If an error occured
+    if (bytesRead == -1)
     {
-      // If its name is other than '.' and '..'
-      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
-        // Add it to the directory list. If an error occured
-        pushBack(subdirs, entry) < 0)
-        // Return an error code.
-        return -2;
+      // If the system call was interrupted by receiving a signal, retry it.
+      if (errno == EINTR)
+        continue;
+      return -3;
     }
-    /* Ignore entries of other types (symbolic links, block devices,
-    character devices, sockets, etc.). */
+    // If all entries were read
+    if (bytesRead == 0)
+      break;
+    /* Copy the entries to the arena because the lists point to them until
+    the arena is restored. If an error occured */
+    char *entries = arenaAllocate(bytesRead);
+    if (entries == NULL)
+      return -3;
+    memcpy(entries, buffer, bytesRead);
+    used += bytesRead;
+    long offset;
+    for (offset = 0; offset < bytesRead;)
+    {
+      struct dirent *entry = (struct dirent *)(entries + offset);
+      // Move to the next entry.
+      offset += entry->d_reclen;
+      // If the entry is a regular file
+      if (entry->d_type == DT_REG)
+      {
+        // Skip excluded files.
+        if (scope != NULL && filterExcluded(scope, entry->d_name, 0))
+          continue;
+        // Add it to the file list. If an error occured
+        if (pushBack(files, entry) < 0)
+          /* Interrupt returning an error code because directory entry lists
+          must be complete for directory comparison during a synchronization. */
+          return -1;
+        used += sizeof(element);
+      }
+      // If the entry is a directory and subdirectories are listed
+      else if (entry->d_type == DT_DIR && subdirs != NULL)
+      {
+        // If its name is other than '.' and '..'
+        if (strcmp(entry->d_name, ".") != 0 &&
+          strcmp(entry->d_name, "..") != 0 &&
+          // and it is not excluded (so it is never opened)
+          (scope == NULL || !filterExcluded(scope, entry->d_name, 1)) &&
+          // Add it to the directory list. If an error occured
+          pushBack(subdirs, entry) < 0)
+          // Return an error code.
+          return -2;
+        used += sizeof(element);
+      }
+      /* Ignore entries of other types (symbolic links, block devices,
+      character devices, sockets, etc.). */
+    }
+  }
+  /* If anything was spilled, spill the rest too so that all entries are
+  read through the merge of the runs. */
+  if (overflow != NULL && overflow->runs != 0)
+  {
+    if (spillWrite(overflow, files, subdirs) < 0)
+      return -4;
+    arenaRestore(mark);
+    initialize(files);
+    if (subdirs != NULL)
+      initialize(subdirs);
   }
-  /* if an error occured while reading a directory entry,
-  then readdir returned NULL and set errno to a value not equal to 0. */
-  if (errno != 0)
-    // Return an error code.
-    return -3;
   // Return the correct ending code.
   return 0;
 }
+
+int listFiles(int dir, list *files, spill *overflow,
+  const filterScope *scope)
+{
+  // Read the entries skipping subdirectories.
+  return listEntries(dir, files, NULL, overflow, scope) < 0 ? -1 : 0;
+}
+
+int listFilesAndDirectories(int dir, list *files, list *subdirs,
+  spill *overflow, const filterScope *scope)
+{
+  // Read the entries.
+  return listEntries(dir, files, subdirs, overflow, scope);
+}
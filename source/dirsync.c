@@ -0,0 +1,312 @@
+#include "dirsync.h"
+#include "arena.h"
+#include "control.h"
+#include "filter.h"
+#include "logger.h"
+#include "metrics.h"
+#include "path.h"
+#include "pipeline.h"
+#include "priority.h"
+#include "probes.h"
+#include "progress.h"
+#include "schedule.h"
+#include "synchronization.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+
+struct dirsync
+{
+  // Passed down to the synchronization (synchronization.h).
+  dirsyncSettings settings;
+  /* If not 0, the settings were replaced since they were applied
+  to the shared modules. */
+  char changed;
+  /* Absolute directory paths ending with '/' in buffers of PATH_MAX bytes
+  in which the synchronization builds the paths of the entries. */
+  char *sourcePath, *destinationPath;
+  size_t sourcePathLength, destinationPathLength;
+  // Function reporting events and its pointer.
+  dirsyncCallback callback;
+  void *user;
+  // Tree of the source directory remembered by adaptive scanning or NULL.
+  scanNode *schedule;
+};
+
+/* Held by the synchronizing context from dirsyncBegin to dirsyncEnd because
+the arena, metrics, pipeline, control socket and filters are shared
+by the process. */
+static pthread_mutex_t engine = PTHREAD_MUTEX_INITIALIZER;
+// Context configuring the shared modules; guarded by engine.
+static dirsync *applied;
+// Guards running so that dirsyncCancel cannot cancel another context.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Synchronizing context or NULL.
+static dirsync *running;
+
+void dirsyncDefaults(dirsyncSettings *settings)
+{
+  memset(settings, 0, sizeof(dirsyncSettings));
+  /* Maximal possible value of unsigned long long int variable so that
+  no file is big. */
+  settings->threshold = ULLONG_MAX;
+}
+
+/*
+Resolves a directory path into an absolute path ending with '/'.
+reads:
+path - directory path
+writes:
+length - length in bytes of the resolved path
+returns:
+NULL if an error occured (errno is set)
+buffer of PATH_MAX bytes with the resolved path otherwise
+*/
+static char *resolve(const char *path, size_t *length)
+{
+  char *buffer = malloc(sizeof(char) * PATH_MAX);
+  if (buffer == NULL)
+    return NULL;
+  if (realpath(path, buffer) == NULL)
+  {
+    free(buffer);
+    return NULL;
+  }
+  *length = strlen(buffer);
+  // If there is no '/' immediately before '\0' (null terminator)
+  if (buffer[*length - 1] != '/')
+    // Insert '/' in place of '\0' and '\0' after it.
+    stringAppend(buffer, (*length)++, "/");
+  return buffer;
+}
+
+/*
+Checks if a context uses adaptive scanning.
+reads:
+context - context
+returns:
+1 if the context uses adaptive scanning
+0 otherwise
+*/
+static int adaptive(const dirsync *context)
+{
+  return context->settings.recursive != 0 &&
+    context->settings.adaptiveInterval != 0;
+}
+
+/*
+Configures the modules shared by the process for a context. The other
+  settings are passed down to the synchronization. Must be called with
+  the engine held.
+writes:
+context - context
+*/
+static void apply(dirsync *context)
+{
+  const dirsyncSettings *s = &context->settings;
+  // Filter rules are matched against paths relative to the source path.
+  filterConfigure(context->sourcePathLength);
+  if (adaptive(context))
+    scheduleConfigure(s->adaptiveInterval, s->maximalInterval);
+  context->changed = 0;
+  applied = context;
+}
+
+dirsync *dirsyncCreate(const char *source, const char *destination,
+  const dirsyncSettings *settings)
+{
+  dirsync *context = calloc(1, sizeof(dirsync));
+  if (context == NULL)
+    return NULL;
+  context->settings = *settings;
+  if ((context->sourcePath = resolve(source, &context->sourcePathLength))
+    == NULL || (context->destinationPath = resolve(destination,
+    &context->destinationPathLength)) == NULL)
+  {
+    dirsyncDestroy(context);
+    return NULL;
+  }
+  return context;
+}
+
+void dirsyncReconfigure(dirsync *context, const dirsyncSettings *settings)
+{
+  context->settings = *settings;
+  // Configure the shared modules again when the context begins.
+  context->changed = 1;
+}
+
+const dirsyncSettings *dirsyncGetSettings(const dirsync *context)
+{
+  return &context->settings;
+}
+
+void dirsyncSetThreshold(dirsync *context, unsigned long long threshold)
+{
+  context->settings.threshold = threshold;
+}
+
+void dirsyncSetCallback(dirsync *context, dirsyncCallback callback,
+  void *user)
+{
+  context->callback = callback;
+  context->user = user;
+}
+
+const char *dirsyncSource(const dirsync *context)
+{
+  return context->sourcePath;
+}
+
+const char *dirsyncDestination(const dirsync *context)
+{
+  return context->destinationPath;
+}
+
+void dirsyncBegin(dirsync *context, char full)
+{
+  pthread_mutex_lock(&engine);
+  // Configure the shared modules if another context configured them last.
+  if (applied != context || context->changed)
+    apply(context);
+  // Reset the progress reported by the control socket and the status file.
+  controlBeginCycle();
+  progressBeginCycle();
+  // Start the spans of the cycle in the trace.
+  traceBeginCycle();
+  PROBE(cycle_start, full);
+  // Zero the counters of the current cycle.
+  metricsBeginCycle();
+  // Reuse the memory of the arena from the beginning.
+  arenaReset();
+  // Start measuring the busy time of the scanner.
+  pipelineBeginCycle();
+  // Treat all directories as due if the synchronization is full.
+  if (adaptive(context))
+    scheduleBeginCycle(full);
+  pthread_mutex_lock(&lock);
+  __atomic_store_n(&running, context, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock);
+}
+
+int dirsyncSynchronize(dirsync *context, const char *subPath)
+{
+  const dirsyncSettings *s = &context->settings;
+  char *sourcePath = context->sourcePath,
+    *destinationPath = context->destinationPath;
+  size_t sourcePathLength = context->sourcePathLength,
+    destinationPathLength = context->destinationPathLength;
+  if (subPath == NULL)
+  {
+    // If priority patterns were given
+    if (priorityCount() != 0)
+    {
+      // Synchronize the matching entries before all other entries.
+      int status = synchronizePriority(s, sourcePath,
+        sourcePathLength, destinationPath, destinationPathLength);
+      /* In the log, write a message about finishing the priority
+      synchronization. */
+      logMessage(LOG_INFO, "finishing priority synchronization; %i", status);
+    }
+    if (adaptive(context))
+    {
+      // If the tree could not be created, it is created in the next cycle.
+      if (context->schedule == NULL)
+        context->schedule = scheduleCreateRoot();
+      return synchronizeAdaptively(s, sourcePath, sourcePathLength,
+        destinationPath, destinationPathLength, context->schedule);
+    }
+    synchronizer synchronize = s->recursive == 0 ?
+      synchronizeNonRecursively : synchronizeRecursively;
+    return synchronize(s, sourcePath, sourcePathLength, destinationPath,
+      destinationPathLength);
+  }
+  /* If the subdirectory path would not fit into PATH_MAX bytes together
+  with '/' and '\0' */
+  if (sourcePathLength + strlen(subPath) + 2 > PATH_MAX ||
+    destinationPathLength + strlen(subPath) + 2 > PATH_MAX)
+    return -20;
+  /* Create the subdirectory paths ending with '/' in the buffers
+  of the context. */
+  size_t subSourcePathLength = appendSubdirectoryName(sourcePath,
+    sourcePathLength, subPath);
+  size_t subDestinationPathLength = appendSubdirectoryName(destinationPath,
+    destinationPathLength, subPath);
+  // Synchronize the subdirectories regardless of adaptive scanning.
+  int ret = (s->recursive ? synchronizeRecursively :
+    synchronizeNonRecursively)(s, sourcePath, subSourcePathLength,
+    destinationPath, subDestinationPathLength);
+  // Restore the directory paths.
+  sourcePath[sourcePathLength] = '\0';
+  destinationPath[destinationPathLength] = '\0';
+  return ret;
+}
+
+void dirsyncEnd(dirsync *context, int status)
+{
+  // Only one context synchronizes so it is the one in running.
+  (void)context;
+  pthread_mutex_lock(&lock);
+  __atomic_store_n(&running, NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock);
+  // Report the finished synchronization to the control socket.
+  controlEndCycle(status);
+  progressEndCycle();
+  PROBE(cycle_end, status, metricsGet(METRIC_FILES_COPIED),
+    metricsGet(METRIC_BYTES_COPIED));
+  // Write the spans of the cycle. If an error occured
+  if (traceEndCycle(status) < 0)
+    // In the log, write a message about the error.
+    logMessage(LOG_WARNING, "writing trace; %i", errno);
+  // Record the busy time of the scanner.
+  pipelineEndCycle();
+  // Accumulate the counters of the finished cycle.
+  metricsEndCycle(status);
+  pthread_mutex_unlock(&engine);
+}
+
+int dirsyncRun(dirsync *context, const char *subPath)
+{
+  dirsyncBegin(context, 1);
+  int status = dirsyncSynchronize(context, subPath);
+  dirsyncEnd(context, status);
+  return status;
+}
+
+int dirsyncCancel(dirsync *context)
+{
+  int ret = 0;
+  pthread_mutex_lock(&lock);
+  if (running == context)
+    ret = controlCancel();
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+void dirsyncDestroy(dirsync *context)
+{
+  if (context == NULL)
+    return;
+  pthread_mutex_lock(&engine);
+  // A later context with the same address has to apply its settings.
+  if (applied == context)
+    applied = NULL;
+  pthread_mutex_unlock(&engine);
+  scheduleDestroy(context->schedule);
+  free(context->sourcePath);
+  free(context->destinationPath);
+  free(context);
+}
+
+void dirsyncNotify(enum dirsyncEvent event, const char *path,
+  unsigned long long bytes, int status)
+{
+  // The context does not change during the cycle so the lock is not needed.
+  dirsync *context = __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+  if (context != NULL && context->callback != NULL)
+    context->callback(context->user, event, path, bytes, status);
+}
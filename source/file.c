@@ -1,4 +1,5 @@
 #include "file.h"
+#include "progress.h"
 
 #include <unistd.h>
 #include <limits.h>
@@ -10,8 +11,17 @@
 #include <sys/mman.h>
 #include <stddef.h>
 
-// Size of the buffer used to copy files.
-#define BUFFERSIZE 4096
+/* Buffer used to copy files. Every thread copying files (the thread
+synchronizing directories or the copier threads of the pipeline) has its own
+buffer. */
+static _Thread_local char copyBuffer[BUFFERMAXIMUM];
+// Number of bytes of the buffer used by a copy.
+static size_t bufferSize = BUFFERSIZE;
+
+void fileSetBufferSize(size_t size)
+{
+  bufferSize = size;
+}
 
 int copySmallFile(const char *srcFilePath, const char *dstFilePath,
   const mode_t dstMode, const struct timespec *dstAccessTime,
@@ -43,105 +53,101 @@ int copySmallFile(const char *srcFilePath, const char *dstFilePath,
       /* Set a non-critical error code because the source file can be read
       even without the advice but less effectively. */
       ret = 1;
-    char *buffer = NULL;
     /* Optimal buffer size for input/output operations on a file can be checked
-    in its metadata read using stat but we use a predefined size. */
-    // Reserve buffer memory. If an error occured
-    if ((buffer = malloc(sizeof(char) * BUFFERSIZE)) == NULL)
-      // Set an error code.
-      ret = -4;
-    else
+    in its metadata read using stat but we use a configured size. The buffer
+    is reused by all copies so that copying does not reserve memory. */
+    char *buffer = copyBuffer;
+    // The size can only change between synchronization cycles.
+    const size_t size = bufferSize;
+    while (1)
     {
-      while (1)
+      // The algorithm below is on page 45.
+      // Position in the buffer.
+      char *position = buffer;
+      // Save the total number of bytes remaining to be read.
+      size_t remainingBytes = size;
+      ssize_t bytesRead;
+      /* While numbers of remaining bytes and bytes read
+      in the current iteration are non-zero. */
+      while (remainingBytes != 0 && (bytesRead =
+        read(in, position, remainingBytes)) != 0)
       {
-        // The algorithm below is on page 45.
-        // Position in the buffer.
-        char *position = buffer;
-        // Save the total number of bytes remaining to be read.
-        size_t remainingBytes = BUFFERSIZE;
-        ssize_t bytesRead;
-        /* While numbers of remaining bytes and bytes read
-        in the current iteration are non-zero. */
-        while (remainingBytes != 0 && (bytesRead =
-          read(in, position, remainingBytes)) != 0)
+        // If an error occured in function read.
+        if (bytesRead == -1)
         {
-          // If an error occured in function read.
-          if (bytesRead == -1)
-          {
-            /* If function read was interrupted by receiving a signal. SIGUSR1
-            and SIGTERM are blocked for the synchronization so those signals
-            cannot cause this error. */
-            if (errno == EINTR)
-              // Retry reading.
-              continue;
-            // If other error occured
-            // Set an error code.
-            ret = -5;
-            // BUFFERSIZE - BUFFERSIZE == 0 so the second loop is not executed
-            remainingBytes = BUFFERSIZE;
-            /* Set 0 so condition if (bytesRead == 0) breaks
-            external loop while (1). */
-            bytesRead = 0;
-            // Break the inner loop.
-            break;
-          }
-          /* Decrease the number of remaining bytes by the number of bytes
-          read in the current iteration and */
-          remainingBytes -= bytesRead;
-          // move the position in the buffer.
-          position += bytesRead;
-        }
-        position = buffer; // page 48
-        /* Save the total number of read bytes that is always less
-        or equal to the buffer size. */
-        remainingBytes = BUFFERSIZE - remainingBytes;
-        ssize_t bytesWritten;
-        /* While numbers of remaining bytes and bytes written
-        in the current iteration are non-zero. */
-        while (remainingBytes != 0 && (bytesWritten =
-          write(out, position, remainingBytes)) != 0)
-        {
-          // If an error occured in function write.
-          if (bytesWritten == -1)
-          {
-            // If function write was interrupted by receiving a signal.
-            if (errno == EINTR)
-              // Retry writing.
-              continue;
-            // If other error occured
-            // Set an error code.
-            ret = -6;
-            /* Set 0 so condition if (bytesRead == 0) breaks
-            external loop while (1). */
-            bytesRead = 0;
-            // Break the inner loop.
-            break;
-          }
-          /* Decrease the number of remaining bytes by the number of bytes
-          written in the current iteration and */
-          remainingBytes -= bytesWritten;
-          // move the position in the buffer.
-          position += bytesWritten;
-        }
-        // If we came to the end of the source file (EOF) or an error occured
-        if (bytesRead == 0)
-          // Break external loop while (1).
+          /* If function read was interrupted by receiving a signal. SIGUSR1
+          and SIGTERM are blocked for the synchronization so those signals
+          cannot cause this error. */
+          if (errno == EINTR)
+            // Retry reading.
+            continue;
+          // If other error occured
+          // Set an error code.
+          ret = -5;
+          // size - size == 0 so the second loop is not executed
+          remainingBytes = size;
+          /* Set 0 so condition if (bytesRead == 0) breaks
+          external loop while (1). */
+          bytesRead = 0;
+          // Break the inner loop.
           break;
+        }
+        /* Decrease the number of remaining bytes by the number of bytes
+        read in the current iteration and */
+        remainingBytes -= bytesRead;
+        // move the position in the buffer.
+        position += bytesRead;
       }
-      // Free buffer memory.
-      free(buffer);
-      // If no error occured while copying
-      if (ret >= 0)
+      position = buffer; // page 48
+      /* Save the total number of read bytes that is always less
+      or equal to the buffer size. */
+      remainingBytes = size - remainingBytes;
+      ssize_t bytesWritten;
+      /* While numbers of remaining bytes and bytes written
+      in the current iteration are non-zero. */
+      while (remainingBytes != 0 && (bytesWritten =
+        write(out, position, remainingBytes)) != 0)
       {
-        // Create a structure containing last access and modification times.
-        const struct timespec times[2] = {*dstAccessTime, *dstModificationTime};
-        /* Must be set after writing the target file ends because writing sets
-        the modification time to the current operating system time.
-        Set the times of the target file. If an error occured */
-        if (futimens(out, times) == -1)
+        // If an error occured in function write.
+        if (bytesWritten == -1)
+        {
+          // If function write was interrupted by receiving a signal.
+          if (errno == EINTR)
+            // Retry writing.
+            continue;
+          // If other error occured
           // Set an error code.
-          ret = -7;
+          ret = -6;
+          /* Set 0 so condition if (bytesRead == 0) breaks
+          external loop while (1). */
+          bytesRead = 0;
+          // Break the inner loop.
+          break;
+        }
+        // Report the written bytes to the progress of the copy.
+        progressAdvance(bytesWritten);
+        /* Decrease the number of remaining bytes by the number of bytes
+        written in the current iteration and */
+        remainingBytes -= bytesWritten;
+        // move the position in the buffer.
+        position += bytesWritten;
       }
+      // If we came to the end of the source file (EOF) or an error occured
+      if (bytesRead == 0)
+        // Break external loop while (1).
+        break;
+    }
+    // If no error occured while copying
+    if (ret >= 0)
+    {
+      // Create a structure containing last access and modification times.
+      const struct timespec times[2] = {*dstAccessTime, *dstModificationTime};
+      /* Must be set after writing the target file ends because writing sets
+      the modification time to the current operating system time.
+      Set the times of the target file. If an error occured */
+      if (futimens(out, times) == -1)
+        // Set an error code.
+        ret = -7;
     }
   }
   // If the source file was opened, close it. If an error occured
@@ -197,113 +203,112 @@ int copyBigFile(const char *srcFilePath, const char *dstFilePath,
         /* Set a non-critical error code because the source file can be read
         even without the advice but less effectively. */
         ret = 1;
-      char *buffer = NULL;
       /* Optimal buffer size for input/output operations on a file can be
-      checked in its metadata read using stat but we use a predefined size. */
-      // Reserve buffer memory. If an error occured
-      if ((buffer = malloc(sizeof(char) * BUFFERSIZE)) == NULL)
-        // Set an error code.
-        ret = -5;
-      else
+      checked in its metadata read using stat but we use a configured size.
+      The buffer is reused by all copies so that copying does not reserve
+      memory. */
+      char *buffer = copyBuffer;
+      // The size can only change between synchronization cycles.
+      const size_t size = bufferSize;
+      // Byte index in the source file.
+      unsigned long long b;
+      // Position in the buffer.
+      char *position;
+      size_t remainingBytes;
+      ssize_t bytesWritten;
+      /* Cannot be (b < fileSize - size) because b and fileSize are
+      of unsigned type so if fileSize < size and we subtract,
+      then we have an overflow. */
+      for (b = 0; b + size < fileSize; b += size)
       {
-        // Byte index in the source file.
-        unsigned long long b;
-        // Position in the buffer.
-        char *position;
-        size_t remainingBytes;
-        ssize_t bytesWritten;
-        /* Cannot be (b < fileSize - BUFFERSIZE) because b and fileSize are
-        of unsigned type so if fileSize < BUFFERSIZE and we subtract,
-        then we have an overflow. */
-        for (b = 0; b + BUFFERSIZE < fileSize; b += BUFFERSIZE)
+        /* Copy size (size of the buffer) bytes from the mapped memory
+        to the buffer. */
+        memcpy(buffer, map + b, size);
+        // The algorithm below is on page 48.
+        position = buffer;
+        /* Save the total number of bytes remaining to be written
+        which is always equal to buffer size. */
+        remainingBytes = size;
+        /* While numbers of remaining bytes and bytes written
+        in the current iteration are non-zero. */
+        while (remainingBytes != 0 && (bytesWritten =
+          write(out, position, remainingBytes)) != 0)
         {
-          /* Copy BUFFERSIZE (size of the buffer) bytes from the mapped memory
-          to the buffer. */
-          memcpy(buffer, map + b, BUFFERSIZE);
-          // The algorithm below is on page 48.
-          position = buffer;
-          /* Save the total number of bytes remaining to be written
-          which is always equal to buffer size. */
-          remainingBytes = BUFFERSIZE;
-          /* While numbers of remaining bytes and bytes written
-          in the current iteration are non-zero. */
-          while (remainingBytes != 0 && (bytesWritten =
-            write(out, position, remainingBytes)) != 0)
+          // If an error occured in function write.
+          if (bytesWritten == -1)
           {
-            // If an error occured in function write.
-            if (bytesWritten == -1)
-            {
-              /* If function write was interrupted by receiving a signal.
-              SIGUSR1 and SIGTERM are blocked for the synchronization
-              so those signals cannot cause this error. */
-              if (errno == EINTR)
-                // Retry writing.
-                continue;
-              // If other error occured
-              // Set an error code.
-              ret = -6;
-              // Set b to break external loop for.
-              b = ULLONG_MAX - BUFFERSIZE;
-              // Break the inner loop.
-              break;
-            }
-            /* Decrease the number of remaining bytes by the number
-            of bytes written in the current iteration and */
-            remainingBytes -= bytesWritten;
-            // move the position in the buffer.
-            position += bytesWritten;
+            /* If function write was interrupted by receiving a signal.
+            SIGUSR1 and SIGTERM are blocked for the synchronization
+            so those signals cannot cause this error. */
+            if (errno == EINTR)
+              // Retry writing.
+              continue;
+            // If other error occured
+            // Set an error code.
+            ret = -6;
+            // Set b to break external loop for.
+            b = ULLONG_MAX - size;
+            // Break the inner loop.
+            break;
           }
+          // Report the written bytes to the progress of the copy.
+          progressAdvance(bytesWritten);
+          /* Decrease the number of remaining bytes by the number
+          of bytes written in the current iteration and */
+          remainingBytes -= bytesWritten;
+          // move the position in the buffer.
+          position += bytesWritten;
         }
-        // If no error occured while copying
-        if (ret >= 0)
+      }
+      // If no error occured while copying
+      if (ret >= 0)
+      {
+        /* Save the number of bytes located at the end of the source file
+        which did not fit into one full buffer. */
+        remainingBytes = fileSize - b;
+        // Copy them from the mapped memory to the buffer.
+        memcpy(buffer, map + b, remainingBytes);
+        // Save the position of the first byte in the buffer.
+        position = buffer;
+        /* While numbers of remaining bytes and bytes written
+        in the current iteration are non-zero. */
+        while (remainingBytes != 0 && (bytesWritten =
+          write(out, position, remainingBytes)) != 0)
         {
-          /* Save the number of bytes located at the end of the source file
-          which did not fit into one full buffer. */
-          remainingBytes = fileSize - b;
-          // Copy them from the mapped memory to the buffer.
-          memcpy(buffer, map + b, remainingBytes);
-          // Save the position of the first byte in the buffer.
-          position = buffer;
-          /* While numbers of remaining bytes and bytes written
-          in the current iteration are non-zero. */
-          while (remainingBytes != 0 && (bytesWritten =
-            write(out, position, remainingBytes)) != 0)
+          // If an error occured in function write.
+          if (bytesWritten == -1)
           {
-            // If an error occured in function write.
-            if (bytesWritten == -1)
-            {
-              // If function write was interrupted by receiving a signal.
-              if (errno == EINTR)
-                // Retry writing.
-                continue;
-              // Set an error code.
-              ret = -7;
-              // Break the inner loop.
-              break;
-            }
-            /* Decrease the number of remaining bytes by the number
-            of bytes written in the current iteration and */
-            remainingBytes -= bytesWritten;
-            // move the position in the buffer.
-            position += bytesWritten;
-          }
-        }
-        // Free buffer memory.
-        free(buffer);
-        // If no error occured while copying
-        if (ret >= 0)
-        {
-          // Create a structure containing last access and modification times.
-          const struct timespec times[2] =
-            {*dstAccessTime, *dstModificationTime};
-          /* Must be set after writing the target file ends because writing sets
-          the modification time to the current operating system time.
-          Set the times of the target file. If an error occured */
-          if (futimens(out, times) == -1)
+            // If function write was interrupted by receiving a signal.
+            if (errno == EINTR)
+              // Retry writing.
+              continue;
             // Set an error code.
-            ret = -8;
+            ret = -7;
+            // Break the inner loop.
+            break;
+          }
+          // Report the written bytes to the progress of the copy.
+          progressAdvance(bytesWritten);
+          /* Decrease the number of remaining bytes by the number
+          of bytes written in the current iteration and */
+          remainingBytes -= bytesWritten;
+          // move the position in the buffer.
+          position += bytesWritten;
         }
       }
+      // If no error occured while copying
+      if (ret >= 0)
+      {
+        // Create a structure containing last access and modification times.
+        const struct timespec times[2] =
+          {*dstAccessTime, *dstModificationTime};
+        /* Must be set after writing the target file ends because writing sets
+        the modification time to the current operating system time.
+        Set the times of the target file. If an error occured */
+        if (futimens(out, times) == -1)
+          // Set an error code.
+          ret = -8;
+      }
       // Unmap the source file in memory. If an error occured
       if (munmap(map, fileSize) == -1)
         // Set an error code.
@@ -0,0 +1,431 @@
+#include "filter.h"
+#include "arena.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+// Maximal size in bytes of a per-directory ignore file.
+#define IGNOREFILESIZE (1024 * 1024)
+
+/*
+Kinds of compiled patterns. Most patterns (names, '*.ext', 'prefix*') are
+  compared as literals without calling fnmatch.
+*/
+enum ruleKind
+{
+  // Pattern without wildcards compared as a whole.
+  KIND_LITERAL,
+  // Literal followed by '*'.
+  KIND_PREFIX,
+  // '*' followed by a literal.
+  KIND_SUFFIX,
+  // Any other pattern matched with fnmatch.
+  KIND_GLOB
+};
+
+/*
+Compiled include or exclude rule.
+*/
+struct filterRule
+{
+  // Pattern without leading and trailing '/'.
+  const char *pattern;
+  // Literal part of the pattern and its length for literal kinds.
+  const char *literal;
+  size_t literalLength;
+  // Kind of the pattern.
+  unsigned char kind;
+  // If not 0, the rule includes entries, otherwise it excludes them.
+  char include;
+  // If not 0, the rule only matches directories.
+  char directoryOnly;
+  /* If not 0, the pattern is matched against the relative path instead
+  of the name. */
+  char anchored;
+};
+
+// Global rules.
+static filterRule *globalRules;
+// Number of global rules and number of rules fitting in the array.
+static unsigned int globalCount, globalCapacity;
+// Name of per-directory ignore files or NULL if they are not read.
+static const char *ignoreName;
+// Length of the absolute source directory path.
+static size_t sourceRootLength;
+
+/*
+Checks if a part of a pattern contains wildcards.
+reads:
+pattern - pattern
+length - length in bytes of the checked part
+returns:
+1 if the part contains '*', '?', '[' or '\'
+0 otherwise
+*/
+static int hasWildcards(const char *pattern, size_t length)
+{
+  size_t i;
+  for (i = 0; i < length; ++i)
+    if (strchr("*?[\\", pattern[i]) != NULL)
+      return 1;
+  return 0;
+}
+
+/*
+Compiles a rule.
+reads:
+include - if not 0, the rule includes entries
+writes:
+pattern - pattern; its trailing '/' is removed
+rule - compiled rule pointing to pattern
+returns:
+-1 if the pattern is empty
+0 if no error occured
+*/
+static int compileRule(char *pattern, char include, filterRule *rule)
+{
+  size_t length = strlen(pattern);
+  rule->include = include;
+  rule->directoryOnly = rule->anchored = 0;
+  // A pattern ending with '/' only matches directories.
+  if (length != 0 && pattern[length - 1] == '/')
+  {
+    rule->directoryOnly = 1;
+    pattern[--length] = '\0';
+  }
+  // A pattern starting with '/' is anchored to the directory of the rule.
+  if (length != 0 && pattern[0] == '/')
+  {
+    rule->anchored = 1;
+    ++pattern;
+    --length;
+  }
+  if (length == 0)
+    return -1;
+  if (strchr(pattern, '/') != NULL)
+    rule->anchored = 1;
+  rule->pattern = rule->literal = pattern;
+  rule->literalLength = length;
+  if (!hasWildcards(pattern, length))
+    rule->kind = KIND_LITERAL;
+  // In paths, '*' must not match '/' so only names use literal parts.
+  else if (rule->anchored)
+    rule->kind = KIND_GLOB;
+  else if (pattern[0] == '*' && !hasWildcards(pattern + 1, length - 1))
+  {
+    rule->kind = KIND_SUFFIX;
+    rule->literal = pattern + 1;
+    rule->literalLength = length - 1;
+  }
+  else if (pattern[length - 1] == '*' && !hasWildcards(pattern, length - 1))
+  {
+    rule->kind = KIND_PREFIX;
+    rule->literalLength = length - 1;
+  }
+  else
+    rule->kind = KIND_GLOB;
+  return 0;
+}
+
+/*
+Splits a line of a rules file into the type and the pattern of the rule.
+writes:
+line - line without '\n'
+include - 1 if the rule includes entries, 0 if it excludes them
+returns:
+NULL if the line is empty or a comment
+pattern of the rule otherwise
+*/
+static char *splitLine(char *line, char *include)
+{
+  size_t length = strlen(line);
+  // Accept files with Windows line endings.
+  if (length != 0 && line[length - 1] == '\r')
+    line[--length] = '\0';
+  if (length == 0 || line[0] == '#')
+    return NULL;
+  *include = 0;
+  if ((line[0] == '+' || line[0] == '-') && line[1] == ' ')
+  {
+    *include = line[0] == '+';
+    return line + 2;
+  }
+  return line;
+}
+
+/*
+Checks a rule against an entry.
+reads:
+rule - rule
+name - entry name
+nameLength - length in bytes of name
+relative - entry path relative to the directory of the rule
+directory - if not 0, the entry is a directory
+returns:
+1 if the rule matches
+0 otherwise
+*/
+static int matches(const filterRule *rule, const char *name,
+  size_t nameLength, const char *relative, char directory)
+{
+  if (rule->directoryOnly && !directory)
+    return 0;
+  const char *subject = rule->anchored ? relative : name;
+  size_t length = rule->anchored ? strlen(relative) : nameLength;
+  switch (rule->kind)
+  {
+  case KIND_LITERAL:
+    return length == rule->literalLength &&
+      memcmp(subject, rule->literal, length) == 0;
+  case KIND_PREFIX:
+    return length >= rule->literalLength &&
+      memcmp(subject, rule->literal, rule->literalLength) == 0;
+  case KIND_SUFFIX:
+    return length >= rule->literalLength &&
+      memcmp(subject + length - rule->literalLength, rule->literal,
+      rule->literalLength) == 0;
+  default:
+    return fnmatch(rule->pattern, subject,
+      rule->anchored ? FNM_PATHNAME : 0) == 0;
+  }
+}
+
+/*
+Finds the first rule matching an entry.
+reads:
+rules - rules
+count - number of rules
+name - entry name
+nameLength - length in bytes of name
+relative - entry path relative to the directory of the rules
+directory - if not 0, the entry is a directory
+returns:
+-1 if no rule matches
+0 if the entry is included
+1 if the entry is excluded
+*/
+static int decide(const filterRule *rules, unsigned int count,
+  const char *name, size_t nameLength, const char *relative, char directory)
+{
+  unsigned int i;
+  for (i = 0; i < count; ++i)
+    if (matches(&rules[i], name, nameLength, relative, directory))
+      return rules[i].include ? 0 : 1;
+  return -1;
+}
+
+int filterAdd(const char *pattern, char include)
+{
+  // If the array is full, double its capacity.
+  if (globalCount == globalCapacity)
+  {
+    unsigned int capacity = globalCapacity == 0 ? 16 : globalCapacity * 2;
+    filterRule *rules = realloc(globalRules, sizeof(filterRule) * capacity);
+    if (rules == NULL)
+      return -1;
+    globalRules = rules;
+    globalCapacity = capacity;
+  }
+  // Keep a copy because compiling modifies the pattern.
+  char *copy = strdup(pattern);
+  if (copy == NULL)
+    return -1;
+  if (compileRule(copy, include, &globalRules[globalCount]) < 0)
+  {
+    free(copy);
+    return -2;
+  }
+  ++globalCount;
+  return 0;
+}
+
+int filterLoad(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return -1;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t length;
+  int ret = 0;
+  while (ret == 0 && (length = getline(&line, &size, file)) != -1)
+  {
+    if (length != 0 && line[length - 1] == '\n')
+      line[length - 1] = '\0';
+    char include, *pattern = splitLine(line, &include);
+    if (pattern != NULL && filterAdd(pattern, include) < 0)
+      ret = -2;
+  }
+  if (ferror(file))
+    ret = -1;
+  free(line);
+  fclose(file);
+  return ret;
+}
+
+void filterSetIgnoreFile(const char *name)
+{
+  ignoreName = name;
+}
+
+void filterConfigure(size_t rootLength)
+{
+  sourceRootLength = rootLength;
+}
+
+/*
+Reads the rules of the ignore file of a directory into the arena.
+reads:
+sourcePath - absolute directory path ending with '/'
+sourcePathLength - length in bytes of sourcePath
+writes:
+scope - scope of the directory with the rules
+returns:
+-1 if the file could not be read
+0 if no error occured (also if the file does not exist)
+*/
+static int loadIgnoreFile(const char *sourcePath, size_t sourcePathLength,
+  filterScope *scope)
+{
+  char path[PATH_MAX];
+  struct stat metadata;
+  if (sourcePathLength + strlen(ignoreName) >= PATH_MAX)
+    return -1;
+  memcpy(path, sourcePath, sourcePathLength);
+  strcpy(path + sourcePathLength, ignoreName);
+  int file = open(path, O_RDONLY | O_CLOEXEC);
+  if (file == -1)
+    return errno == ENOENT ? 0 : -1;
+  int ret = 0;
+  char *text = NULL;
+  size_t length = 0;
+  if (fstat(file, &metadata) == -1 || metadata.st_size > IGNOREFILESIZE ||
+    (text = arenaAllocate(metadata.st_size + 1)) == NULL)
+    ret = -1;
+  // Read the whole file.
+  while (ret == 0 && length < (size_t)metadata.st_size)
+  {
+    ssize_t bytesRead = read(file, text + length, metadata.st_size - length);
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      break;
+    length += bytesRead;
+  }
+  close(file);
+  if (ret != 0)
+    return ret;
+  text[length] = '\0';
+  // Every line can contain a rule.
+  unsigned int lines = 1;
+  size_t i;
+  for (i = 0; i < length; ++i)
+    if (text[i] == '\n')
+      ++lines;
+  filterRule *rules = arenaAllocate(sizeof(filterRule) * lines);
+  if (rules == NULL)
+    return -1;
+  char *line = text;
+  while (line != NULL)
+  {
+    char *end = strchr(line, '\n');
+    if (end != NULL)
+      *end++ = '\0';
+    char include, *pattern = splitLine(line, &include);
+    // Invalid rules are skipped.
+    if (pattern != NULL &&
+      compileRule(pattern, include, &rules[scope->count]) == 0)
+      ++scope->count;
+    line = end;
+  }
+  scope->rules = rules;
+  return 0;
+}
+
+int filterEnter(const char *sourcePath, size_t sourcePathLength,
+  const filterScope *parent, filterScope *scope)
+{
+  scope->parent = parent;
+  scope->rules = NULL;
+  scope->count = 0;
+  scope->path = sourcePath + sourceRootLength;
+  scope->length = sourcePathLength - sourceRootLength;
+  if (ignoreName == NULL)
+    return 0;
+  /* If the synchronization starts below the source directory, read
+  the ignore files of the parent directories too. */
+  if (parent == NULL && scope->length != 0)
+  {
+    // Find the end of the parent directory path.
+    size_t end = sourcePathLength - 1;
+    while (end > sourceRootLength && sourcePath[end - 1] != '/')
+      --end;
+    filterScope *ancestor = arenaAllocate(sizeof(filterScope));
+    if (ancestor == NULL ||
+      filterEnter(sourcePath, end, NULL, ancestor) < 0)
+      return -1;
+    scope->parent = ancestor;
+  }
+  return loadIgnoreFile(sourcePath, sourcePathLength, scope);
+}
+
+int filterExcluded(const filterScope *scope, const char *name,
+  char directory)
+{
+  // Path of the entry relative to the source directory.
+  static char relative[PATH_MAX];
+  // Fast path taken if no rules are used.
+  if (globalCount == 0 && ignoreName == NULL)
+    return 0;
+  size_t nameLength = strlen(name);
+  // If the relative path does not fit, the entry is not filtered.
+  if (scope->length + nameLength >= PATH_MAX)
+    return 0;
+  memcpy(relative, scope->path, scope->length);
+  memcpy(relative + scope->length, name, nameLength + 1);
+  const filterScope *s;
+  int decision;
+  // Check the rules from the innermost directory.
+  for (s = scope; s != NULL; s = s->parent)
+    if ((decision = decide(s->rules, s->count, name, nameLength,
+      relative + s->length, directory)) != -1)
+      return decision;
+  decision = decide(globalRules, globalCount, name, nameLength, relative,
+    directory);
+  return decision == 1;
+}
+
+int filterPathExcluded(const char *relativePath, char directory)
+{
+  static char relative[PATH_MAX];
+  size_t length = strlen(relativePath);
+  if (globalCount == 0 || length >= PATH_MAX)
+    return 0;
+  memcpy(relative, relativePath, length + 1);
+  // Remove the '/' ending a directory path.
+  if (length != 0 && relative[length - 1] == '/')
+    relative[--length] = '\0';
+  size_t start = 0, end;
+  // Check every component from the first one.
+  while (start < length)
+  {
+    for (end = start; end < length && relative[end] != '/'; ++end)
+      ;
+    char saved = relative[end];
+    relative[end] = '\0';
+    int decision = decide(globalRules, globalCount, relative + start,
+      end - start, relative, end < length || directory);
+    relative[end] = saved;
+    if (decision == 1)
+      return 1;
+    start = end + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "hash_join.h"
+#include "arena.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <stdint.h>
+
+// Minimal number of slots of the hash table; must be a power of 2.
+#define MINSLOTS 16
+
+typedef struct bucket bucket;
+/*
+Slot of the open-addressing hash table.
+*/
+struct bucket
+{
+  // Node of the second list or NULL if the slot is empty.
+  element *element;
+  // Cached hash and length of the name to skip most name comparisons.
+  uint32_t hash, length;
+  // If not 0, the node was paired with a node of the first list.
+  char paired;
+};
+
+/*
+Hashes a name reading 8 bytes at a time instead of byte by byte.
+reads:
+name - entry name
+length - length in bytes of name
+returns:
+hash of the name
+*/
+static uint32_t hashName(const char *name, size_t length)
+{
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length, word;
+  while (length >= 8)
+  {
+    // Read unaligned words without breaking strict aliasing.
+    memcpy(&word, name, 8);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+    name += 8;
+    length -= 8;
+  }
+  // Mix the remaining bytes padded with zeros.
+  word = 0;
+  memcpy(&word, name, length);
+  hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 29;
+  return (uint32_t)hash;
+}
+
+/*
+Appends a node to a chain of nodes.
+reads:
+node - appended node
+writes:
+first - first node of the chain
+last - last node of the chain
+*/
+static void append(element **first, element **last, element *node)
+{
+  if (*first == NULL)
+    *first = node;
+  else
+    (*last)->next = node;
+  *last = node;
+}
+
+int hashJoin(list *first, list *second)
+{
+  size_t slots = MINSLOTS, i;
+  // Keep the table at most half full so that probe sequences stay short.
+  while (slots < 2 * (size_t)second->count)
+    slots *= 2;
+  bucket *table = arenaAllocate(sizeof(bucket) * slots);
+  if (table == NULL)
+    return -1;
+  memset(table, 0, sizeof(bucket) * slots);
+  element *cur;
+  // Insert the nodes of the second list.
+  for (cur = second->first; cur != NULL; cur = cur->next)
+  {
+    size_t length = strlen(cur->entry->d_name);
+    uint32_t hash = hashName(cur->entry->d_name, length);
+    // Probe linearly from the slot selected by the hash.
+    for (i = hash & (slots - 1); table[i].element != NULL;
+      i = (i + 1) & (slots - 1))
+      ;
+    table[i].element = cur;
+    table[i].hash = hash;
+    table[i].length = (uint32_t)length;
+  }
+  // Chains of paired and unpaired nodes of both lists.
+  element *pairedFirst = NULL, *pairedLast = NULL, *restFirst = NULL,
+    *restLast = NULL, *pairedSecond = NULL, *pairedSecondLast = NULL,
+    *restSecond = NULL, *restSecondLast = NULL;
+  // Look up the nodes of the first list.
+  cur = first->first;
+  while (cur != NULL)
+  {
+    element *next = cur->next;
+    size_t length = strlen(cur->entry->d_name);
+    uint32_t hash = hashName(cur->entry->d_name, length);
+    bucket *found = NULL;
+    for (i = hash & (slots - 1); table[i].element != NULL;
+      i = (i + 1) & (slots - 1))
+      if (table[i].hash == hash && table[i].length == length &&
+        memcmp(table[i].element->entry->d_name, cur->entry->d_name, length)
+        == 0)
+      {
+        found = &table[i];
+        break;
+      }
+    // Names are unique in a directory so every node is paired at most once.
+    if (found != NULL && !found->paired)
+    {
+      found->paired = 1;
+      append(&pairedFirst, &pairedLast, cur);
+      append(&pairedSecond, &pairedSecondLast, found->element);
+    }
+    else
+      append(&restFirst, &restLast, cur);
+    cur = next;
+  }
+  // Collect the unpaired nodes of the second list.
+  for (i = 0; i < slots; ++i)
+    if (table[i].element != NULL && !table[i].paired)
+      append(&restSecond, &restSecondLast, table[i].element);
+  // Relink the first list: paired nodes followed by the other ones.
+  if (pairedLast != NULL)
+    pairedLast->next = restFirst;
+  else
+    pairedFirst = restFirst;
+  if (restLast != NULL)
+    restLast->next = NULL;
+  else if (pairedLast != NULL)
+    pairedLast->next = NULL;
+  first->first = pairedFirst;
+  first->last = restLast != NULL ? restLast : pairedLast;
+  // Relink the second list in the same way.
+  if (pairedSecondLast != NULL)
+    pairedSecondLast->next = restSecond;
+  else
+    pairedSecond = restSecond;
+  if (restSecondLast != NULL)
+    restSecondLast->next = NULL;
+  else if (pairedSecondLast != NULL)
+    pairedSecondLast->next = NULL;
+  second->first = pairedSecond;
+  second->last = restSecondLast != NULL ? restSecondLast : pairedSecondLast;
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "linked_list.h"
+#include "arena.h"
 
 #include <dirent.h>
 #include <string.h>
@@ -22,8 +23,9 @@ void initialize(list *l)
 int pushBack(list *l, struct dirent *newEntry)
 {
   element *new = NULL;
-  // Reserve memory for a new list node. If an error occured
-  if ((new = malloc(sizeof(element))) == NULL)
+  /* Reserve memory for a new list node in the arena so that listing
+  a directory does not reserve heap memory. If an error occured */
+  if ((new = arenaAllocate(sizeof(element))) == NULL)
     // Return an error code.
     return -1;
   // Store the directory entry pointer in the list node 
@@ -54,18 +56,8 @@ int pushBack(list *l, struct dirent *newEntry)
 
 void clear(list *l)
 {
-  // Save the pointer to the first node.
-  element *cur = l->first, *next;
-  while (cur != NULL)
-  {
-    // Save the pointer to the next node.
-    next = cur->next;
-    // Release the node's memory.
-    free(cur);
-    // Move the pointer to the next node.
-    cur = next;
-  }
-  // Zero out the list's fields.
+  /* The nodes are released together with the other memory allocated
+  from the arena, so only zero out the list's fields. */
   initialize(l);
 }
 
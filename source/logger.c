@@ -0,0 +1,373 @@
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+
+// Number of slots in the ring buffer; must be a power of 2.
+#define SLOTS 2048
+// Maximal length of a message including '\0'; longer ones are truncated.
+#define MESSAGELENGTH 480
+// Size of the buffer in which the file sink batches messages.
+#define BATCHSIZE 65536
+// Time in milliseconds after which the writer drains the queue anyway.
+#define FLUSHINTERVAL 100
+// Number of rotated log files kept next to the current one.
+#define ROTATEDFILES 5
+
+typedef struct slot slot;
+/*
+Slot of the ring buffer. The sequence number tells whether the slot is free
+  for the producer with the matching position or filled for the consumer.
+*/
+struct slot
+{
+  // Sequence number of the slot.
+  unsigned long sequence;
+  // Level of the message.
+  int level;
+  // Time at which the message was logged.
+  struct timespec time;
+  // Text of the message.
+  char text[MESSAGELENGTH];
+};
+
+/* Bounded multi-producer queue (Dmitry Vyukov's algorithm). Producers claim
+positions with compare-and-swap and never block each other; the only
+consumer is the writer thread. */
+static slot slots[SLOTS];
+// Position at which the next message is enqueued.
+static unsigned long enqueuePosition;
+// Position from which the next message is dequeued.
+static unsigned long dequeuePosition;
+// Number of messages dropped because the queue was full.
+static unsigned long dropped;
+// Least important level of logged messages.
+static int minimalLevel = LOG_INFO;
+// Posted to wake the writer before FLUSHINTERVAL passes.
+static sem_t wakeUp;
+// Writer thread.
+static pthread_t writer;
+// Set while the writer thread is running.
+static char started;
+// Set to 0 to stop the writer thread.
+static char running;
+// Descriptor of the log file or -1 if messages are written to syslog.
+static int fileDescriptor = -1;
+// Path of the log file.
+static char filePath[PATH_MAX];
+// Size of the log file in bytes and the size after which it is rotated.
+static unsigned long long fileSize, rotationSize;
+
+// Names of the levels indexed by syslog level numbers.
+static const char *const levelNames[] = {
+  "emergency", "alert", "critical", "error", "warning", "notice", "info",
+  "debug"};
+
+/*
+Opens (creates if needed) the log file for appending and reads its size.
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int openLogFile(void)
+{
+  fileDescriptor = open(filePath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+    0640);
+  if (fileDescriptor == -1)
+    return -1;
+  struct stat metadata;
+  // Continue counting the size of an existing file.
+  fileSize = fstat(fileDescriptor, &metadata) == 0 ? metadata.st_size : 0;
+  return 0;
+}
+
+/*
+Renames '<path>.4' to '<path>.5', ..., '<path>' to '<path>.1' and opens
+  a new empty log file. Errors are ignored; if the new file cannot be opened,
+  messages are written to syslog.
+*/
+static void rotateLogFile(void)
+{
+  char from[PATH_MAX + 16], to[PATH_MAX + 16];
+  int i;
+  close(fileDescriptor);
+  // Shift the rotated files starting at the oldest one which is overwritten.
+  for (i = ROTATEDFILES - 1; i >= 1; --i)
+  {
+    snprintf(from, sizeof(from), "%s.%i", filePath, i);
+    snprintf(to, sizeof(to), "%s.%i", filePath, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", filePath);
+  rename(filePath, to);
+  if (openLogFile() == -1)
+  {
+    fileDescriptor = -1;
+    openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
+  }
+}
+
+/*
+Writes a batch of formatted messages to the log file.
+reads:
+batch - formatted messages
+length - length of the batch in bytes
+*/
+static void writeBatch(const char *batch, size_t length)
+{
+  // Rotate the file before it exceeds the size limit.
+  if (fileSize != 0 && fileSize + length > rotationSize)
+    rotateLogFile();
+  // If the file could not be reopened, the batch is lost.
+  if (fileDescriptor == -1)
+    return;
+  while (length != 0)
+  {
+    ssize_t bytesWritten = write(fileDescriptor, batch, length);
+    if (bytesWritten == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    length -= bytesWritten;
+    batch += bytesWritten;
+    fileSize += bytesWritten;
+  }
+}
+
+/*
+Dequeues and writes all messages present in the queue.
+reads:
+capacity - size of batch in bytes
+writes:
+batch - buffer for the file sink
+*/
+static void drainQueue(char *batch, size_t capacity)
+{
+  size_t length = 0;
+  char line[MESSAGELENGTH + 64];
+  while (1)
+  {
+    slot *s = &slots[dequeuePosition & (SLOTS - 1)];
+    // The slot is filled if its sequence is one greater than the position.
+    if (__atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) != dequeuePosition + 1)
+      break;
+    if (fileDescriptor == -1)
+      syslog(s->level, "%s", s->text);
+    else
+    {
+      struct tm local;
+      localtime_r(&s->time.tv_sec, &local);
+      int lineLength = snprintf(line, sizeof(line),
+        "%04i-%02i-%02iT%02i:%02i:%02i.%03li DirSyncD[%i] %s: %s\n",
+        local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour,
+        local.tm_min, local.tm_sec, s->time.tv_nsec / 1000000, (int)getpid(),
+        levelNames[s->level], s->text);
+      if (lineLength >= (int)sizeof(line))
+        lineLength = sizeof(line) - 1;
+      /* Write the batch if the line does not fit into it or if the line
+      would make the file exceed the rotation size. */
+      if (length + lineLength > capacity || (length != 0 &&
+        fileSize + length + lineLength > rotationSize))
+      {
+        writeBatch(batch, length);
+        length = 0;
+      }
+      memcpy(batch + length, line, lineLength);
+      length += lineLength;
+    }
+    // Free the slot for the producer which will reach it after SLOTS messages.
+    __atomic_store_n(&s->sequence, dequeuePosition + SLOTS, __ATOMIC_RELEASE);
+    ++dequeuePosition;
+  }
+  if (length != 0)
+    writeBatch(batch, length);
+  unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+  // Report dropped messages through the queue which has just been emptied.
+  if (lost != 0)
+    logMessage(LOG_WARNING, "dropped %lu log messages; queue full", lost);
+}
+
+/*
+Function of the writer thread.
+reads:
+argument - unused
+*/
+static void *writerMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  char *batch = malloc(BATCHSIZE);
+  size_t capacity = BATCHSIZE;
+  // Without the buffer, write every message separately.
+  static char fallback[MESSAGELENGTH + 64];
+  if (batch == NULL)
+  {
+    batch = fallback;
+    capacity = sizeof(fallback);
+  }
+  while (1)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FLUSHINTERVAL * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    // Sleep until a producer wakes the writer or the interval passes.
+    sem_timedwait(&wakeUp, &deadline);
+    int stopping = !__atomic_load_n(&running, __ATOMIC_ACQUIRE);
+    // Read the clock only if the drain is traced.
+    unsigned long long start = traceEnabled() ? metricsNow() : 0;
+    unsigned long position = dequeuePosition;
+    drainQueue(batch, capacity);
+    // Trace only drains which wrote messages.
+    if (start != 0 && dequeuePosition != position)
+      traceSpan(TRACE_LOG, start, metricsNow(), NULL);
+    if (stopping)
+    {
+      // Write messages queued by the last drain, e.g. about dropped ones.
+      drainQueue(batch, capacity);
+      break;
+    }
+  }
+  if (batch != fallback)
+    free(batch);
+  return NULL;
+}
+
+int loggerStart(const char *logFile, unsigned long long maxFileSize)
+{
+  unsigned long i;
+  // Every slot is initially free for the producer with its position.
+  for (i = 0; i < SLOTS; ++i)
+    slots[i].sequence = i;
+  enqueuePosition = dequeuePosition = 0;
+  if (logFile != NULL)
+  {
+    if (strlen(logFile) >= sizeof(filePath))
+      return -1;
+    strcpy(filePath, logFile);
+    rotationSize = maxFileSize;
+    if (openLogFile() == -1)
+      return -2;
+  }
+  else
+    // Keep a single connection to syslog open for the daemon's lifetime.
+    openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
+  if (sem_init(&wakeUp, 0, 0) == -1)
+    return -3;
+  running = 1;
+  if (pthread_create(&writer, NULL, writerMain, NULL) != 0)
+  {
+    sem_destroy(&wakeUp);
+    return -4;
+  }
+  __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void loggerStop(void)
+{
+  if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+    return;
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  sem_post(&wakeUp);
+  pthread_join(writer, NULL);
+  __atomic_store_n(&started, 0, __ATOMIC_RELEASE);
+  sem_destroy(&wakeUp);
+  if (fileDescriptor != -1)
+  {
+    close(fileDescriptor);
+    fileDescriptor = -1;
+  }
+  closelog();
+}
+
+void loggerSetLevel(int level)
+{
+  __atomic_store_n(&minimalLevel, level, __ATOMIC_RELAXED);
+}
+
+int loggerParseLevel(const char *name)
+{
+  if (strcmp(name, "error") == 0)
+    return LOG_ERR;
+  if (strcmp(name, "warning") == 0)
+    return LOG_WARNING;
+  if (strcmp(name, "info") == 0)
+    return LOG_INFO;
+  if (strcmp(name, "debug") == 0)
+    return LOG_DEBUG;
+  return -1;
+}
+
+void logMessage(int level, const char *format, ...)
+{
+  // Skip formatting messages which would be filtered out anyway.
+  if (level > __atomic_load_n(&minimalLevel, __ATOMIC_RELAXED))
+    return;
+  va_list arguments;
+  va_start(arguments, format);
+  // Before the writer thread starts, write synchronously.
+  if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+  {
+    openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
+    vsyslog(level, format, arguments);
+    closelog();
+    va_end(arguments);
+    return;
+  }
+  unsigned long position = __atomic_load_n(&enqueuePosition, __ATOMIC_RELAXED);
+  slot *s;
+  while (1)
+  {
+    s = &slots[position & (SLOTS - 1)];
+    unsigned long sequence = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+    long difference = (long)(sequence - position);
+    // The slot is free: try to claim the position.
+    if (difference == 0)
+    {
+      if (__atomic_compare_exchange_n(&enqueuePosition, &position,
+        position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      // Another producer claimed it; position now holds the current value.
+    }
+    // The slot has not been consumed yet: the queue is full.
+    else if (difference < 0)
+    {
+      __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+      sem_post(&wakeUp);
+      va_end(arguments);
+      return;
+    }
+    // Another producer has moved on: reload the position.
+    else
+      position = __atomic_load_n(&enqueuePosition, __ATOMIC_RELAXED);
+  }
+  s->level = level;
+  clock_gettime(CLOCK_REALTIME, &s->time);
+  vsnprintf(s->text, MESSAGELENGTH, format, arguments);
+  va_end(arguments);
+  // Publish the message to the writer.
+  __atomic_store_n(&s->sequence, position + 1, __ATOMIC_RELEASE);
+  /* Wake the writer early when the queue is half full so that bursts
+  of messages are not dropped. */
+  if (((position + 1) & (SLOTS / 2 - 1)) == 0)
+    sem_post(&wakeUp);
+}
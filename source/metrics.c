@@ -0,0 +1,346 @@
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+// Number of finite histogram buckets.
+#define BUCKETS 9
+// Size of the buffer in which the metrics file is formatted.
+#define OUTPUTSIZE 32768
+
+// Names of the counters in the exposition format.
+static const char *const counterNames[METRIC_COUNTERS] = {
+  "dirs_scanned", "files_stated", "files_copied", "bytes_copied", "deletes",
+  "errors", "files_deferred"};
+// Descriptions of the counters written in HELP lines.
+static const char *const counterDescriptions[METRIC_COUNTERS] = {
+  "Directories whose entries were listed",
+  "Files whose metadata was read",
+  "Files copied successfully",
+  "Bytes of files copied successfully",
+  "Files and directories removed successfully",
+  "Operations which failed",
+  "Files left for a later cycle because they were being modified"};
+// Names of the histograms in the exposition format.
+static const char *const histogramNames[METRIC_HISTOGRAMS] = {
+  "stat_latency_seconds", "copy_latency_seconds", "scan_latency_seconds",
+  "replication_lag_seconds"};
+// Descriptions of the histograms written in HELP lines.
+static const char *const histogramDescriptions[METRIC_HISTOGRAMS] = {
+  "Latency of single operations", "Latency of single operations",
+  "Latency of single operations",
+  "Time from the modification of a source file to the end of its copy"};
+// Names of the phases written as label values.
+static const char *const phaseNames[METRIC_PHASES] = {
+  "scan", "sort", "files", "directories"};
+// Names of the stages written as label values.
+static const char *const stageNames[METRIC_STAGES] = {
+  "scanner", "comparator", "copier"};
+/* Upper bounds of the histogram buckets in nanoseconds: latencies from 1 us
+to 100 s, growing 10 times, and the replication lag from 100 ms to a day. */
+static const unsigned long long bucketBounds[METRIC_HISTOGRAMS][BUCKETS] = {
+  {1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL},
+  {1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL},
+  {1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL},
+  {100000000ULL, 1000000000ULL, 10000000000ULL, 60000000000ULL,
+  300000000000ULL, 900000000000ULL, 3600000000000ULL, 21600000000000ULL,
+  86400000000000ULL}};
+
+// Counters of the current cycle.
+static unsigned long long cycleCounters[METRIC_COUNTERS];
+// Counters of all finished cycles.
+static unsigned long long totalCounters[METRIC_COUNTERS];
+// Phase times in nanoseconds of the current cycle.
+static unsigned long long cyclePhases[METRIC_PHASES];
+// Phase times in nanoseconds of all finished cycles.
+static unsigned long long totalPhases[METRIC_PHASES];
+/* Non-cumulative bucket counts; the last bucket of every histogram counts
+latencies greater than all bounds. */
+static unsigned long long histogramBuckets[METRIC_HISTOGRAMS][BUCKETS + 1];
+// Sums of the recorded latencies in nanoseconds.
+static unsigned long long histogramSums[METRIC_HISTOGRAMS];
+// Maximal staleness in nanoseconds of the current and the last finished cycle.
+static unsigned long long cycleStaleness, lastStaleness;
+// Number of threads of the stages.
+static unsigned int stageThreads[METRIC_STAGES];
+// Busy time in nanoseconds of the stages during the current cycle.
+static unsigned long long cycleBusy[METRIC_STAGES];
+// Busy time in nanoseconds of the stages during all finished cycles.
+static unsigned long long totalBusy[METRIC_STAGES];
+// Utilisation of the stages during the last finished cycle.
+static double stageUtilisation[METRIC_STAGES];
+// Number of finished cycles.
+static unsigned long long cycles;
+// Status code of the last finished cycle.
+static int lastStatus;
+// Start time of the current cycle and duration of the last finished one.
+static unsigned long long cycleStart, cycleDuration;
+// Wall clock time in seconds at which the last cycle finished.
+static time_t cycleEnd;
+
+unsigned long long metricsNow(void)
+{
+  struct timespec now;
+  // The monotonic clock is not affected by changes of the system time.
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void metricsAdd(enum metricsCounter counter, unsigned long long value)
+{
+  __atomic_add_fetch(&cycleCounters[counter], value, __ATOMIC_RELAXED);
+}
+
+unsigned long long metricsGet(enum metricsCounter counter)
+{
+  return __atomic_load_n(&cycleCounters[counter], __ATOMIC_RELAXED);
+}
+
+void metricsObserve(enum metricsHistogram histogram,
+  unsigned long long nanoseconds)
+{
+  unsigned int b = 0;
+  // Find the first bucket whose bound is not less than the latency.
+  while (b < BUCKETS && nanoseconds > bucketBounds[histogram][b])
+    ++b;
+  __atomic_add_fetch(&histogramBuckets[histogram][b], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&histogramSums[histogram], nanoseconds, __ATOMIC_RELAXED);
+}
+
+void metricsStaleness(unsigned long long nanoseconds)
+{
+  unsigned long long maximum = __atomic_load_n(&cycleStaleness,
+    __ATOMIC_RELAXED);
+  // Raise the maximum unless another thread raised it higher.
+  while (nanoseconds > maximum && !__atomic_compare_exchange_n(
+    &cycleStaleness, &maximum, nanoseconds, 1, __ATOMIC_RELAXED,
+    __ATOMIC_RELAXED))
+    ;
+}
+
+unsigned long long metricsMaxStaleness(void)
+{
+  return __atomic_load_n(&cycleStaleness, __ATOMIC_RELAXED);
+}
+
+void metricsPhase(enum metricsPhase phase, unsigned long long nanoseconds)
+{
+  __atomic_add_fetch(&cyclePhases[phase], nanoseconds, __ATOMIC_RELAXED);
+}
+
+void metricsStageThreads(enum metricsStage stage, unsigned int threads)
+{
+  stageThreads[stage] = threads;
+}
+
+void metricsStageBusy(enum metricsStage stage, unsigned long long nanoseconds)
+{
+  __atomic_add_fetch(&cycleBusy[stage], nanoseconds, __ATOMIC_RELAXED);
+}
+
+double metricsStageUtilisation(enum metricsStage stage)
+{
+  return stageUtilisation[stage];
+}
+
+void metricsBeginCycle(void)
+{
+  unsigned int i;
+  for (i = 0; i < METRIC_COUNTERS; ++i)
+    __atomic_store_n(&cycleCounters[i], 0, __ATOMIC_RELAXED);
+  for (i = 0; i < METRIC_PHASES; ++i)
+    __atomic_store_n(&cyclePhases[i], 0, __ATOMIC_RELAXED);
+  for (i = 0; i < METRIC_STAGES; ++i)
+    __atomic_store_n(&cycleBusy[i], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&cycleStaleness, 0, __ATOMIC_RELAXED);
+  cycleStart = metricsNow();
+}
+
+void metricsEndCycle(int status)
+{
+  unsigned int i;
+  for (i = 0; i < METRIC_COUNTERS; ++i)
+    totalCounters[i] += metricsGet(i);
+  for (i = 0; i < METRIC_PHASES; ++i)
+    totalPhases[i] += __atomic_load_n(&cyclePhases[i], __ATOMIC_RELAXED);
+  cycleDuration = metricsNow() - cycleStart;
+  for (i = 0; i < METRIC_STAGES; ++i)
+  {
+    unsigned long long busy = __atomic_load_n(&cycleBusy[i], __ATOMIC_RELAXED);
+    totalBusy[i] += busy;
+    stageUtilisation[i] = stageThreads[i] == 0 || cycleDuration == 0 ? 0 :
+      (double)busy / stageThreads[i] / cycleDuration;
+  }
+  cycleEnd = time(NULL);
+  lastStaleness = metricsMaxStaleness();
+  lastStatus = status;
+  ++cycles;
+}
+
+/* Buffer in which the metrics file is formatted before it is written
+so that writing it does not reserve memory like a stdio stream. */
+static char output[OUTPUTSIZE];
+// Number of bytes formatted in the buffer.
+static size_t outputLength;
+
+/*
+Appends formatted text to the buffer of the metrics file. Text which does
+  not fit is truncated and makes outputLength exceed the buffer size.
+reads:
+format - printf format of the text
+*/
+static void writeText(const char *format, ...)
+  __attribute__((format(printf, 1, 2)));
+static void writeText(const char *format, ...)
+{
+  va_list arguments;
+  va_start(arguments, format);
+  size_t space = outputLength < OUTPUTSIZE ? OUTPUTSIZE - outputLength : 0;
+  int length = vsnprintf(output + (OUTPUTSIZE - space), space, format,
+    arguments);
+  va_end(arguments);
+  if (length > 0)
+    outputLength += length;
+}
+
+/*
+Writes a HELP line and a TYPE line describing a metric.
+reads:
+name - metric name without prefix 'dirsyncd_'
+type - metric type: counter, gauge or histogram
+help - metric description
+*/
+static void writeHeader(const char *name, const char *type, const char *help)
+{
+  writeText("# HELP dirsyncd_%s %s.\n# TYPE dirsyncd_%s %s\n", name, help,
+    name, type);
+}
+
+int metricsWrite(const char *path)
+{
+  char temporaryPath[PATH_MAX];
+  /* Write a temporary file next to the target one and rename it. rename is
+  atomic within a file system. Suffix '.tmp' makes node_exporter ignore
+  the temporary file. */
+  if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path)
+    >= (int)sizeof(temporaryPath))
+    return -1;
+  outputLength = 0;
+  unsigned int i, b;
+  char name[64];
+  for (i = 0; i < METRIC_COUNTERS; ++i)
+  {
+    sprintf(name, "%s_total", counterNames[i]);
+    writeHeader(name, "counter", counterDescriptions[i]);
+    writeText("dirsyncd_%s %llu\n", name, totalCounters[i]);
+    sprintf(name, "cycle_%s", counterNames[i]);
+    writeHeader(name, "gauge", counterDescriptions[i]);
+    writeText("dirsyncd_%s %llu\n", name, metricsGet(i));
+  }
+  writeHeader("phase_seconds_total", "counter",
+    "Wall time spent in synchronization phases");
+  for (i = 0; i < METRIC_PHASES; ++i)
+    writeText("dirsyncd_phase_seconds_total{phase=\"%s\"} %.9f\n",
+      phaseNames[i], totalPhases[i] / 1e9);
+  writeHeader("cycle_phase_seconds", "gauge",
+    "Wall time spent in synchronization phases during the last cycle");
+  for (i = 0; i < METRIC_PHASES; ++i)
+    writeText("dirsyncd_cycle_phase_seconds{phase=\"%s\"} %.9f\n",
+      phaseNames[i], __atomic_load_n(&cyclePhases[i], __ATOMIC_RELAXED) / 1e9);
+  // If the pipelined engine is used
+  if (stageThreads[STAGE_COMPARATOR] != 0)
+  {
+    writeHeader("stage_threads", "gauge", "Threads of pipeline stages");
+    for (i = 0; i < METRIC_STAGES; ++i)
+      writeText("dirsyncd_stage_threads{stage=\"%s\"} %u\n", stageNames[i],
+        stageThreads[i]);
+    writeHeader("stage_busy_seconds_total", "counter",
+      "Time during which threads of pipeline stages were busy");
+    for (i = 0; i < METRIC_STAGES; ++i)
+      writeText("dirsyncd_stage_busy_seconds_total{stage=\"%s\"} %.9f\n",
+        stageNames[i], totalBusy[i] / 1e9);
+    writeHeader("stage_utilisation", "gauge",
+      "Busy fraction of the threads of pipeline stages during the last cycle");
+    for (i = 0; i < METRIC_STAGES; ++i)
+      writeText("dirsyncd_stage_utilisation{stage=\"%s\"} %.4f\n",
+        stageNames[i], stageUtilisation[i]);
+  }
+  for (i = 0; i < METRIC_HISTOGRAMS; ++i)
+  {
+    strcpy(name, histogramNames[i]);
+    writeHeader(name, "histogram", histogramDescriptions[i]);
+    // Prometheus buckets are cumulative.
+    unsigned long long count = 0;
+    for (b = 0; b < BUCKETS; ++b)
+    {
+      count += __atomic_load_n(&histogramBuckets[i][b], __ATOMIC_RELAXED);
+      writeText("dirsyncd_%s_bucket{le=\"%g\"} %llu\n", name,
+        bucketBounds[i][b] / 1e9, count);
+    }
+    count += __atomic_load_n(&histogramBuckets[i][BUCKETS], __ATOMIC_RELAXED);
+    writeText("dirsyncd_%s_bucket{le=\"+Inf\"} %llu\n", name, count);
+    writeText("dirsyncd_%s_sum %.9f\n", name,
+      __atomic_load_n(&histogramSums[i], __ATOMIC_RELAXED) / 1e9);
+    writeText("dirsyncd_%s_count %llu\n", name, count);
+  }
+  writeHeader("cycles_total", "counter", "Finished synchronizations");
+  writeText("dirsyncd_cycles_total %llu\n", cycles);
+  writeHeader("cycle_status", "gauge",
+    "Status code of the last synchronization");
+  writeText("dirsyncd_cycle_status %i\n", lastStatus);
+  writeHeader("cycle_duration_seconds", "gauge",
+    "Wall time of the last synchronization");
+  writeText("dirsyncd_cycle_duration_seconds %.9f\n", cycleDuration / 1e9);
+  writeHeader("cycle_max_staleness_seconds", "gauge",
+    "Maximal time since the modification of a source file whose copy "
+    "was written or left outdated during the last synchronization");
+  writeText("dirsyncd_cycle_max_staleness_seconds %.3f\n",
+    lastStaleness / 1e9);
+  writeHeader("cycle_end_timestamp_seconds", "gauge",
+    "Time at which the last synchronization finished");
+  writeText("dirsyncd_cycle_end_timestamp_seconds %lld\n",
+    (long long)cycleEnd);
+  // If the metrics did not fit into the buffer
+  if (outputLength >= OUTPUTSIZE)
+    return -2;
+  int file = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+    0644);
+  if (file == -1)
+    return -2;
+  int ret = 0;
+  size_t written = 0;
+  while (written < outputLength)
+  {
+    ssize_t bytesWritten = write(file, output + written,
+      outputLength - written);
+    if (bytesWritten == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      ret = -3;
+      break;
+    }
+    written += bytesWritten;
+  }
+  // Flush the page cache so a crash cannot leave an empty file.
+  if (ret == 0 && fsync(file) == -1)
+    ret = -3;
+  if (close(file) == -1 && ret == 0)
+    ret = -4;
+  // Replace the previous file. If an error occured
+  if (ret == 0 && rename(temporaryPath, path) == -1)
+    ret = -5;
+  // Do not leave the temporary file if anything failed.
+  if (ret != 0)
+    unlink(temporaryPath);
+  return ret;
+}
@@ -0,0 +1,116 @@
+#include "partition.h"
+
+#include <signal.h>
+#include <pthread.h>
+
+// Threads and their number.
+static pthread_t threads[PARTITIONTHREADS];
+static unsigned int threadCount;
+// Guards the fields below.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a task is posted or the threads are stopped.
+static pthread_cond_t posted = PTHREAD_COND_INITIALIZER;
+// Signalled when the last part of a task finishes.
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+// Current task, its argument or NULL if no task is running.
+static partitionTask currentTask;
+static void *currentArgument;
+// Number of parts, next unclaimed part and number of unfinished parts.
+static unsigned int parts, next, unfinished;
+// Set to stop the threads.
+static char stopping;
+
+/*
+Executes the unclaimed parts of the current task until none is left. Must be
+  called with the lock held; the lock is released while a part executes.
+*/
+static void executeParts(void)
+{
+  while (currentTask != NULL && next < parts)
+  {
+    partitionTask task = currentTask;
+    void *argument = currentArgument;
+    unsigned int part = next++;
+    pthread_mutex_unlock(&lock);
+    task(argument, part);
+    pthread_mutex_lock(&lock);
+    if (--unfinished == 0)
+      pthread_cond_broadcast(&finished);
+  }
+}
+
+/*
+Function of a partitioning thread.
+reads:
+argument - unused
+*/
+static void *partitionMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  pthread_mutex_lock(&lock);
+  while (1)
+  {
+    // Wait for a part to execute.
+    while (!stopping && (currentTask == NULL || next == parts))
+      pthread_cond_wait(&posted, &lock);
+    if (stopping)
+      break;
+    executeParts();
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+int partitionStart(unsigned int count)
+{
+  if (count == 0 || count > PARTITIONTHREADS)
+    return -1;
+  sigset_t set, previousSet;
+  sigfillset(&set);
+  // The threads inherit the mask so signals are not delivered to them.
+  pthread_sigmask(SIG_BLOCK, &set, &previousSet);
+  while (threadCount < count &&
+    pthread_create(&threads[threadCount], NULL, partitionMain, NULL) == 0)
+    ++threadCount;
+  pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+  if (threadCount != count)
+  {
+    partitionStop();
+    return -2;
+  }
+  return 0;
+}
+
+void partitionStop(void)
+{
+  unsigned int i;
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_broadcast(&posted);
+  pthread_mutex_unlock(&lock);
+  for (i = 0; i < threadCount; ++i)
+    pthread_join(threads[i], NULL);
+  threadCount = 0;
+}
+
+unsigned int partitionThreads(void)
+{
+  return threadCount;
+}
+
+void partitionRun(partitionTask task, void *argument, unsigned int count)
+{
+  pthread_mutex_lock(&lock);
+  currentTask = task;
+  currentArgument = argument;
+  parts = unfinished = count;
+  next = 0;
+  pthread_cond_broadcast(&posted);
+  // Execute parts instead of waiting idle.
+  executeParts();
+  while (unfinished != 0)
+    pthread_cond_wait(&finished, &lock);
+  currentTask = NULL;
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,487 @@
+#include "pipeline.h"
+#include "control.h"
+#include "metrics.h"
+#include "progress.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+// Number of actions in the pool; bounds the number of actions in flight.
+#define ACTIONS 64
+/* Number of slots of a queue; must be a power of 2 and fit all actions
+and the stop markers. */
+#define SLOTS 128
+
+_Static_assert(SLOTS >= ACTIONS + PIPELINETHREADS && (SLOTS & (SLOTS - 1)) == 0,
+  "queue too small");
+
+/* Byte budgets of the tiny, medium and huge copy lanes. The first action
+of a lane is always admitted so a lane never stalls on one big file. */
+static const unsigned long long laneBudgets[PIPELINELANES] =
+  { 16ULL << 20, 256ULL << 20, 1ULL << 30 };
+
+typedef struct queue queue;
+/*
+Bounded multi-producer multi-consumer queue of actions (Dmitry Vyukov's
+  algorithm, like the queue of the logger). Producers and consumers claim
+  positions with compare-and-swap. The semaphore counts queued actions
+  so that idle consumers sleep instead of spinning.
+*/
+struct queue
+{
+  struct
+  {
+    // Sequence number telling whether the slot is free or filled.
+    unsigned long sequence;
+    // Queued action.
+    action *action;
+  } slots[SLOTS];
+  // Positions of the next enqueued and dequeued actions on separate lines.
+  unsigned long enqueuePosition __attribute__((aligned(64)));
+  unsigned long dequeuePosition __attribute__((aligned(64)));
+  // Number of queued actions.
+  sem_t items;
+};
+
+typedef struct lane lane;
+/*
+Copy lane with its own queue, copier threads and byte budget. Copies take
+  milliseconds to hours so the queue is a simple list guarded by a mutex.
+*/
+struct lane
+{
+  pthread_mutex_t lock;
+  // Signalled when an action is queued or the lane is stopped.
+  pthread_cond_t ready;
+  // Signalled when the copiers free bytes of the budget.
+  pthread_cond_t released;
+  // First and last queued action.
+  action *first, *last;
+  // Size in bytes of the actions in the lane and its limit.
+  unsigned long long bytes, budget;
+  // Copier threads of the lane and their number.
+  pthread_t threads[PIPELINETHREADS];
+  unsigned int count;
+  // Number of threads copying files and its limit.
+  unsigned int busy, limit;
+  // Set to stop the threads after the queued actions.
+  char stopping;
+};
+
+// Free actions and actions waiting for comparators.
+static queue idle, comparing;
+// Copy lanes and their number.
+static lane copyLanes[PIPELINELANES];
+static unsigned int laneCount;
+// Pool of actions.
+static action *actions;
+// Marker telling a thread to stop.
+static action stopMarker;
+// Handlers of the stages.
+static actionHandler compareHandler, copyHandler;
+// Threads of the comparator stage and their number.
+static pthread_t comparatorThreads[PIPELINETHREADS];
+static unsigned int comparatorCount;
+// Number of actions which failed since the last drain.
+static unsigned int failures;
+// Time since which the scanner has been busy.
+static unsigned long long scannerResumed;
+// Set while the pipeline is running.
+static char started;
+
+/*
+Initializes an empty queue.
+writes:
+q - queue
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int queueInitialize(queue *q)
+{
+  unsigned long i;
+  // Every slot is initially free for the producer with its position.
+  for (i = 0; i < SLOTS; ++i)
+    q->slots[i].sequence = i;
+  q->enqueuePosition = q->dequeuePosition = 0;
+  return sem_init(&q->items, 0, 0);
+}
+
+/*
+Adds an action at the end of a queue. The queue never overflows because
+  it fits all actions.
+reads:
+a - action
+writes:
+q - queue
+*/
+static void queuePush(queue *q, action *a)
+{
+  unsigned long position = __atomic_load_n(&q->enqueuePosition,
+    __ATOMIC_RELAXED);
+  while (1)
+  {
+    unsigned long sequence = __atomic_load_n(
+      &q->slots[position & (SLOTS - 1)].sequence, __ATOMIC_ACQUIRE);
+    long difference = (long)sequence - (long)position;
+    // If the slot is free, claim the position.
+    if (difference == 0)
+    {
+      if (__atomic_compare_exchange_n(&q->enqueuePosition, &position,
+        position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    // If a consumer has not freed the slot yet, let it finish.
+    else if (difference < 0)
+    {
+      sched_yield();
+      position = __atomic_load_n(&q->enqueuePosition, __ATOMIC_RELAXED);
+    }
+    // Another producer claimed the position.
+    else
+      position = __atomic_load_n(&q->enqueuePosition, __ATOMIC_RELAXED);
+  }
+  q->slots[position & (SLOTS - 1)].action = a;
+  __atomic_store_n(&q->slots[position & (SLOTS - 1)].sequence, position + 1,
+    __ATOMIC_RELEASE);
+  sem_post(&q->items);
+}
+
+/*
+Removes the first action from a queue.
+reads:
+wait - if not 0, wait until the queue is not empty
+writes:
+q - queue
+returns:
+NULL if the queue is empty and wait is 0
+first action otherwise
+*/
+static action *queuePop(queue *q, int wait)
+{
+  // Reserve one of the queued actions.
+  while ((wait ? sem_wait(&q->items) : sem_trywait(&q->items)) == -1)
+    if (errno != EINTR)
+      return NULL;
+  unsigned long position = __atomic_load_n(&q->dequeuePosition,
+    __ATOMIC_RELAXED);
+  while (1)
+  {
+    unsigned long sequence = __atomic_load_n(
+      &q->slots[position & (SLOTS - 1)].sequence, __ATOMIC_ACQUIRE);
+    long difference = (long)sequence - (long)(position + 1);
+    // If the slot is filled, claim the position.
+    if (difference == 0)
+    {
+      if (__atomic_compare_exchange_n(&q->dequeuePosition, &position,
+        position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    /* If the producer of an earlier position has not filled its slot yet,
+    let it finish. */
+    else if (difference < 0)
+    {
+      sched_yield();
+      position = __atomic_load_n(&q->dequeuePosition, __ATOMIC_RELAXED);
+    }
+    // Another consumer claimed the position.
+    else
+      position = __atomic_load_n(&q->dequeuePosition, __ATOMIC_RELAXED);
+  }
+  action *a = q->slots[position & (SLOTS - 1)].action;
+  // Free the slot for the producer of the position one lap later.
+  __atomic_store_n(&q->slots[position & (SLOTS - 1)].sequence,
+    position + SLOTS, __ATOMIC_RELEASE);
+  return a;
+}
+
+/*
+Returns a finished action to the pool and releases the directory
+  of its file.
+reads:
+status - status code of the last handler of the action
+writes:
+a - action
+*/
+static void finish(action *a, int status)
+{
+  if (status < 0)
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+  // Count the change of the file in its directory for adaptive scanning.
+  if (a->node != NULL)
+    scheduleRelease(a->node, a->changed);
+  queuePush(&idle, a);
+}
+
+/*
+Passes a compared action to the copy lane of its size class. If the lane
+  is over its budget, waits until the copiers of the lane free enough bytes.
+writes:
+a - action
+*/
+static void laneSubmit(action *a)
+{
+  unsigned long long size = a->metadata.st_size;
+  lane *l = &copyLanes[laneCount == 1 || size < LANETINYSIZE ? 0 :
+    size < LANEHUGESIZE ? 1 : 2];
+  pthread_mutex_lock(&l->lock);
+  /* The copiers of the lane keep copying so the wait ends. An empty lane
+  admits any action. */
+  while (l->bytes != 0 && l->bytes + size > l->budget)
+    pthread_cond_wait(&l->released, &l->lock);
+  l->bytes += size;
+  // Count the file in the bytes known to the progress of the cycle.
+  progressQueue(size);
+  a->next = NULL;
+  if (l->first == NULL)
+    l->first = a;
+  else
+    l->last->next = a;
+  l->last = a;
+  pthread_cond_signal(&l->ready);
+  pthread_mutex_unlock(&l->lock);
+}
+
+/*
+Function of a comparator thread.
+reads:
+argument - unused
+*/
+static void *comparatorMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  action *a;
+  while ((a = queuePop(&comparing, 1)) != &stopMarker)
+  {
+    unsigned long long start = metricsNow();
+    // Skip the remaining actions of a cancelled cycle.
+    int status = controlCancelled() ? 0 : compareHandler(a);
+    metricsStageBusy(STAGE_COMPARATOR, metricsNow() - start);
+    // The copier stage finishes the passed actions.
+    if (status <= 0)
+      finish(a, status);
+    else
+      laneSubmit(a);
+  }
+  return NULL;
+}
+
+/*
+Function of a copier thread.
+reads:
+argument - lane of the thread
+*/
+static void *copierMain(void *argument)
+{
+  lane *l = argument;
+  while (1)
+  {
+    pthread_mutex_lock(&l->lock);
+    while ((l->first == NULL || l->busy >= l->limit) && !l->stopping)
+      pthread_cond_wait(&l->ready, &l->lock);
+    action *a = l->first;
+    if (a != NULL && (l->first = a->next) == NULL)
+      l->last = NULL;
+    ++l->busy;
+    pthread_mutex_unlock(&l->lock);
+    // The lane is stopped and empty.
+    if (a == NULL)
+      break;
+    // The copy counts its own bytes.
+    progressQueue(-(long long)a->metadata.st_size);
+    unsigned long long start = metricsNow();
+    int status = controlCancelled() ? 0 : copyHandler(a);
+    metricsStageBusy(STAGE_COPIER, metricsNow() - start);
+    pthread_mutex_lock(&l->lock);
+    // Let a thread waiting for the limit take the next action.
+    if (--l->busy + 1 >= l->limit)
+      pthread_cond_signal(&l->ready);
+    l->bytes -= a->metadata.st_size;
+    // Comparators waiting for the budget check if the action fits now.
+    pthread_cond_broadcast(&l->released);
+    pthread_mutex_unlock(&l->lock);
+    finish(a, status);
+  }
+  return NULL;
+}
+
+int pipelineStart(unsigned int comparators, unsigned int lanes,
+  const unsigned int *copiers, actionHandler compare, actionHandler copy)
+{
+  unsigned int i, copierCount = 0;
+  if (comparators == 0 || comparators > PIPELINETHREADS ||
+    (lanes != 1 && lanes != PIPELINELANES))
+    return -1;
+  for (i = 0; i < lanes; ++i)
+    if (copiers[i] == 0 || copiers[i] > PIPELINETHREADS)
+      return -1;
+  if ((actions = malloc(sizeof(action) * ACTIONS)) == NULL)
+    return -2;
+  if (queueInitialize(&idle) == -1 || queueInitialize(&comparing) == -1)
+  {
+    free(actions);
+    return -2;
+  }
+  // All actions are initially free.
+  for (i = 0; i < ACTIONS; ++i)
+    queuePush(&idle, &actions[i]);
+  for (i = 0; i < lanes; ++i)
+  {
+    lane *l = &copyLanes[i];
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->ready, NULL);
+    pthread_cond_init(&l->released, NULL);
+    l->first = l->last = NULL;
+    l->bytes = l->count = l->busy = l->stopping = 0;
+    // A single lane is only limited by the pool.
+    l->budget = lanes == 1 ? ULLONG_MAX : laneBudgets[i];
+    l->limit = PIPELINETHREADS;
+  }
+  laneCount = lanes;
+  compareHandler = compare;
+  copyHandler = copy;
+  failures = 0;
+  comparatorCount = 0;
+  sigset_t set, previousSet;
+  sigfillset(&set);
+  // The threads inherit the mask so signals are not delivered to them.
+  pthread_sigmask(SIG_BLOCK, &set, &previousSet);
+  while (comparatorCount < comparators && pthread_create(
+    &comparatorThreads[comparatorCount], NULL, comparatorMain, NULL) == 0)
+    ++comparatorCount;
+  char complete = comparatorCount == comparators;
+  for (i = 0; complete && i < lanes; ++i)
+  {
+    lane *l = &copyLanes[i];
+    while (l->count < copiers[i] && pthread_create(&l->threads[l->count],
+      NULL, copierMain, l) == 0)
+      ++l->count;
+    copierCount += l->count;
+    complete = l->count == copiers[i];
+  }
+  pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+  started = 1;
+  // If any thread could not be started, stop the started ones.
+  if (!complete)
+  {
+    pipelineStop();
+    return -3;
+  }
+  metricsStageThreads(STAGE_SCANNER, 1);
+  metricsStageThreads(STAGE_COMPARATOR, comparators);
+  metricsStageThreads(STAGE_COPIER, copierCount);
+  return 0;
+}
+
+void pipelineStop(void)
+{
+  unsigned int i;
+  if (!started)
+    return;
+  // Comparators stop first so that they do not pass actions to stopped copiers.
+  for (i = 0; i < comparatorCount; ++i)
+    queuePush(&comparing, &stopMarker);
+  for (i = 0; i < comparatorCount; ++i)
+    pthread_join(comparatorThreads[i], NULL);
+  for (i = 0; i < laneCount; ++i)
+  {
+    lane *l = &copyLanes[i];
+    unsigned int j;
+    pthread_mutex_lock(&l->lock);
+    l->stopping = 1;
+    pthread_cond_broadcast(&l->ready);
+    pthread_mutex_unlock(&l->lock);
+    for (j = 0; j < l->count; ++j)
+      pthread_join(l->threads[j], NULL);
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->ready);
+    pthread_cond_destroy(&l->released);
+  }
+  sem_destroy(&idle.items);
+  sem_destroy(&comparing.items);
+  free(actions);
+  actions = NULL;
+  started = 0;
+}
+
+void pipelineSetCopiers(unsigned int copiers)
+{
+  unsigned int i;
+  for (i = 0; i < laneCount; ++i)
+  {
+    pthread_mutex_lock(&copyLanes[i].lock);
+    copyLanes[i].limit = copiers;
+    // Threads may start copying if the limit grew.
+    pthread_cond_broadcast(&copyLanes[i].ready);
+    pthread_mutex_unlock(&copyLanes[i].lock);
+  }
+}
+
+unsigned int pipelineCopiers(void)
+{
+  unsigned int i, copiers = 0;
+  for (i = 0; i < laneCount; ++i)
+    if (copyLanes[i].count > copiers)
+      copiers = copyLanes[i].count;
+  return copiers;
+}
+
+int pipelineEnabled(void)
+{
+  return started;
+}
+
+action *pipelineAcquire(void)
+{
+  action *a = queuePop(&idle, 0);
+  // If all actions are in flight
+  if (a == NULL)
+  {
+    // The scanner is idle until a later stage finishes an action.
+    unsigned long long now = metricsNow();
+    metricsStageBusy(STAGE_SCANNER, now - scannerResumed);
+    a = queuePop(&idle, 1);
+    scannerResumed = metricsNow();
+  }
+  return a;
+}
+
+void pipelineSubmit(action *a)
+{
+  queuePush(&comparing, a);
+}
+
+unsigned int pipelineDrain(void)
+{
+  // Actions taken from the pool while waiting.
+  static action *drained[ACTIONS];
+  unsigned int i;
+  metricsStageBusy(STAGE_SCANNER, metricsNow() - scannerResumed);
+  // All pooled actions are finished when all are back in the pool.
+  for (i = 0; i < ACTIONS; ++i)
+    drained[i] = queuePop(&idle, 1);
+  for (i = 0; i < ACTIONS; ++i)
+    queuePush(&idle, drained[i]);
+  scannerResumed = metricsNow();
+  return __atomic_exchange_n(&failures, 0, __ATOMIC_RELAXED);
+}
+
+void pipelineBeginCycle(void)
+{
+  if (!started)
+    return;
+  scannerResumed = metricsNow();
+}
+
+void pipelineEndCycle(void)
+{
+  if (!started)
+    return;
+  metricsStageBusy(STAGE_SCANNER, metricsNow() - scannerResumed);
+}
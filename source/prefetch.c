@@ -0,0 +1,326 @@
+// statx
+#define _GNU_SOURCE
+
+#include "prefetch.h"
+#include "arena.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+
+// Fields read with statx.
+#define PREFETCHMASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO | \
+  STATX_ATIME | STATX_MTIME)
+
+// States of a record.
+enum recordState
+{
+  RECORD_PENDING,
+  RECORD_READING,
+  // Being read while the comparison waits for it.
+  RECORD_AWAITED,
+  RECORD_READ
+};
+
+typedef struct record record;
+/*
+Metadata of a file read by a prefetching thread or the comparison.
+*/
+struct record
+{
+  struct stat metadata;
+  // errno if reading failed, otherwise 0.
+  int error;
+  // State changed atomically; the thread changing it to reading reads it.
+  int state;
+};
+
+typedef struct side side;
+/*
+Files of one directory.
+*/
+struct side
+{
+  // Directory descriptor used with statx or -1 if it could not be opened.
+  int dir;
+  // File names in the order of the list.
+  const char **names;
+  // Metadata of the files.
+  record *records;
+  // Number of files.
+  unsigned int count;
+};
+
+struct prefetch
+{
+  side sides[PREFETCH_SIDES];
+  /* Next claimed position; positions alternate between the sides so that
+  both are read ahead of the comparison. */
+  unsigned int next;
+  // Number of positions.
+  unsigned int positions;
+  // Number of threads reading the prefetch.
+  unsigned int workers;
+};
+
+// Threads and their number.
+static pthread_t threads[PREFETCHTHREADS];
+static unsigned int threadCount;
+// Guards the fields below.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a prefetch begins or the threads are stopped.
+static pthread_cond_t posted = PTHREAD_COND_INITIALIZER;
+// Signalled when the last thread leaves a prefetch.
+static pthread_cond_t left = PTHREAD_COND_INITIALIZER;
+// Signalled when a record awaited by the comparison is read.
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+// Current prefetch or NULL.
+static prefetch *current;
+// Number of begun prefetches telling the threads which one they finished.
+static unsigned long generation;
+// Set to stop the threads.
+static char stopping;
+
+/*
+Reads the metadata of a file into a record.
+reads:
+s - side of the file
+index - position of the file in the side
+writes:
+r - record
+*/
+static void readRecord(const side *s, unsigned int index, record *r)
+{
+  struct statx buffer;
+  unsigned long long start = metricsNow();
+  if (s->dir == -1)
+    r->error = EBADF;
+  // Follow symbolic links like stat.
+  else if (statx(s->dir, s->names[index], 0, PREFETCHMASK, &buffer) == -1)
+    r->error = errno;
+  else
+  {
+    struct stat *m = &r->metadata;
+    r->error = 0;
+    memset(m, 0, sizeof(struct stat));
+    m->st_dev = makedev(buffer.stx_dev_major, buffer.stx_dev_minor);
+    m->st_ino = buffer.stx_ino;
+    m->st_mode = buffer.stx_mode;
+    m->st_size = buffer.stx_size;
+    m->st_atim.tv_sec = buffer.stx_atime.tv_sec;
+    m->st_atim.tv_nsec = buffer.stx_atime.tv_nsec;
+    m->st_mtim.tv_sec = buffer.stx_mtime.tv_sec;
+    m->st_mtim.tv_nsec = buffer.stx_mtime.tv_nsec;
+  }
+  unsigned long long end = metricsNow();
+  metricsObserve(HISTOGRAM_STAT, end - start);
+  traceSpan(TRACE_STAT, start, end, s->names[index]);
+  PROBE(stat, s->names[index], r->error != 0 ? -1 : 0, end - start);
+  // If the comparison waits for the record, wake it.
+  if (__atomic_exchange_n(&r->state, RECORD_READ, __ATOMIC_ACQ_REL) ==
+    RECORD_AWAITED)
+  {
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&finished);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+/*
+Claims a record for reading.
+writes:
+r - record
+returns:
+1 if the caller has to read the record
+0 if another thread reads or has read it
+*/
+static int claim(record *r)
+{
+  int expected = RECORD_PENDING;
+  return __atomic_compare_exchange_n(&r->state, &expected, RECORD_READING, 0,
+    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+Function of a prefetching thread.
+reads:
+argument - unused
+*/
+static void *prefetchMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&lock);
+  while (1)
+  {
+    // Wait for a prefetch which this thread has not finished yet.
+    while (!stopping && (current == NULL || generation == seen))
+      pthread_cond_wait(&posted, &lock);
+    if (stopping)
+      break;
+    prefetch *p = current;
+    seen = generation;
+    ++p->workers;
+    pthread_mutex_unlock(&lock);
+    unsigned int position;
+    while ((position = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) <
+      p->positions)
+    {
+      const side *s = &p->sides[position & 1];
+      unsigned int index = position >> 1;
+      if (index < s->count && claim(&s->records[index]))
+        readRecord(s, index, &s->records[index]);
+    }
+    pthread_mutex_lock(&lock);
+    if (--p->workers == 0)
+      pthread_cond_broadcast(&left);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+int prefetchStart(unsigned int count)
+{
+  if (count == 0 || count > PREFETCHTHREADS)
+    return -1;
+  sigset_t set, previousSet;
+  sigfillset(&set);
+  // The threads inherit the mask so signals are not delivered to them.
+  pthread_sigmask(SIG_BLOCK, &set, &previousSet);
+  while (threadCount < count &&
+    pthread_create(&threads[threadCount], NULL, prefetchMain, NULL) == 0)
+    ++threadCount;
+  pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+  if (threadCount != count)
+  {
+    prefetchStop();
+    return -2;
+  }
+  return 0;
+}
+
+void prefetchStop(void)
+{
+  unsigned int i;
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_broadcast(&posted);
+  pthread_mutex_unlock(&lock);
+  for (i = 0; i < threadCount; ++i)
+    pthread_join(threads[i], NULL);
+  threadCount = 0;
+}
+
+/*
+Prepares a side of a prefetch.
+reads:
+path - directory path
+files - list of files
+writes:
+s - side
+returns:
+-1 if memory could not be allocated
+0 if no error occured
+*/
+static int prepareSide(const char *path, const list *files, side *s)
+{
+  unsigned int i = 0;
+  element *cur;
+  s->count = files->count;
+  s->names = arenaAllocate(sizeof(const char *) * (s->count + 1));
+  s->records = arenaAllocate(sizeof(record) * (s->count + 1));
+  if (s->names == NULL || s->records == NULL)
+    return -1;
+  for (cur = files->first; cur != NULL; cur = cur->next, ++i)
+  {
+    s->names[i] = cur->entry->d_name;
+    s->records[i].state = RECORD_PENDING;
+  }
+  // Names are resolved relative to the directory so paths are not built.
+  s->dir = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  return 0;
+}
+
+prefetch *prefetchBegin(const char *sourcePath, const list *source,
+  const char *targetPath, const list *target)
+{
+  if (threadCount == 0)
+    return NULL;
+  prefetch *p = arenaAllocate(sizeof(prefetch));
+  if (p == NULL)
+    return NULL;
+  p->sides[PREFETCH_SOURCE].dir = p->sides[PREFETCH_TARGET].dir = -1;
+  if (prepareSide(sourcePath, source, &p->sides[PREFETCH_SOURCE]) < 0 ||
+    prepareSide(targetPath, target, &p->sides[PREFETCH_TARGET]) < 0)
+  {
+    if (p->sides[PREFETCH_SOURCE].dir != -1)
+      close(p->sides[PREFETCH_SOURCE].dir);
+    return NULL;
+  }
+  unsigned int longest = source->count > target->count ? source->count :
+    target->count;
+  p->positions = 2 * longest;
+  p->next = 0;
+  p->workers = 0;
+  pthread_mutex_lock(&lock);
+  current = p;
+  ++generation;
+  pthread_cond_broadcast(&posted);
+  pthread_mutex_unlock(&lock);
+  return p;
+}
+
+int prefetchGet(prefetch *p, enum prefetchSide which, unsigned int index,
+  struct stat *buf)
+{
+  side *s = &p->sides[which];
+  record *r = &s->records[index];
+  int expected = RECORD_READING;
+  // If no thread has reached the file yet, read it instead of waiting.
+  if (claim(r))
+    readRecord(s, index, r);
+  /* If a thread is reading it, e.g. for seconds on a network file system,
+  sleep until the thread signals that it finished. */
+  else if (__atomic_compare_exchange_n(&r->state, &expected, RECORD_AWAITED,
+    0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+  {
+    pthread_mutex_lock(&lock);
+    // The state is changed before the signal, which needs the mutex.
+    while (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE) != RECORD_READ)
+      pthread_cond_wait(&finished, &lock);
+    pthread_mutex_unlock(&lock);
+  }
+  metricsAdd(METRIC_FILES_STATED, 1);
+  if (r->error != 0)
+  {
+    metricsAdd(METRIC_ERRORS, 1);
+    errno = r->error;
+    return -1;
+  }
+  *buf = r->metadata;
+  return 0;
+}
+
+void prefetchEnd(prefetch *p)
+{
+  unsigned int i;
+  // Stop the threads from claiming further positions.
+  __atomic_store_n(&p->next, p->positions, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&lock);
+  current = NULL;
+  while (p->workers != 0)
+    pthread_cond_wait(&left, &lock);
+  pthread_mutex_unlock(&lock);
+  for (i = 0; i < PREFETCH_SIDES; ++i)
+    if (p->sides[i].dir != -1)
+      close(p->sides[i].dir);
+}
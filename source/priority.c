@@ -0,0 +1,262 @@
+#include "priority.h"
+#include "control.h"
+#include "directory.h"
+#include "filter.h"
+#include "logger.h"
+#include "path.h"
+#include "synchronization.h"
+
+#include <glob.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Maximal number of priority patterns.
+#define PRIORITYPATTERNS 16
+
+// Priority patterns in the order in which they were given.
+static const char *patterns[PRIORITYPATTERNS];
+// Number of priority patterns.
+static unsigned int patternCount;
+
+typedef struct match match;
+/*
+Regular file or directory matching a priority pattern.
+*/
+struct match
+{
+  // Path relative to the source directory; directory paths end with '/'.
+  const char *path;
+  // Source metadata.
+  struct stat metadata;
+};
+
+int priorityAdd(const char *pattern)
+{
+  if (patternCount == PRIORITYPATTERNS)
+    return -1;
+  size_t length = strlen(pattern);
+  // Reject empty and absolute patterns.
+  if (length == 0 || pattern[0] == '/')
+    return -2;
+  // Reject patterns which could match entries outside the source directory.
+  const char *component = pattern;
+  while (component != NULL)
+  {
+    if (strncmp(component, "..", 2) == 0 &&
+      (component[2] == '/' || component[2] == '\0'))
+      return -2;
+    if ((component = strchr(component, '/')) != NULL)
+      ++component;
+  }
+  patterns[patternCount++] = pattern;
+  return 0;
+}
+
+unsigned int priorityCount(void)
+{
+  return patternCount;
+}
+
+/*
+Compares matches by modification time.
+reads:
+a - first match
+b - second match
+returns:
+< 0 if a was modified later than b
+0 if a and b were modified at the same time
+> 0 if a was modified earlier than b
+*/
+static int compareModificationTimes(const void *a, const void *b)
+{
+  const struct timespec *timeA = &((const match *)a)->metadata.st_mtim,
+    *timeB = &((const match *)b)->metadata.st_mtim;
+  if (timeA->tv_sec != timeB->tv_sec)
+    return timeA->tv_sec > timeB->tv_sec ? -1 : 1;
+  if (timeA->tv_nsec != timeB->tv_nsec)
+    return timeA->tv_nsec > timeB->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/*
+Checks if the parent directory of a target entry exists.
+reads:
+path - target entry path; a directory path ends with '/'
+length - length in bytes of path
+returns:
+1 if the parent directory exists
+0 otherwise
+*/
+static int parentExists(char *path, size_t length)
+{
+  struct stat metadata;
+  // Skip the '/' ending a directory path.
+  size_t end = length - 1;
+  while (end > 0 && path[end - 1] != '/')
+    --end;
+  // Temporarily cut the path after the parent's '/'.
+  char saved = path[end];
+  path[end] = '\0';
+  int exists = stat(path, &metadata) == 0 && S_ISDIR(metadata.st_mode);
+  path[end] = saved;
+  return exists;
+}
+
+int synchronizePriority(const dirsyncSettings *settings,
+  const char *sourcePath, const size_t sourcePathLength,
+  const char *destinationPath, const size_t destinationPathLength)
+{
+  // Initially, set status code indicating no error.
+  int ret = 0, status;
+  char *pattern = NULL, *nextSourcePath = NULL, *nextDestinationPath = NULL;
+  match *matches = NULL;
+  glob_t found;
+  size_t i, count = 0, files = 0;
+  unsigned int p;
+  found.gl_pathc = 0;
+  found.gl_pathv = NULL;
+  // Reserve memory for the escaped source path followed by a pattern.
+  if ((pattern = malloc(sizeof(char) * 2 * PATH_MAX)) == NULL)
+    ret = -1;
+  // Reserve memory for source entry paths.
+  else if ((nextSourcePath = malloc(sizeof(char) * PATH_MAX)) == NULL)
+    ret = -2;
+  // Reserve memory for target entry paths.
+  else if ((nextDestinationPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
+    ret = -3;
+  else
+  {
+    /* Escape the characters of the source path which glob would interpret
+    as wildcards. */
+    size_t prefixLength = 0;
+    for (i = 0; i < sourcePathLength; ++i)
+    {
+      if (strchr("*?[\\", sourcePath[i]) != NULL)
+        pattern[prefixLength++] = '\\';
+      pattern[prefixLength++] = sourcePath[i];
+    }
+    for (p = 0; p < patternCount && ret == 0; ++p)
+    {
+      // If the pattern does not fit into the buffer, skip it.
+      if (prefixLength + strlen(patterns[p]) >= 2 * PATH_MAX)
+      {
+        ret = 1;
+        continue;
+      }
+      stringAppend(pattern, prefixLength, patterns[p]);
+      /* Append the matches to the ones of the previous patterns. Mark
+      directories with '/' at the end. */
+      status = glob(pattern, GLOB_MARK | (p != 0 ? GLOB_APPEND : 0), NULL,
+        &found);
+      // If memory could not be reserved
+      if (status == GLOB_NOSPACE)
+        ret = -4;
+      // If a directory could not be read, the other matches are still valid.
+      else if (status == GLOB_ABORTED)
+        ret = 2;
+    }
+  }
+  // If any entry matched and the matches can be stored
+  if (ret >= 0 && found.gl_pathc != 0 &&
+    (matches = malloc(sizeof(match) * found.gl_pathc)) == NULL)
+    ret = -5;
+  if (matches != NULL)
+  {
+    /* Select regular files and directories. Symbolic links are ignored
+    like during the synchronization of the whole directory. */
+    for (i = 0; i < found.gl_pathc; ++i)
+    {
+      char *full = found.gl_pathv[i];
+      const char *path = full + sourcePathLength;
+      size_t length = strlen(path);
+      if (length == 0)
+        continue;
+      /* Remove the '/' added by glob so that lstat does not follow
+      a symbolic link to a directory. */
+      if (path[length - 1] == '/')
+        full[sourcePathLength + length - 1] = '\0';
+      status = lstat(full, &matches[count].metadata);
+      if (path[length - 1] == '\0')
+        full[sourcePathLength + length - 1] = '/';
+      if (status == -1)
+        continue;
+      int directory = S_ISDIR(matches[count].metadata.st_mode);
+      if (!directory && !S_ISREG(matches[count].metadata.st_mode))
+        continue;
+      /* Without recursive synchronization, only files located directly
+      in the source directory are synchronized. */
+      if (!settings->recursive && (directory || strchr(path, '/') != NULL))
+        continue;
+      // Excluded entries are not synchronized ahead of the others either.
+      if (filterPathExcluded(path, directory))
+        continue;
+      matches[count].path = path;
+      // Place files before directories.
+      if (!directory)
+      {
+        match file = matches[count];
+        matches[count] = matches[files];
+        matches[files++] = file;
+      }
+      ++count;
+    }
+    // If required, sort the files from the most recently modified.
+    if (settings->newestFirst)
+      qsort(matches, files, sizeof(match), compareModificationTimes);
+    strcpy(nextSourcePath, sourcePath);
+    strcpy(nextDestinationPath, destinationPath);
+    for (i = 0; i < count; ++i)
+    {
+      // If the cycle was cancelled using the control socket
+      if (controlCancelled())
+      {
+        ret = -6;
+        break;
+      }
+      size_t length = strlen(matches[i].path);
+      // If the target path does not fit into PATH_MAX bytes with '\0'
+      if (destinationPathLength + length >= PATH_MAX)
+      {
+        ret = 3;
+        continue;
+      }
+      stringAppend(nextSourcePath, sourcePathLength, matches[i].path);
+      stringAppend(nextDestinationPath, destinationPathLength,
+        matches[i].path);
+      /* If the target parent directory does not exist yet, the entry will be
+      created by the synchronization of the whole directory. */
+      if (!parentExists(nextDestinationPath, destinationPathLength + length))
+        continue;
+      // If the match is a file
+      if (i < files)
+        status = synchronizeFile(settings, nextSourcePath,
+          nextDestinationPath);
+      else
+      {
+        /* Create the target directory if it does not exist. If it exists,
+        the creation fails but the directory is synchronized anyway. */
+        if (createEmptyDirectory(nextDestinationPath,
+          matches[i].metadata.st_mode) == 0)
+          logMessage(LOG_DEBUG, "creating directory %s; 0",
+            nextDestinationPath);
+        status = synchronizeRecursively(settings, nextSourcePath,
+          sourcePathLength + length, nextDestinationPath,
+          destinationPathLength + length);
+      }
+      // If an error occured, continue with the other matches.
+      if (status != 0)
+        ret = 4;
+    }
+  }
+  // Release memory which was reserved.
+  free(matches);
+  globfree(&found);
+  free(pattern);
+  free(nextSourcePath);
+  free(nextDestinationPath);
+  // Return the status code.
+  return ret;
+}
@@ -0,0 +1,358 @@
+#include "progress.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct tracked tracked;
+/*
+File being copied whose progress is reported separately.
+*/
+struct tracked
+{
+  // If not 0, the slot is taken by a copy.
+  char used;
+  // Source file path.
+  char path[PATH_MAX];
+  // Size of the file and number of written bytes.
+  unsigned long long size, done;
+  // Time at which the copy began.
+  unsigned long long start;
+};
+
+typedef struct copy copy;
+/*
+Copy of the calling thread.
+*/
+struct copy
+{
+  // If not 0, the thread is copying a file.
+  char active;
+  // Size of the file and number of written bytes.
+  unsigned long long size, done;
+  // Slot of the file or NULL if it is not reported separately.
+  tracked *slot;
+};
+
+// Guards the slots, the samples and the fields of the status file thread.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled to stop the status file thread.
+static pthread_cond_t stopped = PTHREAD_COND_INITIALIZER;
+// Files reported separately.
+static tracked slots[PROGRESSFILES];
+// Copy of every thread copying files.
+static _Thread_local copy current;
+// Set while a cycle is in progress.
+static char synchronizing;
+// Time at which the current or the last cycle began and ended.
+static unsigned long long cycleStart, cycleEnd;
+/* Bytes written in the cycle, bytes of the begun copies and bytes queued
+for copier threads; changed atomically. */
+static unsigned long long bytesDone, bytesStarted;
+static long long bytesQueued;
+// Time and bytes done of the last sample and the rate measured since then.
+static unsigned long long sampleTime, sampleDone;
+static double rate;
+// Status file path, its temporary path and the thread rewriting it.
+static char statusPath[PATH_MAX], temporaryPath[PATH_MAX];
+static pthread_t statusThread;
+// Set while the status file thread runs.
+static char started, running;
+// Summary written to the status file.
+static char statusText[PROGRESSLENGTH];
+
+void progressBeginCycle(void)
+{
+  pthread_mutex_lock(&lock);
+  synchronizing = 1;
+  cycleStart = cycleEnd = sampleTime = metricsNow();
+  sampleDone = 0;
+  rate = 0;
+  __atomic_store_n(&bytesDone, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&bytesStarted, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&bytesQueued, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&lock);
+}
+
+void progressEndCycle(void)
+{
+  pthread_mutex_lock(&lock);
+  synchronizing = 0;
+  cycleEnd = metricsNow();
+  pthread_mutex_unlock(&lock);
+}
+
+void progressQueue(long long bytes)
+{
+  __atomic_add_fetch(&bytesQueued, bytes, __ATOMIC_RELAXED);
+}
+
+void progressBeginFile(const char *path, unsigned long long size)
+{
+  current.active = 1;
+  current.size = size;
+  current.done = 0;
+  current.slot = NULL;
+  __atomic_add_fetch(&bytesStarted, size, __ATOMIC_RELAXED);
+  // Small files are copied too quickly to be worth reporting.
+  if (size < PROGRESSSIZE)
+    return;
+  unsigned int i;
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < PROGRESSFILES; ++i)
+    if (!slots[i].used)
+    {
+      tracked *t = &slots[i];
+      t->used = 1;
+      strncpy(t->path, path, PATH_MAX - 1);
+      t->path[PATH_MAX - 1] = '\0';
+      t->size = size;
+      t->done = 0;
+      t->start = metricsNow();
+      current.slot = t;
+      break;
+    }
+  pthread_mutex_unlock(&lock);
+}
+
+void progressAdvance(unsigned long long bytes)
+{
+  if (!current.active)
+    return;
+  current.done += bytes;
+  __atomic_add_fetch(&bytesDone, bytes, __ATOMIC_RELAXED);
+  if (current.slot != NULL)
+    __atomic_store_n(&current.slot->done, current.done, __ATOMIC_RELAXED);
+}
+
+void progressEndFile(void)
+{
+  if (!current.active)
+    return;
+  current.active = 0;
+  // Expect only the written bytes of a failed or shortened copy.
+  if (current.done < current.size)
+    __atomic_sub_fetch(&bytesStarted, current.size - current.done,
+      __ATOMIC_RELAXED);
+  if (current.slot != NULL)
+  {
+    pthread_mutex_lock(&lock);
+    current.slot->used = 0;
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+/*
+Appends a line to the summary if it fits.
+reads:
+buffer - summary
+size - size in bytes of the buffer
+length - length in bytes of the summary
+format - format of the line like in printf followed by its arguments
+returns:
+length in bytes of the summary with the line or without it if it does
+  not fit
+*/
+static size_t appendLine(char *buffer, size_t size, size_t length,
+  const char *format, ...)
+{
+  va_list arguments;
+  va_start(arguments, format);
+  int written = vsnprintf(buffer + length, size - length, format, arguments);
+  va_end(arguments);
+  // If the line does not fit, cut it off.
+  if (written < 0 || (size_t)written >= size - length)
+  {
+    buffer[length] = '\0';
+    return length;
+  }
+  return length + written;
+}
+
+/*
+Writes the estimated time left of a copy into a buffer.
+reads:
+remaining - number of bytes left
+speed - rate in bytes per second
+writes:
+buffer - "<seconds> s" or "unknown"; must have room for 32 bytes
+*/
+static void formatEstimate(unsigned long long remaining, double speed,
+  char *buffer)
+{
+  if (remaining == 0)
+    strcpy(buffer, "0 s");
+  else if (speed < 1)
+    strcpy(buffer, "unknown");
+  else
+    snprintf(buffer, 32, "%.0f s", remaining / speed);
+}
+
+size_t progressFormat(char *buffer, size_t size)
+{
+  char estimate[32];
+  size_t length = 0;
+  unsigned int i;
+  buffer[0] = '\0';
+  pthread_mutex_lock(&lock);
+  unsigned long long now = metricsNow();
+  unsigned long long done = __atomic_load_n(&bytesDone, __ATOMIC_RELAXED);
+  unsigned long long end = synchronizing ? now : cycleEnd;
+  double elapsed = (end - cycleStart) / 1e9;
+  if (synchronizing)
+  {
+    /* Measure the current rate over at least a second; before the first
+    sample, use the average of the cycle. */
+    if (now - sampleTime >= 1000000000ULL)
+    {
+      rate = (done - sampleDone) * 1e9 / (now - sampleTime);
+      sampleTime = now;
+      sampleDone = done;
+    }
+    else if (sampleDone == 0 && now > cycleStart)
+      rate = done * 1e9 / (now - cycleStart);
+  }
+  else
+    // Report the average rate of the finished cycle.
+    rate = end > cycleStart ? done * 1e9 / (end - cycleStart) : 0;
+  long long queued = __atomic_load_n(&bytesQueued, __ATOMIC_RELAXED);
+  unsigned long long known = __atomic_load_n(&bytesStarted, __ATOMIC_RELAXED)
+    + (queued > 0 ? queued : 0);
+  if (known < done)
+    known = done;
+  formatEstimate(known - done, rate, estimate);
+  length = appendLine(buffer, size, length,
+    "state: %s\nelapsed: %.0f s\nbytes done: %llu\nbytes known: %llu\n"
+    "rate: %.0f B/s\neta: %s\n", synchronizing ? "synchronizing" : "sleeping",
+    elapsed, done, known, rate, synchronizing ? estimate : "0 s");
+  for (i = 0; i < PROGRESSFILES; ++i)
+    if (slots[i].used)
+    {
+      const tracked *t = &slots[i];
+      unsigned long long fileDone = __atomic_load_n(&t->done,
+        __ATOMIC_RELAXED);
+      double fileRate = now > t->start ? fileDone * 1e9 / (now - t->start) :
+        0;
+      formatEstimate(fileDone < t->size ? t->size - fileDone : 0, fileRate,
+        estimate);
+      // The path is last because it may contain spaces.
+      length = appendLine(buffer, size, length,
+        "file: %llu/%llu bytes, %.0f B/s, eta %s, %s\n", fileDone, t->size,
+        fileRate, estimate, t->path);
+    }
+  pthread_mutex_unlock(&lock);
+  return length;
+}
+
+/*
+Writes the summary to the status file through its temporary file.
+returns:
+-1 if an error occured (errno is set)
+0 if no error occured
+*/
+static int writeStatus(void)
+{
+  size_t length = progressFormat(statusText, sizeof(statusText));
+  int descriptor = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC |
+    O_CLOEXEC, 0644);
+  if (descriptor == -1)
+    return -1;
+  size_t position = 0;
+  while (position < length)
+  {
+    ssize_t written = write(descriptor, statusText + position,
+      length - position);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1)
+    {
+      close(descriptor);
+      return -1;
+    }
+    position += written;
+  }
+  if (close(descriptor) == -1)
+    return -1;
+  // rename is atomic within a file system.
+  return rename(temporaryPath, statusPath);
+}
+
+/*
+Function of the thread rewriting the status file.
+reads:
+argument - unused
+*/
+static void *statusMain(void *argument)
+{
+  // The thread is started without an argument.
+  (void)argument;
+  // Report a failure once instead of every interval.
+  int failed = 0;
+  pthread_mutex_lock(&lock);
+  while (running)
+  {
+    pthread_mutex_unlock(&lock);
+    if (writeStatus() == -1)
+    {
+      if (!failed)
+        logMessage(LOG_WARNING, "writing status to %s; %i", statusPath, errno);
+      failed = 1;
+    }
+    else
+      failed = 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PROGRESSINTERVAL;
+    pthread_mutex_lock(&lock);
+    // Sleep until the interval passes or the thread is stopped.
+    while (running && pthread_cond_timedwait(&stopped, &lock, &deadline) !=
+      ETIMEDOUT)
+      ;
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+int progressStart(const char *path)
+{
+  if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path)
+    >= (int)sizeof(temporaryPath))
+    return -1;
+  strcpy(statusPath, path);
+  running = 1;
+  sigset_t set, previousSet;
+  sigfillset(&set);
+  // The thread inherits the mask so signals are not delivered to it.
+  pthread_sigmask(SIG_BLOCK, &set, &previousSet);
+  int status = pthread_create(&statusThread, NULL, statusMain, NULL);
+  pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+  if (status != 0)
+  {
+    running = 0;
+    return -2;
+  }
+  started = 1;
+  return 0;
+}
+
+void progressStop(void)
+{
+  if (!started)
+    return;
+  pthread_mutex_lock(&lock);
+  running = 0;
+  pthread_cond_signal(&stopped);
+  pthread_mutex_unlock(&lock);
+  pthread_join(statusThread, NULL);
+  started = 0;
+  unlink(statusPath);
+  unlink(temporaryPath);
+}
@@ -0,0 +1,190 @@
+#include "schedule.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Minimal and maximal time in seconds between scans of a directory.
+static unsigned int minimalInterval, maximalInterval;
+// Time at which the current cycle started.
+static time_t now;
+// If not 0, every directory is due in the current cycle.
+static char everythingDue;
+
+/*
+Creates a node of a directory which has never been scanned so it is due
+  immediately.
+reads:
+name - subdirectory name or NULL for the source directory
+returns:
+NULL if an error occured
+created node otherwise
+*/
+static scanNode *createNode(const char *name)
+{
+  scanNode *node = malloc(sizeof(scanNode));
+  if (node == NULL)
+    return NULL;
+  node->name = NULL;
+  // Copy the name because dirent objects are released after the scan.
+  if (name != NULL && (node->name = strdup(name)) == NULL)
+  {
+    free(node);
+    return NULL;
+  }
+  node->children = node->next = NULL;
+  node->interval = minimalInterval;
+  node->due = node->subtreeDue = 0;
+  node->holders = 0;
+  node->changes = 0;
+  return node;
+}
+
+/*
+Releases a node and all its descendants.
+reads:
+node - node to be released
+*/
+static void freeSubtree(scanNode *node)
+{
+  scanNode *child = node->children, *next;
+  while (child != NULL)
+  {
+    next = child->next;
+    freeSubtree(child);
+    child = next;
+  }
+  free(node->name);
+  free(node);
+}
+
+void scheduleConfigure(unsigned int minInterval, unsigned int maxInterval)
+{
+  minimalInterval = minInterval;
+  // The maximal interval cannot be less than the minimal one.
+  maximalInterval = maxInterval > minInterval ? maxInterval : minInterval;
+}
+
+void scheduleBeginCycle(char full)
+{
+  now = time(NULL);
+  everythingDue = full;
+}
+
+scanNode *scheduleCreateRoot(void)
+{
+  return createNode(NULL);
+}
+
+void scheduleDestroy(scanNode *root)
+{
+  if (root != NULL)
+    freeSubtree(root);
+}
+
+int scheduleDue(const scanNode *node)
+{
+  return everythingDue || node->due <= now;
+}
+
+int scheduleSubtreeDue(const scanNode *node)
+{
+  return everythingDue || node->subtreeDue <= now;
+}
+
+void scheduleRecord(scanNode *node, unsigned long long changes)
+{
+  // A directory which has just changed will probably change again soon.
+  if (changes != 0)
+    node->interval = minimalInterval;
+  // Back off exponentially from a directory which does not change.
+  else if (node->interval < maximalInterval / 2)
+    node->interval *= 2;
+  else
+    node->interval = maximalInterval;
+  // The last action of the directory may record it while it is updated.
+  __atomic_store_n(&node->due, now + node->interval, __ATOMIC_RELAXED);
+}
+
+void scheduleOpen(scanNode *node)
+{
+  // No action of the directory is in flight before the scanner lists it.
+  node->holders = 1;
+  node->changes = 0;
+}
+
+void scheduleHold(scanNode *node)
+{
+  __atomic_add_fetch(&node->holders, 1, __ATOMIC_RELAXED);
+}
+
+void scheduleRelease(scanNode *node, unsigned long long changes)
+{
+  if (changes != 0)
+    __atomic_add_fetch(&node->changes, changes, __ATOMIC_RELAXED);
+  // The last holder sees the changes of the others.
+  if (__atomic_sub_fetch(&node->holders, 1, __ATOMIC_ACQ_REL) == 0)
+    scheduleRecord(node, __atomic_load_n(&node->changes, __ATOMIC_RELAXED));
+}
+
+void scheduleInvalidate(scanNode *node)
+{
+  node->due = now;
+}
+
+int scheduleSetChildren(scanNode *node, list *subdirs)
+{
+  // The old children and the subdirectories are both sorted so merge them.
+  scanNode *old = node->children, *next, **tail = &node->children;
+  element *cur = subdirs->first;
+  int ret = 0;
+  while (cur != NULL)
+  {
+    int comparison = old == NULL ? 1 : strcmp(old->name, cur->entry->d_name);
+    // The old child does not exist anymore.
+    if (comparison < 0)
+    {
+      next = old->next;
+      freeSubtree(old);
+      old = next;
+      continue;
+    }
+    // The subdirectory already had a node.
+    if (comparison == 0)
+    {
+      *tail = old;
+      old = old->next;
+    }
+    // The subdirectory is new. If an error occured
+    else if ((*tail = createNode(cur->entry->d_name)) == NULL)
+    {
+      ret = -1;
+      break;
+    }
+    tail = &(*tail)->next;
+    cur = cur->next;
+  }
+  // Terminate the new list of children.
+  *tail = NULL;
+  // Release the old children which were not reused.
+  while (old != NULL)
+  {
+    next = old->next;
+    freeSubtree(old);
+    old = next;
+  }
+  return ret;
+}
+
+void scheduleUpdate(scanNode *node)
+{
+  /* If the last action of the directory records it later, subtreeDue stays
+  earlier than due and the next cycle only descends into the subtree
+  in vain. */
+  time_t earliest = __atomic_load_n(&node->due, __ATOMIC_RELAXED);
+  scanNode *child;
+  for (child = node->children; child != NULL; child = child->next)
+    if (child->subtreeDue < earliest)
+      earliest = child->subtreeDue;
+  node->subtreeDue = earliest;
+}
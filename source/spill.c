@@ -0,0 +1,555 @@
+// O_TMPFILE is a Linux extension.
+#define _GNU_SOURCE
+#include "spill.h"
+#include "arena.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+
+// Size of the buffer in which runs are written.
+#define WRITEBUFFERSIZE 65536
+// Minimal and maximal size of the buffer of a run during merging.
+#define MINRUNBUFFER 4096
+#define MAXRUNBUFFER (1024 * 1024)
+
+/* Buffer in which runs are written. Only the thread synchronizing
+directories spills listings. */
+static char writeBuffer[WRITEBUFFERSIZE];
+// Number of bytes in the buffer.
+static size_t writeLength;
+
+typedef struct reader reader;
+/*
+Buffered reader of one run. A record is the entry type (1 byte) followed
+  by the entry name with '\0'.
+*/
+struct reader
+{
+  // Offset of the unread part of the run and offset of its end.
+  off_t position, end;
+  // Buffer with bytes of the run.
+  char *buffer;
+  // Offset of the current record and number of bytes in the buffer.
+  size_t start, length;
+  // Length of the current record or 0 if the run is exhausted.
+  size_t recordLength;
+};
+
+/*
+K-way merge of runs using a binary min-heap of readers ordered
+  by their current records.
+*/
+struct merge
+{
+  // Spill whose runs are merged.
+  spill *source;
+  // Readers of the runs.
+  reader *readers;
+  // Heap of reader indices.
+  unsigned int *heap;
+  // Number of readers in the heap.
+  unsigned int heapSize;
+  // Size of the buffer of each reader.
+  size_t bufferSize;
+  // Reader whose record was returned and has to be moved before the next one.
+  int returned;
+};
+
+/*
+Writes the buffered records at the end of the temporary file.
+writes:
+s - spill
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int flushWriteBuffer(spill *s)
+{
+  size_t written = 0;
+  while (written < writeLength)
+  {
+    ssize_t bytesWritten = pwrite(s->file, writeBuffer + written,
+      writeLength - written, s->size);
+    if (bytesWritten == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    written += bytesWritten;
+    s->size += bytesWritten;
+  }
+  writeLength = 0;
+  return 0;
+}
+
+/*
+Appends a record to the write buffer.
+reads:
+type - entry type
+name - entry name
+writes:
+s - spill
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int writeRecord(spill *s, unsigned char type, const char *name)
+{
+  size_t length = strlen(name) + 2;
+  if (writeLength + length > WRITEBUFFERSIZE && flushWriteBuffer(s) < 0)
+    return -1;
+  writeBuffer[writeLength] = (char)type;
+  memcpy(writeBuffer + writeLength + 1, name, length - 1);
+  writeLength += length;
+  return 0;
+}
+
+/*
+Ends the run being written.
+writes:
+s - spill with an added run
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int endRun(spill *s)
+{
+  if (flushWriteBuffer(s) < 0)
+    return -1;
+  // Make room for the offset of the end of the run.
+  if (s->runs + 2 > s->capacity)
+  {
+    unsigned int capacity = s->capacity * 2;
+    off_t *offsets = realloc(s->offsets, sizeof(off_t) * capacity);
+    if (offsets == NULL)
+      return -1;
+    s->offsets = offsets;
+    s->capacity = capacity;
+  }
+  s->offsets[++s->runs] = s->size;
+  return 0;
+}
+
+/*
+Creates the temporary file, unlinked so that it disappears when closed.
+writes:
+s - spill
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int createFile(spill *s)
+{
+  const char *directory = getenv("TMPDIR");
+  if (directory == NULL || directory[0] == '\0')
+    directory = "/tmp";
+  if ((s->offsets = malloc(sizeof(off_t) * 16)) == NULL)
+    return -1;
+  s->capacity = 16;
+  s->offsets[0] = 0;
+  s->file = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  // If the file system does not support unnamed files, unlink a named one.
+  if (s->file == -1)
+  {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/DirSyncD.XXXXXX", directory);
+    if ((s->file = mkstemp(path)) != -1)
+      unlink(path);
+  }
+  if (s->file == -1)
+  {
+    free(s->offsets);
+    s->offsets = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void spillInitialize(spill *s, unsigned long long memoryBudget)
+{
+  s->file = -1;
+  s->size = 0;
+  s->offsets = NULL;
+  s->runs = s->capacity = 0;
+  s->limit = memoryBudget / 2;
+}
+
+int spillWrite(spill *s, list *files, list *subdirs)
+{
+  if (s->file == -1 && createFile(s) < 0)
+    return -1;
+  listMergeSort(files);
+  element *curF = files->first, *curD = NULL;
+  if (subdirs != NULL)
+  {
+    listMergeSort(subdirs);
+    curD = subdirs->first;
+  }
+  writeLength = 0;
+  // Merge both sorted lists into one run.
+  while (curF != NULL || curD != NULL)
+  {
+    element **cur = curD == NULL || (curF != NULL && cmp(curF, curD) < 0) ?
+      &curF : &curD;
+    if (writeRecord(s, (*cur)->entry->d_type, (*cur)->entry->d_name) < 0)
+      return -2;
+    *cur = (*cur)->next;
+  }
+  return endRun(s) < 0 ? -3 : 0;
+}
+
+/*
+Moves a reader to its next record.
+reads:
+file - descriptor of the temporary file
+bufferSize - size of the reader's buffer
+writes:
+r - reader; recordLength is 0 if the run is exhausted
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int readRecord(reader *r, int file, size_t bufferSize)
+{
+  r->start += r->recordLength;
+  r->recordLength = 0;
+  while (1)
+  {
+    // Look for the end of the name after the type byte.
+    if (r->length - r->start >= 2)
+    {
+      char *end = memchr(r->buffer + r->start + 1, '\0',
+        r->length - r->start - 1);
+      if (end != NULL)
+      {
+        r->recordLength = end - (r->buffer + r->start) + 1;
+        return 0;
+      }
+    }
+    // If the whole run was read, it is exhausted.
+    if (r->position == r->end)
+      return r->start == r->length ? 0 : -1;
+    // Move the incomplete record to the beginning and read more bytes.
+    memmove(r->buffer, r->buffer + r->start, r->length - r->start);
+    r->length -= r->start;
+    r->start = 0;
+    size_t count = bufferSize - r->length;
+    if ((off_t)count > r->end - r->position)
+      count = r->end - r->position;
+    ssize_t bytesRead = pread(file, r->buffer + r->length, count, r->position);
+    if (bytesRead == -1 && errno == EINTR)
+      continue;
+    if (bytesRead <= 0)
+      return -1;
+    r->length += bytesRead;
+    r->position += bytesRead;
+  }
+}
+
+/*
+Compares the current records of two readers by entry name.
+*/
+static int compareReaders(merge *m, unsigned int a, unsigned int b)
+{
+  reader *ra = &m->readers[a], *rb = &m->readers[b];
+  int comparison = strcmp(ra->buffer + ra->start + 1,
+    rb->buffer + rb->start + 1);
+  // Prefer earlier runs to keep the merge stable.
+  return comparison != 0 ? comparison : (int)a - (int)b;
+}
+
+/*
+Restores the heap order by moving down the reader at the given position.
+*/
+static void siftDown(merge *m, unsigned int i)
+{
+  while (1)
+  {
+    unsigned int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+    if (left < m->heapSize &&
+      compareReaders(m, m->heap[left], m->heap[smallest]) < 0)
+      smallest = left;
+    if (right < m->heapSize &&
+      compareReaders(m, m->heap[right], m->heap[smallest]) < 0)
+      smallest = right;
+    if (smallest == i)
+      return;
+    unsigned int swap = m->heap[i];
+    m->heap[i] = m->heap[smallest];
+    m->heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+/*
+Starts merging a range of runs.
+reads:
+first - index of the first run
+count - number of runs
+bufferSize - size of the buffer of each reader
+writes:
+m - merge
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+static int mergeOpen(merge *m, spill *s, unsigned int first, unsigned int count,
+  size_t bufferSize)
+{
+  unsigned int i;
+  m->source = s;
+  m->bufferSize = bufferSize;
+  m->heapSize = 0;
+  m->returned = -1;
+  m->readers = malloc(sizeof(reader) * count);
+  m->heap = malloc(sizeof(unsigned int) * count);
+  char *buffers = malloc(bufferSize * count);
+  if (m->readers == NULL || m->heap == NULL || buffers == NULL)
+  {
+    free(m->readers);
+    free(m->heap);
+    free(buffers);
+    return -1;
+  }
+  for (i = 0; i < count; ++i)
+  {
+    reader *r = &m->readers[i];
+    r->position = s->offsets[first + i];
+    r->end = s->offsets[first + i + 1];
+    r->buffer = buffers + bufferSize * i;
+    r->start = r->length = r->recordLength = 0;
+    if (readRecord(r, s->file, bufferSize) < 0)
+    {
+      free(m->readers);
+      free(m->heap);
+      free(buffers);
+      return -2;
+    }
+    // Only runs which are not empty take part in the merge.
+    if (r->recordLength != 0)
+      m->heap[m->heapSize++] = i;
+  }
+  for (i = m->heapSize / 2; i-- > 0;)
+    siftDown(m, i);
+  return 0;
+}
+
+/*
+Returns the next record of the merge. The record stays valid until
+  the next call.
+writes:
+m - merge
+returns:
+NULL if all runs are exhausted or an error occured (error is set to 1)
+record (type byte followed by the name) otherwise
+*/
+static const char *mergeNext(merge *m, int *error)
+{
+  *error = 0;
+  // Move the reader whose record was returned by the previous call.
+  if (m->returned != -1)
+  {
+    reader *r = &m->readers[m->heap[0]];
+    if (readRecord(r, m->source->file, m->bufferSize) < 0)
+    {
+      *error = 1;
+      return NULL;
+    }
+    // If the run is exhausted, replace it with the last one in the heap.
+    if (r->recordLength == 0)
+      m->heap[0] = m->heap[--m->heapSize];
+    siftDown(m, 0);
+    m->returned = -1;
+  }
+  if (m->heapSize == 0)
+    return NULL;
+  m->returned = (int)m->heap[0];
+  reader *r = &m->readers[m->heap[0]];
+  return r->buffer + r->start;
+}
+
+/*
+Releases the memory of a merge.
+*/
+static void mergeClose(merge *m)
+{
+  free(m->readers[0].buffer);
+  free(m->readers);
+  free(m->heap);
+}
+
+/*
+Merges groups of runs into longer runs until all runs can be merged
+  at once within the limit of the spill.
+writes:
+s - spill
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+static int reduceRuns(spill *s)
+{
+  // Maximal number of runs merged at once.
+  unsigned int fanIn = s->limit / MINRUNBUFFER;
+  if (fanIn < 2)
+    fanIn = 2;
+  while (s->runs > fanIn)
+  {
+    unsigned int runs = s->runs, first, merged = 0;
+    // Offsets of the new runs written at the end of the file.
+    off_t *offsets = malloc(sizeof(off_t) * (runs / fanIn + 2));
+    if (offsets == NULL)
+      return -1;
+    offsets[0] = s->size;
+    for (first = 0; first < runs; first += fanIn)
+    {
+      unsigned int count = runs - first < fanIn ? runs - first : fanIn;
+      merge m;
+      const char *record;
+      int error;
+      if (mergeOpen(&m, s, first, count, MINRUNBUFFER) < 0)
+      {
+        free(offsets);
+        return -2;
+      }
+      writeLength = 0;
+      while ((record = mergeNext(&m, &error)) != NULL)
+        if (writeRecord(s, (unsigned char)record[0], record + 1) < 0)
+        {
+          error = 1;
+          break;
+        }
+      mergeClose(&m);
+      if (error || flushWriteBuffer(s) < 0)
+      {
+        free(offsets);
+        return -3;
+      }
+      offsets[++merged] = s->size;
+    }
+    // Replace the runs with the merged ones.
+    free(s->offsets);
+    s->offsets = offsets;
+    s->runs = merged;
+    s->capacity = runs / fanIn + 2;
+  }
+  return 0;
+}
+
+int spillCollect(spill *s, unsigned char type, list *l)
+{
+  cursor c;
+  if (cursorOpen(&c, NULL, s, type) < 0)
+    return -1;
+  int ret = 0;
+  while (c.name != NULL)
+  {
+    // Create a directory entry containing only the type and the name.
+    size_t length = strlen(c.name) + 1;
+    struct dirent *entry = arenaAllocate(offsetof(struct dirent, d_name) +
+      length);
+    if (entry == NULL || pushBack(l, entry) < 0)
+    {
+      ret = -2;
+      break;
+    }
+    entry->d_type = type;
+    memcpy(entry->d_name, c.name, length);
+    if (cursorNext(&c) < 0)
+    {
+      ret = -3;
+      break;
+    }
+  }
+  cursorClose(&c);
+  return ret;
+}
+
+void spillClose(spill *s)
+{
+  if (s->file != -1)
+    close(s->file);
+  free(s->offsets);
+  // Keep the limit so that the spill can be used again.
+  s->file = -1;
+  s->size = 0;
+  s->offsets = NULL;
+  s->runs = s->capacity = 0;
+}
+
+int cursorOpen(cursor *c, list *l, spill *s, unsigned char type)
+{
+  c->element = NULL;
+  c->merge = NULL;
+  c->type = type;
+  c->name = NULL;
+  c->index = 0;
+  // If nothing was spilled, iterate over the list.
+  if (s == NULL || s->runs == 0)
+  {
+    c->element = l != NULL ? l->first : NULL;
+    c->name = c->element != NULL ? c->element->entry->d_name : NULL;
+    return 0;
+  }
+  // Merge runs if there are too many to read them at once.
+  if (reduceRuns(s) < 0)
+    return -1;
+  size_t bufferSize = s->limit / s->runs;
+  if (bufferSize < MINRUNBUFFER)
+    bufferSize = MINRUNBUFFER;
+  if (bufferSize > MAXRUNBUFFER)
+    bufferSize = MAXRUNBUFFER;
+  if ((c->merge = malloc(sizeof(merge))) == NULL)
+    return -2;
+  if (mergeOpen(c->merge, s, 0, s->runs, bufferSize) < 0)
+  {
+    free(c->merge);
+    c->merge = NULL;
+    return -3;
+  }
+  // Move to the first entry of the type.
+  return cursorNext(c);
+}
+
+int cursorNext(cursor *c)
+{
+  ++c->index;
+  if (c->merge == NULL)
+  {
+    if (c->element != NULL)
+      c->element = c->element->next;
+    c->name = c->element != NULL ? c->element->entry->d_name : NULL;
+    return 0;
+  }
+  const char *record;
+  int error;
+  // Skip the records of entries of other types.
+  while ((record = mergeNext(c->merge, &error)) != NULL &&
+    (unsigned char)record[0] != c->type)
+    ;
+  c->name = record != NULL ? record + 1 : NULL;
+  return error ? -1 : 0;
+}
+
+int cursorStable(const cursor *c)
+{
+  return c->merge == NULL;
+}
+
+void cursorClose(cursor *c)
+{
+  if (c->merge != NULL)
+  {
+    mergeClose(c->merge);
+    free(c->merge);
+    c->merge = NULL;
+  }
+}
@@ -1,51 +1,684 @@
+#include "arena.h"
+#include "control.h"
+#include "device.h"
 #include "directory.h"
+#include "dirsync.h"
 #include "file.h"
+#include "filter.h"
+#include "hash_join.h"
+#include "logger.h"
+#include "metrics.h"
+#include "partition.h"
 #include "path.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "probes.h"
+#include "progress.h"
+#include "schedule.h"
 #include "synchronization.h"
+#include "trace.h"
 
+#include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <syslog.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
 
-// 'extern' - a global variable declared in a different .c file
-/* Big file threshold. If the file size is lesser than threshold,
-then during copying the file is considered small, otherwise big. */
-extern unsigned long long threshold;
+// Device of a target directory whose metadata could not be read.
+#define UNKNOWNDEVICE ((dev_t)-1)
 
-int updateDestinationFiles(const char *srcDirPath,
-  const size_t srcDirPathLength, list *filesSrc,
-  const char *dstDirPath, const size_t dstDirPathLength, list *filesDst)
+/* Device of the target directory of the range synchronized by this thread
+(partition.h) or UNKNOWNDEVICE if copies of this thread do not reserve
+device slots. */
+static _Thread_local dev_t rangeDevice = UNKNOWNDEVICE;
+/* Node of the directory whose files the scanner submits to the pipeline
+or NULL without adaptive scanning. */
+static scanNode *scannedNode;
+
+/*
+Reads file metadata using stat and records the latency in the metrics.
+reads:
+path - file path
+writes:
+buf - file metadata
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int statFile(const char *path, struct stat *buf)
+{
+  // Save the time before reading metadata.
+  unsigned long long start = metricsNow();
+  // Read the metadata.
+  int ret = stat(path, buf);
+  // Record the latency.
+  unsigned long long end = metricsNow();
+  metricsObserve(HISTOGRAM_STAT, end - start);
+  traceSpan(TRACE_STAT, start, end, path);
+  PROBE(stat, path, ret, end - start);
+  // Count the file.
+  metricsAdd(METRIC_FILES_STATED, 1);
+  // If an error occured
+  if (ret == -1)
+    // Count the error.
+    metricsAdd(METRIC_ERRORS, 1);
+  // Return the status code.
+  return ret;
+}
+
+/*
+Reads the metadata of the file at a cursor from a prefetch or, if it was not
+  prefetched, using statFile.
+reads:
+metadata - prefetch of the files or NULL
+side - side of the cursor in the prefetch
+c - cursor at the file
+path - file path
+writes:
+buf - file metadata
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int statCursor(prefetch *metadata, enum prefetchSide side,
+  const cursor *c, const char *path, struct stat *buf)
+{
+  // Files read from spilled runs are not prefetched.
+  if (metadata != NULL && cursorStable(c))
+    return prefetchGet(metadata, side, c->index, buf);
+  return statFile(path, buf);
+}
+
+/*
+Computes how long ago a source file was modified, i.e. how stale its copy
+  is until the copy is written.
+reads:
+metadata - source file metadata
+returns:
+time in nanoseconds since the modification or 0 if it is in the future
+*/
+static unsigned long long staleness(const struct stat *metadata)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  long long nanoseconds = ((long long)now.tv_sec -
+    metadata->st_mtim.tv_sec) * 1000000000LL + (now.tv_nsec -
+    metadata->st_mtim.tv_nsec);
+  // Modification times in the future are caused by clock skew.
+  return nanoseconds > 0 ? (unsigned long long)nanoseconds : 0;
+}
+
+/*
+Checks if a file was modified less than minimumAge seconds ago, so that
+  it may still be written, and if so, counts and logs it.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+path - source file path
+metadata - source file metadata
+returns:
+1 if copying the file has to be deferred to a later cycle
+0 otherwise
+*/
+static int deferCopy(const dirsyncSettings *settings, const char *path,
+  const struct stat *metadata)
+{
+  unsigned int minimumAge = settings->minimumAge;
+  // If the check is disabled
+  if (minimumAge == 0)
+    return 0;
+  long long age = (long long)time(NULL) - metadata->st_mtim.tv_sec;
+  /* Modification times in the future by less than minimumAge are treated
+  the same because of clock skew between a file server and the daemon. */
+  if (age >= minimumAge || age <= -(long long)minimumAge)
+    return 0;
+  metricsAdd(METRIC_FILES_DEFERRED, 1);
+  // The target file stays outdated until a later cycle.
+  metricsStaleness(staleness(metadata));
+  logMessage(LOG_DEBUG, "deferring %s modified %llis ago; 0", path, age);
+  return 1;
+}
+
+/*
+Checks if a source file changed while it was copied. If so, sets
+  the modification time of the copy to the epoch so that the next cycle
+  finds it outdated and copies the file again.
+reads:
+srcFilePath - source file path
+dstFilePath - target file path
+srcFile - source file metadata read before copying
+returns:
+1 if the source file changed
+0 otherwise
+*/
+static int changedWhileCopying(const char *srcFilePath,
+  const char *dstFilePath, const struct stat *srcFile)
+{
+  struct stat current;
+  const struct timespec epoch[2] = {{0, 0}, {0, 0}};
+  // If the file was removed, the next cycle removes the copy.
+  if (stat(srcFilePath, &current) == -1 ||
+    (current.st_size == srcFile->st_size &&
+    current.st_mtim.tv_sec == srcFile->st_mtim.tv_sec &&
+    current.st_mtim.tv_nsec == srcFile->st_mtim.tv_nsec))
+    return 0;
+  utimensat(AT_FDCWD, dstFilePath, epoch, 0);
+  metricsAdd(METRIC_FILES_DEFERRED, 1);
+  logMessage(LOG_WARNING, "source file %s changed while copying it to %s, "
+    "copying it again later; 0", srcFilePath, dstFilePath);
+  return 1;
+}
+
+/*
+Copies a file using copySmallFile or copyBigFile depending on its size
+  and the big file threshold. In a partitioning thread, waits for slots
+  on the devices (device.h) like a copier of the pipeline. Records
+  the latency, the replication lag and copied bytes in the metrics
+  and reports the copy to the callback of the synchronizing context
+  (dirsync.h).
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+srcFilePath - source file path
+dstFilePath - target file path
+srcFile - source file metadata
+returns:
+the status code of copySmallFile or copyBigFile
+*/
+static int copyFile(const dirsyncSettings *settings,
+  const char *srcFilePath, const char *dstFilePath, const struct stat *srcFile)
+{
+  int status;
+  // If the thread synchronizes a range, wait until both devices allow a copy.
+  if (rangeDevice != UNKNOWNDEVICE)
+    deviceAcquire(srcFile->st_dev, rangeDevice,
+      srcFile->st_size < LANETINYSIZE);
+  // Save the time before copying.
+  unsigned long long start = metricsNow();
+  // Report the bytes written by the copy loops to the progress.
+  progressBeginFile(srcFilePath, srcFile->st_size);
+  PROBE(copy_start, srcFilePath, dstFilePath, srcFile->st_size,
+    (unsigned long long)srcFile->st_size < settings->threshold ?
+    "small" : "big");
+  // If the source file is smaller than the big file threshold
+  if ((unsigned long long)srcFile->st_size < settings->threshold)
+    /* Copy it as a small file. Copy permissions and modification time
+    of the source file to the target file. */
+    status = copySmallFile(srcFilePath, dstFilePath, srcFile->st_mode,
+      &srcFile->st_atim, &srcFile->st_mtim);
+  // If the source file is bigger or the same size as the big file threshold
+  else
+    // Copy it as a big file.
+    status = copyBigFile(srcFilePath, dstFilePath, srcFile->st_size,
+      srcFile->st_mode, &srcFile->st_atim, &srcFile->st_mtim);
+  // Stop reporting the copy.
+  progressEndFile();
+  if (rangeDevice != UNKNOWNDEVICE)
+    deviceRelease(srcFile->st_dev, rangeDevice);
+  // Record the latency.
+  unsigned long long end = metricsNow();
+  metricsObserve(HISTOGRAM_COPY, end - start);
+  traceSpan(TRACE_COPY, start, end, srcFilePath);
+  PROBE(copy_end, srcFilePath, srcFile->st_size, status, end - start);
+  /* Whether the copy succeeded or not, the target file was as stale
+  as the modification of the source file is old. */
+  unsigned long long lag = staleness(srcFile);
+  metricsStaleness(lag);
+  // If an error occured
+  if (status != 0)
+  {
+    // Count the error.
+    metricsAdd(METRIC_ERRORS, 1);
+    dirsyncNotify(DIRSYNC_ERROR, dstFilePath, 0, status);
+  }
+  /* If files may be modified while they are copied and the source file was,
+  the copy is not counted. */
+  else if (settings->minimumAge == 0 ||
+    !changedWhileCopying(srcFilePath, dstFilePath, srcFile))
+  {
+    // Count the file and its bytes and record the replication lag.
+    metricsAdd(METRIC_FILES_COPIED, 1);
+    metricsObserve(HISTOGRAM_LAG, lag);
+    metricsAdd(METRIC_BYTES_COPIED, srcFile->st_size);
+    dirsyncNotify(DIRSYNC_COPIED, dstFilePath, srcFile->st_size, 0);
+  }
+  // Return the status code.
+  return status;
+}
+
+/*
+Records the result of removing a file or a directory in the metrics
+  and reports it to the callback of the synchronizing context (dirsync.h).
+reads:
+path - path of the removed entry
+status - status code of the removal
+start - time before the removal (metricsNow)
+*/
+static void countRemoval(const char *path, int status,
+  unsigned long long start)
+{
+  unsigned long long end = metricsNow();
+  traceSpan(TRACE_DELETE, start, end, path);
+  PROBE(delete, path, status, end - start);
+  // If an error occured, count the error, otherwise count the removal.
+  metricsAdd(status != 0 ? METRIC_ERRORS : METRIC_DELETES, 1);
+  dirsyncNotify(status != 0 ? DIRSYNC_ERROR : DIRSYNC_DELETED, path, 0,
+    status);
+}
+
+typedef struct pendingCopy pendingCopy;
+/*
+File whose copying is postponed until all files of the directory
+  are compared, so that the files can be copied in order from the most
+  recently modified.
+*/
+struct pendingCopy
+{
+  // Name of the source file.
+  const char *name;
+  // Source file metadata.
+  struct stat metadata;
+  // If not 0, the file exists in the target directory and is overwritten.
+  char existing;
+};
+
+typedef struct pendingCopies pendingCopies;
+/*
+Growing array of postponed copies.
+*/
+struct pendingCopies
+{
+  // Postponed copies.
+  pendingCopy *copies;
+  // Number of postponed copies and number of copies fitting in the array.
+  size_t count, capacity;
+};
+
+/*
+Postpones copying a file.
+reads:
+name - name of the source file; must stay valid until the copy is made
+metadata - source file metadata
+existing - if not 0, the file exists in the target directory
+writes:
+pending - array of postponed copies
+returns:
+-1 if an error occured (the file has to be copied immediately)
+0 if no error occured
+*/
+static int postponeCopy(pendingCopies *pending, const char *name,
+  const struct stat *metadata, char existing)
+{
+  // If the array is full
+  if (pending->count == pending->capacity)
+  {
+    // Double its capacity.
+    size_t capacity = pending->capacity == 0 ? 16 : pending->capacity * 2;
+    pendingCopy *copies = realloc(pending->copies,
+      sizeof(pendingCopy) * capacity);
+    // If an error occured
+    if (copies == NULL)
+      // Return an error code.
+      return -1;
+    pending->copies = copies;
+    pending->capacity = capacity;
+  }
+  pendingCopy *copy = &pending->copies[pending->count++];
+  copy->name = name;
+  copy->metadata = *metadata;
+  copy->existing = existing;
+  return 0;
+}
+
+/*
+Compares postponed copies by modification time of the source file.
+reads:
+a - first copy
+b - second copy
+returns:
+< 0 if a was modified later than b
+0 if a and b were modified at the same time
+> 0 if a was modified earlier than b
+*/
+static int compareModificationTimes(const void *a, const void *b)
+{
+  const struct timespec *timeA = &((const pendingCopy *)a)->metadata.st_mtim,
+    *timeB = &((const pendingCopy *)b)->metadata.st_mtim;
+  if (timeA->tv_sec != timeB->tv_sec)
+    return timeA->tv_sec > timeB->tv_sec ? -1 : 1;
+  if (timeA->tv_nsec != timeB->tv_nsec)
+    return timeA->tv_nsec > timeB->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/*
+Copies the postponed files in order from the most recently modified.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+pending - array of postponed copies
+srcDirPathLength - length in bytes of the source directory path
+dstDirPathLength - length in bytes of the target directory path
+writes:
+srcFilePath - buffer beginning with the source directory path
+dstFilePath - buffer beginning with the target directory path
+returns:
+-3 if the cycle was cancelled
+> 0 if an error occured which prevents from copying a file
+0 if no error occured
+*/
+static int copyPostponed(const dirsyncSettings *settings,
+  pendingCopies *pending, char *srcFilePath, const size_t srcDirPathLength,
+  char *dstFilePath, const size_t dstDirPathLength)
+{
+  int status, ret = 0;
+  size_t i;
+  // Sort the copies from the most recently modified file.
+  qsort(pending->copies, pending->count, sizeof(pendingCopy),
+    compareModificationTimes);
+  for (i = 0; i < pending->count; ++i)
+  {
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+      // Return an error code.
+      return -3;
+    pendingCopy *copy = &pending->copies[i];
+    // Create the source and target file paths.
+    stringAppend(srcFilePath, srcDirPathLength, copy->name);
+    stringAppend(dstFilePath, dstDirPathLength, copy->name);
+    // Copy the file.
+    status = copyFile(settings, srcFilePath, dstFilePath, &copy->metadata);
+    // In the log, write the same message as without postponing.
+    if (copy->existing)
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "writing %s to %s; %i", srcFilePath, dstFilePath, status);
+    else
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "copying file %s to directory %.*s; %i", srcFilePath,
+        (int)dstDirPathLength, dstFilePath, status);
+    // If an error occured
+    if (status != 0)
+      // Set an error code.
+      ret = copy->existing ? 6 : 4;
+  }
+  return ret;
+}
+
+int synchronizeFile(const dirsyncSettings *settings,
+  const char *srcFilePath, const char *dstFilePath)
 {
-  char *srcFilePath = NULL, *dstFilePath = NULL;
-  /* Reserve memory for paths of files in the source directory.
-  If an error occured */
-  if ((srcFilePath = malloc(sizeof(char) * PATH_MAX)) == NULL)
+  struct stat srcFile, dstFile;
+  int status;
+  // Read source file metadata. If an error occured
+  if (statFile(srcFilePath, &srcFile) == -1)
     // Return an error code.
     return -1;
-  /* Reserve memory for paths of files in the target directory.
-  If an error occured */
-  if ((dstFilePath = malloc(sizeof(char) * PATH_MAX)) == NULL)
+  // Only regular files are synchronized.
+  if (!S_ISREG(srcFile.st_mode))
+    return -2;
+  /* Read target file metadata without statFile because a missing target
+  file is not an error. If the target file does not exist */
+  if (stat(dstFilePath, &dstFile) == -1)
   {
-    // Release already reserved memory.
-    free(srcFilePath);
-    // Return an error code.
+    // If another error occured
+    if (errno != ENOENT)
+    {
+      // Count the error.
+      metricsAdd(METRIC_ERRORS, 1);
+      // Return an error code.
+      return -3;
+    }
+    // If the file may still be written, leave it for a later cycle.
+    if (deferCopy(settings, srcFilePath, &srcFile))
+      return 0;
+    // Copy the file.
+    status = copyFile(settings, srcFilePath, dstFilePath, &srcFile);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "copying file %s to %s; %i", srcFilePath, dstFilePath, status);
+    return status != 0 ? 1 : 0;
+  }
+  // If the target file has other modification time than the source file
+  if (srcFile.st_mtim.tv_sec != dstFile.st_mtim.tv_sec ||
+    srcFile.st_mtim.tv_nsec != dstFile.st_mtim.tv_nsec)
+  {
+    // If the file may still be written, leave it for a later cycle.
+    if (deferCopy(settings, srcFilePath, &srcFile))
+      return 0;
+    // Overwrite the target file.
+    status = copyFile(settings, srcFilePath, dstFilePath, &srcFile);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "writing %s to %s; %i", srcFilePath, dstFilePath, status);
+    return status != 0 ? 2 : 0;
+  }
+  // If the files have different permissions
+  if (srcFile.st_mode != dstFile.st_mode)
+  {
+    // Copy permissions from the source file to the target file.
+    status = chmod(dstFilePath, srcFile.st_mode) == -1 ? errno : 0;
+    // If an error occured, count it.
+    if (status != 0)
+      metricsAdd(METRIC_ERRORS, 1);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "copying permissions of file %s to %s; %i",
+      srcFilePath, dstFilePath, status);
+    return status != 0 ? 3 : 0;
+  }
+  return 0;
+}
+
+int compareAction(action *a)
+{
+  struct stat dstFile;
+  /* Read source file metadata. If an error occured, the source file
+  is unavailable. */
+  if (statFile(a->source, &a->metadata) == -1)
+  {
+    // In the log, write the same message as the scanner would.
+    if (a->existing)
+      logMessage(LOG_WARNING, "reading metadata of source file %s; %i",
+        a->source, errno);
+    else
+      logMessage(LOG_WARNING, "copying file %s to %s; %i", a->source,
+        a->destination, errno);
+    return -1;
+  }
+  // If the target file does not exist
+  if (!a->existing)
+  {
+    /* Copy the source file. If the target directory is unavailable, the copy
+    fails and reports it. */
+    if (a->targetDevice == UNKNOWNDEVICE)
+      a->targetDevice = a->metadata.st_dev;
+    // Unless the file may still be written; a deferred file is a change.
+    a->changed = deferCopy(a->settings, a->source, &a->metadata);
+    return !a->changed;
+  }
+  // Read target file metadata. If an error occured
+  if (statFile(a->destination, &dstFile) == -1)
+  {
+    logMessage(LOG_WARNING, "reading metadata of target file %s; %i",
+      a->destination, errno);
     return -2;
   }
-  // Copy the source directory path as the beginning of its file paths.
-  strcpy(srcFilePath, srcDirPath);
-  // Copy the target directory path as the beginning of its file paths.
-  strcpy(dstFilePath, dstDirPath);
-  // Save pointers to the first source and target files.
-  element *curS = filesSrc->first, *curD = filesDst->first;
+  a->targetDevice = dstFile.st_dev;
+  /* If the target file has other modification time, overwrite it unless
+  the source file may still be written. */
+  if (a->metadata.st_mtim.tv_sec != dstFile.st_mtim.tv_sec ||
+    a->metadata.st_mtim.tv_nsec != dstFile.st_mtim.tv_nsec)
+  {
+    a->changed = deferCopy(a->settings, a->source, &a->metadata);
+    return !a->changed;
+  }
+  // If the files have different permissions
+  if (a->metadata.st_mode != dstFile.st_mode)
+  {
+    // Copy permissions from the source file to the target file.
+    int status = chmod(a->destination, a->metadata.st_mode) == -1 ? errno : 0;
+    // If an error occured, count it.
+    if (status != 0)
+      metricsAdd(METRIC_ERRORS, 1);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "copying permissions of file %s to %s; %i", a->source, a->destination,
+      status);
+    return status != 0 ? -3 : 0;
+  }
+  return 0;
+}
+
+int copyAction(action *a)
+{
+  // Wait until both devices allow another copy.
+  deviceAcquire(a->metadata.st_dev, a->targetDevice,
+    a->metadata.st_size < LANETINYSIZE);
+  // Copy the file with permissions and modification time.
+  int status = copyFile(a->settings, a->source, a->destination,
+    &a->metadata);
+  deviceRelease(a->metadata.st_dev, a->targetDevice);
+  a->changed = status == 0;
+  logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING, a->existing ?
+    "writing %s to %s; %i" : "copying file %s to %s; %i", a->source,
+    a->destination, status);
+  return status != 0 ? -1 : 0;
+}
+
+/*
+Submits a file to the comparator stage of the pipeline.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+srcDirPath - source directory path
+srcDirPathLength - length in bytes of srcDirPath
+dstDirPath - target directory path
+dstDirPathLength - length in bytes of dstDirPath
+name - file name
+existing - if not 0, the file exists in the target directory
+targetDevice - device of the target directory or UNKNOWNDEVICE
+*/
+static void submitFile(const dirsyncSettings *settings,
+  const char *srcDirPath, const size_t srcDirPathLength,
+  const char *dstDirPath, const size_t dstDirPathLength, const char *name,
+  char existing, dev_t targetDevice)
+{
+  // Wait for a free action if all are in flight.
+  action *a = pipelineAcquire();
+  // The context does not change until the pipeline is drained.
+  a->settings = settings;
+  a->existing = existing;
+  a->targetDevice = targetDevice;
+  // The action holds the directory until its file is handled.
+  a->node = scannedNode;
+  a->changed = 0;
+  if (scannedNode != NULL)
+    scheduleHold(scannedNode);
+  // Copy the paths because the scanner reuses its buffers.
+  memcpy(a->source, srcDirPath, srcDirPathLength);
+  stringAppend(a->source, srcDirPathLength, name);
+  memcpy(a->destination, dstDirPath, dstDirPathLength);
+  stringAppend(a->destination, dstDirPathLength, name);
+  pipelineSubmit(a);
+}
+
+/*
+Pipelined version of updateDestinationFiles. The scanner merges the file
+  names and removes the target files missing in the source directory;
+  the other files are compared and copied by the threads of the pipeline.
+  Errors of the pipeline are reported by pipelineDrain.
+*/
+static int submitFiles(const dirsyncSettings *settings, char *srcDirPath,
+  const size_t srcDirPathLength, cursor *curS, char *dstDirPath,
+  const size_t dstDirPathLength, cursor *curD)
+{
+  int status, ret = 0;
+  struct stat dstDir;
+  /* Device on which new files are created, read once per directory
+  for the first new file. */
+  dev_t targetDevice = UNKNOWNDEVICE;
+  char deviceRead = 0;
+  while (curS->name != NULL || curD->name != NULL)
+  {
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code.
+      ret = -3;
+      break;
+    }
+    // Compare the names; a missing name is greater than every other.
+    int comparison = curS->name == NULL ? 1 : curD->name == NULL ? -1 :
+      strcmp(curS->name, curD->name);
+    // If the target file does not exist in the source directory
+    if (comparison > 0)
+    {
+      // Remove it like updateDestinationFiles.
+      stringAppend(dstDirPath, dstDirPathLength, curD->name);
+      // Save the time before removing.
+      unsigned long long removalStart = metricsNow();
+      status = removeFile(dstDirPath);
+      countRemoval(dstDirPath, status, removalStart);
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "deleting file %s; %i", dstDirPath, status);
+      if (status != 0)
+        ret = 1;
+    }
+    // Otherwise, let the comparators decide what to do with the file.
+    else
+    {
+      if (comparison < 0 && !deviceRead)
+      {
+        deviceRead = 1;
+        dstDirPath[dstDirPathLength] = '\0';
+        if (statFile(dstDirPath, &dstDir) == 0)
+          targetDevice = dstDir.st_dev;
+      }
+      submitFile(settings, srcDirPath, srcDirPathLength, dstDirPath,
+        dstDirPathLength, curS->name, comparison == 0, targetDevice);
+    }
+    /* Move the cursors past the handled names. If an error occured
+    while reading spilled entries */
+    if ((comparison <= 0 && cursorNext(curS) < 0) ||
+      (comparison >= 0 && cursorNext(curD) < 0))
+    {
+      // Set an error code.
+      ret = -4;
+      break;
+    }
+  }
+  // Restore the target directory path.
+  dstDirPath[dstDirPathLength] = '\0';
+  return ret;
+}
+
+int updateDestinationFiles(const dirsyncSettings *settings, char *srcDirPath,
+  const size_t srcDirPathLength, cursor *filesSrc,
+  char *dstDirPath, const size_t dstDirPathLength, cursor *filesDst,
+  prefetch *metadata)
+{
+  // If the pipeline is running, let its threads compare and copy the files.
+  if (pipelineEnabled())
+    return submitFiles(settings, srcDirPath, srcDirPathLength, filesSrc,
+      dstDirPath, dstDirPathLength, filesDst);
+  /* Build the paths of files in the buffers of the directory paths,
+  after the directory paths, so that no memory is reserved. */
+  char *srcFilePath = srcDirPath, *dstFilePath = dstDirPath;
+  /* Length of the target directory path printed in the log because
+  the buffer contains a file path. */
+  const int dstDirLength = (int)dstDirPathLength;
+  // Cursors at the current source and target files.
+  cursor *curS = filesSrc, *curD = filesDst;
   struct stat srcFile, dstFile;
+  // Copies postponed to order them from the most recently modified file.
+  pendingCopies pending = {NULL, 0, 0};
   // Initially, set status code indicating no error.
   int status = 0, ret = 0;
-  // Open a connection to the log '/var/log/syslog'.
-  openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
-  while (curS != NULL && curD != NULL)
+  while (curS->name != NULL && curD->name != NULL)
   {
-    char *srcFileName = curS->entry->d_name, *dstFileName = curD->entry->d_name;
+    /* Wait if synchronizations are paused. If the cycle was cancelled
+    using the control socket */
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code which also skips the loops below.
+      ret = -3;
+      break;
+    }
+    const char *srcFileName = curS->name, *dstFileName = curD->name;
     // Compare source and target file names in lexicographic order.
     int comparison = strcmp(srcFileName, dstFileName);
     // If the source file is greater than the target file in the order
@@ -53,17 +686,28 @@ int updateDestinationFiles(const char *srcDirPath,
     {
       // Append target file name to its parent directory path.
       stringAppend(dstFilePath, dstDirPathLength, dstFileName);
+      // Save the time before removing.
+      unsigned long long removalStart = metricsNow();
       // Remove the target file.
       status = removeFile(dstFilePath);
+      // Count the removal.
+      countRemoval(dstFilePath, status, removalStart);
       // In the log, write a message about removal.
-      syslog(LOG_INFO, "deleting file %s; %i\n", dstFilePath, status);
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "deleting file %s; %i", dstFilePath, status);
       // If an error occured
       if (status != 0)
         /* Set a positive error code to indicate partial synchronization
         but do not break the loop. */
         ret = 1;
-      // Move the pointer to the next target file.
-      curD = curD->next;
+      /* Move the cursor to the next target file. If an error occured
+      while reading spilled entries */
+      if (cursorNext(curD) < 0)
+      {
+        // Set an error code.
+        ret = -4;
+        break;
+      }
     }
     else
     {
@@ -71,15 +715,17 @@ int updateDestinationFiles(const char *srcDirPath,
       stringAppend(srcFilePath, srcDirPathLength, srcFileName);
       /* Read source file metadata. If an error occured, the source file
       is unavailable and will not be able to be copied when comparison < 0. */
-      if (stat(srcFilePath, &srcFile) == -1)
+      if (statCursor(metadata, PREFETCH_SOURCE, curS, srcFilePath, &srcFile)
+        == -1)
       {
         // If the source file is less than the target file in the order
         if (comparison < 0)
         {
           /* In the log, write a message about unsuccessful copying.
           The status code written to errno by stat is a positive number. */
-          syslog(LOG_INFO, "copying file %s to directory %s; %i\n",
-            srcFilePath, dstDirPath, errno);
+          logMessage(LOG_WARNING,
+            "copying file %s to directory %.*s; %i",
+            srcFilePath, dstDirLength, dstDirPath, errno);
           // Set an error code.
           ret = 2;
         }
@@ -87,15 +733,27 @@ int updateDestinationFiles(const char *srcDirPath,
         else
         {
           // In the log, save a message about unsuccessful metadata reading.
-          syslog(LOG_INFO, "reading metadata of source file %s; %i\n",
-            srcFilePath, errno);
-          // Move the pointer to the next target file.
-          curD = curD->next;
+          logMessage(LOG_WARNING,
+            "reading metadata of source file %s; %i", srcFilePath, errno);
+          /* Move the cursor to the next target file. If an error occured
+          while reading spilled entries */
+          if (cursorNext(curD) < 0)
+          {
+            // Set an error code.
+            ret = -4;
+            break;
+          }
           // Set an error code.
           ret = 3;
         }
-        // Move the pointer to the next source file.
-        curS = curS->next;
+        /* Move the cursor to the next source file. If an error occured
+        while reading spilled entries */
+        if (cursorNext(curS) < 0)
+        {
+          // Set an error code.
+          ret = -4;
+          break;
+        }
         // Go to the next loop iteration.
         continue;
       }
@@ -103,29 +761,44 @@ int updateDestinationFiles(const char *srcDirPath,
       // If the source file is less than the target file in the order
       if (comparison < 0)
       {
+        /* If the file may still be written, leave it for a later cycle.
+        If files are copied from the most recently modified, postpone
+        copying until all files are compared. */
+        if (deferCopy(settings, srcFilePath, &srcFile) ||
+          (settings->newestFirst && cursorStable(curS) &&
+          postponeCopy(&pending, srcFileName, &srcFile, 0) == 0))
+        {
+          /* Move the cursor to the next source file. If an error occured
+          while reading spilled entries */
+          if (cursorNext(curS) < 0)
+          {
+            // Set an error code.
+            ret = -4;
+            break;
+          }
+          continue;
+        }
         // Append source file name to the target directory path.
         stringAppend(dstFilePath, dstDirPathLength, srcFileName);
-        // If the source file is smaller than the big file threshold
-        if (srcFile.st_size < threshold)
-          /* Copy it as a small file. Copy permissions and modification time
-          of the source file to the target file. */
-          status = copySmallFile(srcFilePath, dstFilePath, srcFile.st_mode,
-            &srcFile.st_atim, &srcFile.st_mtim);
-        /* If the source file is bigger or the same size
-        as the big file threshold */
-        else
-          // Copy it as a big file.
-          status = copyBigFile(srcFilePath, dstFilePath, srcFile.st_size,
-            srcFile.st_mode, &srcFile.st_atim, &srcFile.st_mtim);
+        /* Copy the file. Copy permissions and modification time
+        of the source file to the target file. */
+        status = copyFile(settings, srcFilePath, dstFilePath, &srcFile);
         // In the log, write a message about copying.
-        syslog(LOG_INFO, "copying file %s to directory %s; %i\n",
-          srcFilePath, dstDirPath, status);
+        logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+          "copying file %s to directory %.*s; %i",
+          srcFilePath, dstDirLength, dstDirPath, status);
         // If an error occured
         if (status != 0)
           // Set an error code.
           ret = 4;
-        // Move the pointer to the next source file.
-        curS = curS->next;
+        /* Move the cursor to the next source file. If an error occured
+        while reading spilled entries */
+        if (cursorNext(curS) < 0)
+        {
+          // Set an error code.
+          ret = -4;
+          break;
+        }
       }
       // If the source file is equal to the target file in the order
       else
@@ -134,11 +807,12 @@ int updateDestinationFiles(const char *srcDirPath,
         stringAppend(dstFilePath, dstDirPathLength, dstFileName);
         /* Read target file metadata. If an error occured, the target file
         is unavailable and we will not be able to compare modification times. */
-        if (stat(dstFilePath, &dstFile) == -1)
+        if (statCursor(metadata, PREFETCH_TARGET, curD, dstFilePath, &dstFile)
+          == -1)
         {
           // In the log, save a message about unsuccessful metadata reading.
-          syslog(LOG_INFO, "reading metadata of target file %s; %i\n",
-            dstFilePath, errno);
+          logMessage(LOG_WARNING,
+            "reading metadata of target file %s; %i", dstFilePath, errno);
           // Set an error code.
           ret = 5;
         }
@@ -148,21 +822,22 @@ int updateDestinationFiles(const char *srcDirPath,
         else if (srcFile.st_mtim.tv_sec != dstFile.st_mtim.tv_sec ||
           srcFile.st_mtim.tv_nsec != dstFile.st_mtim.tv_nsec)
         {
-          // Copy the source file to an existing target file.
-          // If the source file is smaller than the big file threshold
-          if (srcFile.st_size < threshold)
-            // Copy it as a small file.
-            status = copySmallFile(srcFilePath, dstFilePath, srcFile.st_mode,
-              &srcFile.st_atim, &srcFile.st_mtim);
-          /* If the source file is bigger or the same size
-          as the big file threshold */
+          // If the file may still be written, leave it for a later cycle.
+          if (deferCopy(settings, srcFilePath, &srcFile))
+            status = 0;
+          /* If files are copied from the most recently modified, postpone
+          copying until all files are compared. */
+          else if (settings->newestFirst && cursorStable(curS) &&
+            postponeCopy(&pending, srcFileName, &srcFile, 1) == 0)
+            status = 0;
+          // Otherwise copy the source file to an existing target file.
           else
-            // Copy it as a big file.
-            status = copyBigFile(srcFilePath, dstFilePath, srcFile.st_size,
-              srcFile.st_mode, &srcFile.st_atim, &srcFile.st_mtim);
-          // In the log, write a message about copying.
-          syslog(LOG_INFO, "writing %s to %s; %i\n",
-            srcFilePath, dstFilePath, status);
+          {
+            status = copyFile(settings, srcFilePath, dstFilePath, &srcFile);
+            // In the log, write a message about copying.
+            logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+              "writing %s to %s; %i", srcFilePath, dstFilePath, status);
+          }
           // If an error occured
           if (status != 0)
             // Set an error code.
@@ -180,6 +855,8 @@ int updateDestinationFiles(const char *srcDirPath,
             /* Set status code not equal to 0 because errno has
             value not equal to 0. */
             status = errno;
+            // Count the error.
+            metricsAdd(METRIC_ERRORS, 1);
             // Set an error code.
             ret = 7;
           }
@@ -188,120 +865,166 @@ int updateDestinationFiles(const char *srcDirPath,
             // Set status code equal to 0.
             status = 0;
           // In the log, write a message about copying permissions.
-          syslog(LOG_INFO, "copying permissions of file %s to %s; %i\n",
+          logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+            "copying permissions of file %s to %s; %i",
             srcFilePath, dstFilePath, status);
         }
-        // Move the pointer to the next source file.
-        curS = curS->next;
-        // Move the pointer to the next target file.
-        curD = curD->next;
+        /* Move the cursor to the next source file. If an error occured
+        while reading spilled entries */
+        if (cursorNext(curS) < 0)
+        {
+          // Set an error code.
+          ret = -4;
+          break;
+        }
+        /* Move the cursor to the next target file. If an error occured
+        while reading spilled entries */
+        if (cursorNext(curD) < 0)
+        {
+          // Set an error code.
+          ret = -4;
+          break;
+        }
       }
     }
   }
   /* If any remaining files exist in the target directory, remove them because
   they do not exist in the source directory.
   Start removing at the file currently pointed to by curD. */
-  while (curD != NULL)
+  while (ret >= 0 && curD->name != NULL)
   {
-    char *dstFileName = curD->entry->d_name;
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code.
+      ret = -3;
+      break;
+    }
+    const char *dstFileName = curD->name;
     // Append target file name to its parent directory path.
     stringAppend(dstFilePath, dstDirPathLength, dstFileName);
+    // Save the time before removing.
+    unsigned long long removalStart = metricsNow();
     // Remove the target file.
     status = removeFile(dstFilePath);
+    // Count the removal.
+    countRemoval(dstFilePath, status, removalStart);
     // In the log, write a message about removal.
-    syslog(LOG_INFO, "deleting file %s; %i\n", dstFilePath, status);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "deleting file %s; %i", dstFilePath, status);
     // If an error occured
     if (status != 0)
       // Set an error code.
       ret = 8;
-    // Move the pointer to the next target file.
-    curD = curD->next;
+    /* Move the cursor to the next target file. If an error occured
+    while reading spilled entries */
+    if (cursorNext(curD) < 0)
+    {
+      // Set an error code.
+      ret = -4;
+      break;
+    }
   }
   /* If any remaining files exist in the source directory, copy them because
   they do not exist in the target directory.
   Start copying at the file currently pointed to by curS. */
-  while (curS != NULL)
+  while (ret >= 0 && curS->name != NULL)
   {
-    char *srcFileName = curS->entry->d_name;
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code.
+      ret = -3;
+      break;
+    }
+    const char *srcFileName = curS->name;
     // Append source file name to its parent directory path.
     stringAppend(srcFilePath, srcDirPathLength, srcFileName);
     // Read source file metadata. If an error occured
-    if (stat(srcFilePath, &srcFile) == -1)
+    if (statCursor(metadata, PREFETCH_SOURCE, curS, srcFilePath, &srcFile)
+      == -1)
     {
       // In the log, write a message about unsuccessful copying.
-      syslog(LOG_INFO, "copying file %s to directory %s; %i\n",
-        srcFilePath, dstDirPath, errno);
+      logMessage(LOG_WARNING,
+        "copying file %s to directory %.*s; %i", srcFilePath, dstDirLength,
+        dstDirPath, errno);
       // Set an error code.
       ret = 9;
     }
-    else
+    /* If the file may still be written, leave it for a later cycle.
+    If files are copied from the most recently modified, postpone copying.
+    Otherwise or if postponing failed */
+    else if (!deferCopy(settings, srcFilePath, &srcFile) &&
+      (!settings->newestFirst || !cursorStable(curS) ||
+      postponeCopy(&pending, srcFileName, &srcFile, 0) < 0))
     {
       // Append source file name to the target directory name.
       stringAppend(dstFilePath, dstDirPathLength, srcFileName);
-      // If the source file is smaller than the big file threshold
-      if (srcFile.st_size < threshold)
-        // Copy it as a small file.
-        status = copySmallFile(srcFilePath, dstFilePath, srcFile.st_mode,
-          &srcFile.st_atim, &srcFile.st_mtim);
-      // If the source file is bigger or the same size as the big file threshold
-      else
-        // Copy it as a big file.
-        status = copyBigFile(srcFilePath, dstFilePath, srcFile.st_size,
-          srcFile.st_mode, &srcFile.st_atim, &srcFile.st_mtim);
+      // Copy the file.
+      status = copyFile(settings, srcFilePath, dstFilePath, &srcFile);
       // In the log, write a message about copying.
-      syslog(LOG_INFO, "copying file %s to directory %s; %i\n",
-        srcFilePath, dstDirPath, status);
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "copying file %s to directory %.*s; %i", srcFilePath, dstDirLength,
+        dstDirPath, status);
       // If an error occured
       if (status != 0)
         // Set an error code.
         ret = 10;
     }
-    // Move the pointer to the next source file.
-    curS = curS->next;
+    /* Move the cursor to the next source file. If an error occured
+    while reading spilled entries */
+    if (cursorNext(curS) < 0)
+    {
+      // Set an error code.
+      ret = -4;
+      break;
+    }
+  }
+  // If the cycle was not cancelled, copy the postponed files.
+  if (ret >= 0 && pending.count != 0)
+  {
+    status = copyPostponed(settings, &pending, srcFilePath,
+      srcDirPathLength, dstFilePath, dstDirPathLength);
+    // If an error occured
+    if (status != 0)
+      // Set an error code.
+      ret = status;
   }
-  // Release source file path memory.
-  free(srcFilePath);
-  // Release target file path memory.
-  free(dstFilePath);
-  // Close the connection to the log.
-  closelog();
+  // Release the array of postponed copies.
+  free(pending.copies);
+  // Restore the source directory path.
+  srcDirPath[srcDirPathLength] = '\0';
+  // Restore the target directory path.
+  dstDirPath[dstDirPathLength] = '\0';
   // Return the status code.
   return ret;
 }
 
-int updateDestinationDirectories(const char *srcDirPath,
-  const size_t srcDirPathLength, list *subdirsSrc, const char *dstDirPath,
+int updateDestinationDirectories(char *srcDirPath,
+  const size_t srcDirPathLength, list *subdirsSrc, char *dstDirPath,
   const size_t dstDirPathLength, list *subdirsDst, char *isReady)
 {
-  char *srcSubdirPath = NULL, *dstSubdirPath = NULL;
-  /* Reserve memory for paths of subdirectories in the source directory
-    (hereinafter referred to as source subdirectories). If an error occured */
-  if ((srcSubdirPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-    // Return an error code.
-    return -1;
-  /* Reserve memory for paths of subdirectories in the target directory
-    (hereinafter referred to as target subdirectories). If an error occured */
-  if ((dstSubdirPath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-  {
-    // Release already reserved memory.
-    free(srcSubdirPath);
-    // Return an error code.
-    return -2;
-  }
-  // Copy the source directory path as the beginning of its subdirectory paths.
-  strcpy(srcSubdirPath, srcDirPath);
-  // Copy the target directory path as the beginning of its subdirectory paths.
-  strcpy(dstSubdirPath, dstDirPath);
+  /* Build the paths of subdirectories in the source directory (hereinafter
+  referred to as source subdirectories) and in the target directory
+  (hereinafter referred to as target subdirectories) in the buffers
+  of the directory paths, after the directory paths. */
+  char *srcSubdirPath = srcDirPath, *dstSubdirPath = dstDirPath;
   // Save pointers to the first source and target subdirectories.
   element *curS = subdirsSrc->first, *curD = subdirsDst->first;
   struct stat srcSubdir, dstSubdir;
   unsigned int i = 0;
   // Initially, set status code indicating no error.
   int status = 0, ret = 0;
-  // Open a connection to the log '/var/log/syslog'.
-  openlog("DirSyncD", LOG_ODELAY | LOG_PID, LOG_DAEMON);
   while (curS != NULL && curD != NULL)
   {
+    /* Wait if synchronizations are paused. If the cycle was cancelled
+    using the control socket */
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code which also skips the loops below.
+      ret = -3;
+      break;
+    }
     char *srcSubdirName = curS->entry->d_name,
       *dstSubdirName = curD->entry->d_name;
     // Compare source and target subdirectory names in lexicographic order.
@@ -315,10 +1038,15 @@ int updateDestinationDirectories(const char *srcDirPath,
       with '/'. */
       size_t length = appendSubdirectoryName(dstSubdirPath, dstDirPathLength,
         dstSubdirName);
+      // Save the time before removing.
+      unsigned long long removalStart = metricsNow();
       // Recursively remove the target subdirectory.
       status = removeDirectoryRecursively(dstSubdirPath, length);
+      // Count the removal.
+      countRemoval(dstSubdirPath, status, removalStart);
       // In the log, write a message about removal.
-      syslog(LOG_INFO, "deleting directory %s; %i\n", dstSubdirPath, status);
+      logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+        "deleting directory %s; %i", dstSubdirPath, status);
       // If an error occured
       if (status != 0)
         /* Set a positive error code to indicate partial synchronization
@@ -343,7 +1071,8 @@ int updateDestinationDirectories(const char *srcDirPath,
         {
           /* In the log, write a message about unsuccessful copying.
           The status code written to errno by stat is a positive number. */
-          syslog(LOG_INFO, "creating directory %s; %i\n", dstSubdirPath, errno);
+          logMessage(LOG_WARNING,
+            "creating directory %s; %i", dstSubdirPath, errno);
           /* Indicate that the subdirectory is unready for synchronization
           because it does not exist. */
           isReady[i++] = 0;
@@ -353,7 +1082,8 @@ int updateDestinationDirectories(const char *srcDirPath,
         else
         {
           // In the log, save a message about unsuccessful metadata reading.
-          syslog(LOG_INFO, "reading metadata of source directory %s; %i\n",
+          logMessage(LOG_WARNING,
+            "reading metadata of source directory %s; %i",
             srcSubdirPath, errno);
           /* If we did not manage to check if source and target subdirectories
           have equal permissions, assume that they do.
@@ -382,10 +1112,13 @@ int updateDestinationDirectories(const char *srcDirPath,
         all subdirectories are browsed to detect file changes. */
         status = createEmptyDirectory(dstSubdirPath, srcSubdir.st_mode);
         // In the log, write a meesage about creation.
-        syslog(LOG_INFO, "creating directory %s; %i\n", dstSubdirPath, status);
+        logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+          "creating directory %s; %i", dstSubdirPath, status);
         // If an error occured
         if (status != 0)
         {
+          // Count the error.
+          metricsAdd(METRIC_ERRORS, 1);
           /* Indicate that the subdirectory is unready for synchronization
           because it does not exist. */
           isReady[i++] = 0;
@@ -413,7 +1146,8 @@ int updateDestinationDirectories(const char *srcDirPath,
         if (stat(dstSubdirPath, &dstSubdir) == -1)
         {
           // In the log, save a message about unsuccessful metadata reading.
-          syslog(LOG_INFO, "reading metadata of target directory %s; %i\n",
+          logMessage(LOG_WARNING,
+            "reading metadata of target directory %s; %i",
             dstSubdirPath, errno);
           // Set an error code.
           ret = 5;
@@ -431,6 +1165,8 @@ int updateDestinationDirectories(const char *srcDirPath,
             /* Set status code not equal to 0 because errno has value
             not equal to 0. */
             status = errno;
+            // Count the error.
+            metricsAdd(METRIC_ERRORS, 1);
             // Set an error code.
             ret = 6;
           }
@@ -439,7 +1175,8 @@ int updateDestinationDirectories(const char *srcDirPath,
             // Set status code equal to 0.
             status = 0;
           // In the log, write a message about copying permissions.
-          syslog(LOG_INFO, "copying permissions of directory %s to %s; %i\n",
+          logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+            "copying permissions of directory %s to %s; %i",
             srcSubdirPath, dstSubdirPath, status);
         }
         // Move the pointer to the next source subdirectory.
@@ -452,16 +1189,28 @@ int updateDestinationDirectories(const char *srcDirPath,
   /* If any remaining subdirectories exist in the target directory,
   remove them because they do not exist in the source directory.
   Start removing at the subdirectory currently pointed to by curD. */
-  while (curD != NULL)
+  while (ret >= 0 && curD != NULL)
   {
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code.
+      ret = -3;
+      break;
+    }
     char *dstSubdirName = curD->entry->d_name;
     // Append target subdirectory name to its parent directory path.
     size_t length = appendSubdirectoryName(dstSubdirPath, dstDirPathLength,
       dstSubdirName);
+    // Save the time before removing.
+    unsigned long long removalStart = metricsNow();
     // Recursively remove the target subdirectory.
     status = removeDirectoryRecursively(dstSubdirPath, length);
+    // Count the removal.
+    countRemoval(dstSubdirPath, status, removalStart);
     // In the log, write a message about removal.
-    syslog(LOG_INFO, "deleting directory %s; %i\n", dstSubdirPath, status);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "deleting directory %s; %i", dstSubdirPath, status);
     // If an error occured
     if (status != 0)
       // Set an error code.
@@ -472,8 +1221,15 @@ int updateDestinationDirectories(const char *srcDirPath,
   /* If any remaining subdirectories exist in the source directory,
   copy them because they do not exist in the target directory.
   Start copying at the file currently pointed to by curS. */
-  while (curS != NULL)
+  while (ret >= 0 && curS != NULL)
   {
+    // If the cycle was cancelled
+    if (controlCheckpoint() < 0)
+    {
+      // Set an error code.
+      ret = -3;
+      break;
+    }
     char *srcSubdirName = curS->entry->d_name;
     // Append source subdirectory name to its parent directory path.
     stringAppend(srcSubdirPath, srcDirPathLength, srcSubdirName);
@@ -481,7 +1237,8 @@ int updateDestinationDirectories(const char *srcDirPath,
     if (stat(srcSubdirPath, &srcSubdir) == -1)
     {
       // In the log, write a message about unsuccessful creation.
-      syslog(LOG_INFO, "creating directory %s; %i\n", dstSubdirPath, errno);
+      logMessage(LOG_WARNING,
+        "creating directory %s; %i", dstSubdirPath, errno);
       /* Indicate that the subdirectory is unready for synchronization
       because it does not exist. */
       isReady[i++] = 0;
@@ -498,10 +1255,13 @@ int updateDestinationDirectories(const char *srcDirPath,
     as the source subdirectory and copy permissions. */
     status = createEmptyDirectory(dstSubdirPath, srcSubdir.st_mode);
     // In the log, write a message about creation.
-    syslog(LOG_INFO, "creating directory %s; %i\n", dstSubdirPath, status);
+    logMessage(status == 0 ? LOG_DEBUG : LOG_WARNING,
+      "creating directory %s; %i", dstSubdirPath, status);
     // If an error occured
     if (status != 0)
     {
+      // Count the error.
+      metricsAdd(METRIC_ERRORS, 1);
       /* Indicate that the subdirectory is unready for synchronization
       because it does not exist. */
       isReady[i++] = 0;
@@ -514,30 +1274,303 @@ int updateDestinationDirectories(const char *srcDirPath,
     // Move the pointer to the next source subdirectory.
     curS = curS->next;
   }
-  // Release source subdirectory path memory.
-  free(srcSubdirPath);
-  // Release target subdirectory path memory.
-  free(dstSubdirPath);
-  // Close the connection to the log.
-  closelog();
+  // Restore the source directory path.
+  srcDirPath[srcDirPathLength] = '\0';
+  // Restore the target directory path.
+  dstDirPath[dstDirPathLength] = '\0';
   // Return the status code.
   return ret;
 }
 
-int synchronizeNonRecursively(
-  const char *sourcePath, const size_t sourcePathLength,
-  const char *destinationPath, const size_t destinationPathLength)
+/*
+Prepares the file lists for updateDestinationFiles. If hash diff is enabled
+  and no entries were spilled, pairs them with hashJoin, otherwise or if it
+  fails, sorts both.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+spillS - spill of the source directory
+spillD - spill of the target directory
+writes:
+filesS - list of source files
+filesD - list of target files
+*/
+static void orderFiles(const dirsyncSettings *settings, list *filesS,
+  const spill *spillS, list *filesD, const spill *spillD)
 {
+  /* The cursors of spilled lists yield names merged in sorted order, which
+  only pair with a sorted list. If hash diff is enabled, no entries were
+  spilled and the table could be allocated */
+  if (settings->hashDiff && spillS->runs == 0 && spillD->runs == 0 &&
+    hashJoin(filesS, filesD) == 0)
+    return;
+  // Sort the source directory file list.
+  listMergeSort(filesS);
+  // Sort the target directory file list.
+  listMergeSort(filesD);
+}
+
+typedef struct range range;
+/*
+Range of file names of a directory synchronized by a partitioning thread.
+*/
+struct range
+{
+  // Source (0) and target (1) files with names in the range.
+  list files[2];
+  // Buffers beginning with the source and target directory paths.
+  char *sourcePath, *destinationPath;
+  // Status code of updateDestinationFiles.
+  int status;
+};
+
+typedef struct partitioned partitioned;
+/*
+Directory pair whose files are synchronized in ranges.
+*/
+struct partitioned
+{
+  // Settings of the synchronizing context (dirsync.h).
+  const dirsyncSettings *settings;
+  range *ranges;
+  size_t sourcePathLength, destinationPathLength;
+  // Device of the target directory or UNKNOWNDEVICE.
+  dev_t destinationDevice;
+};
+
+/*
+Splits a sorted list into consecutive sublists of the ranges, cutting
+  the chain of its nodes at the end of every sublist.
+reads:
+bounds - names beginning the ranges after the first one
+parts - number of ranges
+side - 0 for the source list, 1 for the target list
+writes:
+files - list
+ranges - ranges
+*/
+static void splitList(list *files, const char **bounds, unsigned int parts,
+  range *ranges, unsigned int side)
+{
+  element *cur = files->first;
+  unsigned int part;
+  for (part = 0; part < parts; ++part)
+  {
+    list *sublist = &ranges[part].files[side];
+    initialize(sublist);
+    // The last range has no upper bound.
+    while (cur != NULL && (part == parts - 1 ||
+      strcmp(cur->entry->d_name, bounds[part]) < 0))
+    {
+      if (sublist->first == NULL)
+        sublist->first = cur;
+      sublist->last = cur;
+      ++sublist->count;
+      cur = cur->next;
+    }
+    if (sublist->last != NULL)
+      sublist->last->next = NULL;
+  }
+}
+
+/*
+Links the nodes of the sublists back into the list split by splitList.
+reads:
+parts - number of ranges
+side - 0 for the source list, 1 for the target list
+ranges - ranges
+*/
+static void joinList(unsigned int parts, unsigned int side,
+  const range *ranges)
+{
+  element *previous = NULL;
+  unsigned int part;
+  for (part = 0; part < parts; ++part)
+  {
+    const list *sublist = &ranges[part].files[side];
+    if (sublist->first == NULL)
+      continue;
+    if (previous != NULL)
+      previous->next = sublist->first;
+    previous = sublist->last;
+  }
+}
+
+/*
+Synchronizes the files of a range. Executed by partitionRun.
+reads:
+argument - directory pair
+part - index of the range
+*/
+static void updateRange(void *argument, unsigned int part)
+{
+  const partitioned *p = argument;
+  range *r = &p->ranges[part];
+  cursor curS, curD;
+  // Cursors over lists cannot fail.
+  cursorOpen(&curS, &r->files[0], NULL, DT_REG);
+  cursorOpen(&curD, &r->files[1], NULL, DT_REG);
+  // The ranges copy in parallel so their copies reserve device slots.
+  rangeDevice = p->destinationDevice;
+  r->status = updateDestinationFiles(p->settings, r->sourcePath,
+    p->sourcePathLength, &curS, r->destinationPath, p->destinationPathLength,
+    &curD, NULL);
+  rangeDevice = UNKNOWNDEVICE;
+  cursorClose(&curD);
+  cursorClose(&curS);
+}
+
+/*
+Splits the sorted file lists of a directory pair into ranges of names
+  at the same bounds, so that a file and its copy are in the same range,
+  and synchronizes the ranges in parallel with partitionRun.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath, sourcePathLength, destinationPath, destinationPathLength -
+  like in updateDestinationFiles
+writes:
+filesS - sorted list of source files, restored after synchronizing
+filesD - sorted list of target files, restored after synchronizing
+ret - the first negative status code of the ranges, otherwise the first
+  positive one or 0
+returns:
+-1 if memory could not be allocated (nothing was synchronized)
+0 if the ranges were synchronized
+*/
+static int updatePartitioned(const dirsyncSettings *settings,
+  const char *sourcePath,
+  const size_t sourcePathLength, list *filesS, const char *destinationPath,
+  const size_t destinationPathLength, list *filesD, int *ret)
+{
+  // The calling thread synchronizes a range too.
+  unsigned int parts = partitionThreads() + 1, part, i;
+  partitioned p = {settings, arenaAllocate(sizeof(range) * parts),
+    sourcePathLength, destinationPathLength, UNKNOWNDEVICE};
+  struct stat destination;
+  const char **bounds = arenaAllocate(sizeof(const char *) * parts);
+  if (p.ranges == NULL || bounds == NULL)
+    return -1;
+  for (part = 0; part < parts; ++part)
+  {
+    range *r = &p.ranges[part];
+    r->sourcePath = arenaAllocate(PATH_MAX);
+    r->destinationPath = arenaAllocate(PATH_MAX);
+    if (r->sourcePath == NULL || r->destinationPath == NULL)
+      return -1;
+    memcpy(r->sourcePath, sourcePath, sourcePathLength + 1);
+    memcpy(r->destinationPath, destinationPath, destinationPathLength + 1);
+  }
+  /* Take the bounds from the longer list so that the ranges have about
+  the same numbers of files. */
+  const list *longer = filesS->count >= filesD->count ? filesS : filesD;
+  element *cur = longer->first;
+  for (part = 0, i = 0; part < parts - 1; ++i, cur = cur->next)
+    if (i == (unsigned long long)(part + 1) * longer->count / parts)
+      bounds[part++] = cur->entry->d_name;
+  splitList(filesS, bounds, parts, p.ranges, 0);
+  splitList(filesD, bounds, parts, p.ranges, 1);
+  // If the directory is unavailable, the copies fail and report it.
+  if (statFile(destinationPath, &destination) == 0)
+    p.destinationDevice = destination.st_dev;
+  partitionRun(updateRange, &p, parts);
+  joinList(parts, 0, p.ranges);
+  joinList(parts, 1, p.ranges);
+  *ret = 0;
+  for (part = 0; part < parts; ++part)
+  {
+    int status = p.ranges[part].status;
+    if ((status < 0 && *ret >= 0) || (status > 0 && *ret == 0))
+      *ret = status;
+  }
+  logMessage(LOG_DEBUG, "comparing %u and %u files of %s and %s in %u "
+    "partitions; %i", filesS->count, filesD->count, sourcePath,
+    destinationPath, parts, *ret);
+  return 0;
+}
+
+/*
+Compares the files of the source and target directories, reading
+  them from the spills if they did not fit into the memory budget.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath, sourcePathLength, destinationPath, destinationPathLength -
+  like in updateDestinationFiles
+filesS - sorted list of source files used if nothing was spilled
+filesD - sorted list of target files used if nothing was spilled
+writes:
+spillS - spill of the source directory
+spillD - spill of the target directory
+returns:
+the status code of updateDestinationFiles or -1 if the spilled runs
+  could not be read
+*/
+static int updateFiles(const dirsyncSettings *settings, char *sourcePath,
+  const size_t sourcePathLength, list *filesS, spill *spillS,
+  char *destinationPath,
+  const size_t destinationPathLength, list *filesD, spill *spillD)
+{
+  cursor curS, curD;
+  int ret = -1;
+  /* Synchronize a huge directory in ranges in parallel unless the files are
+  compared by the pipeline, were spilled or paired with a hash table. */
+  if (partitionThreads() != 0 && !pipelineEnabled() && !settings->hashDiff &&
+    spillS->runs == 0 && spillD->runs == 0 &&
+    filesS->count + filesD->count >= PARTITIONFILES &&
+    updatePartitioned(settings, sourcePath, sourcePathLength, filesS,
+    destinationPath, destinationPathLength, filesD, &ret) == 0)
+    return ret;
+  // If any listing was spilled, write it to the log.
+  if (spillS->runs != 0 || spillD->runs != 0)
+    logMessage(LOG_DEBUG, "spilling listings of %s (%u runs) and %s "
+      "(%u runs); 0", sourcePath, spillS->runs, destinationPath,
+      spillD->runs);
+  if (cursorOpen(&curS, filesS, spillS, DT_REG) == 0)
+  {
+    if (cursorOpen(&curD, filesD, spillD, DT_REG) == 0)
+    {
+      /* Prefetch the metadata of the files unless they are compared
+      by the pipeline or read from spilled runs. */
+      prefetch *metadata = pipelineEnabled() || spillS->runs != 0 ||
+        spillD->runs != 0 ? NULL : prefetchBegin(sourcePath, filesS,
+        destinationPath, filesD);
+      ret = updateDestinationFiles(settings, sourcePath, sourcePathLength,
+        &curS, destinationPath, destinationPathLength, &curD, metadata);
+      if (metadata != NULL)
+        prefetchEnd(metadata);
+      cursorClose(&curD);
+    }
+    cursorClose(&curS);
+  }
+  return ret;
+}
+
+int synchronizeNonRecursively(const dirsyncSettings *settings,
+  char *sourcePath, const size_t sourcePathLength,
+  char *destinationPath, const size_t destinationPathLength)
+{
+  // If the cycle was cancelled using the control socket
+  if (controlCancelled())
+    // Return status code indicating an error.
+    return -11;
+  // Report the synchronized directory to the control socket.
+  controlEnterDirectory(sourcePath);
   // Initially, set status code indicating no error.
-  int ret = 0;
-  DIR *dirS = NULL, *dirD = NULL;
+  int ret = 0, dirS = -1, dirD = -1;
+  /* Save the arena position to release the directory entries and list nodes
+  at the end. */
+  arenaMark mark = arenaSave();
+  // Filter rules applying in the directory.
+  filterScope scope;
+  // Read the ignore files of the directory. If an error occured
+  if (filterEnter(sourcePath, sourcePathLength, NULL, &scope) < 0)
+    // Set status code indicating an error.
+    ret = -14;
   // Open the source directory. If an error occured
-  if ((dirS = opendir(sourcePath)) == NULL)
+  else if ((dirS = openDirectory(sourcePath)) == -1)
     /* Set status code indicating an error. After that, the program
     immediately goes to the end of the current function. */
     ret = -1;
   // Open the target directory. If an error occured
-  else if ((dirD = opendir(destinationPath)) == NULL)
+  else if ((dirD = openDirectory(destinationPath)) == -1)
     // Set status code indicating an error.
     ret = -2;
   else
@@ -548,62 +1581,215 @@ int synchronizeNonRecursively(
     initialize(&filesS);
     // Initialize the target directory file list.
     initialize(&filesD);
+    /* Create spills for the entries which do not fit into the memory
+    budget. */
+    spill spillS, spillD;
+    spillInitialize(&spillS, settings->memoryBudget);
+    spillInitialize(&spillD, settings->memoryBudget);
+    // Save the time before listing.
+    unsigned long long start = metricsNow(), end;
+    PROBE(scan_start, sourcePath, destinationPath);
     // Fill the source directory file list. If an error occured
-    if (listFiles(dirS, &filesS) < 0)
+    if (listFiles(dirS, &filesS, &spillS, &scope) < 0)
       // Set status code indicating an error.
       ret = -3;
-    // Fill the target directory file list. If an error occured
-    else if (listFiles(dirD, &filesD) < 0)
+    /* Fill the target directory file list skipping excluded files so that
+    they are not deleted. If an error occured */
+    else if (listFiles(dirD, &filesD, &spillD, &scope) < 0)
       // Set status code indicating an error.
       ret = -4;
+    // Record the latency of listing both directories.
+    end = metricsNow();
+    metricsObserve(HISTOGRAM_SCAN, end - start);
+    metricsPhase(PHASE_SCAN, end - start);
+    traceSpan(TRACE_SCAN, start, end, sourcePath);
+    PROBE(scan_end, sourcePath, ret, end - start);
+    metricsAdd(METRIC_DIRS_SCANNED, 2);
+    // If an error occured
+    if (ret < 0)
+      // Count the error.
+      metricsAdd(METRIC_ERRORS, 1);
     else
     {
-      // Sort the source directory file list.
-      listMergeSort(&filesS);
-      // Sort the target directory file list.
-      listMergeSort(&filesD);
+      start = end;
+      // Sort or pair the source and target directory file lists.
+      orderFiles(settings, &filesS, &spillS, &filesD, &spillD);
+      end = metricsNow();
+      metricsPhase(PHASE_SORT, end - start);
+      traceSpan(TRACE_SORT, start, end, sourcePath);
+      start = end;
       /* Check compliance and if needed, update target directory files.
       If an error occured */
-      if (updateDestinationFiles(sourcePath, sourcePathLength, &filesS,
-        destinationPath, destinationPathLength, &filesD) != 0)
+      if (updateFiles(settings, sourcePath, sourcePathLength, &filesS,
+        &spillS, destinationPath, destinationPathLength, &filesD, &spillD)
+        != 0)
         // Set status code indicating an error.
         ret = -5;
+      end = metricsNow();
+      metricsPhase(PHASE_FILES, end - start);
+      // Cut off the name of the last file appended by the update.
+      sourcePath[sourcePathLength] = '\0';
+      traceSpan(TRACE_DIFF, start, end, sourcePath);
     }
     // Clear the source directory file list.
     clear(&filesS);
     // Clear the target directory file list.
     clear(&filesD);
+    // Remove the temporary files of the spills.
+    spillClose(&spillS);
+    spillClose(&spillD);
   }
   // If an error occured somewhere, go here.
-  /* Objects of type dirent, which we read from the directory using readdir,
-  are removed from memory on calling closedir. Therefore, we cannot close
-  the directory until we finish using dirent objects.
-  If the source directory was opened */
-  if (dirS != NULL)
+  /* Release the dirent objects, which we read from the directories
+  into the arena, and the list nodes. */
+  arenaRestore(mark);
+  // If the source directory was opened
+  if (dirS != -1)
     // Close the source directory. If an error occured, ignore it.
-    closedir(dirS);
+    close(dirS);
   // If the target directory was opened
-  if (dirD != NULL)
+  if (dirD != -1)
     // Close the target directory. If an error occured, ignore it.
-    closedir(dirD);
+    close(dirD);
+  // Wait for the files still handled by the pipeline. If any failed
+  if (pipelineEnabled() && pipelineDrain() != 0 && ret == 0)
+    // Set status code indicating an error.
+    ret = -5;
   // Return the status code.
   return ret;
 }
 
-int synchronizeRecursively(
-  const char *sourcePath, const size_t sourcePathLength,
-  const char *destinationPath, const size_t destinationPathLength)
+static int synchronizeSubtree(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
+  const size_t destinationPathLength, scanNode *node,
+  const filterScope *parent);
+
+/*
+Synchronizes the due subtrees of a directory which itself is not due,
+  without listing it. Its subdirectories are taken from the tree
+  of scanNode objects remembered from its last scan.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath - source directory path; must end with '/'
+sourcePathLength - length in bytes of sourcePath
+destinationPath - target directory path; must end with '/'
+destinationPathLength - length in bytes of destinationPath
+scope - filter rules applying in the directory
+writes:
+node - node of the directory
+returns:
+< 0 if an error occured
+0 if no error occured
+*/
+static int synchronizeCachedSubdirectories(
+  const dirsyncSettings *settings, char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
+  const size_t destinationPathLength, scanNode *node,
+  const filterScope *scope)
 {
   // Initially, set status code indicating no error.
   int ret = 0;
-  DIR *dirS = NULL, *dirD = NULL;
+  scanNode *child;
+  for (child = node->children; child != NULL; child = child->next)
+  {
+    // Skip subtrees in which nothing is due.
+    if (!scheduleSubtreeDue(child))
+      continue;
+    /* Create the source subdirectory path after the directory path
+    and save its length. */
+    size_t nextSourcePathLength = appendSubdirectoryName(sourcePath,
+      sourcePathLength, child->name);
+    // Create the target subdirectory path and save its length.
+    size_t nextDestinationPathLength = appendSubdirectoryName(
+      destinationPath, destinationPathLength, child->name);
+    int status = synchronizeSubtree(settings, sourcePath,
+      nextSourcePathLength, destinationPath, nextDestinationPathLength, child,
+      scope);
+    /* If the subdirectory could not be opened, it was probably removed
+    or replaced since the directory was listed. Scan the directory
+    in the next cycle to update its subdirectories. */
+    if (status == -1 || status == -2)
+      scheduleInvalidate(node);
+    // If another error occured
+    else if (status < 0)
+      // Set status code indicating an error.
+      ret = -3;
+  }
+  // Restore the directory paths.
+  sourcePath[sourcePathLength] = '\0';
+  destinationPath[destinationPathLength] = '\0';
+  // Update the time at which anything in the subtree is due.
+  scheduleUpdate(node);
+  // Return the status code.
+  return ret;
+}
+
+/*
+Recursively synchronizes the source and target directories.
+reads:
+settings - settings of the synchronizing context (dirsync.h)
+sourcePath - source directory path; must end with '/'
+sourcePathLength - length in bytes of sourcePath
+destinationPath - target directory path; must end with '/'
+destinationPathLength - length in bytes of destinationPath
+writes:
+node - node of the directory if adaptive scanning is used, otherwise NULL;
+  directories which are not due are not listed
+parent - filter rules applying in the parent directory or NULL
+  if the synchronization starts in the directory
+returns:
+-1 if the source directory could not be opened
+-2 if the target directory could not be opened
+< 0 if another error occured
+0 if no error occured
+*/
+static int synchronizeSubtree(const dirsyncSettings *settings,
+  char *sourcePath,
+  const size_t sourcePathLength, char *destinationPath,
+  const size_t destinationPathLength, scanNode *node,
+  const filterScope *parent)
+{
+  // If the cycle was cancelled using the control socket
+  if (controlCancelled())
+    // Return status code indicating an error.
+    return -11;
+  // If adaptive scanning is used and nothing in the subtree is due
+  if (node != NULL && !scheduleSubtreeDue(node))
+    // Skip the subtree.
+    return 0;
+  /* Save the arena position to release the filter rules, directory entries
+  and list nodes at the end. */
+  arenaMark mark = arenaSave();
+  // Filter rules applying in the directory and its subdirectories.
+  filterScope scope;
+  // Read the ignore files of the directory. If an error occured
+  if (filterEnter(sourcePath, sourcePathLength, parent, &scope) < 0)
+  {
+    arenaRestore(mark);
+    // Return status code indicating an error.
+    return -14;
+  }
+  // If adaptive scanning is used and only some subdirectories are due
+  if (node != NULL && !scheduleDue(node))
+  {
+    // Synchronize them without listing the directory.
+    int status = synchronizeCachedSubdirectories(settings, sourcePath,
+      sourcePathLength, destinationPath, destinationPathLength, node, &scope);
+    arenaRestore(mark);
+    return status;
+  }
+  // Report the synchronized directory to the control socket.
+  controlEnterDirectory(sourcePath);
+  // Initially, set status code indicating no error.
+  int ret = 0, dirS = -1, dirD = -1;
   // Open the source directory. If an error occured
-  if ((dirS = opendir(sourcePath)) == NULL)
+  if ((dirS = openDirectory(sourcePath)) == -1)
     /* Set status code indicating an error. After that, the program
     immediately goes to the end of the current function. */
     ret = -1;
   // Open the target directory. If an error occured
-  else if ((dirD = opendir(destinationPath)) == NULL)
+  else if ((dirD = openDirectory(destinationPath)) == -1)
     // Set status code indicating an error.
     ret = -2;
   else
@@ -620,49 +1806,109 @@ int synchronizeRecursively(
     initialize(&filesD);
     // Initialize the target directory subdirectory list.
     initialize(&subdirsD);
+    /* Create spills for the entries which do not fit into the memory
+    budget. */
+    spill spillS, spillD;
+    spillInitialize(&spillS, settings->memoryBudget);
+    spillInitialize(&spillD, settings->memoryBudget);
+    // Save the time before listing.
+    unsigned long long start = metricsNow(), end;
+    PROBE(scan_start, sourcePath, destinationPath);
     /* Fill the source directory file and subdirectory lists.
     If an error occured */
-    if (listFilesAndDirectories(dirS, &filesS, &subdirsS) < 0)
+    if (listFilesAndDirectories(dirS, &filesS, &subdirsS, &spillS, &scope)
+      < 0)
       // Set status code indicating an error.
       ret = -3;
-    /* Fill the target directory file and subdirectory lists.
-    If an error occured */
-    else if (listFilesAndDirectories(dirD, &filesD, &subdirsD) < 0)
+    /* Fill the target directory file and subdirectory lists skipping
+    excluded entries so that they are not deleted. If an error occured */
+    else if (listFilesAndDirectories(dirD, &filesD, &subdirsD, &spillD,
+      &scope) < 0)
       // Set status code indicating an error.
       ret = -4;
+    // Record the latency of listing both directories.
+    end = metricsNow();
+    metricsObserve(HISTOGRAM_SCAN, end - start);
+    metricsPhase(PHASE_SCAN, end - start);
+    traceSpan(TRACE_SCAN, start, end, sourcePath);
+    PROBE(scan_end, sourcePath, ret, end - start);
+    metricsAdd(METRIC_DIRS_SCANNED, 2);
+    // If an error occured
+    if (ret < 0)
+      // Count the error.
+      metricsAdd(METRIC_ERRORS, 1);
     else
     {
-      // Sort the source directory file list.
-      listMergeSort(&filesS);
-      // Sort the target directory file list.
-      listMergeSort(&filesD);
+      start = end;
+      // Sort or pair the source and target directory file lists.
+      orderFiles(settings, &filesS, &spillS, &filesD, &spillD);
+      end = metricsNow();
+      metricsPhase(PHASE_SORT, end - start);
+      traceSpan(TRACE_SORT, start, end, sourcePath);
+      start = end;
+      /* Save the number of changes made before updating the directory
+      to compute how many changes it needed. A deferred file is counted
+      so that the directory is scanned again soon. */
+      unsigned long long changes = metricsGet(METRIC_FILES_COPIED) +
+        metricsGet(METRIC_DELETES) + metricsGet(METRIC_FILES_DEFERRED),
+        deletes = metricsGet(METRIC_DELETES);
+      /* With the pipeline, the actions of the files count their changes
+      in the node. */
+      if (node != NULL && pipelineEnabled())
+      {
+        scheduleOpen(node);
+        scannedNode = node;
+      }
       /* Check compliance and if needed, update target directory files.
       If an error occured */
-      if (updateDestinationFiles(sourcePath, sourcePathLength, &filesS,
-        destinationPath, destinationPathLength, &filesD) != 0)
+      if (updateFiles(settings, sourcePath, sourcePathLength, &filesS,
+        &spillS, destinationPath, destinationPathLength, &filesD, &spillD)
+        != 0)
         // Set status code indicating an error.
         ret = -5;
+      scannedNode = NULL;
+      end = metricsNow();
+      metricsPhase(PHASE_FILES, end - start);
+      // Cut off the name of the last file appended by the update.
+      sourcePath[sourcePathLength] = '\0';
+      traceSpan(TRACE_DIFF, start, end, sourcePath);
       // Clear the source directory file list.
       clear(&filesS);
       // Clear the target directory file list.
       clear(&filesD);
+      /* Subdirectories are needed during the recursion so read the spilled
+      ones into the lists. If an error occured */
+      if ((spillS.runs != 0 &&
+        spillCollect(&spillS, DT_DIR, &subdirsS) < 0) ||
+        (spillD.runs != 0 && spillCollect(&spillD, DT_DIR, &subdirsD) < 0))
+        // Set status code indicating an error.
+        ret = -13;
+      /* Remove the temporary files of the spills before the recursion
+      so that they are not kept open in every level. */
+      spillClose(&spillS);
+      spillClose(&spillD);
 
+      start = metricsNow();
       // Sort the source directory subdirectory list.
       listMergeSort(&subdirsS);
       // Sort the target directory subdirectory list.
       listMergeSort(&subdirsD);
+      end = metricsNow();
+      metricsPhase(PHASE_SORT, end - start);
+      traceSpan(TRACE_SORT, start, end, sourcePath);
       /* Set i-th cell of array isReady to 1 if i-th source subdirectory exists
       or will be correctly created in the target directory
       by function updateDestinationDirectories so it
       will be ready for recursive synchronization. */
       char *isReady = NULL;
-      /* Reserve memory for an array with size equal to the number
-      of source subdirectories. If an error occured */
-      if ((isReady = malloc(sizeof(char) * subdirsS.count)) == NULL)
+      /* Allocate an array with size equal to the number of source
+      subdirectories from the arena. If an error occured */
+      if ((isReady = arenaAllocate(sizeof(char) * subdirsS.count)) == NULL)
         // Set status code indicating an error.
         ret = -6;
       else
       {
+        start = end;
         /* Check compliance and if needed, update target directory
         subdirectories. Fill array isReady. If an error occured */
         if (updateDestinationDirectories(sourcePath, sourcePathLength,
@@ -670,66 +1916,81 @@ int synchronizeRecursively(
           != 0)
           // Set status code indicating an error.
           ret = -7;
+        end = metricsNow();
+        metricsPhase(PHASE_DIRECTORIES, end - start);
+        // Cut off the name of the last subdirectory appended by the update.
+        sourcePath[sourcePathLength] = '\0';
+        traceSpan(TRACE_DIRECTORIES, start, end, sourcePath);
+        // If adaptive scanning is used
+        if (node != NULL)
+        {
+          /* With the pipeline, the copies of other directories are counted
+          in the metrics meanwhile, so count only the removals made
+          by the scanner. The last action of the files of the directory
+          computes when the directory is due next. */
+          if (pipelineEnabled())
+            scheduleRelease(node, metricsGet(METRIC_DELETES) - deletes);
+          /* Otherwise, compute it from the number of changes made
+          in the directory. */
+          else
+            scheduleRecord(node, metricsGet(METRIC_FILES_COPIED) +
+              metricsGet(METRIC_DELETES) +
+              metricsGet(METRIC_FILES_DEFERRED) - changes);
+          /* Remember the subdirectories for cycles in which the directory
+          is not listed. If an error occured, the subdirectories without
+          nodes are synchronized without adaptive scanning. */
+          if (scheduleSetChildren(node, &subdirsS) < 0)
+            // Set status code indicating an error.
+            ret = -12;
+        }
+        // Node of the first subdirectory if adaptive scanning is used.
+        scanNode *child = node != NULL ? node->children : NULL;
         /* Do not clear source subdirectory list yet because
         function synchronizeRecursively will be recursively called
         on subdirectories from that list. */
         // Clear target subdirectory list.
         clear(&subdirsD);
 
-        char *nextSourcePath = NULL, *nextDestinationPath = NULL;
-        // Reserve memory for source subdirectory paths. If an error occured
-        if ((nextSourcePath = malloc(sizeof(char) * PATH_MAX)) == NULL)
-          // Set status code indicating an error.
-          ret = -8;
-        // Reserve memory for target subdirectory paths. If an error occured
-        else if ((nextDestinationPath = malloc(sizeof(char) * PATH_MAX))
-          == NULL)
-          // Set status code indicating an error.
-          ret = -9;
-        else
+        // Save a pointer to the first source subdirectory.
+        element *curS = subdirsS.first;
+        unsigned int i = 0;
+        while (curS != NULL)
         {
-          /* Copy the source directory path as the beginning
-          of its subdirectory paths. */
-          strcpy(nextSourcePath, sourcePath);
-          /* Copy the target directory path as the beginning
-          of its subdirectory paths. */
-          strcpy(nextDestinationPath, destinationPath);
-          // Save a pointer to the first source subdirectory.
-          element *curS = subdirsS.first;
-          unsigned int i = 0;
-          while (curS != NULL)
+          /* If the cycle was cancelled, array isReady may be incomplete
+          so do not read it. */
+          if (controlCancelled())
+          {
+            // Set status code indicating an error.
+            ret = -11;
+            break;
+          }
+          // If the subdirectory is ready for synchronization
+          if (isReady[i++] == 1)
           {
-            // If the subdirectory is ready for synchronization
-            if (isReady[i++] == 1)
-            {
-              // Create the source subdirectory path and save its length.
-              size_t nextSourcePathLength = appendSubdirectoryName(
-                nextSourcePath, sourcePathLength, curS->entry->d_name);
-              // Create the target subdirectory path and save its length.
-              size_t nextDestinationPathLength = appendSubdirectoryName(
-                nextDestinationPath, destinationPathLength,
-                curS->entry->d_name);
-              // Recursively synchronize subdirectories. If an error occured
-              if (synchronizeRecursively(nextSourcePath, nextSourcePathLength,
-                nextDestinationPath, nextDestinationPathLength) < 0)
-                // Set status code indicating an error.
-                ret = -10;
-            }
-            // If the subdirectory is unready for synchronization, skip it.
-            // Move the pointer to the next subdirectory.
-            curS = curS->next;
+            /* Create the source subdirectory path after the directory path
+            and save its length. */
+            size_t nextSourcePathLength = appendSubdirectoryName(
+              sourcePath, sourcePathLength, curS->entry->d_name);
+            // Create the target subdirectory path and save its length.
+            size_t nextDestinationPathLength = appendSubdirectoryName(
+              destinationPath, destinationPathLength, curS->entry->d_name);
+            // Recursively synchronize subdirectories. If an error occured
+            if (synchronizeSubtree(settings, sourcePath,
+              nextSourcePathLength, destinationPath,
+              nextDestinationPathLength, child, &scope) < 0)
+              // Set status code indicating an error.
+              ret = -10;
           }
+          // If the subdirectory is unready for synchronization, skip it.
+          // Move the pointer to the next subdirectory.
+          curS = curS->next;
+          // Move the pointer to the node of the next subdirectory.
+          if (child != NULL)
+            child = child->next;
         }
-        // Free array isReady.
-        free(isReady);
-        // If memory for source subdirectory paths was reserved
-        if (nextSourcePath != NULL)
-          // Release memory.
-          free(nextSourcePath);
-        // If memory for target directory paths was reserved
-        if (nextDestinationPath != NULL)
-          // Release memory.
-          free(nextDestinationPath);
+        // Restore the directory paths.
+        sourcePath[sourcePathLength] = '\0';
+        destinationPath[destinationPathLength] = '\0';
       }
     }
     // Clear the source subdirectory list.
@@ -739,16 +2000,60 @@ int synchronizeRecursively(
     if (subdirsD.count != 0)
       // Clear it.
       clear(&subdirsD);
+    // If listing failed, remove the temporary files of the spills.
+    spillClose(&spillS);
+    spillClose(&spillD);
   }
 
+  /* Release the filter rules, directory entries, list nodes and array
+  isReady. */
+  arenaRestore(mark);
   // If the source directory was opened
-  if (dirS != NULL)
+  if (dirS != -1)
     // Close the source directory. If an error occured, ignore it.
-    closedir(dirS);
+    close(dirS);
   // If the target directory was opened
-  if (dirD != NULL)
+  if (dirD != -1)
     // Close the target directory. If an error occured, ignore it.
-    closedir(dirD);
+    close(dirD);
+  // If adaptive scanning is used
+  if (node != NULL)
+  {
+    // If the directory could not be listed, try again in the next cycle.
+    if (ret == -3 || ret == -4)
+      scheduleInvalidate(node);
+    // Update the time at which anything in the subtree is due.
+    scheduleUpdate(node);
+  }
   // Return the status code.
   return ret;
 }
+
+int synchronizeRecursively(const dirsyncSettings *settings,
+  char *sourcePath, const size_t sourcePathLength,
+  char *destinationPath, const size_t destinationPathLength)
+{
+  // Synchronize without adaptive scanning.
+  int ret = synchronizeSubtree(settings, sourcePath, sourcePathLength,
+    destinationPath, destinationPathLength, NULL, NULL);
+  // Wait for the files still handled by the pipeline. If any failed
+  if (pipelineEnabled() && pipelineDrain() != 0 && ret == 0)
+    // Set status code indicating an error.
+    ret = -5;
+  return ret;
+}
+
+int synchronizeAdaptively(const dirsyncSettings *settings,
+  char *sourcePath, const size_t sourcePathLength,
+  char *destinationPath, const size_t destinationPathLength, scanNode *root)
+{
+  /* Synchronize with adaptive scanning starting at the node of the source
+  directory. If it could not be created, the whole tree is synchronized. */
+  int ret = synchronizeSubtree(settings, sourcePath, sourcePathLength,
+    destinationPath, destinationPathLength, root, NULL);
+  // Wait for the files still handled by the pipeline. If any failed
+  if (pipelineEnabled() && pipelineDrain() != 0 && ret == 0)
+    // Set status code indicating an error.
+    ret = -5;
+  return ret;
+}
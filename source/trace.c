@@ -0,0 +1,235 @@
+// syscall
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+typedef struct event event;
+/*
+Span recorded by a thread.
+*/
+struct event
+{
+  unsigned long long start, end;
+  enum traceKind kind;
+  // End of the path or an empty string.
+  char name[TRACENAME];
+};
+
+typedef struct buffer buffer;
+/*
+Ring of the spans of one thread. The thread advances head and the thread
+  writing the trace advances tail, so neither needs a lock.
+*/
+struct buffer
+{
+  // Thread identifier shown in the trace.
+  int tid;
+  // Positions of the next recorded and the next written span.
+  unsigned long head, tail;
+  // Number of spans dropped because the ring was full.
+  unsigned long dropped;
+  // Next buffer of the list of all buffers.
+  buffer *next;
+  event events[TRACEEVENTS];
+};
+
+// Names of the kinds in the trace.
+static const char *kindNames[TRACE_KINDS] = {"cycle", "scan", "sort", "diff",
+  "directories", "stat", "copy", "delete", "log"};
+// Set while tracing is enabled; read without locking.
+static char enabled;
+// Trace file path and the path of its temporary file.
+static char tracePath[PATH_MAX], temporaryPath[PATH_MAX];
+// List of the buffers of all threads which recorded spans.
+static buffer *buffers;
+// Buffer of the calling thread or NULL.
+static _Thread_local buffer *own;
+// Set if memory for the buffer of the calling thread could not be reserved.
+static _Thread_local char failed;
+// Time at which the current cycle began.
+static unsigned long long cycleStart;
+
+int traceStart(const char *path)
+{
+  if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path)
+    >= (int)sizeof(temporaryPath))
+    return -1;
+  strcpy(tracePath, path);
+  __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void traceStop(void)
+{
+  __atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+}
+
+int traceEnabled(void)
+{
+  return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+/*
+Creates the buffer of the calling thread and adds it to the list.
+returns:
+NULL if memory could not be reserved
+buffer otherwise
+*/
+static buffer *createBuffer(void)
+{
+  buffer *b = malloc(sizeof(buffer));
+  if (b == NULL)
+    return NULL;
+  b->tid = (int)syscall(SYS_gettid);
+  b->head = b->tail = b->dropped = 0;
+  b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+  // Push the buffer onto the list; other threads may push at the same time.
+  while (!__atomic_compare_exchange_n(&buffers, &b->next, b, 1,
+    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return b;
+}
+
+void traceSpan(enum traceKind kind, unsigned long long start,
+  unsigned long long end, const char *path)
+{
+  if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+    return;
+  if (own == NULL)
+  {
+    if (failed || (own = createBuffer()) == NULL)
+    {
+      failed = 1;
+      return;
+    }
+  }
+  buffer *b = own;
+  unsigned long head = b->head;
+  // If the thread writing the trace has not taken the old spans yet
+  if (head - __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE) >= TRACEEVENTS)
+  {
+    __atomic_add_fetch(&b->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  event *e = &b->events[head % TRACEEVENTS];
+  e->start = start;
+  e->end = end;
+  e->kind = kind;
+  e->name[0] = '\0';
+  if (path != NULL)
+  {
+    // Keep the end of a long path because it tells the most.
+    size_t length = strlen(path);
+    if (length >= TRACENAME)
+      path += length - (TRACENAME - 1);
+    strcpy(e->name, path);
+  }
+  // Publish the span to the thread writing the trace.
+  __atomic_store_n(&b->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void traceBeginCycle(void)
+{
+  cycleStart = metricsNow();
+}
+
+/*
+Writes a string as a JSON string literal.
+reads:
+text - string
+writes:
+file - file
+*/
+static void writeString(FILE *file, const char *text)
+{
+  fputc('"', file);
+  for (; *text != '\0'; ++text)
+  {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\')
+      fprintf(file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(file, "\\u%04x", c);
+    else
+      fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+/*
+Writes a span as a complete event of the Chrome trace format with times
+  in microseconds since the beginning of the cycle.
+reads:
+e - span
+tid - identifier of the thread which recorded it
+pid - process identifier
+writes:
+file - file
+*/
+static void writeEvent(FILE *file, const event *e, int tid, int pid)
+{
+  unsigned long long start = e->start > cycleStart ? e->start - cycleStart :
+    0;
+  fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"dirsync\",\"ph\":\"X\","
+    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%i,\"tid\":%i", kindNames[e->kind],
+    start / 1e3, (e->end - e->start) / 1e3, pid, tid);
+  if (e->name[0] != '\0')
+  {
+    fputs(",\"args\":{\"path\":", file);
+    writeString(file, e->name);
+    fputc('}', file);
+  }
+  fputc('}', file);
+}
+
+int traceEndCycle(int status)
+{
+  if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+    return 0;
+  unsigned long long end = metricsNow();
+  int pid = (int)getpid();
+  unsigned long dropped = 0;
+  FILE *file = fopen(temporaryPath, "w");
+  // Without the file, the spans are still taken so that the rings are free.
+  if (file != NULL)
+  {
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,"
+      "\"args\":{\"name\":\"DirSyncD\"}},\n"
+      "{\"name\":\"%s\",\"cat\":\"dirsync\",\"ph\":\"X\",\"ts\":0,"
+      "\"dur\":%.3f,\"pid\":%i,\"tid\":%i,\"args\":{\"status\":%i}}", pid,
+      kindNames[TRACE_CYCLE], (end - cycleStart) / 1e3, pid,
+      (int)syscall(SYS_gettid), status);
+  }
+  buffer *b;
+  for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL;
+    b = b->next)
+  {
+    unsigned long head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE), tail;
+    for (tail = b->tail; tail != head; ++tail)
+    {
+      const event *e = &b->events[tail % TRACEEVENTS];
+      // Spans recorded between cycles, e.g. by the logger, are skipped.
+      if (file != NULL && e->end >= cycleStart)
+        writeEvent(file, e, b->tid, pid);
+    }
+    // Free the written spans for the thread.
+    __atomic_store_n(&b->tail, head, __ATOMIC_RELEASE);
+    dropped += __atomic_exchange_n(&b->dropped, 0, __ATOMIC_RELAXED);
+  }
+  if (file == NULL)
+    return -1;
+  fprintf(file, "\n],\"otherData\":{\"dropped\":\"%lu\"}}\n", dropped);
+  if (fclose(file) == EOF)
+    return -1;
+  // rename is atomic within a file system.
+  return rename(temporaryPath, tracePath);
+}
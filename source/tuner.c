@@ -0,0 +1,303 @@
+#include "tuner.h"
+#include "dirsync.h"
+#include "file.h"
+#include "logger.h"
+#include "metrics.h"
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+// Tuned settings.
+enum knobKind
+{
+  KNOB_COPIERS,
+  KNOB_BUFFER,
+  KNOB_THRESHOLD,
+  KNOBS
+};
+
+typedef struct knob knob;
+/*
+Setting tuned in steps. Its value is computed from its level.
+*/
+struct knob
+{
+  // Name used in the log and in the settings file.
+  const char *name;
+  // Current level and its bounds.
+  int level, minimum, maximum;
+};
+
+// Knobs; a knob with minimum equal to maximum is not tuned.
+static knob knobs[KNOBS] =
+{
+  // Copier threads of a lane copying at the same time.
+  { "copiers", 1, 1, 1 },
+  // Copy buffer of 4 KiB << level.
+  { "buffer", 0, 0, 6 },
+  /* Big file threshold of 64 KiB << (2 * level) (up to 1 GiB)
+  or no big files at the maximal level. */
+  { "threshold", 8, 0, 8 }
+};
+// Path of the settings file or an empty string if the tuner is disabled.
+static char settingsPath[PATH_MAX];
+// Context whose big file threshold is tuned.
+static dirsync *tuned;
+// Time at which the current cycle started.
+static unsigned long long cycleStart;
+// Throughput of the last measured cycle with the kept settings.
+static double baseline;
+// Tuned knob, direction of its step and number of rejected steps.
+static unsigned int current;
+static int direction = 1;
+static unsigned int rejected;
+// If not 0, the current cycle tries a moved knob.
+static char trying;
+
+/*
+Computes the value of a knob.
+reads:
+kind - knob
+level - level of the knob
+returns:
+value of the setting
+*/
+static unsigned long long knobValue(enum knobKind kind, int level)
+{
+  switch (kind)
+  {
+  case KNOB_COPIERS:
+    return level;
+  case KNOB_BUFFER:
+    return 4096ULL << level;
+  default:
+    return level == knobs[KNOB_THRESHOLD].maximum ? ULLONG_MAX :
+      65536ULL << (2 * level);
+  }
+}
+
+/*
+Applies the current level of a knob.
+reads:
+kind - knob
+*/
+static void applyKnob(enum knobKind kind)
+{
+  unsigned long long value = knobValue(kind, knobs[kind].level);
+  if (kind == KNOB_COPIERS)
+  {
+    if (pipelineEnabled())
+      pipelineSetCopiers(value);
+  }
+  else if (kind == KNOB_BUFFER)
+    fileSetBufferSize(value);
+  else
+    dirsyncSetThreshold(tuned, value);
+}
+
+/*
+Sets the level of the threshold knob to the lowest one whose value is not
+  less than a threshold.
+reads:
+value - big file threshold
+*/
+static void setThresholdLevel(unsigned long long value)
+{
+  knob *t = &knobs[KNOB_THRESHOLD];
+  for (t->level = t->minimum; t->level < t->maximum; ++t->level)
+    if (knobValue(KNOB_THRESHOLD, t->level) >= value)
+      break;
+}
+
+/*
+Writes the current settings to the settings file. The file is replaced
+  atomically so a crash never leaves it half-written.
+returns:
+-1 if an error occured
+0 if no error occured
+*/
+static int saveSettings(void)
+{
+  char temporary[PATH_MAX + 4];
+  unsigned int i;
+  snprintf(temporary, sizeof(temporary), "%s.new", settingsPath);
+  FILE *file = fopen(temporary, "w");
+  if (file == NULL)
+    return -1;
+  for (i = 0; i < KNOBS; ++i)
+    fprintf(file, "%s %llu\n", knobs[i].name, knobValue(i, knobs[i].level));
+  if (fclose(file) == EOF || rename(temporary, settingsPath) == -1)
+    return -1;
+  return 0;
+}
+
+/*
+Reads the settings file. Unknown names and values which are not levels
+  of their knobs are ignored.
+*/
+static void loadSettings(void)
+{
+  char name[32];
+  unsigned long long value;
+  int level;
+  unsigned int i;
+  FILE *file = fopen(settingsPath, "r");
+  if (file == NULL)
+    return;
+  while (fscanf(file, "%31s %llu", name, &value) == 2)
+    for (i = 0; i < KNOBS; ++i)
+      if (strcmp(name, knobs[i].name) == 0)
+        for (level = knobs[i].minimum; level <= knobs[i].maximum; ++level)
+          if (knobValue(i, level) == value)
+            knobs[i].level = level;
+  fclose(file);
+}
+
+/*
+Moves the tuned knob by one step in the current direction, switching
+  the direction and the knob when a step is impossible.
+returns:
+0 if no knob can be moved
+1 if a knob was moved
+*/
+static int step(void)
+{
+  unsigned int attempts;
+  for (attempts = 0; attempts < 2 * KNOBS; ++attempts)
+  {
+    knob *k = &knobs[current];
+    int level = k->level + direction;
+    if (level >= k->minimum && level <= k->maximum)
+    {
+      k->level = level;
+      applyKnob(current);
+      return 1;
+    }
+    // The knob is at its bound so try the other direction.
+    direction = -direction;
+    if (++rejected >= 2)
+    {
+      rejected = 0;
+      current = (current + 1) % KNOBS;
+    }
+  }
+  return 0;
+}
+
+int tunerStart(const char *directory, dirsync *context)
+{
+  // FNV-1a hash of the pair of paths naming the settings file.
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  const char *paths[] = { dirsyncSource(context), "\n",
+    dirsyncDestination(context) }, *c, *end;
+  unsigned int i;
+  for (i = 0; i < 3; ++i)
+  {
+    // A trailing '/' is skipped so that both forms of a path name one file.
+    end = paths[i] + strlen(paths[i]);
+    if (end - paths[i] > 1 && end[-1] == '/')
+      --end;
+    for (c = paths[i]; c != end; ++c)
+      hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+  }
+  if (snprintf(settingsPath, sizeof(settingsPath), "%s/dirsyncd-%016llx.tune",
+    directory, hash) >= (int)sizeof(settingsPath))
+  {
+    settingsPath[0] = '\0';
+    return -1;
+  }
+  tuned = context;
+  // Start from all threads and the threshold of the context.
+  knobs[KNOB_COPIERS].maximum = knobs[KNOB_COPIERS].level =
+    pipelineEnabled() ? pipelineCopiers() : 1;
+  setThresholdLevel(dirsyncGetSettings(context)->threshold);
+  loadSettings();
+  for (i = 0; i < KNOBS; ++i)
+    applyKnob(i);
+  logMessage(LOG_INFO, "tuner: starting with copiers %llu, buffer %llu, "
+    "threshold %llu (settings file %s)",
+    knobValue(KNOB_COPIERS, knobs[KNOB_COPIERS].level),
+    knobValue(KNOB_BUFFER, knobs[KNOB_BUFFER].level),
+    knobValue(KNOB_THRESHOLD, knobs[KNOB_THRESHOLD].level), settingsPath);
+  return 0;
+}
+
+void tunerSetThreshold(unsigned long long value)
+{
+  if (settingsPath[0] == '\0')
+    return;
+  // The tried setting would be compared with a baseline of other settings.
+  if (trying)
+  {
+    trying = 0;
+    knobs[current].level -= direction;
+    applyKnob(current);
+  }
+  setThresholdLevel(value);
+  applyKnob(KNOB_THRESHOLD);
+  logMessage(LOG_INFO, "tuner: setting threshold %llu",
+    knobValue(KNOB_THRESHOLD, knobs[KNOB_THRESHOLD].level));
+}
+
+void tunerBeginCycle(void)
+{
+  if (settingsPath[0] == '\0')
+    return;
+  cycleStart = metricsNow();
+}
+
+void tunerEndCycle(unsigned long long files, unsigned long long bytes)
+{
+  if (settingsPath[0] == '\0')
+    return;
+  unsigned long long duration = metricsNow() - cycleStart;
+  // A cycle which copied little measures the scanning, not the copying.
+  if ((files < TUNERFILES && bytes < TUNERBYTES) || duration == 0)
+  {
+    logMessage(LOG_DEBUG, "tuner: copied too little to measure (%llu files, "
+      "%llu bytes)", files, bytes);
+    return;
+  }
+  // Throughput in MB/s.
+  double score = (bytes + files * (double)TUNERFILECOST) * 1e3 / duration;
+  knob *k = &knobs[current];
+  if (trying)
+  {
+    trying = 0;
+    // If the tried setting is not clearly better
+    if (score <= baseline * (1 + TUNERGAIN / 100.0))
+    {
+      // Revert it and measure the kept settings again in the next cycle.
+      k->level -= direction;
+      applyKnob(current);
+      logMessage(LOG_INFO, "tuner: reverting %s to %llu; %.1f MB/s after "
+        "%.1f MB/s", k->name, knobValue(current, k->level), score, baseline);
+      direction = -direction;
+      if (++rejected >= 2)
+      {
+        rejected = 0;
+        current = (current + 1) % KNOBS;
+      }
+      return;
+    }
+    logMessage(LOG_INFO, "tuner: keeping %s %llu; %.1f MB/s after %.1f MB/s",
+      k->name, knobValue(current, k->level), score, baseline);
+    // Keep moving the knob in the same direction.
+    rejected = 0;
+    if (saveSettings() < 0)
+      logMessage(LOG_WARNING, "tuner: saving settings to %s; %i",
+        settingsPath, errno);
+  }
+  baseline = score;
+  // Try the next step.
+  if (step())
+  {
+    trying = 1;
+    k = &knobs[current];
+    logMessage(LOG_INFO, "tuner: trying %s %llu after %.1f MB/s", k->name,
+      knobValue(current, k->level), score);
+  }
+}